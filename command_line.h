@@ -0,0 +1,243 @@
+#pragma once
+
+// Splitting of shell verb command lines
+//
+// A verb's "command" value is a Windows command line: the program, then its
+// arguments ("%1", "%V" and friends are placeholders Explorer fills in).
+// The program is found the way CreateProcess finds it:
+//
+//   - quoted: everything up to the next quote, nothing is escaped in it
+//   - unquoted: CreateProcess tries each prefix that ends at a space,
+//     shortest first, and runs the first one that names a file. Without
+//     touching the disk the closest match is the first prefix ending in an
+//     executable extension (.exe, .com, .bat, .cmd), else the first word -
+//     so "C:\Program Files\App\app.exe %1" works and "C:\tools.exe.d\run.exe"
+//     isn't cut after "tools.exe".
+//
+// Arguments follow the CommandLineToArgvW rules: whitespace separates, quotes
+// group, 2n backslashes before a quote are n backslashes and an open/close
+// quote, 2n+1 are n backslashes and a literal quote, "" inside quotes is a
+// literal quote, and backslashes anywhere else are literal.
+//
+// Icon values ("path,index") are split here too: quoted or not, with an
+// optional ",index" (or ",-resource id") after the file.
+//
+// Everything works on views into the caller's string in one pass and never
+// allocates; only UnquoteCommandArgument writes, into a buffer the caller
+// can reuse.
+
+#include <string>
+#include <string_view>
+
+// A command line split into the program and the rest, both views into the command
+struct CommandLineParts
+{
+    std::wstring_view executable; // Program path without quotes, may be empty
+    std::wstring_view arguments;  // Everything after it, surrounding whitespace trimmed
+    bool quoted;                  // Whether the program was quoted
+};
+
+inline bool IsCommandLineSpace(wchar_t c)
+{
+    return c == L' ' || c == L'\t';
+}
+
+inline std::wstring_view TrimCommandLine(std::wstring_view text)
+{
+    std::size_t first = 0;
+    while (first < text.length() && IsCommandLineSpace(text[first]))
+        first++;
+    std::size_t last = text.length();
+    while (last > first && IsCommandLineSpace(text[last - 1]))
+        last--;
+    return text.substr(first, last - first);
+}
+
+// Whether path ends in an extension CreateProcess (or cmd, for scripts) can run
+inline bool HasExecutableExtension(std::wstring_view path)
+{
+    static const wchar_t *const kExtensions[] = {L".exe", L".com", L".bat", L".cmd"};
+    if (path.length() < 4)
+        return false;
+    std::wstring_view tail = path.substr(path.length() - 4);
+    for (const wchar_t *extension : kExtensions)
+    {
+        std::size_t i = 0;
+        while (i < 4 && (tail[i] | 0x20) == extension[i])
+            i++;
+        if (i == 4)
+            return true;
+    }
+    return false;
+}
+
+// Split a command line into program and arguments (see the rules above)
+inline CommandLineParts SplitCommandLine(std::wstring_view command)
+{
+    CommandLineParts parts = {std::wstring_view(), std::wstring_view(), false};
+    command = TrimCommandLine(command);
+    if (command.empty())
+        return parts;
+
+    if (command[0] == L'\"')
+    {
+        // A missing closing quote takes the rest of the line
+        std::size_t close = command.find(L'\"', 1);
+        parts.quoted = true;
+        parts.executable = command.substr(1, close == std::wstring_view::npos ? std::wstring_view::npos : close - 1);
+        if (close != std::wstring_view::npos)
+            parts.arguments = TrimCommandLine(command.substr(close + 1));
+        return parts;
+    }
+
+    // Each word end is a candidate; the first one is the fallback
+    std::size_t end = std::wstring_view::npos;
+    for (std::size_t i = 0; i <= command.length(); i++)
+    {
+        if (i < command.length() && !IsCommandLineSpace(command[i]))
+            continue;
+        if (i > 0 && IsCommandLineSpace(command[i - 1]))
+            continue; // Second of several spaces
+        if (end == std::wstring_view::npos)
+            end = i;
+        if (HasExecutableExtension(command.substr(0, i)))
+        {
+            end = i;
+            break;
+        }
+    }
+    parts.executable = command.substr(0, end);
+    parts.arguments = TrimCommandLine(command.substr(end));
+    return parts;
+}
+
+// Take the next argument off the front of rest. raw receives it as written, quotes and
+// escapes included; false when only whitespace is left.
+inline bool NextCommandArgument(std::wstring_view &rest, std::wstring_view &raw)
+{
+    std::size_t start = 0;
+    while (start < rest.length() && IsCommandLineSpace(rest[start]))
+        start++;
+    if (start == rest.length())
+    {
+        rest = std::wstring_view();
+        return false;
+    }
+
+    bool inQuotes = false;
+    std::size_t backslashes = 0;
+    std::size_t i = start;
+    for (; i < rest.length(); i++)
+    {
+        wchar_t c = rest[i];
+        if (c == L'\\')
+        {
+            backslashes++;
+            continue;
+        }
+        if (c == L'\"' && backslashes % 2 == 0)
+        {
+            if (inQuotes && i + 1 < rest.length() && rest[i + 1] == L'\"')
+                i++; // "" inside quotes
+            else
+                inQuotes = !inQuotes;
+        }
+        else if (!inQuotes && IsCommandLineSpace(c))
+            break;
+        backslashes = 0;
+    }
+    raw = rest.substr(start, i - start);
+    rest = rest.substr(i);
+    return true;
+}
+
+// The value of an argument returned by NextCommandArgument, with quotes and escapes resolved
+inline void UnquoteCommandArgument(std::wstring_view raw, std::wstring &value)
+{
+    value.clear();
+    bool inQuotes = false;
+    std::size_t backslashes = 0;
+    for (std::size_t i = 0; i < raw.length(); i++)
+    {
+        wchar_t c = raw[i];
+        if (c == L'\\')
+        {
+            backslashes++;
+            continue;
+        }
+        if (c != L'\"')
+        {
+            value.append(backslashes, L'\\');
+            backslashes = 0;
+            value += c;
+            continue;
+        }
+
+        value.append(backslashes / 2, L'\\');
+        if (backslashes % 2 == 1)
+            value += L'\"';
+        else if (inQuotes && i + 1 < raw.length() && raw[i + 1] == L'\"')
+        {
+            value += L'\"';
+            i++;
+        }
+        else
+            inQuotes = !inQuotes;
+        backslashes = 0;
+    }
+    value.append(backslashes, L'\\');
+}
+
+// File part of an "Icon" value: "path", "\"path\",0" or "path,-123". Empty if the value names no
+// file ("ms-appx://...", "@{Package...}" and other resource references). index, if given,
+// receives the number after the comma - 0 when there is none.
+inline std::wstring_view SplitIconLocation(std::wstring_view icon, int *index)
+{
+    if (index)
+        *index = 0;
+    icon = TrimCommandLine(icon);
+    std::wstring_view number;
+    if (!icon.empty() && icon[0] == L'\"')
+    {
+        std::size_t close = icon.find(L'\"', 1);
+        if (close != std::wstring_view::npos)
+        {
+            std::wstring_view rest = TrimCommandLine(icon.substr(close + 1));
+            if (!rest.empty() && rest[0] == L',')
+                number = TrimCommandLine(rest.substr(1));
+        }
+        icon = icon.substr(1, close == std::wstring_view::npos ? std::wstring_view::npos : close - 1);
+    }
+    else
+    {
+        // A trailing ",index" or ",-resource id"; any other comma belongs to the path
+        std::size_t comma = icon.rfind(L',');
+        if (comma != std::wstring_view::npos)
+        {
+            std::size_t digit = comma + 1;
+            if (digit < icon.length() && icon[digit] == L'-')
+                digit++;
+            bool isNumber = digit < icon.length();
+            for (std::size_t i = digit; i < icon.length() && isNumber; i++)
+                isNumber = icon[i] >= L'0' && icon[i] <= L'9';
+            if (isNumber)
+            {
+                number = icon.substr(comma + 1);
+                icon = TrimCommandLine(icon.substr(0, comma));
+            }
+        }
+    }
+
+    if (index && !number.empty())
+    {
+        bool negative = number[0] == L'-';
+        int value = 0;
+        for (std::size_t i = negative ? 1 : 0; i < number.length() && number[i] >= L'0' && number[i] <= L'9'; i++)
+            value = value < 100000000 ? value * 10 + (number[i] - L'0') : value;
+        *index = negative ? -value : value;
+    }
+
+    if (icon.find(L"://") != std::wstring_view::npos || (!icon.empty() && icon[0] == L'@'))
+        return std::wstring_view();
+    return icon;
+}
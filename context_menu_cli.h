@@ -0,0 +1,924 @@
+#pragma once
+
+// Headless command-line mode
+//
+//   list [--all]                      List items created by this program (--all: every non-system item),
+//                                     in every scope unless --scope picks one
+//   add <program>... [--name <text>]  Add programs; --name only with a single program
+//   remove <item>... [--force]        Remove items; --force is needed for items not created by this program
+//   rename <item> <display name>      Change the text shown in the menu
+//   reorder <item>...                 Move the listed items to the top, in this order
+//   group create <display name>       Add an empty cascading submenu
+//   group move <group> <item>...      Move items into a group (groups take their members along)
+//   group leave <item>...             Move group members up one level
+//   group flatten <group>             Move a group's members up one level and delete the group
+//   apply <file>                      Run the commands in a UTF-8 text file, one per line ('#' starts a comment)
+//   reconcile <file> [--dry-run]      Make the custom items match a desired-state file (see desired_state.h)
+//   audit [--threads <n>]             List every <class>\shell\<verb> in HKEY_CLASSES_ROOT (see shell_audit.h)
+//   health [--remove [--force]] [--threads <n>]
+//                                     List items whose program or icon file is missing, in every scope
+//                                     unless --scope picks one (see health_check.h); --remove deletes them,
+//                                     --force also those not created by this program
+//
+// <item> is a registry key name or, if no key matches, a unique display name.
+// Group members are named by key path ("Group\shell\Verb") or display name.
+// Every command but audit takes --scope <desktop|folder|drive|files|.ext> (see
+// menu_scope.h) to work on that menu instead of the desktop's. Given to apply
+// it is the default for the file's lines; in the file it applies to its own
+// line only.
+// The result is written as one JSON object. Exit code: 0 success, 1 a change
+// or the registry failed, 2 usage error.
+
+#include "context_menu_store.h"
+#include "health_check.h"
+#include "json_writer.h"
+#include "shell_audit.h"
+
+const char *const kCliUsage =
+    "usage: list [--all] | add <program>... [--name <text>] | remove <item>... [--force] | "
+    "rename <item> <display name> | reorder <item>... | group create <display name> | "
+    "group move <group> <item>... | group leave <item>... | group flatten <group> | "
+    "apply <file> | reconcile <file> [--dry-run] | "
+    "audit [--threads <n>] | health [--remove [--force]] [--threads <n>] | --scope <desktop|folder|drive|files|.ext> with any command but audit";
+
+// Split a line into arguments: whitespace separates, double quotes group, "" inside quotes is a literal quote.
+// Backslashes are ordinary characters so Windows paths need no escaping.
+inline void SplitArguments(const std::wstring &line, std::vector<std::wstring> &args)
+{
+    args.clear();
+    size_t i = 0;
+    while (i < line.length())
+    {
+        while (i < line.length() && (line[i] == L' ' || line[i] == L'\t'))
+            i++;
+        if (i >= line.length())
+            break;
+
+        std::wstring arg;
+        bool quoted = false;
+        for (; i < line.length(); i++)
+        {
+            wchar_t c = line[i];
+            if (c == L'"')
+            {
+                if (quoted && i + 1 < line.length() && line[i + 1] == L'"')
+                {
+                    arg += L'"';
+                    i++;
+                }
+                else
+                {
+                    quoted = !quoted;
+                }
+            }
+            else if (!quoted && (c == L' ' || c == L'\t'))
+            {
+                break;
+            }
+            else
+            {
+                arg += c;
+            }
+        }
+        args.push_back(arg);
+    }
+}
+
+class ContextMenuCli
+{
+public:
+    // Read a whole text file; false if it cannot be read
+    typedef std::function<bool(const std::wstring &path, std::wstring &text)> ReadFileFn;
+
+private:
+    struct Result
+    {
+        int line;            // Line in the apply file, 0 for the command line
+        std::wstring command;
+        std::wstring scope;  // Name of the scope the command worked on
+        std::wstring item;   // Argument the result is about
+        std::wstring key;    // Registry key affected, when known
+        long status;         // RegOk or the registry error code
+        const char *error;   // NULL on success
+    };
+
+    ContextMenuStore &store;
+    ReadFileFn readFile;
+    HealthChecker healthChecker;
+    std::vector<Result> results;
+    int line;
+    std::wstring argument; // Reused by WriteArguments
+
+    void Report(const std::wstring &command, const std::wstring &item, const std::wstring &key,
+                long status, const char *error)
+    {
+        Result result = {line, command, store.Scope(store.SelectedScope()).Name(), item, key, status, error};
+        results.push_back(result);
+    }
+
+    // Take "--scope <name>" out of args and select that scope; false if the name is missing or invalid.
+    // given (optional) tells whether the option was there.
+    bool TakeScope(std::vector<std::wstring> &args, bool *given)
+    {
+        if (given)
+            *given = false;
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            if (args[i] != L"--scope")
+                continue;
+
+            MenuScope scope;
+            if (i + 1 >= args.size() || !ParseMenuScope(args[i + 1], scope))
+                return false;
+            store.SelectScope(store.AddScope(scope));
+            args.erase(args.begin() + i, args.begin() + i + 2);
+            if (given)
+                *given = true;
+            return true;
+        }
+        return true;
+    }
+
+    // Parse the <n> of "--threads <n>"; false unless it is a number from 1 to 256
+    static bool ParseThreads(const std::wstring &text, unsigned *threads)
+    {
+        wchar_t *end = NULL;
+        unsigned long value = wcstoul(text.c_str(), &end, 10);
+        if (*end != L'\0' || value == 0 || value > 256)
+            return false;
+        *threads = (unsigned)value;
+        return true;
+    }
+
+    static const char *ResolveError(long status)
+    {
+        return status == RegNotFound ? "not found" : "ambiguous display name";
+    }
+
+    static const char *GroupError(long status)
+    {
+        switch (status)
+        {
+        case RegOk:
+            return NULL;
+        case RegNotFound:
+            return "not found";
+        case RegAlreadyExists:
+            return "key name already taken in the group";
+        case RegInvalidParameter:
+            return "not a group, or a group moved into itself";
+        default:
+            return "registry error";
+        }
+    }
+
+    // Run "group <subcommand> ..."; false on a usage error
+    bool ExecuteGroup(const std::vector<std::wstring> &args)
+    {
+        if (args.size() < 3)
+            return false;
+        const std::wstring &subcommand = args[1];
+        std::wstring command = args[0] + L" " + subcommand;
+
+        if (subcommand == L"create")
+        {
+            if (args.size() != 3 || args[2].empty())
+                return false;
+            std::wstring keyName;
+            long status = store.CreateGroup(args[2], &keyName);
+            Report(command, args[2], keyName, status, status == RegOk ? NULL : "registry error");
+            return true;
+        }
+
+        if (subcommand == L"flatten")
+        {
+            if (args.size() != 3)
+                return false;
+            int index;
+            long status = store.Resolve(args[2], &index);
+            if (status != RegOk)
+            {
+                Report(command, args[2], L"", status, ResolveError(status));
+                return true;
+            }
+            std::wstring keyName = store.Entries()[index].name.str();
+            status = store.FlattenGroup(keyName);
+            Report(command, args[2], keyName, status, GroupError(status));
+            return true;
+        }
+
+        if (subcommand == L"move" || subcommand == L"leave")
+        {
+            bool leave = subcommand == L"leave";
+            if (!leave && args.size() < 4)
+                return false;
+
+            std::wstring group;
+            if (!leave)
+            {
+                int index;
+                long status = store.Resolve(args[2], &index);
+                if (status != RegOk)
+                {
+                    Report(command, args[2], L"", status, ResolveError(status));
+                    return true;
+                }
+                group = store.Entries()[index].name;
+            }
+
+            // One move per item, so each is reported under its new key path
+            for (size_t i = leave ? 2 : 3; i < args.size(); i++)
+            {
+                int index;
+                long status = store.Resolve(args[i], &index);
+                if (status != RegOk)
+                {
+                    Report(command, args[i], L"", status, ResolveError(status));
+                    continue;
+                }
+                std::wstring keyName = store.Entries()[index].name.str();
+                if (leave && keyName.find(L'\\') == std::wstring::npos)
+                {
+                    Report(command, args[i], keyName, RegInvalidParameter, "not in a group");
+                    continue;
+                }
+                std::wstring target = leave ? ParentGroupPath(ParentGroupPath(keyName)) : group;
+
+                std::vector<std::wstring> keyNames(1, keyName);
+                status = store.MoveToGroup(keyNames, target);
+                Report(command, args[i], status == RegOk ? GroupMemberPath(target, LeafKeyName(keyName)) : keyName,
+                       status, GroupError(status));
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Run one mutating command; false on a usage error
+    bool Execute(const std::vector<std::wstring> &args)
+    {
+        if (args.empty())
+            return false;
+        const std::wstring &command = args[0];
+
+        if (command == L"add")
+        {
+            std::vector<std::wstring> paths;
+            std::wstring displayName;
+            for (size_t i = 1; i < args.size(); i++)
+            {
+                if (args[i] == L"--name")
+                {
+                    if (++i >= args.size())
+                        return false;
+                    displayName = args[i];
+                }
+                else
+                {
+                    paths.push_back(args[i]);
+                }
+            }
+            if (paths.empty() || (!displayName.empty() && paths.size() > 1))
+                return false;
+
+            for (const auto &path : paths)
+            {
+                std::wstring keyName;
+                long status = store.Add(path, displayName, &keyName, NULL);
+                Report(command, path, keyName, status,
+                       status == RegOk ? NULL : status == RegInvalidParameter ? "invalid program path" : "registry error");
+            }
+            return true;
+        }
+
+        if (command == L"remove")
+        {
+            std::vector<std::wstring> items;
+            bool force = false;
+            for (size_t i = 1; i < args.size(); i++)
+            {
+                if (args[i] == L"--force")
+                    force = true;
+                else
+                    items.push_back(args[i]);
+            }
+            if (items.empty())
+                return false;
+
+            // Resolve every item first, then delete them all in one pass
+            std::vector<std::wstring> keyNames(items.size());
+            std::vector<long> statuses(items.size(), RegOk);
+            std::vector<const char *> errors(items.size(), (const char *)NULL);
+            std::vector<std::wstring> removals;
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                int index;
+                statuses[i] = store.Resolve(items[i], &index);
+                if (statuses[i] != RegOk)
+                {
+                    errors[i] = ResolveError(statuses[i]);
+                    continue;
+                }
+
+                keyNames[i] = store.Entries()[index].name;
+                if (!store.Entries()[index].isCustom && !force)
+                {
+                    statuses[i] = RegAccessDenied;
+                    errors[i] = "not created by this program (use --force)";
+                    continue;
+                }
+                removals.push_back(keyNames[i]);
+            }
+
+            std::vector<long> removed;
+            if (!removals.empty())
+                store.RemoveMany(removals, &removed);
+
+            size_t next = 0;
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                if (!errors[i])
+                {
+                    statuses[i] = removed[next++];
+                    if (statuses[i] != RegOk)
+                        errors[i] = "registry error";
+                }
+                Report(command, items[i], keyNames[i], statuses[i], errors[i]);
+            }
+            return true;
+        }
+
+        if (command == L"rename")
+        {
+            if (args.size() != 3 || args[2].empty())
+                return false;
+
+            int index;
+            long status = store.Resolve(args[1], &index);
+            if (status != RegOk)
+            {
+                Report(command, args[1], L"", status, ResolveError(status));
+                return true;
+            }
+
+            std::wstring keyName = store.Entries()[index].name.str();
+            status = store.Rename(keyName, args[2]);
+            Report(command, args[1], keyName, status, status == RegOk ? NULL : "registry error");
+            return true;
+        }
+
+        if (command == L"reorder")
+        {
+            if (args.size() < 2)
+                return false;
+
+            std::vector<std::wstring> items(args.begin() + 1, args.end());
+            std::vector<std::wstring> keyNames;
+            for (const auto &item : items)
+            {
+                int index;
+                long status = store.Resolve(item, &index);
+                if (status != RegOk)
+                {
+                    Report(command, item, L"", status, ResolveError(status));
+                    return true;
+                }
+                if (!store.Entries()[index].isCustom)
+                {
+                    Report(command, item, store.Entries()[index].name.str(), RegInvalidParameter,
+                           "only items created by this program can be reordered");
+                    return true;
+                }
+                if (store.Entries()[index].depth > 0)
+                {
+                    Report(command, item, store.Entries()[index].name.str(), RegInvalidParameter,
+                           "group members keep their key order");
+                    return true;
+                }
+                keyNames.push_back(store.Entries()[index].name.str());
+            }
+
+            // Report each item under its key name after the move
+            std::vector<KeyRename> renames;
+            long status = store.Reorder(keyNames, &renames);
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                std::wstring keyName = keyNames[i];
+                for (const auto &rename : renames)
+                {
+                    if (CompareRegistryNames(rename.from, keyName) == 0)
+                        keyName = rename.to;
+                }
+                Report(command, items[i], keyName, status, status == RegOk ? NULL : "registry error");
+            }
+            return true;
+        }
+
+        if (command == L"group")
+            return ExecuteGroup(args);
+
+        return false;
+    }
+
+    void Apply(const std::wstring &path)
+    {
+        std::wstring text;
+        if (!readFile || !readFile(path, text))
+        {
+            Report(L"apply", path, L"", RegNotFound, "cannot read file");
+            return;
+        }
+
+        // The scope apply itself was given is the default for every line
+        std::size_t selected = store.SelectedScope();
+        std::vector<std::wstring> args;
+        size_t start = 0;
+        for (line = 1; start <= text.length(); line++)
+        {
+            size_t end = text.find(L'\n', start);
+            if (end == std::wstring::npos)
+                end = text.length();
+            std::wstring current = text.substr(start, end - start);
+            start = end + 1;
+
+            if (!current.empty() && current[current.length() - 1] == L'\r')
+                current.erase(current.length() - 1);
+            size_t first = current.find_first_not_of(L" \t");
+            if (first == std::wstring::npos || current[first] == L'#')
+                continue;
+
+            SplitArguments(current, args);
+            if (args[0] == L"list" || args[0] == L"apply" || args[0] == L"reconcile" || args[0] == L"audit" ||
+                args[0] == L"health" || !TakeScope(args, NULL) || !Execute(args))
+                Report(args[0], current, L"", RegInvalidParameter, "usage");
+            store.SelectScope(selected);
+        }
+        line = 0;
+    }
+
+    int Reconcile(const std::wstring &path, bool dryRun, JsonWriter &json)
+    {
+        static const char *const kActionNames[] = {"delete", "rename", "create", "update"};
+
+        json.BeginObject();
+        json.Key("command");
+        json.String("reconcile");
+        json.Key("scope");
+        json.String(store.Scope(store.SelectedScope()).Name());
+
+        std::wstring text, error;
+        std::vector<DesiredEntry> desired;
+        if (!readFile || !readFile(path, text))
+            error = L"cannot read file";
+        else
+            ParseDesiredMenu(text, desired, error);
+        if (!error.empty())
+        {
+            json.Key("ok");
+            json.Bool(false);
+            json.Key("error");
+            json.String(error);
+            json.EndObject();
+            return 1;
+        }
+
+        std::vector<ReconcileStep> plan;
+        std::size_t operations = 0;
+        long status = store.Reconcile(desired, dryRun, plan, &operations);
+
+        json.Key("ok");
+        json.Bool(status == RegOk);
+        if (status != RegOk)
+        {
+            json.Key("status");
+            json.Number(status);
+            json.Key("error");
+            json.String(status == RegInvalidParameter ? "too many items" : "registry error");
+        }
+        json.Key("dryRun");
+        json.Bool(dryRun);
+        json.Key("operations");
+        json.Number((long long)operations);
+        json.Key("changes");
+        json.BeginArray();
+        for (const auto &step : plan)
+        {
+            json.BeginObject();
+            json.Key("action");
+            json.String(kActionNames[step.action]);
+            json.Key("key");
+            json.String(step.keyName);
+            if (step.action == ReconcileRename)
+            {
+                json.Key("newKey");
+                json.String(step.newKeyName);
+            }
+            json.Key("name");
+            json.String(step.displayName);
+            if (step.action == ReconcileUpdate)
+            {
+                json.Key("fields");
+                json.BeginArray();
+                if (step.setDisplayName)
+                    json.String("name");
+                if (step.setIcon)
+                    json.String("icon");
+                if (step.setCommand)
+                    json.String("command");
+                json.EndArray();
+            }
+            json.EndObject();
+        }
+        json.EndArray();
+        json.EndObject();
+        return status == RegOk ? 0 : 1;
+    }
+
+    int Audit(unsigned threads, JsonWriter &json)
+    {
+        std::vector<AuditedVerb> verbs;
+        StringPool strings;
+        AuditStats stats;
+        long status = AuditShellVerbs(store.Backend(), kRegClassesRoot, threads, verbs, strings, &stats);
+
+        json.BeginObject();
+        json.Key("command");
+        json.String("audit");
+        json.Key("ok");
+        json.Bool(status == RegOk);
+        if (status != RegOk)
+        {
+            json.Key("status");
+            json.Number(status);
+            json.Key("error");
+            json.String("cannot list HKEY_CLASSES_ROOT");
+            json.EndObject();
+            return 1;
+        }
+        json.Key("classes");
+        json.Number((long long)stats.classes);
+        json.Key("shellKeys");
+        json.Number((long long)stats.shellKeys);
+        json.Key("threads");
+        json.Number((long long)stats.threads);
+        json.Key("verbs");
+        json.BeginArray();
+        for (const auto &verb : verbs)
+        {
+            json.BeginObject();
+            json.Key("class");
+            json.String(verb.className);
+            json.Key("key");
+            json.String(verb.app.name);
+            json.Key("name");
+            json.String(verb.app.displayName);
+            json.Key("command");
+            json.String(verb.command);
+            json.Key("path");
+            json.String(verb.app.path);
+            WriteArguments(json, verb.app.arguments);
+            json.Key("icon");
+            json.String(verb.app.icon);
+            json.Key("system");
+            json.Bool(verb.system);
+            json.EndObject();
+        }
+        json.EndArray();
+        json.EndObject();
+        return 0;
+    }
+
+    // Check the entries of the selected scope, or of every scope with allScopes, and list the broken ones.
+    // With remove they are deleted as well (only custom ones unless force).
+    int Health(bool allScopes, unsigned threads, bool remove, bool force, JsonWriter &json)
+    {
+        struct BrokenItem
+        {
+            std::wstring key;
+            unsigned missing;  // HealthFlags
+            bool removing;     // Passed to RemoveMany
+            long status;
+            const char *error; // NULL unless the removal was refused or failed
+        };
+
+        json.BeginObject();
+        json.Key("command");
+        json.String("health");
+        json.Key("broken");
+        json.BeginArray();
+
+        bool ok = true;
+        std::size_t checked = 0, paths = 0, probed = 0;
+        unsigned usedThreads = 0;
+        std::vector<unsigned> health;
+        std::size_t selected = store.SelectedScope();
+        for (std::size_t scope = 0; scope < store.ScopeCount(); scope++)
+        {
+            if (!allScopes && scope != selected)
+                continue;
+            const std::vector<AppEntry> &entries = store.Entries(scope);
+            HealthStats stats = healthChecker.Check(entries, health, threads);
+            checked += entries.size();
+            paths += stats.paths;
+            probed += stats.probed;
+            usedThreads = std::max(usedThreads, stats.threads);
+
+            // Removal shifts the entries, so everything needed is copied out first
+            std::vector<BrokenItem> items;
+            std::vector<std::wstring> removals;
+            for (std::size_t i = 0; i < entries.size(); i++)
+            {
+                if (health[i] == HealthOk)
+                    continue;
+                BrokenItem item = {entries[i].name.str(), health[i], remove && (entries[i].isCustom || force), RegOk, NULL};
+                if (remove && !item.removing)
+                {
+                    item.status = RegAccessDenied;
+                    item.error = "not created by this program (use --force)";
+                }
+                if (item.removing)
+                    removals.push_back(item.key);
+                items.push_back(item);
+            }
+
+            std::vector<long> statuses;
+            if (!removals.empty())
+            {
+                store.SelectScope(scope);
+                store.RemoveMany(removals, &statuses);
+            }
+
+            std::size_t next = 0;
+            std::wstring scopeName = store.Scope(scope).Name();
+            for (auto &item : items)
+            {
+                if (item.removing)
+                {
+                    item.status = statuses[next++];
+                    if (item.status != RegOk)
+                        item.error = "registry error";
+                }
+                if (item.error)
+                    ok = false;
+
+                json.BeginObject();
+                json.Key("scope");
+                json.String(scopeName);
+                json.Key("key");
+                json.String(item.key);
+                json.Key("missing");
+                json.BeginArray();
+                if (item.missing & HealthMissingProgram)
+                    json.String("program");
+                if (item.missing & HealthMissingIcon)
+                    json.String("icon");
+                json.EndArray();
+                if (remove)
+                {
+                    json.Key("removed");
+                    json.Bool(item.error == NULL);
+                }
+                if (item.error)
+                {
+                    json.Key("status");
+                    json.Number(item.status);
+                    json.Key("error");
+                    json.String(item.error);
+                }
+                json.EndObject();
+            }
+        }
+        store.SelectScope(selected);
+        json.EndArray();
+
+        json.Key("ok");
+        json.Bool(ok);
+        json.Key("checked");
+        json.Number((long long)checked);
+        json.Key("paths");
+        json.Number((long long)paths);
+        json.Key("probed");
+        json.Number((long long)probed);
+        json.Key("threads");
+        json.Number((long long)usedThreads);
+        json.EndObject();
+        return ok ? 0 : 1;
+    }
+
+    // "arguments" as the program would receive them - placeholders like %1 are kept as they are
+    void WriteArguments(JsonWriter &json, std::wstring_view arguments)
+    {
+        json.Key("arguments");
+        json.BeginArray();
+        std::wstring_view rest = arguments;
+        std::wstring_view raw;
+        while (NextCommandArgument(rest, raw))
+        {
+            UnquoteCommandArgument(raw, argument);
+            json.String(argument);
+        }
+        json.EndArray();
+    }
+
+    // Entries of the selected scope, or of every scope with allScopes
+    void WriteEntries(JsonWriter &json, bool all, bool allScopes)
+    {
+        json.Key("entries");
+        json.BeginArray();
+        for (std::size_t scope = 0; scope < store.ScopeCount(); scope++)
+        {
+            if (!allScopes && scope != store.SelectedScope())
+                continue;
+            WriteScopeEntries(json, scope, all);
+        }
+        json.EndArray();
+    }
+
+    void WriteScopeEntries(JsonWriter &json, std::size_t scope, bool all)
+    {
+        std::wstring scopeName = store.Scope(scope).Name();
+        for (const auto &app : store.Entries(scope))
+        {
+            if (!all && !app.isCustom)
+                continue;
+            json.BeginObject();
+            json.Key("scope");
+            json.String(scopeName);
+            json.Key("key");
+            json.String(app.name);
+            json.Key("name");
+            json.String(app.displayName);
+            json.Key("path");
+            json.String(app.path);
+            WriteArguments(json, app.arguments);
+            json.Key("icon");
+            json.String(app.icon);
+            json.Key("custom");
+            json.Bool(app.isCustom);
+            json.Key("group");
+            json.Bool(app.isGroup);
+            json.EndObject();
+        }
+    }
+
+    void WriteResults(JsonWriter &json)
+    {
+        json.Key("results");
+        json.BeginArray();
+        for (const auto &result : results)
+        {
+            json.BeginObject();
+            if (result.line > 0)
+            {
+                json.Key("line");
+                json.Number(result.line);
+                json.Key("command");
+                json.String(result.command);
+            }
+            json.Key("scope");
+            json.String(result.scope);
+            json.Key("item");
+            json.String(result.item);
+            if (!result.key.empty())
+            {
+                json.Key("key");
+                json.String(result.key);
+            }
+            json.Key("ok");
+            json.Bool(result.error == NULL);
+            if (result.error)
+            {
+                json.Key("status");
+                json.Number(result.status);
+                json.Key("error");
+                json.String(result.error);
+            }
+            json.EndObject();
+        }
+        json.EndArray();
+    }
+
+    static int UsageError(JsonWriter &json)
+    {
+        json.BeginObject();
+        json.Key("ok");
+        json.Bool(false);
+        json.Key("error");
+        json.String("usage");
+        json.Key("usage");
+        json.String(kCliUsage);
+        json.EndObject();
+        return 2;
+    }
+
+public:
+    ContextMenuCli(ContextMenuStore &menuStore, ReadFileFn fileReader, FileProbe &fileProbe)
+        : store(menuStore), readFile(fileReader), healthChecker(fileProbe), line(0) {}
+
+    // Run the command in commandLine (which excludes the program name). Returns the process exit code.
+    int Run(const std::vector<std::wstring> &commandLine, JsonWriter &json)
+    {
+        results.clear();
+        if (commandLine.empty())
+            return UsageError(json);
+
+        std::vector<std::wstring> args = commandLine;
+        bool scopeGiven;
+        if (!TakeScope(args, &scopeGiven))
+            return UsageError(json);
+        const std::wstring &command = args[0];
+        bool listAll = args.size() == 2 && args[1] == L"--all";
+        if (command == L"list" && args.size() > 1 && !listAll)
+            return UsageError(json);
+        if (command == L"apply" && args.size() != 2)
+            return UsageError(json);
+        bool dryRun = args.size() == 3 && args[2] == L"--dry-run";
+        if (command == L"reconcile" && args.size() != 2 && !dryRun)
+            return UsageError(json);
+
+        // The audit reads all of HKEY_CLASSES_ROOT, not the menu's shell key
+        if (command == L"audit")
+        {
+            if (scopeGiven)
+                return UsageError(json);
+            unsigned threads = 0;
+            if (args.size() == 3 && args[1] == L"--threads")
+            {
+                if (!ParseThreads(args[2], &threads))
+                    return UsageError(json);
+            }
+            else if (args.size() != 1)
+                return UsageError(json);
+            return Audit(threads, json);
+        }
+
+        if (!store.Load())
+        {
+            json.BeginObject();
+            json.Key("command");
+            json.String(command);
+            json.Key("ok");
+            json.Bool(false);
+            json.Key("error");
+            json.String("cannot open any context menu shell key");
+            json.EndObject();
+            return 1;
+        }
+
+        if (command == L"list")
+        {
+            json.BeginObject();
+            json.Key("command");
+            json.String(command);
+            json.Key("ok");
+            json.Bool(true);
+            WriteEntries(json, listAll, !scopeGiven);
+            json.EndObject();
+            return 0;
+        }
+
+        if (command == L"reconcile")
+            return Reconcile(args[1], dryRun, json);
+
+        if (command == L"health")
+        {
+            bool remove = false, force = false;
+            unsigned threads = 0;
+            for (size_t i = 1; i < args.size(); i++)
+            {
+                if (args[i] == L"--remove")
+                    remove = true;
+                else if (args[i] == L"--force")
+                    force = true;
+                else if (args[i] == L"--threads" && i + 1 < args.size() && ParseThreads(args[i + 1], &threads))
+                    i++;
+                else
+                    return UsageError(json);
+            }
+            if (force && !remove)
+                return UsageError(json);
+            return Health(!scopeGiven, threads, remove, force, json);
+        }
+
+        if (command == L"apply")
+            Apply(args[1]);
+        else if (!Execute(args))
+            return UsageError(json);
+
+        bool ok = true;
+        for (const auto &result : results)
+        {
+            if (result.error)
+                ok = false;
+        }
+
+        json.BeginObject();
+        json.Key("command");
+        json.String(command);
+        json.Key("ok");
+        json.Bool(ok);
+        WriteResults(json);
+        json.EndObject();
+        return ok ? 0 : 1;
+    }
+};
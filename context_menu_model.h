@@ -0,0 +1,438 @@
+#pragma once
+
+// Context menu entry model shared by the GUI and the command-line mode
+//
+// Everything here is free of window handles: how a verb is turned into an
+// AppEntry, which verbs belong to Windows, how a new custom entry is named
+// and written, and how a custom order is turned into key renames.
+//
+// Members of cascading groups are entries too: their name is the key path
+// below the shell key ("0003_CustomApp_Tools\shell\0001_CustomApp_Paint")
+// and key paths sort one component at a time, so every group is directly
+// followed by its members. Only top-level items take part in reordering.
+
+#include "command_line.h"
+#include "registry_transaction.h"
+#include "reorder_planner.h"
+#include "shell_enumerator.h"
+#include "static_name_set.h"
+#include "string_pool.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+// Application structure. The strings are handles into the StringPool the
+// entry was made with (string_pool.h), which must outlive it.
+struct AppEntry
+{
+    PooledString name;        // Registry key name - key path below the shell key for group members
+    PooledString path;        // Program path, from the command line
+    PooledString arguments;   // Rest of the command line ("%1" and the like), unparsed
+    PooledString displayName; // Display name
+    PooledString icon;        // Icon path
+    bool isCustom;            // Whether created by this program
+    bool isGroup;             // Cascading group ("SubCommands" with members under its "shell" subkey)
+    unsigned depth;           // Group nesting level, 0 for top-level items
+    unsigned health;          // HealthFlags from the last health check (health_check.h), 0 if fine or unchecked
+};
+
+// System built-in right-click menu items - never listed or touched
+constexpr const wchar_t *kSystemVerbs[] = {
+    L"New",
+    L"View",
+    L"SortBy",
+    L"Paste",
+    L"PasteShortcut",
+    L"DesktopBackground",
+    L"Settings",
+    L"Display",
+    L"GraphicsProperties",
+    L"NvDriverUpdate",
+    L"Share",
+    L"GrantAccess",
+    L"PinToQuickAccess",
+    L"IncludeInLibrary",
+    L"Properties",
+    L"Open",
+    L"OpenInNewWindow",
+    L"Print",
+    L"ScanWithMicrosoftDefender"};
+
+// Checked for every enumerated verb, so looked up through a perfect hash built at compile time
+constexpr auto kSystemVerbSet = MakeStaticNameSet<64>(kSystemVerbs);
+static_assert(kSystemVerbSet.Valid(), "no collision-free seed for kSystemVerbs - raise the slot count");
+
+inline bool IsSystemVerb(const wchar_t *keyName)
+{
+    return kSystemVerbSet.Contains(keyName);
+}
+
+// Compare key paths one component at a time, so a group sorts directly before its members
+inline int CompareKeyPaths(std::wstring_view a, std::wstring_view b)
+{
+    std::size_t aStart = 0, bStart = 0;
+    for (;;)
+    {
+        std::size_t aEnd = a.find(L'\\', aStart);
+        std::size_t bEnd = b.find(L'\\', bStart);
+        if (aEnd == std::wstring_view::npos)
+            aEnd = a.length();
+        if (bEnd == std::wstring_view::npos)
+            bEnd = b.length();
+
+        int result = CompareRegistryNames(a.data() + aStart, aEnd - aStart, b.data() + bStart, bEnd - bStart);
+        if (result != 0)
+            return result;
+        bool aLast = aEnd == a.length(), bLast = bEnd == b.length();
+        if (aLast || bLast)
+            return (int)!aLast - (int)!bLast;
+        aStart = aEnd + 1;
+        bStart = bEnd + 1;
+    }
+}
+
+// Sort by registry key name, the order Explorer shows verbs in
+inline bool AppKeyNameLess(const AppEntry &a, const AppEntry &b)
+{
+    return CompareKeyPaths(a.name, b.name) < 0;
+}
+
+// Key path of a member of group ("" for the shell key itself)
+inline std::wstring GroupMemberPath(std::wstring_view group, std::wstring_view keyName)
+{
+    std::wstring keyPath(group);
+    if (!group.empty())
+        keyPath += L"\\shell\\";
+    keyPath += keyName;
+    return keyPath;
+}
+
+// Group a key path is a member of, "" for top-level items
+inline std::wstring ParentGroupPath(std::wstring_view keyPath)
+{
+    std::size_t pos = keyPath.rfind(L"\\shell\\");
+    return pos == std::wstring_view::npos ? std::wstring() : std::wstring(keyPath.substr(0, pos));
+}
+
+// Last component of a key path
+inline std::wstring LeafKeyName(std::wstring_view keyPath)
+{
+    std::size_t pos = keyPath.find_last_of(L'\\');
+    return std::wstring(pos == std::wstring_view::npos ? keyPath : keyPath.substr(pos + 1));
+}
+
+// First component of a key path - the top-level item a group member is filed under
+inline std::wstring TopKeyName(std::wstring_view keyPath)
+{
+    return std::wstring(keyPath.substr(0, keyPath.find(L'\\')));
+}
+
+// Whether keyPath lies below group, at any depth
+inline bool IsInGroup(std::wstring_view keyPath, std::wstring_view group)
+{
+    return keyPath.length() > group.length() && keyPath[group.length()] == L'\\' &&
+           CompareRegistryNames(keyPath.data(), group.length(), group.data(), group.length()) == 0;
+}
+
+// Value that holds the text a verb shows: groups are written with MUIVerb, commands with the default value
+inline const wchar_t *DisplayNameValue(const AppEntry &app)
+{
+    return app.isGroup ? L"MUIVerb" : NULL;
+}
+
+// Entry for a verb, its strings interned into strings
+inline AppEntry MakeAppEntry(const ShellEntry &entry, StringPool &strings)
+{
+    AppEntry app;
+    app.name = strings.Intern(entry.keyName);
+    std::size_t leaf = entry.keyName.find_last_of(L'\\');
+    app.isCustom = (entry.keyName.find(L"CustomApp_", leaf == std::wstring::npos ? 0 : leaf + 1) != std::wstring::npos);
+    app.isGroup = entry.isGroup;
+    app.depth = entry.depth;
+    app.health = 0;
+    app.displayName = strings.Intern(entry.displayName);
+    app.icon = strings.Intern(entry.icon);
+    if (entry.hasCommand)
+    {
+        CommandLineParts parts = SplitCommandLine(entry.command);
+        app.path = strings.Intern(parts.executable);
+        app.arguments = strings.Intern(parts.arguments);
+    }
+    return app;
+}
+
+// A copy of app whose strings live in strings - for moving entries between lists with their own pools
+inline AppEntry InternAppEntry(const AppEntry &app, StringPool &strings)
+{
+    AppEntry copy = app;
+    copy.name = strings.Intern(app.name);
+    copy.path = strings.Intern(app.path);
+    copy.arguments = strings.Intern(app.arguments);
+    copy.displayName = strings.Intern(app.displayName);
+    copy.icon = strings.Intern(app.icon);
+    return copy;
+}
+
+// Key name -> position in a vector of AppEntry kept sorted by key name.
+// Positions shift when entries are inserted or erased, so the owner of the
+// vector reports each such change (or calls Rebuild after a batch of them).
+// Keys are views of the entries' pooled names, so indexing copies no strings;
+// rebuild the index when the entries move to another pool.
+class AppIndex
+{
+private:
+    std::unordered_map<std::wstring_view, std::size_t, RegistryNameHash, RegistryNameEqual> positions;
+    int lastSortKey; // Highest sort key of a custom entry, -1 if none
+
+    void Renumber(const std::vector<AppEntry> &entries, std::size_t from)
+    {
+        for (std::size_t i = from; i < entries.size(); i++)
+            positions[entries[i].name] = i;
+    }
+
+    void NoteSortKey(const AppEntry &app)
+    {
+        int sortKey;
+        if (app.isCustom && app.depth == 0 && ParseSortKey(app.name, &sortKey) && sortKey > lastSortKey)
+            lastSortKey = sortKey;
+    }
+
+public:
+    AppIndex() : lastSortKey(-1) {}
+
+    void Clear()
+    {
+        positions.clear();
+        lastSortKey = -1;
+    }
+
+    void Rebuild(const std::vector<AppEntry> &entries)
+    {
+        Clear();
+        positions.reserve(entries.size());
+        for (const auto &app : entries)
+            NoteSortKey(app);
+        Renumber(entries, 0);
+    }
+
+    // entries[position] was just inserted
+    void Inserted(const std::vector<AppEntry> &entries, std::size_t position)
+    {
+        NoteSortKey(entries[position]);
+        Renumber(entries, position);
+    }
+
+    // The entry named keyName was just erased from entries[position]
+    void Erased(const std::vector<AppEntry> &entries, std::size_t position, std::wstring_view keyName)
+    {
+        int sortKey;
+        positions.erase(keyName);
+        Renumber(entries, position);
+        if (ParseSortKey(keyName, &sortKey) && sortKey == lastSortKey)
+        {
+            lastSortKey = -1;
+            for (const auto &app : entries)
+                NoteSortKey(app);
+        }
+    }
+
+    // Position of the entry with this key name, -1 if none
+    int Find(std::wstring_view keyName) const
+    {
+        auto found = positions.find(keyName);
+        return found != positions.end() ? (int)found->second : -1;
+    }
+
+    int LastSortKey() const { return lastSortKey; }
+    std::size_t Size() const { return positions.size(); }
+};
+
+// Display name for a program: its file name without extension. False if appPath has no directory part.
+inline bool AppNameFromPath(const std::wstring &appPath, std::wstring &appName)
+{
+    size_t lastSlash = appPath.find_last_of(L'\\');
+    size_t lastDot = appPath.find_last_of(L'.');
+    if (lastSlash == std::wstring::npos)
+        return false;
+
+    appName = appPath.substr(lastSlash + 1);
+    if (lastDot != std::wstring::npos && lastDot > lastSlash)
+    {
+        appName = appPath.substr(lastSlash + 1, lastDot - lastSlash - 1);
+    }
+    return true;
+}
+
+// Key name for a new custom item, sorted after the last indexed custom item
+inline std::wstring GenerateCustomKeyName(const AppIndex &index, const std::wstring &displayName)
+{
+    int sortKey = NextSortKey(index.LastSortKey());
+    if (sortKey >= 0)
+        return FormatCustomKeyName(sortKey, displayName);
+
+    // No sort key left after the last item - an unranked name still sorts last,
+    // and the next reorder gives it a proper key. Start past the entry count so the
+    // first candidate is almost always free.
+    for (int counter = (int)index.Size() + 1;; counter++)
+    {
+        std::wstring keyName = L"CustomApp_" + displayName + L"_" + std::to_wstring(counter);
+        if (index.Find(keyName) < 0)
+            return keyName;
+    }
+}
+
+// Operations StageAddApp appends, in order - lets callers report which step failed
+enum AddAppStep
+{
+    AddStepCreateKey,
+    AddStepDisplayName,
+    AddStepIcon,
+    AddStepCreateCommand,
+    AddStepCommand
+};
+
+// Stage a new custom item: the verb key with display name and icon, and its command
+inline void StageAddApp(RegistryTransaction &transaction, const std::wstring &keyName,
+                        const std::wstring &appPath, const std::wstring &displayName)
+{
+    std::wstring commandKey = keyName + L"\\command";
+
+    std::wstring quotedPath = L"\"";
+    quotedPath += appPath;
+    quotedPath += L"\"";
+
+    transaction.CreateKey(keyName);
+    transaction.SetString(keyName, NULL, displayName);
+    transaction.SetString(keyName, L"Icon", quotedPath);
+    transaction.CreateKey(commandKey);
+    transaction.SetString(commandKey, NULL, quotedPath);
+}
+
+// Rewrite the SubCommands value of the top-level group above keyPath, if any. The change
+// tracker only sees top-level keys, and their last write time doesn't move when something
+// deeper changes - this makes every change inside a group show up as a change of the group.
+inline void StageTouchGroup(RegistryTransaction &transaction, const std::wstring &keyPath)
+{
+    if (keyPath.find(L'\\') != std::wstring::npos)
+        transaction.SetString(TopKeyName(keyPath), L"SubCommands", L"");
+}
+
+// Stage a new, empty group inside group ("" for the top level)
+inline void StageCreateGroup(RegistryTransaction &transaction, const std::wstring &group,
+                             const std::wstring &keyName, const std::wstring &displayName)
+{
+    std::wstring keyPath = GroupMemberPath(group, keyName);
+    transaction.CreateKey(keyPath + L"\\shell");
+    transaction.SetString(keyPath, L"MUIVerb", displayName);
+    transaction.SetString(keyPath, L"SubCommands", L"");
+    StageTouchGroup(transaction, keyPath);
+}
+
+// Renames that move entries into group ("" for the top level), keeping their key names.
+// False if an entry is the group itself or one of its parents, or would nest deeper than
+// kMaxMenuGroupDepth.
+inline bool PlanGroupMove(const std::vector<AppEntry> &entries, const std::vector<std::size_t> &moved,
+                          const std::wstring &group, unsigned groupDepth, std::vector<KeyRename> &renames)
+{
+    renames.clear();
+    for (std::size_t position : moved)
+    {
+        const AppEntry &app = entries[position];
+        if (CompareRegistryNames(app.name, group) == 0 || IsInGroup(group, app.name))
+            return false;
+
+        // A moved group takes its members along
+        unsigned deepest = 0;
+        for (std::size_t i = position + 1; i < entries.size() && IsInGroup(entries[i].name, app.name); i++)
+            deepest = std::max(deepest, entries[i].depth - app.depth);
+        if ((group.empty() ? 0 : groupDepth + 1) + deepest > kMaxMenuGroupDepth)
+            return false;
+
+        KeyRename rename = {app.name.str(), GroupMemberPath(group, LeafKeyName(app.name))};
+        if (CompareRegistryNames(rename.from, rename.to) != 0)
+            renames.push_back(rename);
+    }
+    return true;
+}
+
+// Stage moves planned by PlanGroupMove (or any renames across groups), touching every group involved
+inline void StageGroupMove(RegistryTransaction &transaction, const std::vector<KeyRename> &renames)
+{
+    if (renames.empty())
+        return;
+    transaction.Rename(L"", renames);
+
+    // Every top-level group that lost or gained a member is touched once
+    std::vector<std::wstring> groups;
+    for (const auto &rename : renames)
+    {
+        const std::wstring *paths[] = {&rename.from, &rename.to};
+        for (const std::wstring *keyPath : paths)
+        {
+            if (keyPath->find(L'\\') == std::wstring::npos)
+                continue;
+            std::wstring top = TopKeyName(*keyPath);
+            if (std::find_if(groups.begin(), groups.end(), [&top](const std::wstring &group)
+                             { return CompareRegistryNames(group, top) == 0; }) == groups.end())
+                groups.push_back(top);
+        }
+    }
+    for (const auto &group : groups)
+        transaction.SetString(group, L"SubCommands", L"");
+}
+
+// Renames that move the direct members of the group at entries[position] up one level, keeping their key names
+inline void PlanFlattenGroup(const std::vector<AppEntry> &entries, std::size_t position, std::vector<KeyRename> &renames)
+{
+    const AppEntry &group = entries[position];
+    std::wstring parent = ParentGroupPath(group.name);
+    renames.clear();
+    for (std::size_t i = position + 1; i < entries.size() && IsInGroup(entries[i].name, group.name); i++)
+    {
+        if (entries[i].depth != group.depth + 1)
+            continue;
+        KeyRename rename = {entries[i].name.str(), GroupMemberPath(parent, LeafKeyName(entries[i].name))};
+        renames.push_back(rename);
+    }
+}
+
+// Stage dissolving a group: its members move as PlanFlattenGroup planned, then the emptied group is deleted
+inline void StageFlattenGroup(RegistryTransaction &transaction, const std::wstring &group, const std::vector<KeyRename> &renames)
+{
+    StageGroupMove(transaction, renames);
+    transaction.DeleteTree(group);
+    StageTouchGroup(transaction, group);
+}
+
+// Renames that make the key order of the custom items match the order in which
+// order lists them (positions into entries). Non-custom entries and group members are ignored.
+// Returns false if there are more items than sort keys.
+inline bool PlanOrderRenames(const std::vector<AppEntry> &entries, const std::vector<std::size_t> &order,
+                             std::vector<KeyRename> &renames)
+{
+    std::vector<const AppEntry *> customApps;
+    std::vector<int> sortKeys;
+    for (std::size_t position : order)
+    {
+        const AppEntry &app = entries[position];
+        if (app.isCustom && app.depth == 0)
+        {
+            int sortKey;
+            customApps.push_back(&app);
+            sortKeys.push_back(ParseSortKey(app.name, &sortKey) ? sortKey : -1);
+        }
+    }
+
+    std::vector<ReorderMove> moves;
+    if (!PlanReorder(sortKeys, moves))
+        return false;
+
+    renames.clear();
+    for (const auto &move : moves)
+    {
+        const AppEntry &app = *customApps[move.index];
+        KeyRename rename = {app.name.str(), FormatCustomKeyName(move.sortKey, app.displayName)};
+        renames.push_back(rename);
+    }
+    return true;
+}
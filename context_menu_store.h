@@ -0,0 +1,518 @@
+#pragma once
+
+// Window-less view of the context menus
+//
+// ContextMenuStore holds the non-system verbs of every managed scope (see
+// menu_scope.h) as AppEntry items sorted by key name, one list per scope, and
+// applies changes through the same helpers the GUI uses. Load() reads all
+// scopes in one pass with one enumerator. Changes go to the selected scope
+// (desktop unless SelectScope says otherwise). Each change is one registry
+// transaction; the loaded list is patched in place afterwards instead of
+// being re-read, so applying thousands of changes in one process stays linear.
+// Only group moves and flattening, which move whole subtrees, re-read the scope.
+// Each scope interns its strings into its own pool, dropped when it is re-read.
+
+#include "desired_state.h"
+#include "menu_scope.h"
+
+#include <algorithm>
+#include <functional>
+
+class ContextMenuStore
+{
+private:
+    struct ScopeItems
+    {
+        MenuScope scope;
+        std::wstring shellPath;
+        std::vector<AppEntry> entries;
+        AppIndex keyIndex;  // Key name lookups into entries
+        StringPool strings; // Strings of entries
+    };
+
+    RegistryBackend &registry;
+    ShellKeyEnumerator enumerator;
+    std::vector<ScopeItems> scopes; // Managed scopes, desktop first
+    std::size_t current;            // Selected scope - the one changes go to
+    bool loaded;
+    std::function<void()> onCommit;
+    RegistryJournal *journal; // Records every transaction, if set
+
+    ContextMenuStore(const ContextMenuStore &);
+    ContextMenuStore &operator=(const ContextMenuStore &);
+
+    // Re-read one verb after it was written; false if it is gone
+    bool ReadEntry(const std::wstring &keyName, AppEntry &app)
+    {
+        ScopedRegKey shellKey(registry);
+        if (registry.OpenKey(kRegClassesRoot, scopes[current].shellPath.c_str(), false, shellKey.Receive()) != RegOk)
+            return false;
+
+        ShellEntry entry;
+        if (!enumerator.ReadEntry(shellKey.Get(), keyName.c_str(), entry))
+            return false;
+        app = MakeAppEntry(entry, scopes[current].strings);
+        return true;
+    }
+
+    void InsertSorted(const AppEntry &app)
+    {
+        ScopeItems &items = scopes[current];
+        auto position = items.entries.insert(std::upper_bound(items.entries.begin(), items.entries.end(), app, AppKeyNameLess), app);
+        items.keyIndex.Inserted(items.entries, position - items.entries.begin());
+    }
+
+    // Read every non-system verb of one scope, group members included; false if its shell key could not be opened
+    bool LoadScope(ScopeItems &items)
+    {
+        items.entries.clear();
+        items.strings.Clear();
+        long count = enumerator.EnumerateTree(
+            kRegClassesRoot, items.shellPath.c_str(),
+            [](const wchar_t *keyName)
+            { return IsSystemVerb(keyName); },
+            [&items](const ShellEntry &entry)
+            { items.entries.push_back(MakeAppEntry(entry, items.strings)); });
+        std::sort(items.entries.begin(), items.entries.end(), AppKeyNameLess);
+        items.keyIndex.Rebuild(items.entries);
+        return count >= 0;
+    }
+
+    // Create the scope's shell key if it is missing - extension scopes often have none yet
+    long CreateShellKey(const ScopeItems &items)
+    {
+        ScopedRegKey shellKey(registry);
+        return registry.CreateKey(kRegClassesRoot, items.shellPath.c_str(), shellKey.Receive());
+    }
+
+    // Drop entries[position] and, for a group, the members sorted right behind it
+    void EraseWithMembers(ScopeItems &items, std::size_t position)
+    {
+        std::size_t end = position + 1;
+        while (end < items.entries.size() && IsInGroup(items.entries[end].name, items.entries[position].name))
+            end++;
+        if (end == position + 1)
+        {
+            PooledString erasedName = items.entries[position].name;
+            items.entries.erase(items.entries.begin() + position);
+            items.keyIndex.Erased(items.entries, position, erasedName);
+            return;
+        }
+        items.entries.erase(items.entries.begin() + position, items.entries.begin() + end);
+        items.keyIndex.Rebuild(items.entries);
+    }
+
+public:
+    // commitCallback runs after every committed change, e.g. to schedule a shell notification
+    // Manages the built-in scopes (desktop, folder, drive, files); add extensions with AddScope
+    explicit ContextMenuStore(RegistryBackend &backend, std::function<void()> commitCallback = nullptr)
+        : registry(backend), enumerator(backend), current(0), loaded(false), onCommit(commitCallback), journal(NULL)
+    {
+        for (const auto &scope : BuiltInMenuScopes())
+            AddScope(scope);
+    }
+
+    // Read every non-system verb of every managed scope, in one pass with the same enumerator.
+    // A scope without a shell key is simply empty; false only if no shell key could be opened.
+    bool Load()
+    {
+        bool opened = false;
+        for (auto &items : scopes)
+        {
+            if (LoadScope(items))
+                opened = true;
+        }
+        loaded = true;
+        return opened;
+    }
+
+    // Manage another scope (no-op if it already is), reading it if the others were loaded. Returns its index.
+    std::size_t AddScope(const MenuScope &scope)
+    {
+        for (std::size_t i = 0; i < scopes.size(); i++)
+        {
+            if (scopes[i].scope == scope)
+                return i;
+        }
+        ScopeItems items;
+        items.scope = scope;
+        items.shellPath = scope.ShellPath();
+        scopes.push_back(std::move(items));
+        if (loaded)
+            LoadScope(scopes.back());
+        return scopes.size() - 1;
+    }
+
+    std::size_t ScopeCount() const { return scopes.size(); }
+    const MenuScope &Scope(std::size_t index) const { return scopes[index].scope; }
+
+    // Send the following changes to scopes[index]
+    void SelectScope(std::size_t index) { current = index; }
+    std::size_t SelectedScope() const { return current; }
+
+    // Record every transaction in journal from now on (NULL stops that). RemoveMany deletes key by
+    // key, reporting each one, and is not journaled.
+    void SetJournal(RegistryJournal *commitJournal) { journal = commitJournal; }
+
+    // Entries of the selected scope, or of scopes[index]
+    const std::vector<AppEntry> &Entries() const { return scopes[current].entries; }
+    const std::vector<AppEntry> &Entries(std::size_t index) const { return scopes[index].entries; }
+
+    // The backend changes are written through, for read-only scans beyond the shell key
+    RegistryBackend &Backend() { return registry; }
+
+    // Index of the entry with this key name, -1 if none
+    int Find(const std::wstring &keyName) const
+    {
+        return scopes[current].keyIndex.Find(keyName);
+    }
+
+    // Look an entry up by key name, or else by display name.
+    // RegNotFound if nothing matches, RegInvalidParameter if several display names match.
+    long Resolve(const std::wstring &item, int *index) const
+    {
+        const ScopeItems &items = scopes[current];
+        *index = Find(item);
+        if (*index >= 0)
+            return RegOk;
+
+        for (size_t i = 0; i < items.entries.size(); i++)
+        {
+            if (CompareRegistryNames(items.entries[i].displayName, item) == 0)
+            {
+                if (*index >= 0)
+                    return RegInvalidParameter;
+                *index = (int)i;
+            }
+        }
+        return *index >= 0 ? RegOk : RegNotFound;
+    }
+
+    // Add a program; an empty displayName uses the file name. failedStep (optional)
+    // receives the AddAppStep that failed.
+    long Add(const std::wstring &appPath, const std::wstring &displayName, std::wstring *keyName, int *failedStep)
+    {
+        ScopeItems &items = scopes[current];
+        std::wstring appName = displayName;
+        if (appName.empty() && !AppNameFromPath(appPath, appName))
+            return RegInvalidParameter;
+
+        long status = CreateShellKey(items);
+        if (status != RegOk)
+            return status;
+
+        std::wstring registryKey = GenerateCustomKeyName(items.keyIndex, appName);
+        RegistryTransaction transaction(registry, kRegClassesRoot, items.shellPath.c_str(), onCommit, journal);
+        StageAddApp(transaction, registryKey, appPath, appName);
+
+        status = transaction.Commit();
+        if (failedStep)
+            *failedStep = transaction.FailedOperation();
+        if (status != RegOk)
+            return status;
+
+        AppEntry app;
+        if (ReadEntry(registryKey, app))
+            InsertSorted(app);
+        if (keyName)
+            *keyName = registryKey;
+        return RegOk;
+    }
+
+    long Remove(const std::wstring &keyName)
+    {
+        ScopeItems &items = scopes[current];
+        RegistryTransaction transaction(registry, kRegClassesRoot, items.shellPath.c_str(), onCommit, journal);
+        transaction.DeleteTree(keyName);
+        StageTouchGroup(transaction, keyName);
+        long status = transaction.Commit();
+        if (status != RegOk)
+            return status;
+
+        int position = Find(keyName);
+        if (position >= 0)
+            EraseWithMembers(items, position);
+        return RegOk;
+    }
+
+    // Remove many items in one pass: the shell key is opened once, the commit callback runs once
+    // and the list is compacted once. Not a transaction - each key is deleted on its own and
+    // statuses (optional) receives every key's result in order (RegOk if it was already gone).
+    // Returns the first failure, RegOk if every key is gone.
+    long RemoveMany(const std::vector<std::wstring> &keyNames, std::vector<long> *statuses = NULL)
+    {
+        ScopeItems &items = scopes[current];
+        ScopedRegKey shellKey(registry);
+        long result = registry.OpenKey(kRegClassesRoot, items.shellPath.c_str(), true, shellKey.Receive());
+        if (statuses)
+            statuses->assign(keyNames.size(), result);
+        if (result != RegOk)
+            return result;
+
+        std::vector<bool> removed(items.entries.size(), false);
+        std::vector<std::wstring> groups; // Top-level groups that lost a member
+        bool deleted = false;
+        for (size_t i = 0; i < keyNames.size(); i++)
+        {
+            // Whole-tree delete first (SHDeleteKeyW on Windows), key by key if that fails
+            long status = registry.DeleteTree(shellKey.Get(), keyNames[i].c_str());
+            if (status != RegOk && status != RegNotFound)
+                status = DeleteKeyTree(registry, shellKey.Get(), keyNames[i].c_str());
+
+            if (status == RegOk)
+            {
+                deleted = true;
+                if (keyNames[i].find(L'\\') != std::wstring::npos)
+                    groups.push_back(TopKeyName(keyNames[i]));
+            }
+            if (status == RegOk || status == RegNotFound)
+            {
+                status = RegOk;
+                int position = Find(keyNames[i]);
+                if (position >= 0)
+                    removed[position] = true;
+            }
+            else if (result == RegOk)
+                result = status;
+            if (statuses)
+                (*statuses)[i] = status;
+        }
+
+        // Let change trackers see the groups as changed (see StageTouchGroup)
+        for (const auto &group : groups)
+        {
+            ScopedRegKey groupKey(registry);
+            if (registry.OpenKey(shellKey.Get(), group.c_str(), true, groupKey.Receive()) == RegOk)
+                SetStringValue(registry, groupKey.Get(), L"SubCommands", L"");
+        }
+        shellKey.Reset();
+
+        // Members of a removed group went with it
+        for (size_t i = 0; i < items.entries.size(); i++)
+        {
+            if (!removed[i])
+                continue;
+            PooledString group = items.entries[i].name;
+            for (size_t j = i + 1; j < items.entries.size() && IsInGroup(items.entries[j].name, group); j++)
+                removed[j] = true;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < items.entries.size(); i++)
+        {
+            if (removed[i])
+                continue;
+            if (kept != i)
+                items.entries[kept] = std::move(items.entries[i]);
+            kept++;
+        }
+        if (kept != items.entries.size())
+        {
+            items.entries.resize(kept);
+            items.keyIndex.Rebuild(items.entries);
+        }
+
+        if (deleted && onCommit)
+            onCommit();
+        return result;
+    }
+
+    // Change the display name; the key name (and so the position) stays the same
+    long Rename(const std::wstring &keyName, const std::wstring &displayName)
+    {
+        ScopeItems &items = scopes[current];
+        int index = Find(keyName);
+        RegistryTransaction transaction(registry, kRegClassesRoot, items.shellPath.c_str(), onCommit, journal);
+        transaction.SetString(keyName, index >= 0 ? DisplayNameValue(items.entries[index]) : NULL, displayName);
+        StageTouchGroup(transaction, keyName);
+        long status = transaction.Commit();
+        if (status != RegOk)
+            return status;
+
+        if (index >= 0)
+            items.entries[index].displayName = items.strings.Intern(displayName);
+        return RegOk;
+    }
+
+    // Move the listed custom items to the top, in the given order; other custom items keep
+    // their relative order after them. Non-custom key names and group members are rejected
+    // with RegInvalidParameter.
+    // appliedRenames (optional) receives the keys that were renamed.
+    long Reorder(const std::vector<std::wstring> &keyNames, std::vector<KeyRename> *appliedRenames = NULL)
+    {
+        ScopeItems &items = scopes[current];
+        std::vector<std::size_t> ordered;
+        std::vector<bool> placed(items.entries.size(), false);
+        for (const auto &keyName : keyNames)
+        {
+            int index = Find(keyName);
+            if (index < 0)
+                return RegNotFound;
+            if (!items.entries[index].isCustom || items.entries[index].depth > 0)
+                return RegInvalidParameter;
+            if (!placed[index])
+            {
+                ordered.push_back(index);
+                placed[index] = true;
+            }
+        }
+        for (size_t i = 0; i < items.entries.size(); i++)
+        {
+            if (items.entries[i].isCustom && items.entries[i].depth == 0 && !placed[i])
+                ordered.push_back(i);
+        }
+
+        std::vector<KeyRename> renames;
+        if (!PlanOrderRenames(items.entries, ordered, renames))
+            return RegInvalidParameter;
+        if (renames.empty())
+            return RegOk;
+
+        RegistryTransaction transaction(registry, kRegClassesRoot, items.shellPath.c_str(), onCommit, journal);
+        transaction.Rename(L"", renames);
+        long status = transaction.Commit();
+        if (status != RegOk)
+            return status;
+
+        for (const auto &rename : renames)
+        {
+            int index = Find(rename.from);
+            if (index < 0)
+                continue;
+
+            // A renamed group's members are still right behind it - their paths change with it
+            for (size_t i = index + 1; i < items.entries.size() && IsInGroup(items.entries[i].name, rename.from); i++)
+            {
+                std::wstring keyPath = rename.to;
+                keyPath += items.entries[i].name.view().substr(rename.from.length());
+                items.entries[i].name = items.strings.Intern(keyPath);
+            }
+            items.entries[index].name = items.strings.Intern(rename.to);
+        }
+        std::sort(items.entries.begin(), items.entries.end(), AppKeyNameLess);
+        items.keyIndex.Rebuild(items.entries);
+        if (appliedRenames)
+            appliedRenames->swap(renames);
+        return RegOk;
+    }
+
+    // Add an empty cascading group at the top level; keyName (optional) receives its key
+    long CreateGroup(const std::wstring &displayName, std::wstring *keyName)
+    {
+        ScopeItems &items = scopes[current];
+        if (displayName.empty())
+            return RegInvalidParameter;
+        long status = CreateShellKey(items);
+        if (status != RegOk)
+            return status;
+
+        std::wstring groupKey = GenerateCustomKeyName(items.keyIndex, displayName);
+        RegistryTransaction transaction(registry, kRegClassesRoot, items.shellPath.c_str(), onCommit, journal);
+        StageCreateGroup(transaction, L"", groupKey, displayName);
+        status = transaction.Commit();
+        if (status != RegOk)
+            return status;
+
+        AppEntry app;
+        if (ReadEntry(groupKey, app))
+            InsertSorted(app);
+        if (keyName)
+            *keyName = groupKey;
+        return RegOk;
+    }
+
+    // Move items into group ("" for the top level); a moved group takes its members along.
+    // Key names are kept, so an item whose name is taken in the group fails with RegAlreadyExists.
+    // RegInvalidParameter if group is no group or would end up inside one of the moved items.
+    long MoveToGroup(const std::vector<std::wstring> &keyNames, const std::wstring &group)
+    {
+        ScopeItems &items = scopes[current];
+        unsigned groupDepth = 0;
+        if (!group.empty())
+        {
+            int index = Find(group);
+            if (index < 0)
+                return RegNotFound;
+            if (!items.entries[index].isGroup)
+                return RegInvalidParameter;
+            groupDepth = items.entries[index].depth;
+        }
+
+        std::vector<std::size_t> moved;
+        for (const auto &keyName : keyNames)
+        {
+            int index = Find(keyName);
+            if (index < 0)
+                return RegNotFound;
+            moved.push_back(index);
+        }
+
+        std::vector<KeyRename> renames;
+        if (!PlanGroupMove(items.entries, moved, group, groupDepth, renames))
+            return RegInvalidParameter;
+        if (renames.empty())
+            return RegOk;
+
+        RegistryTransaction transaction(registry, kRegClassesRoot, items.shellPath.c_str(), onCommit, journal);
+        StageGroupMove(transaction, renames);
+        long status = transaction.Commit();
+        if (status != RegOk)
+            return status;
+
+        // Whole subtrees moved - re-read rather than patch
+        LoadScope(items);
+        return RegOk;
+    }
+
+    // Dissolve a group: its members move up one level, keeping their key names, and the group is deleted
+    long FlattenGroup(const std::wstring &keyName)
+    {
+        ScopeItems &items = scopes[current];
+        int index = Find(keyName);
+        if (index < 0)
+            return RegNotFound;
+        if (!items.entries[index].isGroup)
+            return RegInvalidParameter;
+
+        std::vector<KeyRename> renames;
+        PlanFlattenGroup(items.entries, index, renames);
+        RegistryTransaction transaction(registry, kRegClassesRoot, items.shellPath.c_str(), onCommit, journal);
+        StageFlattenGroup(transaction, keyName, renames);
+        long status = transaction.Commit();
+        if (status != RegOk)
+            return status;
+
+        LoadScope(items);
+        return RegOk;
+    }
+
+    // Bring the custom items in line with a desired-state list, as one transaction.
+    // plan receives the steps; with dryRun nothing is written. operations (optional)
+    // receives the number of staged registry operations - 0 when nothing differs.
+    long Reconcile(const std::vector<DesiredEntry> &desired, bool dryRun, std::vector<ReconcileStep> &plan,
+                   std::size_t *operations)
+    {
+        ScopeItems &items = scopes[current];
+        if (operations)
+            *operations = 0;
+        if (!PlanReconcile(desired, items.entries, plan))
+            return RegInvalidParameter;
+        if (plan.empty())
+            return RegOk;
+
+        RegistryTransaction transaction(registry, kRegClassesRoot, items.shellPath.c_str(), onCommit, journal);
+        StageReconcile(transaction, plan);
+        if (operations)
+            *operations = transaction.Size();
+        if (dryRun)
+            return RegOk;
+
+        long status = transaction.Commit();
+        if (status != RegOk)
+            return status;
+
+        // Many keys may have moved - re-read rather than patch
+        LoadScope(items);
+        return RegOk;
+    }
+};
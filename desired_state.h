@@ -0,0 +1,318 @@
+#pragma once
+
+// Desired-state file and reconcile planning
+//
+// A desired-state file lists the items this program should own, in menu order:
+//
+//     # Comments start with '#' or ';'
+//     [Notepad]
+//     path = C:\Windows\notepad.exe
+//
+//     [Paint]
+//     path = C:\Windows\System32\mspaint.exe
+//     icon = C:\Windows\System32\mspaint.exe,0
+//
+// The section name is the display name; "icon" defaults to the quoted path,
+// as for items added from the window. Only items created by this program are
+// reconciled - any other verb under the shell key is left alone, and so are
+// cascading groups and their members, which the file has no way to describe.
+//
+// PlanReconcile matches desired items to live ones (by display name, then by
+// program path), then derives the smallest plan: delete unmatched live items,
+// rename to fix the order (via PlanReorder, so items already in order keep
+// their keys), create missing items, and write only the values that differ.
+// An unchanged file yields an empty plan and no registry writes at all.
+
+#include "context_menu_model.h"
+
+struct DesiredEntry
+{
+    std::wstring displayName;
+    std::wstring path;
+    std::wstring icon; // Empty: quoted path
+    int line;          // Section line in the file, for messages
+};
+
+// Value written for an item's icon, given the desired entry
+inline std::wstring DesiredIcon(const DesiredEntry &entry)
+{
+    if (!entry.icon.empty())
+        return entry.icon;
+    return L"\"" + entry.path + L"\"";
+}
+
+inline std::wstring TrimSpaces(const std::wstring &text)
+{
+    size_t first = text.find_first_not_of(L" \t");
+    if (first == std::wstring::npos)
+        return std::wstring();
+    size_t last = text.find_last_not_of(L" \t");
+    return text.substr(first, last - first + 1);
+}
+
+// Parse a desired-state file. On failure error describes the first problem, with its line number.
+inline bool ParseDesiredMenu(const std::wstring &text, std::vector<DesiredEntry> &entries, std::wstring &error)
+{
+    entries.clear();
+    error.clear();
+
+    wchar_t prefix[32];
+    size_t start = 0;
+    for (int line = 1; start <= text.length(); line++)
+    {
+        size_t end = text.find(L'\n', start);
+        if (end == std::wstring::npos)
+            end = text.length();
+        std::wstring current = TrimSpaces(text.substr(start, end - start));
+        start = end + 1;
+
+        if (!current.empty() && current[current.length() - 1] == L'\r')
+            current = TrimSpaces(current.substr(0, current.length() - 1));
+        if (current.empty() || current[0] == L'#' || current[0] == L';')
+            continue;
+
+        swprintf(prefix, 32, L"line %d: ", line);
+        if (current[0] == L'[')
+        {
+            if (current[current.length() - 1] != L']' || current.length() < 3)
+            {
+                error = prefix + std::wstring(L"malformed section header");
+                return false;
+            }
+
+            DesiredEntry entry;
+            entry.displayName = TrimSpaces(current.substr(1, current.length() - 2));
+            entry.line = line;
+            for (const auto &existing : entries)
+            {
+                if (existing.displayName == entry.displayName)
+                {
+                    error = prefix + std::wstring(L"duplicate item \"") + entry.displayName + L"\"";
+                    return false;
+                }
+            }
+            entries.push_back(entry);
+            continue;
+        }
+
+        size_t equals = current.find(L'=');
+        if (equals == std::wstring::npos)
+        {
+            error = prefix + std::wstring(L"expected key = value");
+            return false;
+        }
+        if (entries.empty())
+        {
+            error = prefix + std::wstring(L"value outside of an [item] section");
+            return false;
+        }
+
+        std::wstring key = TrimSpaces(current.substr(0, equals));
+        std::wstring value = TrimSpaces(current.substr(equals + 1));
+        if (value.length() >= 2 && value[0] == L'"' && value[value.length() - 1] == L'"' && key == L"path")
+            value = value.substr(1, value.length() - 2);
+
+        if (key == L"path")
+            entries.back().path = value;
+        else if (key == L"icon")
+            entries.back().icon = value;
+        else
+        {
+            error = prefix + std::wstring(L"unknown key \"") + key + L"\"";
+            return false;
+        }
+    }
+
+    for (const auto &entry : entries)
+    {
+        if (entry.path.empty())
+        {
+            swprintf(prefix, 32, L"line %d: ", entry.line);
+            error = prefix + std::wstring(L"item \"") + entry.displayName + L"\" has no path";
+            return false;
+        }
+    }
+    return true;
+}
+
+enum ReconcileAction
+{
+    ReconcileDelete,
+    ReconcileRename,
+    ReconcileCreate,
+    ReconcileUpdate
+};
+
+struct ReconcileStep
+{
+    ReconcileAction action;
+    std::wstring keyName;    // Existing key (the new key for ReconcileCreate)
+    std::wstring newKeyName; // ReconcileRename only
+    std::wstring displayName;
+    std::wstring path;
+    std::wstring icon;
+    bool setDisplayName;     // ReconcileUpdate: which values differ
+    bool setIcon;
+    bool setCommand;
+};
+
+// Live items a desired-state file speaks for: top-level commands created by this program
+inline bool IsReconciledItem(const AppEntry &app)
+{
+    return app.isCustom && !app.isGroup && app.depth == 0;
+}
+
+// Steps are ordered deletes, renames, creates, updates - the order StageReconcile applies them in.
+// Returns false if the file lists more items than there are sort keys.
+inline bool PlanReconcile(const std::vector<DesiredEntry> &desired, const std::vector<AppEntry> &live,
+                          std::vector<ReconcileStep> &plan)
+{
+    plan.clear();
+
+    // Match desired items to live custom items: same display name first, then same program path
+    std::vector<int> match(desired.size(), -1);
+    std::vector<bool> used(live.size(), false);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = 0; i < desired.size(); i++)
+        {
+            if (match[i] >= 0)
+                continue;
+            for (size_t j = 0; j < live.size(); j++)
+            {
+                if (used[j] || !IsReconciledItem(live[j]))
+                    continue;
+                bool same = pass == 0 ? live[j].displayName == desired[i].displayName
+                                      : CompareRegistryNames(live[j].path, desired[i].path) == 0;
+                if (same)
+                {
+                    match[i] = (int)j;
+                    used[j] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t j = 0; j < live.size(); j++)
+    {
+        if (IsReconciledItem(live[j]) && !used[j])
+        {
+            ReconcileStep step = {ReconcileDelete, live[j].name.str(), L"", live[j].displayName.str(), live[j].path.str(), L"", false, false, false};
+            plan.push_back(step);
+        }
+    }
+
+    // Order: matched items keep their sort key where possible, new items get keys between them
+    std::vector<int> sortKeys;
+    for (size_t i = 0; i < desired.size(); i++)
+    {
+        int sortKey = -1;
+        if (match[i] >= 0 && !ParseSortKey(live[match[i]].name, &sortKey))
+            sortKey = -1;
+        sortKeys.push_back(sortKey);
+    }
+    std::vector<ReorderMove> moves;
+    if (!PlanReorder(sortKeys, moves))
+    {
+        plan.clear();
+        return false;
+    }
+
+    std::vector<std::wstring> finalKeys(desired.size());
+    for (size_t i = 0; i < desired.size(); i++)
+    {
+        if (match[i] >= 0)
+            finalKeys[i] = live[match[i]].name;
+    }
+    for (const auto &move : moves)
+    {
+        const DesiredEntry &entry = desired[move.index];
+        if (match[move.index] >= 0)
+        {
+            // Keep the display name part of the existing key; only the position changes
+            const AppEntry &app = live[match[move.index]];
+            finalKeys[move.index] = FormatCustomKeyName(move.sortKey, app.displayName);
+            ReconcileStep step = {ReconcileRename, app.name.str(), finalKeys[move.index], entry.displayName, entry.path, L"", false, false, false};
+            plan.push_back(step);
+        }
+        else
+        {
+            finalKeys[move.index] = FormatCustomKeyName(move.sortKey, entry.displayName);
+        }
+    }
+
+    for (size_t i = 0; i < desired.size(); i++)
+    {
+        if (match[i] < 0)
+        {
+            ReconcileStep step = {ReconcileCreate, finalKeys[i], L"", desired[i].displayName, desired[i].path,
+                                  DesiredIcon(desired[i]), true, true, true};
+            plan.push_back(step);
+        }
+    }
+
+    for (size_t i = 0; i < desired.size(); i++)
+    {
+        if (match[i] < 0)
+            continue;
+        const AppEntry &app = live[match[i]];
+        std::wstring icon = DesiredIcon(desired[i]);
+        ReconcileStep step = {ReconcileUpdate, finalKeys[i], L"", desired[i].displayName, desired[i].path, icon,
+                              app.displayName != desired[i].displayName,
+                              app.icon != icon,
+                              CompareRegistryNames(app.path, desired[i].path) != 0 || !app.arguments.empty()};
+        if (step.setDisplayName || step.setIcon || step.setCommand)
+            plan.push_back(step);
+    }
+    return true;
+}
+
+// Stage a plan into a transaction rooted at the shell key
+inline void StageReconcile(RegistryTransaction &transaction, const std::vector<ReconcileStep> &plan)
+{
+    std::vector<KeyRename> renames;
+    for (const auto &step : plan)
+    {
+        if (step.action == ReconcileDelete)
+            transaction.DeleteTree(step.keyName);
+        else if (step.action == ReconcileRename)
+        {
+            KeyRename rename = {step.keyName, step.newKeyName};
+            renames.push_back(rename);
+        }
+    }
+    if (!renames.empty())
+        transaction.Rename(L"", renames);
+
+    for (const auto &step : plan)
+    {
+        if (step.action == ReconcileCreate)
+        {
+            std::wstring commandKey = step.keyName + L"\\command";
+            transaction.CreateKey(step.keyName);
+            transaction.SetString(step.keyName, NULL, step.displayName);
+            transaction.SetString(step.keyName, L"Icon", step.icon);
+            transaction.CreateKey(commandKey);
+            transaction.SetString(commandKey, NULL, L"\"" + step.path + L"\"");
+        }
+        else if (step.action == ReconcileUpdate)
+        {
+            if (step.setDisplayName)
+                transaction.SetString(step.keyName, NULL, step.displayName);
+            if (step.setIcon)
+                transaction.SetString(step.keyName, L"Icon", step.icon);
+            if (step.setCommand)
+            {
+                std::wstring commandKey = step.keyName + L"\\command";
+                transaction.CreateKey(commandKey);
+                transaction.SetString(commandKey, NULL, L"\"" + step.path + L"\"");
+
+                // Writing only the command subkey leaves the verb's last write time alone, so
+                // rewrite its (unchanged) display name for change trackers to see the edit
+                if (!step.setDisplayName && !step.setIcon)
+                    transaction.SetString(step.keyName, NULL, step.displayName);
+            }
+        }
+    }
+}
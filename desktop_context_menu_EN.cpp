@@ -10,12 +10,34 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <memory>
+#include <unordered_set>
 #include <shlwapi.h>
 #include <shellscalingapi.h>
 
+#include "registry_backend_win32.h"
+#include "journal_file_win32.h"
+#include "file_probe_win32.h"
+#include "shell_enumerator.h"
+#include "registry_watcher.h"
+#include "context_menu_model.h"
+#include "menu_scope.h"
+#include "context_menu_cli.h"
+#include "health_check.h"
+#include "icon_source_win32.h"
+#include "list_view_model.h"
+#include "menu_snapshot.h"
+#include "menu_history.h"
+#include "registry_worker.h"
+#include "shell_notify.h"
+
 #define IDI_MAIN_ICON 101
 #define IDI_SMALL_ICON 102
 
+// Posted by the registry watcher thread when Directory\Background\shell changes
+#define WM_APP_REGISTRY_CHANGED (WM_APP + 1)
+#define WM_APP_WORKER_DONE (WM_APP + 2)
+
 #ifndef GET_X_LPARAM
 #define GET_X_LPARAM(lParam) ((int)(short)LOWORD(lParam))
 #endif
@@ -31,21 +53,107 @@
 #pragma comment(lib, "shlwapi.lib")
 #pragma comment(lib, "Shcore.lib")
 
-// Application structure
-struct AppEntry
+// Measures list text with the list box's font; the DC is only fetched if something needs measuring
+class ListTextMeasurer : public TextMeasurer
 {
-    std::wstring name;        // Registry key name
-    std::wstring path;        // Program path
-    std::wstring displayName; // Display name
-    std::wstring icon;        // Icon path
-    bool isCustom;            // Whether created by this program
+private:
+    HWND hWnd;
+    HFONT hFont;
+    int dpi;
+    HDC hdc;
+    HFONT hOldFont;
+
+public:
+    ListTextMeasurer(HWND hwnd, HFONT font, int dpiX) : hWnd(hwnd), hFont(font), dpi(dpiX), hdc(NULL), hOldFont(NULL) {}
+
+    ~ListTextMeasurer()
+    {
+        if (hdc)
+        {
+            SelectObject(hdc, hOldFont);
+            ReleaseDC(hWnd, hdc);
+        }
+    }
+
+    std::uint64_t Context() const
+    {
+        return ((std::uint64_t)(std::uintptr_t)hFont << 16) ^ (std::uint64_t)dpi;
+    }
+
+    int Width(const std::wstring &text)
+    {
+        if (!hdc)
+        {
+            hdc = GetDC(hWnd);
+            if (!hdc)
+                return 0;
+            hOldFont = (HFONT)SelectObject(hdc, hFont);
+        }
+
+        SIZE size;
+        if (!GetTextExtentPoint32W(hdc, text.c_str(), (int)text.length(), &size))
+            return 0;
+        return size.cx;
+    }
 };
 
+// Announces menu changes to Explorer so it drops its cached associations
+class Win32ShellNotifier : public ShellNotifier
+{
+public:
+    void Notify()
+    {
+        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
+    }
+};
+
+// %LOCALAPPDATA%\RightClickManager\<fileName>; empty if there is no such folder
+static std::wstring LocalDataPath(const wchar_t *fileName, bool create)
+{
+    wchar_t folder[MAX_PATH];
+    if (FAILED(SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, folder)))
+        return std::wstring();
+    std::wstring path = std::wstring(folder) + L"\\RightClickManager";
+    if (create)
+        CreateDirectoryW(path.c_str(), NULL);
+    return path + L"\\" + fileName;
+}
+
 class RightClickManager
 {
 private:
-    std::vector<AppEntry> apps;
     std::vector<AppEntry> allApps; // Store all apps for filtering
+    std::shared_ptr<StringPool> appStrings; // Strings of allApps - replaced along with it by a reload
+    AppIndex appIndex;             // Key name -> position in allApps
+    ListViewModel listView;        // Rows of the virtual list box, over allApps
+    RegistryBackend &registry;     // All registry access goes through here
+    ShellKeyEnumerator shellEnumerator; // Reusable single-pass shell key reader (I/O worker only)
+    ShellKeyTracker keyTracker;         // Last write time of every loaded verb (I/O worker only)
+    MenuHistory history;                // Undo/redo of removes, adds and moves (I/O worker only)
+    Win32JournalFile journalFile;
+    RegistryJournal journal;            // Write-ahead record of every transaction (I/O worker only)
+    Win32FileProbe fileProbe;
+    HealthChecker healthChecker;        // Program and icon file checks, answers cached (I/O worker only)
+    MenuScope menuScope;                // Menu the window manages - the desktop's
+    std::wstring shellPath;             // Shell key of menuScope, fixed after construction
+    Win32RegistryChangeSource shellChangeSource;
+    RegistryWatcher shellWatcher;       // Posts WM_APP_REGISTRY_CHANGED on external changes
+    bool registrySyncDeferred;          // A change arrived while editing
+    RegistryWorker ioWorker;            // Runs registry reads and writes off the UI thread
+    Win32IconSource iconSource;
+    IconCache iconCache;                // Row icons by (path, index, size, DPI), saved across runs
+    RegistryWorker iconWorker;          // Extracts icons, so registry I/O never waits behind them
+    HIMAGELIST hIconList;               // One image per atlas slot of iconCache
+    std::vector<IconKey> iconQueue;     // Icons painted but not resolved, for the next job
+    std::unordered_set<IconKey, IconKeyHash, IconKeyEqual> iconQueued; // Queued or being resolved
+    bool iconJobPosted;
+    int iconSize;                       // Pixels, scaled for the screen DPI
+    Win32ShellNotifier shellNotifier;
+    ShellNotifyScheduler shellNotify;   // One SHChangeNotify per burst of changes
+    int pendingWrites;                  // Writes posted whose completion hasn't run yet
+    std::size_t undoSteps;              // Depth of history as of the last write
+    std::size_t redoSteps;
+    bool reloadReport;                  // Show totals when the next reload completes
     HWND hMainWindow;
     HWND hListBox;
     HWND hAddButton;
@@ -62,7 +170,11 @@ private:
     int editingIndex;     // Index of item being edited
     WNDPROC oldEditProc;  // Original edit box procedure
     HMENU hContextMenu;   // Context menu handle
+    HMENU hGroupMenu;     // "Move into Group" submenu, refilled each time the menu opens
+    HACCEL hAccelerators; // Ctrl+Z / Ctrl+Y
+    std::vector<std::wstring> groupMenuKeys; // Group key behind each submenu command
     int contextMenuIndex; // Index of context menu item
+    int screenDpi;        // Read once at startup
 
     static LRESULT CALLBACK EditBoxProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     {
@@ -101,65 +213,49 @@ private:
         return DefWindowProc(hwnd, uMsg, wParam, lParam);
     }
 
+    // Item shown at a list index
+    AppEntry &VisibleApp(int index)
+    {
+        return allApps[listView.Position(index)];
+    }
+
     // Sort by registry key name (maintain actual order in registry)
     void SortAppsByRegistryKeyName()
     {
-        std::sort(allApps.begin(), allApps.end(), [](const AppEntry &a, const AppEntry &b)
-                  {
-                  // Sort by registry key name, maintain original registry order
-                  return _wcsicmp(a.name.c_str(), b.name.c_str()) < 0; });
+        std::sort(allApps.begin(), allApps.end(), AppKeyNameLess);
+        appIndex.Rebuild(allApps);
+    }
+
+    // Path of a verb key below HKEY_CLASSES_ROOT
+    std::wstring ItemKeyPath(std::wstring_view keyName) const
+    {
+        std::wstring keyPath = shellPath + L"\\";
+        keyPath += keyName;
+        return keyPath;
     }
 
     // Refresh single item display name from registry
     void RefreshSingleItemFromRegistry(const std::wstring &itemName)
     {
-        // Find corresponding item in allApps
-        for (auto &app : allApps)
+        // Find corresponding item in allApps; the list is refiltered from it below
+        int index = appIndex.Find(itemName);
+        if (index >= 0)
         {
-            if (app.name == itemName)
-            {
-                // Re-read display name from registry
-                std::wstring displayPath = L"Directory\\Background\\shell\\";
-                displayPath += itemName;
-
-                HKEY hDisplayKey;
-                if (RegOpenKeyExW(HKEY_CLASSES_ROOT, displayPath.c_str(), 0, KEY_READ, &hDisplayKey) == ERROR_SUCCESS)
-                {
-                    wchar_t displayName[256];
-                    DWORD nameSize = sizeof(displayName);
-                    if (RegQueryValueExW(hDisplayKey, NULL, NULL, NULL, (LPBYTE)displayName, &nameSize) == ERROR_SUCCESS)
-                    {
-                        // Update display name in memory
-                        app.displayName = displayName;
-                    }
-                    RegCloseKey(hDisplayKey);
-                }
-                break;
-            }
-        }
+            // Re-read display name from registry
+            std::wstring displayPath = ItemKeyPath(itemName);
 
-        // Also update corresponding item in apps
-        for (auto &app : apps)
-        {
-            if (app.name == itemName)
+            RegKey hDisplayKey;
+            if (registry.OpenKey(kRegClassesRoot, displayPath.c_str(), false, &hDisplayKey) == RegOk)
             {
-                // Re-read display name from registry
-                std::wstring displayPath = L"Directory\\Background\\shell\\";
-                displayPath += itemName;
-
-                HKEY hDisplayKey;
-                if (RegOpenKeyExW(HKEY_CLASSES_ROOT, displayPath.c_str(), 0, KEY_READ, &hDisplayKey) == ERROR_SUCCESS)
+                RegistryValueReader reader(registry);
+                std::wstring_view displayName;
+                if (reader.Read(hDisplayKey, DisplayNameValue(allApps[index]), displayName))
                 {
-                    wchar_t displayName[256];
-                    DWORD nameSize = sizeof(displayName);
-                    if (RegQueryValueExW(hDisplayKey, NULL, NULL, NULL, (LPBYTE)displayName, &nameSize) == ERROR_SUCCESS)
-                    {
-                        // Update display name in memory
-                        app.displayName = displayName;
-                    }
-                    RegCloseKey(hDisplayKey);
+                    // Update display name in memory
+                    allApps[index].displayName = appStrings->Intern(displayName);
+                    listView.Invalidate(itemName);
                 }
-                break;
+                registry.CloseKey(hDisplayKey);
             }
         }
 
@@ -167,309 +263,835 @@ private:
         FilterApps();
     }
 
-    // System built-in right-click menu items blacklist
-    std::vector<std::wstring> systemItems = {
-        L"New",
-        L"View",
-        L"SortBy",
-        L"Paste",
-        L"PasteShortcut",
-        L"DesktopBackground",
-        L"Settings",
-        L"Display",
-        L"GraphicsProperties",
-        L"NvDriverUpdate",
-        L"Share",
-        L"GrantAccess",
-        L"PinToQuickAccess",
-        L"IncludeInLibrary",
-        L"Properties",
-        L"Open",
-        L"OpenInNewWindow",
-        L"Print",
-        L"ScanWithMicrosoftDefender"};
-
 private:
-    // Generate registry key name - simplified version, no auto-sorting
-    std::wstring GenerateRegistryKey(const std::wstring &displayName)
+    // Move registry item - implement actual order change by renaming registry keys.
+    // The outcome is reported once the renames complete; false if the move isn't possible.
+    bool MoveRegistryItem(int fromIndex, int toIndex, const wchar_t *successMessage, const wchar_t *failureMessage)
     {
-        // Use timestamp for uniqueness, avoid auto-sorting
-        static int counter = 0;
-        counter++;
-
-        wchar_t keyName[256];
-        swprintf(keyName, 256, L"CustomApp_%s_%d", displayName.c_str(), counter);
-        return keyName;
-    }
-
-    // Move registry item - implement actual order change by renaming registry keys
-    bool MoveRegistryItem(int fromIndex, int toIndex)
-    {
-        if (fromIndex < 0 || toIndex < 0 || fromIndex >= (int)apps.size() || toIndex >= (int)apps.size())
+        if (fromIndex < 0 || toIndex < 0 || fromIndex >= (int)listView.RowCount() || toIndex >= (int)listView.RowCount())
             return false;
 
-        AppEntry &fromApp = apps[fromIndex];
-        AppEntry &toApp = apps[toIndex];
+        AppEntry &fromApp = VisibleApp(fromIndex);
+        AppEntry &toApp = VisibleApp(toIndex);
 
-        // Only allow moving custom apps
-        if (!fromApp.isCustom || !toApp.isCustom)
+        // Only allow moving custom apps, and only at the top level
+        if (!fromApp.isCustom || !toApp.isCustom || fromApp.depth > 0 || toApp.depth > 0)
             return false;
+        std::wstring movedKey = fromApp.name.str();
 
         // Swap positions in list
-        std::swap(apps[fromIndex], apps[toIndex]);
+        listView.SwapRows(fromIndex, toIndex);
 
-        // Update registry order - by renaming registry keys
-        if (!UpdateRegistryOrder())
+        // Plan the smallest set of renames that makes the key order match the list order
+        std::vector<KeyRename> renames;
+        if (!PlanOrderRenames(allApps, listView.Rows(), renames))
         {
-            // If registry update fails, restore memory order
-            std::swap(apps[fromIndex], apps[toIndex]);
+            // Restore memory order
+            listView.SwapRows(fromIndex, toIndex);
             return false;
         }
+        for (const auto &rename : renames)
+        {
+            if (CompareRegistryNames(rename.from, movedKey) == 0)
+                movedKey = rename.to;
+        }
 
-        // Update list display
+        // Show the new order right away; if the renames fail it is refiltered from allApps
         UpdateListBoxDisplay();
+        SendMessageW(hListBox, LB_SETCURSEL, toIndex, 0);
+
+        UpdateRegistryOrder(
+            renames,
+            [this, movedKey, successMessage, failureMessage](long result)
+            {
+                if (result != RegOk)
+                {
+                    FilterApps();
+                    MessageBoxW(hMainWindow, failureMessage, L"Error", MB_OK | MB_ICONERROR);
+                    return;
+                }
+
+                // Keep the moved item selected
+                int row = FindAppIndex(movedKey);
+                if (row >= 0)
+                    SendMessageW(hListBox, LB_SETCURSEL, row, 0);
+                MessageBoxW(hMainWindow, successMessage, L"Success", MB_OK | MB_ICONINFORMATION);
+            });
         return true;
     }
 
-    // Update registry order - recreate all custom items' registry keys to ensure correct order
-    bool UpdateRegistryOrder()
+    // Update registry order - rename only the custom items whose sort key must change
+    void UpdateRegistryOrder(const std::vector<KeyRename> &renames, std::function<void(long)> done)
     {
-        // Collect all custom apps
-        std::vector<AppEntry> customApps;
-        for (const auto &app : apps)
-        {
-            if (app.isCustom)
+        PostWrite(
+            [this, renames]() -> long
             {
-                customApps.push_back(app);
-            }
+                if (renames.empty())
+                    return RegOk;
+
+                // Renaming copies the whole verb subtree, so values this program doesn't manage survive.
+                // If any rename fails, the ones already done are renamed back.
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                transaction.Rename(L"", renames);
+                long result = transaction.Commit();
+                if (result == RegOk)
+                    history.RecordRenames(renames);
+                return result;
+            },
+            done);
+    }
+
+    // Run a registry write on the I/O worker. When it completes, the list is patched with
+    // whatever changed and then done(result) runs on the UI thread.
+    void PostWrite(std::function<long()> write, std::function<void(long)> done)
+    {
+        pendingWrites++;
+        ioWorker.Post(
+            RegistryWorker::JobWrite,
+            [this, write, done](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                // Read back what the write changed in the same job, so the list is never behind it
+                long result = write();
+                std::size_t undo = history.UndoSteps(), redo = history.RedoSteps();
+                std::shared_ptr<ShellSync> sync = std::make_shared<ShellSync>();
+                ReadShellChanges(*sync);
+                return [this, result, undo, redo, sync, done]()
+                {
+                    pendingWrites--;
+                    undoSteps = undo;
+                    redoSteps = redo;
+                    ApplySync(*sync);
+                    done(result);
+                };
+            });
+    }
+
+    // Writes are planned from the list, so let the previous one land before planning another
+    bool WritePending()
+    {
+        if (pendingWrites == 0)
+            return false;
+        MessageBeep(MB_ICONWARNING);
+        return true;
+    }
+
+    // Commit callback for registry transactions - the scheduler folds a burst of them into one broadcast
+    void NotifyShellChange()
+    {
+        // Refresh system to make registry changes take effect
+        shellNotify.Request();
+    }
+
+    // Journal for registry transactions; NULL if its file couldn't be opened - writes still work then,
+    // just without recovery after a crash
+    RegistryJournal *Journal()
+    {
+        return journalFile.IsOpen() ? &journal : NULL;
+    }
+
+    // Put back whatever a previous run left half written, before the menu is read
+    void RecoverInterruptedWrites()
+    {
+        if (!journalFile.Open(LocalDataPath(L"registry.journal", true)))
+            return;
+
+        JournalRecoveryStats stats;
+        long result = RecoverRegistryJournal(registry, journal, RecoverRollBack, &stats);
+        if (stats.interrupted == 0)
+            return;
+        NotifyShellChange();
+
+        wchar_t message[512];
+        if (result == RegOk)
+        {
+            swprintf(message, 512,
+                     L"The program was closed in the middle of changing the context menu.\n\n"
+                     L"%d unfinished change(s) were undone, so the menu is as it was before them.",
+                     (int)stats.interrupted);
+            MessageBoxW(hMainWindow, message, L"Unfinished Changes Undone", MB_OK | MB_ICONINFORMATION);
         }
+        else
+        {
+            swprintf(message, 512,
+                     L"The program was closed in the middle of changing the context menu, and the unfinished change "
+                     L"could not be undone. Error code: %d\n\n"
+                     L"It will be tried again at the next start. Please run as administrator.",
+                     (int)result);
+            MessageBoxW(hMainWindow, message, L"Error", MB_OK | MB_ICONERROR);
+        }
+    }
 
-        // Recreate registry keys for each custom app (in new order)
-        int position = 1;
-        for (const auto &app : customApps)
+    // Find the list index of an item by registry key name, -1 if not shown
+    int FindAppIndex(const std::wstring &keyName)
+    {
+        int index = appIndex.Find(keyName);
+        return index >= 0 ? listView.FindRow(index) : -1;
+    }
+
+    // Update list box display - the list box only holds the row count and asks for text when painting
+    void UpdateListBoxDisplay()
+    {
+        SendMessageW(hListBox, LB_SETCOUNT, listView.RowCount(), 0);
+        InvalidateRect(hListBox, NULL, TRUE);
+
+        // Set horizontal scroll range
+        UpdateHorizontalScroll();
+    }
+
+    // Paint one row of the virtual list box
+    void DrawListItem(const DRAWITEMSTRUCT *item)
+    {
+        if (item->itemID == (UINT)-1)
+            return;
+
+        bool selected = (item->itemState & ODS_SELECTED) != 0;
+        FillRect(item->hDC, &item->rcItem, GetSysColorBrush(selected ? COLOR_HIGHLIGHT : COLOR_WINDOW));
+
+        if (item->itemID < listView.RowCount())
         {
-            // Generate new registry key name (with order number)
-            wchar_t newKeyName[256];
-            swprintf(newKeyName, 256, L"%02d_CustomApp_%s", position, app.displayName.c_str());
+            const std::wstring &listText = listView.RowText(item->itemID);
+            HFONT hOldFont = hModernFont ? (HFONT)SelectObject(item->hDC, hModernFont) : NULL;
+            SetBkMode(item->hDC, TRANSPARENT);
+            SetTextColor(item->hDC, GetSysColor(selected ? COLOR_HIGHLIGHTTEXT : COLOR_WINDOWTEXT));
 
-            // Skip if name hasn't changed
-            if (app.name == newKeyName)
-            {
-                position++;
-                continue;
-            }
+            RECT textRect = item->rcItem;
+            textRect.left += IconColumnWidth();
+            DrawRowIcon(item->hDC, VisibleApp(item->itemID), item->rcItem);
+            DrawTextW(item->hDC, listText.c_str(), (int)listText.length(), &textRect,
+                      DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX);
+            if (hOldFont)
+                SelectObject(item->hDC, hOldFont);
+        }
 
-            // Create new registry key
-            std::wstring newShellKey = L"Directory\\Background\\shell\\";
-            newShellKey += newKeyName;
+        if (item->itemState & ODS_FOCUS)
+            DrawFocusRect(item->hDC, &item->rcItem);
+    }
 
-            HKEY hNewKey;
-            if (RegCreateKeyExW(HKEY_CLASSES_ROOT, newShellKey.c_str(), 0, NULL, 0, KEY_ALL_ACCESS, NULL, &hNewKey, NULL) == ERROR_SUCCESS)
-            {
-                // Copy display name
-                RegSetValueExW(hNewKey, NULL, 0, REG_SZ,
-                               (const BYTE *)app.displayName.c_str(),
-                               (app.displayName.length() + 1) * sizeof(wchar_t));
+    // Space before the row text: the icon and a gap on either side
+    int IconColumnWidth() const
+    {
+        return iconSize + (int)(6 * (screenDpi / 96.0f));
+    }
 
-                // Copy icon
-                if (!app.icon.empty())
-                {
-                    RegSetValueExW(hNewKey, L"Icon", 0, REG_SZ,
-                                   (const BYTE *)app.icon.c_str(),
-                                   (app.icon.length() + 1) * sizeof(wchar_t));
-                }
+    // The icon a row shows: its Icon value, else the first icon of its program
+    bool RowIconKey(const AppEntry &app, IconKey &key) const
+    {
+        int index = 0;
+        std::wstring_view file = SplitIconLocation(app.icon, &index);
+        if (file.empty())
+        {
+            file = app.path;
+            index = 0;
+        }
+        if (file.empty())
+            return false;
+        key.path.assign(file.data(), file.length());
+        key.index = index;
+        key.size = iconSize;
+        key.dpi = screenDpi;
+        return true;
+    }
 
-                RegCloseKey(hNewKey);
+    // Draw a row's icon from the cache; one that isn't there (or is left from the last run) is
+    // queued for the icon worker and shows up when it has been extracted
+    void DrawRowIcon(HDC hdc, const AppEntry &app, const RECT &rowRect)
+    {
+        IconKey key;
+        if (!hIconList || !RowIconKey(app, key))
+            return;
 
-                // Create command subkey
-                std::wstring newCommandKey = newShellKey + L"\\command";
-                if (RegCreateKeyExW(HKEY_CLASSES_ROOT, newCommandKey.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hNewKey, NULL) == ERROR_SUCCESS)
-                {
-                    std::wstring commandValue = L"\"";
-                    commandValue += app.path;
-                    commandValue += L"\"";
-
-                    RegSetValueExW(hNewKey, NULL, 0, REG_SZ,
-                                   (const BYTE *)commandValue.c_str(),
-                                   (commandValue.length() + 1) * sizeof(wchar_t));
-                    RegCloseKey(hNewKey);
-
-                    // Delete old registry key
-                    std::wstring oldShellKey = L"Directory\\Background\\shell\\";
-                    oldShellKey += app.name;
-                    DeleteRegistryTree(HKEY_CLASSES_ROOT, oldShellKey.c_str());
-                }
-                else
+        bool stale = false;
+        int slot = iconCache.Find(key, &stale);
+        if (slot >= 0 && slot < ImageList_GetImageCount(hIconList))
+        {
+            int top = rowRect.top + (rowRect.bottom - rowRect.top - iconSize) / 2;
+            ImageList_Draw(hIconList, slot, hdc, rowRect.left + (int)(2 * (screenDpi / 96.0f)), top, ILD_TRANSPARENT);
+        }
+        if (slot == kIconUnknown || stale)
+            QueueIcon(key);
+    }
+
+    void QueueIcon(const IconKey &key)
+    {
+        if (!iconQueued.insert(key).second)
+            return;
+        iconQueue.push_back(key);
+        if (!iconJobPosted)
+            PostIconJob();
+    }
+
+    // Resolve the queued icons on the icon worker - one job at a time, so icons painted while it
+    // runs are batched into the next
+    void PostIconJob()
+    {
+        std::shared_ptr<std::vector<IconKey>> keys = std::make_shared<std::vector<IconKey>>();
+        keys->swap(iconQueue);
+        iconJobPosted = true;
+        iconWorker.Post(
+            RegistryWorker::JobCheck,
+            [this, keys](const std::atomic<bool> &cancelled) -> RegistryWorker::Completion
+            {
+                std::shared_ptr<std::vector<int>> changed = std::make_shared<std::vector<int>>();
+                iconCache.Resolve(iconSource, *keys, *changed, &cancelled);
+                return [this, keys, changed]()
                 {
-                    // Failed to create command, delete shell key
-                    RegDeleteKeyW(HKEY_CLASSES_ROOT, newShellKey.c_str());
-                    return false;
-                }
-            }
+                    iconJobPosted = false;
+                    for (const auto &key : *keys)
+                        iconQueued.erase(key);
+                    UpdateIconList(*changed);
+                    if (!iconQueue.empty())
+                        PostIconJob();
+                };
+            });
+    }
+
+    // Copy changed atlas slots into the image list, whose indexes are the slot numbers
+    void UpdateIconList(const std::vector<int> &slots)
+    {
+        IconBitmap bitmap;
+        for (int slot : slots)
+        {
+            if (!iconCache.Bitmap(slot, bitmap))
+                continue;
+            HBITMAP image = CreateIconImage(bitmap, iconSize);
+            if (!image)
+                continue;
+            int count = ImageList_GetImageCount(hIconList);
+            if (slot < count)
+                ImageList_Replace(hIconList, slot, image, NULL);
             else
             {
-                return false;
+                // Slots fill in any order; images in a gap are replaced when their slot arrives
+                for (; count <= slot; count++)
+                    ImageList_Add(hIconList, image, NULL);
             }
+            DeleteObject(image);
+        }
+        if (!slots.empty())
+            InvalidateRect(hListBox, NULL, FALSE);
+    }
 
-            position++;
+    // A size x size 32-bit DIB of bitmap, cropped or padded with transparency if it differs
+    static HBITMAP CreateIconImage(const IconBitmap &bitmap, int size)
+    {
+        BITMAPINFO header = {};
+        header.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        header.bmiHeader.biWidth = size;
+        header.bmiHeader.biHeight = -size; // Top row first, as IconBitmap stores it
+        header.bmiHeader.biPlanes = 1;
+        header.bmiHeader.biBitCount = 32;
+        header.bmiHeader.biCompression = BI_RGB;
+        void *bits = NULL;
+        HBITMAP image = CreateDIBSection(NULL, &header, DIB_RGB_COLORS, &bits, NULL, 0);
+        if (!image || !bits)
+            return image;
+
+        std::uint32_t *pixels = (std::uint32_t *)bits;
+        for (int y = 0; y < size; y++)
+        {
+            for (int x = 0; x < size; x++)
+            {
+                bool inside = x < bitmap.width && y < bitmap.height;
+                pixels[y * size + x] = inside ? bitmap.pixels[(std::size_t)y * bitmap.width + x] : 0;
+            }
         }
+        return image;
+    }
 
-        // Refresh system
-        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
-        // Force reload from registry to ensure memory data matches registry
-        ForceReloadFromRegistry();
+    // Write data to path through a temporary file, so a crash never leaves half a file behind
+    static bool WriteLocalDataFile(const std::wstring &path, const std::vector<std::uint8_t> &data)
+    {
+        std::wstring temporary = path + L".tmp";
+        HANDLE hFile = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+        DWORD written = 0;
+        bool saved = WriteFile(hFile, data.data(), (DWORD)data.size(), &written, NULL) && written == data.size();
+        CloseHandle(hFile);
+        if (!saved || !MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            DeleteFileW(temporary.c_str());
+            return false;
+        }
         return true;
     }
 
-    // Update list box display
-    void UpdateListBoxDisplay()
+    // Load the icons the last run saved, on the icon worker ahead of any extraction. A missing or
+    // unreadable file just means every icon is extracted again.
+    void LoadIconCache()
     {
-        SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
-        for (const auto &app : apps)
+        iconWorker.Post(
+            RegistryWorker::JobCheck,
+            [this](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                std::wstring path = LocalDataPath(L"icons.cache", false);
+                HANDLE hFile = path.empty() ? INVALID_HANDLE_VALUE
+                                            : CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                                          FILE_ATTRIBUTE_NORMAL, NULL);
+                if (hFile == INVALID_HANDLE_VALUE)
+                    return RegistryWorker::Completion();
+
+                std::vector<std::uint8_t> data;
+                LARGE_INTEGER size;
+                DWORD bytesRead = 0;
+                bool read = GetFileSizeEx(hFile, &size) && size.QuadPart > 0 && size.QuadPart < (64 << 20);
+                if (read)
+                {
+                    data.resize((std::size_t)size.QuadPart);
+                    read = ReadFile(hFile, data.data(), (DWORD)data.size(), &bytesRead, NULL) && bytesRead == data.size();
+                }
+                CloseHandle(hFile);
+
+                std::shared_ptr<std::vector<int>> slots = std::make_shared<std::vector<int>>();
+                if (!read || !iconCache.Load(data.data(), data.size(), *slots))
+                    return RegistryWorker::Completion();
+                return [this, slots]()
+                { UpdateIconList(*slots); };
+            });
+    }
+
+    // Save the cache for the next run - with the icon worker stopped
+    void SaveIconCache()
+    {
+        std::wstring path = LocalDataPath(L"icons.cache", true);
+        if (path.empty())
+            return;
+        std::vector<std::uint8_t> data;
+        iconCache.Save(data);
+        WriteLocalDataFile(path, data);
+    }
+
+    // Fill the list from the snapshot the last run saved, mapped rather than read, and validate it
+    // against the registry on the I/O worker: the tracker gets the saved key times and a sync
+    // pass reads whatever changed since. False if there is no usable snapshot.
+    bool LoadMenuSnapshot()
+    {
+        std::wstring path = LocalDataPath(L"menu.snapshot", false);
+        HANDLE hFile = path.empty() ? INVALID_HANDLE_VALUE
+                                    : CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                                  FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+
+        std::shared_ptr<MenuSnapshot> snapshot = std::make_shared<MenuSnapshot>();
+        bool read = false;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0 && size.QuadPart < (256 << 20))
         {
-            std::wstring listText = GetDisplayText(app);
-            SendMessageW(hListBox, LB_ADDSTRING, 0, (LPARAM)listText.c_str());
+            HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (hMapping)
+            {
+                const std::uint8_t *view = (const std::uint8_t *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+                if (view)
+                {
+                    read = ReadMenuSnapshot(view, (std::size_t)size.QuadPart, *snapshot);
+                    UnmapViewOfFile(view);
+                }
+                CloseHandle(hMapping);
+            }
         }
+        CloseHandle(hFile);
+        if (!read || CompareRegistryNames(snapshot->shellPath, shellPath) != 0)
+            return false;
 
-        // Set horizontal scroll range
-        UpdateHorizontalScroll();
+        allApps.swap(snapshot->entries);
+        appStrings = std::make_shared<StringPool>(std::move(snapshot->strings));
+        listView.InvalidateAll();
+        SortAppsByRegistryKeyName();
+        FilterApps();
+
+        bool posted = ioWorker.Post(
+            RegistryWorker::JobSync,
+            [this, snapshot](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                keyTracker.Clear();
+                for (const auto &stamp : snapshot->stamps)
+                    keyTracker.Record(stamp.keyName, stamp.lastWriteTime);
+                std::shared_ptr<ShellSync> sync = std::make_shared<ShellSync>();
+                ReadShellChanges(*sync);
+                return [this, sync]()
+                {
+                    // ApplySync checks re-read items; an unchanged snapshot still needs its first check
+                    bool checked = !sync->opened || !sync->changed.empty() || !sync->added.empty();
+                    ApplySync(*sync);
+                    if (!checked)
+                        CheckItemHealth(false, false);
+                };
+            });
+        if (!posted)
+            ForceReloadFromRegistry(); // The tracker was never seeded
+        return true;
+    }
+
+    // Save the list for the next start - with the I/O worker stopped, and only if it had nothing in
+    // flight: otherwise the tracker may have seen changes the list doesn't show, and the snapshot
+    // would hide them from the next start
+    void SaveMenuSnapshot()
+    {
+        std::wstring path = LocalDataPath(L"menu.snapshot", true);
+        if (path.empty())
+            return;
+        std::vector<std::uint8_t> data;
+        WriteMenuSnapshot(shellPath, allApps, keyTracker, data);
+        WriteLocalDataFile(path, data);
     }
 
-    // Update horizontal scroll range
+    // Update horizontal scroll range - only rows added or changed since the last pass are measured
     void UpdateHorizontalScroll()
     {
-        if (!apps.empty())
+        ListTextMeasurer measurer(hListBox, hModernFont, screenDpi);
+        listView.UpdateWidths(measurer);
+
+        if (!listView.Empty())
         {
-            HDC hdc = GetDC(hListBox);
-            if (hdc)
-            {
-                int maxWidth = 0;
-                HFONT hOldFont = (HFONT)SelectObject(hdc, hModernFont);
+            int horizontalExtent = listView.MaxWidth() + (int)(100 * (screenDpi / 96.0f));
+            SendMessage(hListBox, LB_SETHORIZONTALEXTENT, horizontalExtent, 0);
+        }
+    }
 
-                for (const auto &app : apps)
-                {
-                    std::wstring listText = GetDisplayText(app);
-                    SIZE size;
-                    if (GetTextExtentPoint32W(hdc, listText.c_str(), (int)listText.length(), &size))
-                    {
-                        if (size.cx > maxWidth)
-                        {
-                            maxWidth = size.cx;
-                        }
-                    }
-                }
+    // What a sync pass read on the I/O worker, applied to allApps on the UI thread
+    struct ShellSync
+    {
+        bool opened;                   // False: shell key unavailable, needs a full reload
+        ShellKeyChanges changes;
+        std::vector<AppEntry> changed; // Re-read entries of changes.changed
+        std::vector<AppEntry> added;   // Entries of changes.added
+        StringPool strings;            // Strings of changed and added, re-interned into appStrings
+    };
+
+    // I/O worker: read every non-system verb into entries and strings, stopping early once cancelled
+    void ReadAllFromRegistry(std::vector<AppEntry> &entries, StringPool &strings, const std::atomic<bool> &cancelled)
+    {
+        keyTracker.Clear();
 
-                SelectObject(hdc, hOldFont);
-                ReleaseDC(hListBox, hdc);
+        shellEnumerator.EnumerateTree(
+            kRegClassesRoot, shellPath.c_str(),
+            [this, &cancelled](const wchar_t *keyName)
+            {
+                // Skip system items without opening them - and everything once a newer reload is waiting
+                return cancelled || IsSystemItem(keyName);
+            },
+            [this, &entries, &strings](const ShellEntry &entry)
+            {
+                entries.push_back(MakeAppEntry(entry, strings));
+                if (entry.depth == 0)
+                    keyTracker.Record(entry.keyName, entry.lastWriteTime); // Groups stand for their members
+            });
+    }
 
-                // Calculate DPI scaling
-                HDC hdcWindow = GetDC(hMainWindow);
-                int dpiX = GetDeviceCaps(hdcWindow, LOGPIXELSX);
-                ReleaseDC(hMainWindow, hdcWindow);
-                float scale = dpiX / 96.0f;
+    // I/O worker: find the verbs whose keys changed since the last read and read just those,
+    // with all members of the groups among them
+    void ReadShellChanges(ShellSync &sync)
+    {
+        sync.opened = keyTracker.Diff(
+            registry, kRegClassesRoot, shellPath.c_str(),
+            [this](const wchar_t *keyName)
+            { return IsSystemItem(keyName); },
+            sync.changes);
+        if (!sync.opened || sync.changes.Empty())
+            return;
 
-                int horizontalExtent = maxWidth + (int)(100 * scale);
-                SendMessage(hListBox, LB_SETHORIZONTALEXTENT, horizontalExtent, 0);
+        ScopedRegKey shellKey(registry);
+        if (registry.OpenKey(kRegClassesRoot, shellPath.c_str(), false, shellKey.Receive()) != RegOk)
+            return;
+
+        auto skip = [this](const wchar_t *keyName)
+        { return IsSystemItem(keyName); };
+        for (const auto &keyName : sync.changes.changed)
+        {
+            // A changed group's members are dropped and come back as added
+            shellEnumerator.ReadTree(
+                shellKey.Get(), keyName.c_str(), skip,
+                [&sync](const ShellEntry &entry)
+                { (entry.depth == 0 ? sync.changed : sync.added).push_back(MakeAppEntry(entry, sync.strings)); });
+        }
+        for (const auto &keyName : sync.changes.added)
+        {
+            if (!shellEnumerator.ReadTree(
+                    shellKey.Get(), keyName.c_str(), skip,
+                    [&sync](const ShellEntry &entry)
+                    { sync.added.push_back(MakeAppEntry(entry, sync.strings)); }))
+            {
+                // Gone again already, let the next pass report it
+                keyTracker.Forget(keyName);
             }
         }
     }
 
-    // Force reload all menu items from registry
-    void ForceReloadFromRegistry()
+    // I/O worker: let the change tracker see a change below a top-level group (see StageTouchGroup)
+    void TouchGroup(std::wstring_view keyName)
+    {
+        if (keyName.find(L'\\') == std::wstring_view::npos)
+            return;
+        ScopedRegKey groupKey(registry);
+        if (registry.OpenKey(kRegClassesRoot, ItemKeyPath(TopKeyName(keyName)).c_str(), true, groupKey.Receive()) == RegOk)
+            SetStringValue(registry, groupKey.Get(), L"SubCommands", L"");
+    }
+
+    // Patch allApps in place with what a sync pass read
+    void ApplySync(const ShellSync &sync)
     {
-        // Clear existing data
-        allApps.clear();
-        apps.clear();
+        if (!sync.opened)
+        {
+            // Shell key unavailable, fall back to a full rebuild
+            ForceReloadFromRegistry();
+            return;
+        }
 
-        // Reset list box
-        SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
+        if (sync.changes.Empty())
+            return;
 
-        // Reload directly from registry
-        HKEY hKey;
-        if (RegOpenKeyExW(HKEY_CLASSES_ROOT, L"Directory\\Background\\shell", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+        // Update changed items where they are, while positions in the index are still current
+        for (const auto &app : sync.changed)
         {
-            wchar_t subkeyName[256];
-            DWORD index = 0;
-            DWORD nameSize = sizeof(subkeyName) / sizeof(wchar_t);
+            int index = appIndex.Find(app.name);
+            if (index >= 0)
+                allApps[index] = InternAppEntry(app, *appStrings);
+        }
+        for (const auto &keyName : sync.changes.changed)
+            listView.Invalidate(keyName);
 
-            while (RegEnumKeyExW(hKey, index, subkeyName, &nameSize, NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
+        // Drop removed items, and the members of removed or re-read groups, in one pass
+        bool dropped = false;
+        if (!sync.changes.removed.empty() || !sync.changes.changed.empty())
+        {
+            std::vector<bool> removed(allApps.size(), false);
+            std::unordered_set<std::wstring, RegistryNameHash, RegistryNameEqual> groups(
+                sync.changes.changed.begin(), sync.changes.changed.end());
+            for (const auto &keyName : sync.changes.removed)
+            {
+                int index = appIndex.Find(keyName);
+                if (index >= 0)
+                    removed[index] = true;
+                listView.Invalidate(keyName);
+                groups.insert(keyName);
+            }
+            for (size_t i = 0; i < allApps.size(); i++)
             {
-                // Skip system items
-                if (!IsSystemItem(subkeyName))
+                if (allApps[i].depth > 0 && groups.count(TopKeyName(allApps[i].name)))
                 {
-                    AppEntry app;
-                    app.name = subkeyName;
-                    // Modified custom app identification logic
-                    app.isCustom = (wcsstr(subkeyName, L"CustomApp_") != nullptr);
+                    removed[i] = true;
+                    listView.Invalidate(allApps[i].name);
+                }
+            }
+            size_t kept = 0;
+            for (size_t i = 0; i < allApps.size(); i++)
+            {
+                if (removed[i])
+                    continue;
+                if (kept != i)
+                    allApps[kept] = std::move(allApps[i]);
+                kept++;
+            }
+            dropped = kept != allApps.size();
+            allApps.resize(kept);
+        }
 
-                    // Get display name
-                    std::wstring displayPath = L"Directory\\Background\\shell\\";
-                    displayPath += subkeyName;
+        // Insert new items at their sorted position
+        for (const auto &app : sync.added)
+        {
+            allApps.insert(std::upper_bound(allApps.begin(), allApps.end(), app, AppKeyNameLess),
+                           InternAppEntry(app, *appStrings));
+            listView.Invalidate(app.name);
+        }
 
-                    HKEY hDisplayKey;
-                    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, displayPath.c_str(), 0, KEY_READ, &hDisplayKey) == ERROR_SUCCESS)
-                    {
-                        wchar_t displayName[256];
-                        DWORD nameSize = sizeof(displayName);
-                        if (RegQueryValueExW(hDisplayKey, NULL, NULL, NULL, (LPBYTE)displayName, &nameSize) == ERROR_SUCCESS)
-                        {
-                            app.displayName = displayName;
-                        }
-                        else
-                        {
-                            app.displayName = subkeyName;
-                        }
+        // Positions shifted - re-index once for the whole batch
+        if (dropped || !sync.added.empty())
+            appIndex.Rebuild(allApps);
 
-                        // Get icon
-                        wchar_t iconPath[1024];
-                        DWORD iconSize = sizeof(iconPath);
-                        if (RegQueryValueExW(hDisplayKey, L"Icon", NULL, NULL, (LPBYTE)iconPath, &iconSize) == ERROR_SUCCESS)
-                        {
-                            app.icon = iconPath;
-                        }
+        FilterApps();
 
-                        RegCloseKey(hDisplayKey);
-                    }
-                    else
-                    {
-                        app.displayName = subkeyName;
-                    }
+        // Re-read items come back unchecked
+        if (!sync.changed.empty() || !sync.added.empty())
+            CheckItemHealth(false, false);
+    }
 
-                    // Get program path
-                    std::wstring commandPath = displayPath + L"\\command";
-                    HKEY hCommandKey;
-                    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, commandPath.c_str(), 0, KEY_READ, &hCommandKey) == ERROR_SUCCESS)
-                    {
-                        wchar_t appPath[1024];
-                        DWORD pathSize = sizeof(appPath);
-                        if (RegQueryValueExW(hCommandKey, NULL, NULL, NULL, (LPBYTE)appPath, &pathSize) == ERROR_SUCCESS)
-                        {
-                            app.path = appPath;
-                            CleanAppPath(app.path);
-                        }
-                        RegCloseKey(hCommandKey);
-                    }
+    // Re-read only the verbs whose keys changed since the last read; the list is patched when the read completes
+    void SyncFromRegistry()
+    {
+        ioWorker.Post(
+            RegistryWorker::JobSync,
+            [this](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                std::shared_ptr<ShellSync> sync = std::make_shared<ShellSync>();
+                ReadShellChanges(*sync);
+                return [this, sync]()
+                { ApplySync(*sync); };
+            });
+    }
 
-                    allApps.push_back(app);
-                }
-                index++;
-                nameSize = sizeof(subkeyName) / sizeof(wchar_t);
-            }
-            RegCloseKey(hKey);
-        }
+    // Force reload all menu items from registry; the list is replaced when the read completes.
+    // Back-to-back requests collapse into one read, and a read already running is abandoned.
+    void ForceReloadFromRegistry()
+    {
+        ioWorker.Post(
+            RegistryWorker::JobReload,
+            [this](const std::atomic<bool> &cancelled) -> RegistryWorker::Completion
+            {
+                // A fresh pool per read: the old list's strings go in one go when it is replaced
+                std::shared_ptr<std::vector<AppEntry>> entries = std::make_shared<std::vector<AppEntry>>();
+                std::shared_ptr<StringPool> strings = std::make_shared<StringPool>();
+                ReadAllFromRegistry(*entries, *strings, cancelled);
+                if (cancelled)
+                    return nullptr;
+                return [this, entries, strings]()
+                { ApplyReload(*entries, strings); };
+            });
+    }
+
+    // Replace allApps with a full read, whose strings are in strings
+    void ApplyReload(std::vector<AppEntry> &entries, const std::shared_ptr<StringPool> &strings)
+    {
+        allApps.swap(entries);
+        appStrings = strings;
+        listView.InvalidateAll();
 
         // Re-sort and filter app list
         SortAppsByRegistryKeyName();
         FilterApps();
+
+        // A reload the user asked for looks at the files again too
+        CheckItemHealth(reloadReport, false);
+
+        if (reloadReport)
+        {
+            reloadReport = false;
+
+            // Show result statistics
+            wchar_t resultMsg[256];
+            swprintf(resultMsg, 256, L"Refresh complete!\nFound %d total menu items\n%d created by this program",
+                     (int)allApps.size(),
+                     (int)std::count_if(allApps.begin(), allApps.end(), [](const AppEntry &app)
+                                        { return app.isCustom; }));
+
+            MessageBoxW(hMainWindow, resultMsg, L"Refresh Complete", MB_OK | MB_ICONINFORMATION);
+        }
+    }
+
+    // Check every item's program and icon file on the I/O worker and mark the broken ones.
+    // fresh drops the cached answers first; report shows the outcome and offers to remove
+    // the broken items created by this program.
+    void CheckItemHealth(bool fresh, bool report)
+    {
+        // The copy shares allApps' strings, so it keeps their pool alive until it is applied
+        std::shared_ptr<std::vector<AppEntry>> entries = std::make_shared<std::vector<AppEntry>>(allApps);
+        std::shared_ptr<StringPool> strings = appStrings;
+        ioWorker.Post(
+            RegistryWorker::JobCheck,
+            [this, entries, strings, fresh, report](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                if (fresh)
+                    healthChecker.Forget();
+                std::shared_ptr<std::vector<unsigned>> health = std::make_shared<std::vector<unsigned>>();
+                healthChecker.Check(*entries, *health);
+                return [this, entries, strings, health, report]()
+                { ApplyHealth(*entries, *health, report); };
+            });
+    }
+
+    // Mark the items a health check found broken; items changed since it was posted are left alone
+    void ApplyHealth(const std::vector<AppEntry> &checked, const std::vector<unsigned> &health, bool report)
+    {
+        bool marked = false;
+        for (size_t i = 0; i < checked.size(); i++)
+        {
+            int index = appIndex.Find(checked[i].name);
+            if (index < 0 || allApps[index].path != checked[i].path || allApps[index].icon != checked[i].icon)
+                continue;
+            if (allApps[index].health != health[i])
+            {
+                allApps[index].health = health[i];
+                listView.Invalidate(checked[i].name);
+                marked = true;
+            }
+        }
+        if (marked)
+            FilterApps();
+        if (!report)
+            return;
+
+        // Only items created by this program are offered for removal; others are just marked
+        std::vector<std::wstring> removals;
+        int broken = 0;
+        for (const auto &app : allApps)
+        {
+            if (app.health == HealthOk)
+                continue;
+            broken++;
+            if (app.isCustom)
+                removals.push_back(app.name.str()); // Never a group - groups have no files to check
+        }
+        if (broken == 0)
+        {
+            MessageBoxW(hMainWindow, L"No broken items found - every program and icon file exists.", L"Check Complete", MB_OK | MB_ICONINFORMATION);
+            return;
+        }
+
+        wchar_t message[512];
+        if (removals.empty())
+        {
+            swprintf(message, 512, L"Found %d items whose program or icon file is missing (marked ⚠).\n"
+                                   L"None of them was created by this program; remove them one by one if they are no longer needed.",
+                     broken);
+            MessageBoxW(hMainWindow, message, L"Check Complete", MB_OK | MB_ICONWARNING);
+            return;
+        }
+        swprintf(message, 512, L"Found %d items whose program or icon file is missing (marked ⚠).\n\n"
+                               L"Remove the %d of them created by this program?",
+                 broken, (int)removals.size());
+        if (MessageBoxW(hMainWindow, message, L"Check Complete", MB_YESNO | MB_ICONWARNING) == IDYES && !WritePending())
+            RemoveBrokenItems(removals);
+    }
+
+    // Delete items in one transaction - all of them or, if one fails, none
+    void RemoveBrokenItems(const std::vector<std::wstring> &keyNames)
+    {
+        PostWrite(
+            [this, keyNames]() -> long
+            {
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                for (const auto &keyName : keyNames)
+                {
+                    transaction.DeleteTree(keyName);
+                    StageTouchGroup(transaction, keyName);
+                }
+                return transaction.Commit();
+            },
+            [this, keyNames](long result)
+            {
+                if (result != RegOk)
+                {
+                    MessageBoxW(hMainWindow, L"Failed to remove broken items! Please run as administrator.", L"Error", MB_OK | MB_ICONERROR);
+                    return;
+                }
+                wchar_t message[128];
+                swprintf(message, 128, L"Removed %d broken items.", (int)keyNames.size());
+                MessageBoxW(hMainWindow, message, L"Success", MB_OK | MB_ICONINFORMATION);
+            });
     }
 
 public:
-    RightClickManager() : hMainWindow(NULL), hListBox(NULL), hAddButton(NULL),
+    explicit RightClickManager(RegistryBackend &backend)
+        : appStrings(std::make_shared<StringPool>()), listView(allApps, appIndex), registry(backend), shellEnumerator(backend), history(backend), journal(journalFile), healthChecker(fileProbe),
+          menuScope(MakeMenuScope(ScopeDesktop)), shellPath(menuScope.ShellPath()),
+          shellChangeSource(HKEY_CLASSES_ROOT, shellPath.c_str()),
+          shellWatcher(shellChangeSource, [this]()
+                       { PostMessageW(hMainWindow, WM_APP_REGISTRY_CHANGED, 0, 0); }),
+          registrySyncDeferred(false),
+          ioWorker([this]()
+                   { PostMessageW(hMainWindow, WM_APP_WORKER_DONE, 0, 0); }),
+          iconWorker([this]()
+                     { PostMessageW(hMainWindow, WM_APP_WORKER_DONE, 0, 0); }),
+          hIconList(NULL), iconJobPosted(false), iconSize(16),
+          shellNotify(shellNotifier),
+          pendingWrites(0), undoSteps(0), redoSteps(0), reloadReport(false), hMainWindow(NULL), hListBox(NULL), hAddButton(NULL),
                           hRemoveButton(NULL), hRefreshButton(NULL), hShowAllCheckbox(NULL),
                           hMoveUpButton(NULL), hMoveDownButton(NULL),
                           hEditBox(NULL), hMutex(NULL), showAllItems(false), isEditing(false),
                           hModernFont(NULL), editingIndex(-1), oldEditProc(NULL),
-                          hContextMenu(NULL), contextMenuIndex(-1) {}
+                          hContextMenu(NULL), hGroupMenu(NULL), hAccelerators(NULL), contextMenuIndex(-1), screenDpi(96) {}
 
     ~RightClickManager()
     {
@@ -485,8 +1107,19 @@ public:
         }
         if (hContextMenu)
         {
-            DestroyMenu(hContextMenu);
+            DestroyMenu(hContextMenu); // Destroys the group submenu too
             hContextMenu = NULL;
+            hGroupMenu = NULL;
+        }
+        if (hIconList)
+        {
+            ImageList_Destroy(hIconList);
+            hIconList = NULL;
+        }
+        if (hAccelerators)
+        {
+            DestroyAcceleratorTable(hAccelerators);
+            hAccelerators = NULL;
         }
     }
 
@@ -499,13 +1132,53 @@ public:
             AppendMenuW(hContextMenu, MF_STRING, 1101, L"📁 Open in Registry");
             AppendMenuW(hContextMenu, MF_SEPARATOR, 0, NULL);
             AppendMenuW(hContextMenu, MF_STRING, 1102, L"🔄 Refresh This Item");
+            AppendMenuW(hContextMenu, MF_STRING, 1106, L"🩺 Check for Broken Items");
+            AppendMenuW(hContextMenu, MF_SEPARATOR, 0, NULL);
+            AppendMenuW(hContextMenu, MF_STRING, 1103, L"📂 New Group");
+            hGroupMenu = CreatePopupMenu();
+            if (hGroupMenu)
+                AppendMenuW(hContextMenu, MF_POPUP, (UINT_PTR)hGroupMenu, L"➡ Move into Group");
+            AppendMenuW(hContextMenu, MF_STRING, 1104, L"⬅ Move out of Group");
+            AppendMenuW(hContextMenu, MF_STRING, 1105, L"🧺 Flatten Group");
+            AppendMenuW(hContextMenu, MF_SEPARATOR, 0, NULL);
+            AppendMenuW(hContextMenu, MF_STRING, 1107, L"↩ Undo\tCtrl+Z");
+            AppendMenuW(hContextMenu, MF_STRING, 1108, L"↪ Redo\tCtrl+Y");
+        }
+    }
+
+    // Fill the "Move into Group" submenu with every group the item at index can go into
+    void UpdateGroupMenu(int index)
+    {
+        while (GetMenuItemCount(hGroupMenu) > 0)
+            DeleteMenu(hGroupMenu, 0, MF_BYPOSITION);
+        groupMenuKeys.clear();
+
+        const AppEntry &app = VisibleApp(index);
+        for (const auto &group : allApps)
+        {
+            if (!group.isGroup || groupMenuKeys.size() >= 100)
+                continue;
+            // Not into itself, its own members or the group it is already in
+            if (CompareRegistryNames(group.name, app.name) == 0 || IsInGroup(group.name, app.name) ||
+                CompareRegistryNames(group.name, ParentGroupPath(app.name)) == 0)
+                continue;
+
+            std::wstring text(group.depth * 4, L' ');
+            text += group.displayName;
+            AppendMenuW(hGroupMenu, MF_STRING, 1200 + groupMenuKeys.size(), text.c_str());
+            groupMenuKeys.push_back(group.name.str());
         }
+        if (groupMenuKeys.empty())
+            AppendMenuW(hGroupMenu, MF_STRING | MF_GRAYED, 0, L"(No other groups)");
+
+        EnableMenuItem(hContextMenu, 1104, MF_BYCOMMAND | (app.depth > 0 ? MF_ENABLED : MF_GRAYED));
+        EnableMenuItem(hContextMenu, 1105, MF_BYCOMMAND | (app.isGroup ? MF_ENABLED : MF_GRAYED));
     }
 
     // Show context menu
     void ShowContextMenu(int x, int y, int index)
     {
-        if (index < 0 || index >= (int)apps.size())
+        if (index < 0 || index >= (int)listView.RowCount())
             return;
 
         contextMenuIndex = index;
@@ -517,6 +1190,11 @@ public:
 
         if (hContextMenu)
         {
+            if (hGroupMenu)
+                UpdateGroupMenu(index);
+            EnableMenuItem(hContextMenu, 1107, MF_BYCOMMAND | (undoSteps > 0 ? MF_ENABLED : MF_GRAYED));
+            EnableMenuItem(hContextMenu, 1108, MF_BYCOMMAND | (redoSteps > 0 ? MF_ENABLED : MF_GRAYED));
+
             // Get list item rectangle position
             RECT itemRect;
             if (SendMessageW(hListBox, LB_GETITEMRECT, index, (LPARAM)&itemRect) != LB_ERR)
@@ -549,13 +1227,13 @@ public:
     // Open registry location
     void OpenRegistryLocation(int index)
     {
-        if (index < 0 || index >= (int)apps.size())
+        if (index < 0 || index >= (int)listView.RowCount())
             return;
 
-        AppEntry &app = apps[index];
+        AppEntry &app = VisibleApp(index);
 
         // Build registry path
-        std::wstring regPath = L"Computer\\HKEY_CLASSES_ROOT\\Directory\\Background\\shell\\" + app.name;
+        std::wstring regPath = L"Computer\\HKEY_CLASSES_ROOT\\" + ItemKeyPath(app.name);
 
         // Try to open Registry Editor using ShellExecute
         SHELLEXECUTEINFOW sei = {sizeof(sei)};
@@ -690,15 +1368,15 @@ public:
     // Handle list box double-click event
     void OnListBoxDoubleClick()
     {
-        if (isEditing)
-            return; // Ignore double-click if editing
+        if (isEditing || WritePending())
+            return; // Ignore double-click if editing or a change is still being written
 
         int selectedIndex = (int)SendMessageW(hListBox, LB_GETCURSEL, 0, 0);
         if (selectedIndex == LB_ERR)
             return;
 
         // Only allow renaming items created by this program
-        if (selectedIndex >= 0 && selectedIndex < (int)apps.size() && apps[selectedIndex].isCustom)
+        if (selectedIndex >= 0 && selectedIndex < (int)listView.RowCount() && VisibleApp(selectedIndex).isCustom)
         {
             StartEditing(selectedIndex);
         }
@@ -722,12 +1400,12 @@ public:
         SendMessageW(hListBox, LB_GETITEMRECT, index, (LPARAM)&itemRect);
 
         // Adjust edit box position, avoid icon area
-        itemRect.left += 30; // Leave space for icon
+        itemRect.left += IconColumnWidth(); // Leave space for icon
 
         // Create edit box
         hEditBox = CreateWindowW(
             L"EDIT",
-            apps[index].displayName.c_str(),
+            VisibleApp(index).displayName.c_str(),
             WS_CHILD | WS_VISIBLE | ES_AUTOHSCROLL | WS_BORDER,
             itemRect.left, itemRect.top,
             itemRect.right - itemRect.left - 5, itemRect.bottom - itemRect.top,
@@ -756,42 +1434,50 @@ public:
 
         if (saveChanges && hEditBox)
         {
-            // Get new name from edit box
-            wchar_t newName[256];
-            GetWindowTextW(hEditBox, newName, 256);
+            // Get new name from edit box, however long it is
+            std::vector<wchar_t> text(GetWindowTextLengthW(hEditBox) + 1, L'\0');
+            GetWindowTextW(hEditBox, text.data(), (int)text.size());
+            std::wstring newName = text.data();
 
-            if (wcslen(newName) > 0)
+            if (!newName.empty())
             {
-                AppEntry &app = apps[editingIndex];
-                std::wstring oldDisplayName = app.displayName;
-
-                // Check if name actually changed
-                if (lstrcmpiW(oldDisplayName.c_str(), newName) != 0)
-                {
-                    // Update display name in registry
-                    std::wstring shellKey = L"Directory\\Background\\shell\\";
-                    shellKey += app.name;
-
-                    HKEY hKey;
-                    // Use RegCreateKeyExW with KEY_ALL_ACCESS permission
-                    if (RegCreateKeyExW(HKEY_CLASSES_ROOT, shellKey.c_str(), 0, NULL,
-                                        REG_OPTION_NON_VOLATILE, KEY_ALL_ACCESS, NULL, &hKey, NULL) == ERROR_SUCCESS)
-                    {
-                        RegSetValueExW(hKey, NULL, 0, REG_SZ, (const BYTE *)newName, (wcslen(newName) + 1) * sizeof(wchar_t));
-                        RegCloseKey(hKey);
-
-                        // Refresh system
-                        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
+                AppEntry &app = VisibleApp(editingIndex);
+                std::wstring oldDisplayName = app.displayName.str();
 
-                        // Re-read display name directly from registry for this item to ensure data sync
-                        RefreshSingleItemFromRegistry(app.name);
+                // Check if name actually changed
+                if (lstrcmpiW(oldDisplayName.c_str(), newName.c_str()) != 0)
+                {
+                    // Update display name in registry (groups keep theirs in MUIVerb)
+                    std::wstring shellKey = ItemKeyPath(app.name);
+
+                    std::wstring displayName = newName;
+                    std::wstring keyName = app.name.str();
+                    const wchar_t *valueName = DisplayNameValue(app);
+                    PostWrite(
+                        [this, shellKey, displayName, keyName, valueName]() -> long
+                        {
+                            RegKey hKey;
+                            // Backend CreateKey opens with full access
+                            long result = registry.CreateKey(kRegClassesRoot, shellKey.c_str(), &hKey);
+                            if (result == RegOk)
+                            {
+                                result = SetStringValue(registry, hKey, valueName, displayName);
+                                registry.CloseKey(hKey);
+                                TouchGroup(keyName);
 
-                        MessageBoxW(hMainWindow, L"Rename successful!", L"Success", MB_OK | MB_ICONINFORMATION);
-                    }
-                    else
-                    {
-                        MessageBoxW(hMainWindow, L"Rename failed! Please run as administrator.", L"Error", MB_OK | MB_ICONERROR);
-                    }
+                                // Refresh system
+                                NotifyShellChange();
+                            }
+                            return result;
+                        },
+                        [this](long result)
+                        {
+                            // The renamed item was re-read with the rest of the write's changes
+                            if (result == RegOk)
+                                MessageBoxW(hMainWindow, L"Rename successful!", L"Success", MB_OK | MB_ICONINFORMATION);
+                            else
+                                MessageBoxW(hMainWindow, L"Rename failed! Please run as administrator.", L"Error", MB_OK | MB_ICONERROR);
+                        });
                 }
                 else
                 {
@@ -816,6 +1502,13 @@ public:
         editingIndex = -1;
         isEditing = false;
         SetFocus(hListBox);
+
+        // Apply registry changes that arrived during editing
+        if (registrySyncDeferred)
+        {
+            registrySyncDeferred = false;
+            SyncFromRegistry();
+        }
     }
 
     // Cancel editing
@@ -874,6 +1567,7 @@ public:
         int dpiX = GetDeviceCaps(hdc, LOGPIXELSX);
         ReleaseDC(NULL, hdc);
         float scale = dpiX / 96.0f;
+        screenDpi = dpiX;
 
         // Create main window
         WNDCLASSEXW wc = {};
@@ -919,10 +1613,28 @@ public:
         }
 
         CreateControls(hInstance);
-        LoadAllContextMenuItems();
+
+        // Ctrl+Shift+Z redoes too
+        ACCEL accelerators[] = {
+            {FVIRTKEY | FCONTROL, 'Z', 1107},
+            {FVIRTKEY | FCONTROL, 'Y', 1108},
+            {FVIRTKEY | FCONTROL | FSHIFT, 'Z', 1108},
+        };
+        hAccelerators = CreateAcceleratorTableW(accelerators, 3);
+
+        ioWorker.Start();
+        iconWorker.Start();
+        LoadIconCache();
+        shellNotify.Start();
+        RecoverInterruptedWrites();
+        if (!LoadMenuSnapshot())
+            LoadAllContextMenuItems();
         ShowWindow(hMainWindow, SW_SHOW);
         UpdateWindow(hMainWindow);
 
+        // Watch for changes made by us or anyone else
+        shellWatcher.Start();
+
         return true;
     }
 
@@ -950,7 +1662,7 @@ public:
             WS_EX_CLIENTEDGE,
             L"LISTBOX",
             L"",
-            WS_CHILD | WS_VISIBLE | LBS_NOTIFY | LBS_HASSTRINGS |
+            WS_CHILD | WS_VISIBLE | LBS_NOTIFY | LBS_OWNERDRAWFIXED | LBS_NODATA |
                 WS_VSCROLL | WS_HSCROLL | LBS_NOINTEGRALHEIGHT | LBS_DISABLENOSCROLL, // Add LBS_DISABLENOSCROLL to ensure scroll bars always available
             margin, margin,
             listBoxWidth, listBoxHeight,
@@ -963,6 +1675,10 @@ public:
         int itemHeight = (int)(24 * scale); // Slightly increase item height for better readability
         SendMessage(hListBox, LB_SETITEMHEIGHT, 0, itemHeight);
 
+        // Row icons - images are added as the icon worker extracts them
+        iconSize = (int)(16 * scale);
+        hIconList = ImageList_Create(iconSize, iconSize, ILC_COLOR32, 16, 16);
+
         // Add button
         hAddButton = CreateWindowW(
             L"BUTTON",
@@ -1068,34 +1784,10 @@ public:
         SendMessage(hShowAllCheckbox, BM_SETCHECK, showAllItems ? BST_CHECKED : BST_UNCHECKED, 0);
     }
 
-    std::wstring GetDisplayText(const AppEntry &app, int maxDisplayLength = 100)
-    {
-        std::wstring baseText = app.isCustom ? L"✅ " : L"📌 ";
-        baseText += app.displayName + L" - " + app.path;
-
-        // Truncate if text is too long (this is just for display, full content can still be viewed via scrolling)
-        if (baseText.length() > maxDisplayLength)
-        {
-            // Preserve important information at beginning and end
-            std::wstring shortened = baseText.substr(0, maxDisplayLength - 10) + L"..." +
-                                     baseText.substr(baseText.length() - 7);
-            return shortened;
-        }
-
-        return baseText;
-    }
-
     // Check if system item
     bool IsSystemItem(const std::wstring &itemName)
     {
-        for (const auto &systemItem : systemItems)
-        {
-            if (itemName == systemItem)
-            {
-                return true;
-            }
-        }
-        return false;
+        return IsSystemVerb(itemName.c_str());
     }
 
     // Load all context menu items
@@ -1108,89 +1800,8 @@ public:
             CancelEditing();
         }
 
-        // Clear existing data
-        allApps.clear();
-        apps.clear();
-        SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
-
-        // Check desktop context menu registry location
-        HKEY hKey;
-        if (RegOpenKeyExW(HKEY_CLASSES_ROOT, L"Directory\\Background\\shell", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
-        {
-            wchar_t subkeyName[256];
-            DWORD index = 0;
-            DWORD nameSize = sizeof(subkeyName) / sizeof(wchar_t);
-
-            while (RegEnumKeyExW(hKey, index, subkeyName, &nameSize, NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
-            {
-                // Skip system items
-                if (!IsSystemItem(subkeyName))
-                {
-                    AppEntry app;
-                    app.name = subkeyName;
-                    app.isCustom = (wcsstr(subkeyName, L"CustomApp_") != nullptr);
-
-                    // Get display name
-                    std::wstring displayPath = L"Directory\\Background\\shell\\";
-                    displayPath += subkeyName;
-
-                    HKEY hDisplayKey;
-                    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, displayPath.c_str(), 0, KEY_READ, &hDisplayKey) == ERROR_SUCCESS)
-                    {
-                        wchar_t displayName[256];
-                        DWORD nameSize = sizeof(displayName);
-                        if (RegQueryValueExW(hDisplayKey, NULL, NULL, NULL, (LPBYTE)displayName, &nameSize) == ERROR_SUCCESS)
-                        {
-                            app.displayName = displayName;
-                        }
-                        else
-                        {
-                            app.displayName = subkeyName; // Use registry key name if no display name
-                        }
-
-                        // Get icon
-                        wchar_t iconPath[1024];
-                        DWORD iconSize = sizeof(iconPath);
-                        if (RegQueryValueExW(hDisplayKey, L"Icon", NULL, NULL, (LPBYTE)iconPath, &iconSize) == ERROR_SUCCESS)
-                        {
-                            app.icon = iconPath;
-                        }
-
-                        RegCloseKey(hDisplayKey);
-                    }
-                    else
-                    {
-                        app.displayName = subkeyName;
-                    }
-
-                    // Get program path
-                    std::wstring commandPath = displayPath + L"\\command";
-                    HKEY hCommandKey;
-                    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, commandPath.c_str(), 0, KEY_READ, &hCommandKey) == ERROR_SUCCESS)
-                    {
-                        wchar_t appPath[1024];
-                        DWORD pathSize = sizeof(appPath);
-                        if (RegQueryValueExW(hCommandKey, NULL, NULL, NULL, (LPBYTE)appPath, &pathSize) == ERROR_SUCCESS)
-                        {
-                            app.path = appPath;
-                            CleanAppPath(app.path);
-                        }
-                        RegCloseKey(hCommandKey);
-                    }
-
-                    allApps.push_back(app);
-                }
-                index++;
-                nameSize = sizeof(subkeyName) / sizeof(wchar_t);
-            }
-            RegCloseKey(hKey);
-        }
-
-        // Sort by display name alphabetically
-        SortAppsByRegistryKeyName();
-
-        // Filter app list based on display settings
-        FilterApps();
+        // Read desktop context menu registry location - the list fills in when the read completes
+        ForceReloadFromRegistry();
     }
 
     // Filter app list based on display settings
@@ -1202,20 +1813,10 @@ public:
             CancelEditing();
         }
 
-        apps.clear();
-        SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
-
-        for (const auto &app : allApps)
-        {
-            if (showAllItems || app.isCustom)
-            {
-                apps.push_back(app);
-
-                // Use optimized display text
-                std::wstring listText = GetDisplayText(app);
-                SendMessageW(hListBox, LB_ADDSTRING, 0, (LPARAM)listText.c_str());
-            }
-        }
+        // Only the row count goes to the list box; row text is formatted when first painted
+        listView.Filter(showAllItems);
+        SendMessageW(hListBox, LB_SETCOUNT, listView.RowCount(), 0);
+        InvalidateRect(hListBox, NULL, TRUE);
 
         // Set horizontal scroll range so long text can be scrolled to view
         UpdateHorizontalScroll();
@@ -1236,135 +1837,90 @@ public:
 
         // If number of items exceeds visible area, vertical scroll bar will automatically display
         // We can select first item to give user visual feedback
-        if (!apps.empty())
+        if (!listView.Empty())
         {
             SendMessageW(hListBox, LB_SETCURSEL, 0, 0);
         }
     }
 
-    // Clean app path
-    void CleanAppPath(std::wstring &path)
-    {
-        // Remove quotes
-        if (path.length() >= 2 && path[0] == L'\"' && path[path.length() - 1] == L'\"')
-        {
-            path = path.substr(1, path.length() - 2);
-        }
-        // Remove parameters
-        size_t pos = path.find(L".exe");
-        if (pos != std::wstring::npos)
-        {
-            path = path.substr(0, pos + 4);
-        }
-    }
-
-    // Add app to desktop context menu
+    // Add app to desktop context menu - the outcome is reported once the write completes.
+    // False if appPath has no file name to show.
     bool AddAppToContextMenu(const std::wstring &appPath)
     {
         // Get program name
-        size_t lastSlash = appPath.find_last_of(L'\\');
-        size_t lastDot = appPath.find_last_of(L'.');
-        if (lastSlash == std::wstring::npos)
+        std::wstring appName;
+        if (!AppNameFromPath(appPath, appName))
             return false;
 
-        std::wstring appName = appPath.substr(lastSlash + 1);
-        if (lastDot != std::wstring::npos && lastDot > lastSlash)
-        {
-            appName = appPath.substr(lastSlash + 1, lastDot - lastSlash - 1);
-        }
-
-        // Generate registry key name - simplified version, no auto-sorting
-        std::wstring registryKey = GenerateRegistryKey(appName);
-
-        // Create registry key
-        std::wstring shellKey = L"Directory\\Background\\shell\\";
-        shellKey += registryKey;
+        // Generate registry key name - appended after the last custom item
+        std::wstring registryKey = GenerateCustomKeyName(appIndex, appName);
 
-        HKEY hKey;
-        LONG result = RegCreateKeyExW(HKEY_CLASSES_ROOT, shellKey.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hKey, NULL);
-        if (result == ERROR_SUCCESS)
-        {
-            // Set display name
-            result = RegSetValueExW(hKey, NULL, 0, REG_SZ, (const BYTE *)appName.c_str(), (appName.length() + 1) * sizeof(wchar_t));
-            if (result != ERROR_SUCCESS)
+        std::shared_ptr<int> failedStep = std::make_shared<int>(-1);
+        PostWrite(
+            [this, registryKey, appPath, appName, failedStep]() -> long
             {
-                // Add error information
-                wchar_t errorMsg[256];
-                swprintf(errorMsg, 256, L"Failed to set display name! Error code: %d", result);
-                MessageBoxW(hMainWindow, errorMsg, L"Error", MB_OK | MB_ICONERROR);
-                RegCloseKey(hKey);
-                return false;
-            }
-
-            // Set icon
-            std::wstring iconValue = L"\"";
-            iconValue += appPath;
-            iconValue += L"\"";
-
-            RegSetValueExW(hKey, L"Icon", 0, REG_SZ, (const BYTE *)iconValue.c_str(), (iconValue.length() + 1) * sizeof(wchar_t));
-
-            RegCloseKey(hKey);
-        }
-        else
-        {
-            // Add error information
-            wchar_t errorMsg[256];
-            swprintf(errorMsg, 256, L"Failed to create registry key! Error code: %d", result);
-            MessageBoxW(hMainWindow, errorMsg, L"Error", MB_OK | MB_ICONERROR);
-            return false;
-        }
-
-        // Create command subkey
-        std::wstring commandKey = shellKey + L"\\command";
-        if (RegCreateKeyExW(HKEY_CLASSES_ROOT, commandKey.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hKey, NULL) == ERROR_SUCCESS)
-        {
-            std::wstring commandValue = L"\"";
-            commandValue += appPath;
-            commandValue += L"\"";
-
-            result = RegSetValueExW(hKey, NULL, 0, REG_SZ, (const BYTE *)commandValue.c_str(), (commandValue.length() + 1) * sizeof(wchar_t));
-            RegCloseKey(hKey);
-
-            if (result == ERROR_SUCCESS)
+                // Stage the whole item, so a failure part way leaves no half-created key behind
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                StageAddApp(transaction, registryKey, appPath, appName);
+
+                long result = transaction.Commit();
+                *failedStep = transaction.FailedOperation();
+                if (result == RegOk)
+                    history.RecordCreate(registryKey);
+                return result;
+            },
+            [this, failedStep](long result)
             {
-                // Refresh system to make registry changes take effect immediately
-                SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
+                if (result == RegOk)
+                {
+                    MessageBoxW(hMainWindow,
+                                L"Program successfully added to desktop context menu!\n"
+                                L"Program icon will also display in menu.\n"
+                                L"May need to refresh desktop or restart Explorer to see changes.",
+                                L"Success", MB_OK | MB_ICONINFORMATION);
+                    return;
+                }
+
+                // Add error information for the step that failed
+                const wchar_t *errorFormat = L"Failed to create registry key! Error code: %d";
+                switch (*failedStep)
+                {
+                case AddStepDisplayName:
+                    errorFormat = L"Failed to set display name! Error code: %d";
+                    break;
+                case AddStepIcon:
+                    errorFormat = L"Failed to set icon! Error code: %d";
+                    break;
+                case AddStepCreateCommand:
+                    errorFormat = L"Failed to create command subkey! Error code: %d";
+                    break;
+                case AddStepCommand:
+                    errorFormat = L"Failed to set command! Error code: %d";
+                    break;
+                }
 
-                // Reload all menu items
-                LoadAllContextMenuItems();
-                return true;
-            }
-            else
-            {
-                // Add error information
                 wchar_t errorMsg[256];
-                swprintf(errorMsg, 256, L"Failed to set command! Error code: %d", result);
+                swprintf(errorMsg, 256, errorFormat, result);
                 MessageBoxW(hMainWindow, errorMsg, L"Error", MB_OK | MB_ICONERROR);
-            }
-        }
-        else
-        {
-            // Add error information
-            wchar_t errorMsg[256];
-            swprintf(errorMsg, 256, L"Failed to create command subkey! Error code: %d", GetLastError());
-            MessageBoxW(hMainWindow, errorMsg, L"Error", MB_OK | MB_ICONERROR);
-        }
-
-        return false;
+                MessageBoxW(hMainWindow, L"Failed to add program! Please run as administrator.", L"Error", MB_OK | MB_ICONERROR);
+            });
+        return true;
     }
 
-    // Remove app from context menu
+    // Remove app from context menu - the outcome is reported once the delete completes.
+    // False if nothing was deleted (no such row, or the warning was declined).
     bool RemoveAppFromContextMenu(int index)
     {
-        if (index < 0 || index >= (int)apps.size())
+        if (index < 0 || index >= (int)listView.RowCount())
             return false;
 
-        AppEntry &app = apps[index];
+        AppEntry &app = VisibleApp(index);
 
         // Save item information to be deleted
-        std::wstring deleteName = app.name;
-        std::wstring deleteDisplayName = app.displayName;
-        std::wstring deletePath = app.path;
+        std::wstring deleteName = app.name.str();
+        std::wstring deleteDisplayName = app.displayName.str();
+        std::wstring deletePath = app.path.str();
 
         // Show extra warning for items not created by this program
         if (!app.isCustom)
@@ -1380,101 +1936,240 @@ public:
             }
         }
 
-        std::wstring shellKey = L"Directory\\Background\\shell\\";
-        shellKey += app.name;
+        std::wstring shellKey = ItemKeyPath(deleteName); // app may have been patched while the warning was shown
 
-        // First try normal deletion
-        bool deleteSuccess = DeleteRegistryTree(HKEY_CLASSES_ROOT, shellKey.c_str());
+        PostWrite(
+            [this, shellKey, deleteName]() -> long
+            {
+                // Keep what the key holds, so the delete can be undone
+                std::shared_ptr<KeySnapshot> tree = std::make_shared<KeySnapshot>();
+                ScopedRegKey key(registry);
+                bool captured = registry.OpenKey(kRegClassesRoot, shellKey.c_str(), false, key.Receive()) == RegOk &&
+                                CaptureKeyTree(registry, key.Get(), *tree) == RegOk;
+                key.Reset();
+
+                // First try normal deletion - a group goes with all its members. Journaled when possible,
+                // so a delete cut short is put back at the next start instead of leaving half a verb
+                long result = RegWriteFault;
+                if (Journal())
+                {
+                    RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), nullptr, Journal());
+                    transaction.DeleteTree(deleteName);
+                    result = transaction.Commit();
+                }
+                if (result != RegOk)
+                    result = DeleteRegistryTree(kRegClassesRoot, shellKey.c_str());
+                if (result == RegOk)
+                {
+                    TouchGroup(deleteName);
+                    if (captured)
+                        history.RecordDelete(deleteName, tree);
 
-        if (!deleteSuccess)
-        {
-            // If normal deletion fails, show detailed error information
-            DWORD errorCode = GetLastError();
-            wchar_t errorMsg[512];
-            swprintf(errorMsg, 512,
-                     L"Deletion failed! Error code: %d\n\n"
-                     L"Possible reasons:\n"
-                     L"• Registry key occupied by another process\n"
-                     L"• Insufficient permissions\n"
-                     L"• Registry key does not exist\n\n"
-                     L"Please try running as administrator or restart and try again.",
-                     errorCode);
+                    // Refresh system
+                    NotifyShellChange();
+                }
+                return result;
+            },
+            [this](long result)
+            {
+                if (result != RegOk)
+                {
+                    // If normal deletion fails, show detailed error information
+                    wchar_t errorMsg[512];
+                    swprintf(errorMsg, 512,
+                             L"Deletion failed! Error code: %d\n\n"
+                             L"Possible reasons:\n"
+                             L"• Registry key occupied by another process\n"
+                             L"• Insufficient permissions\n"
+                             L"• Registry key does not exist\n\n"
+                             L"Please try running as administrator or restart and try again.",
+                             (int)result);
+
+                    MessageBoxW(hMainWindow, errorMsg, L"Deletion Failed", MB_OK | MB_ICONERROR);
+                    MessageBoxW(hMainWindow, L"Failed to remove program!", L"Error", MB_OK | MB_ICONERROR);
+                    return;
+                }
 
-            MessageBoxW(hMainWindow, errorMsg, L"Deletion Failed", MB_OK | MB_ICONERROR);
-            return false;
+                // Show success message
+                MessageBoxW(hMainWindow,
+                            L"Program removed from desktop context menu!\n"
+                            L"If menu item still displays, try refreshing desktop (F5) or restarting Explorer.",
+                            L"Deletion Successful", MB_OK | MB_ICONINFORMATION);
+                MessageBoxW(hMainWindow, L"Program removed from desktop context menu!", L"Success", MB_OK | MB_ICONINFORMATION);
+            });
+
+        return true;
+    }
+
+    // Registry tree deletion method - RegOk if the key is gone, else the failing status
+    long DeleteRegistryTree(RegKey hParentKey, const wchar_t *subkey)
+    {
+        // First try the backend's whole-tree delete (SHDeleteKeyW on Windows), it's more reliable
+        long result = registry.DeleteTree(hParentKey, subkey);
+        if (result != RegOk && result != RegNotFound)
+        {
+            // If whole-tree delete fails, fall back to deleting key by key, children first
+            result = DeleteKeyTree(registry, hParentKey, subkey);
         }
 
-        // Refresh system
-        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
+        // If key doesn't exist, consider deletion successful
+        return result == RegNotFound ? RegOk : result;
+    }
 
-        // Reload directly from registry
-        ForceReloadFromRegistry();
+    // Add an empty cascading group at the top level and start editing its name
+    void CreateMenuGroup()
+    {
+        if (isEditing || WritePending())
+            return;
 
-        // Show success message
-        MessageBoxW(hMainWindow,
-                    L"Program removed from desktop context menu!\n"
-                    L"If menu item still displays, try refreshing desktop (F5) or restarting Explorer.",
-                    L"Deletion Successful", MB_OK | MB_ICONINFORMATION);
+        std::wstring groupKey = GenerateCustomKeyName(appIndex, L"New Group");
+        PostWrite(
+            [this, groupKey]() -> long
+            {
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                StageCreateGroup(transaction, L"", groupKey, L"New Group");
+                return transaction.Commit();
+            },
+            [this, groupKey](long result)
+            {
+                if (result != RegOk)
+                {
+                    MessageBoxW(hMainWindow, L"Failed to create group! Please run as administrator.", L"Error", MB_OK | MB_ICONERROR);
+                    return;
+                }
 
-        return true;
+                int row = FindAppIndex(groupKey);
+                if (row >= 0)
+                {
+                    SendMessageW(hListBox, LB_SETCURSEL, row, 0);
+                    StartEditing(row);
+                }
+            });
     }
 
-    // Improved recursive registry tree deletion method
-    bool DeleteRegistryTree(HKEY hParentKey, const wchar_t *subkey)
+    // Move the item at index, with its members if it is a group, into group ("" for the top level).
+    // Key names are kept, so the group must not already hold an item with the same key name.
+    void MoveIntoGroup(int index, const std::wstring &group)
     {
-        // First try using SHDeleteKeyW, it's more reliable
-        LONG result = SHDeleteKeyW(hParentKey, subkey);
-        if (result == ERROR_SUCCESS || result == ERROR_FILE_NOT_FOUND)
-        {
-            return true;
-        }
+        if (isEditing || WritePending())
+            return;
 
-        // If SHDeleteKeyW fails, fall back to manual deletion
-        HKEY hKey;
-        result = RegOpenKeyExW(hParentKey, subkey, 0, KEY_READ | KEY_WRITE, &hKey);
+        int position = appIndex.Find(VisibleApp(index).name);
+        int groupPosition = group.empty() ? -1 : appIndex.Find(group);
+        if (position < 0 || (!group.empty() && groupPosition < 0))
+            return;
 
-        if (result != ERROR_SUCCESS)
+        std::vector<std::size_t> moved(1, (std::size_t)position);
+        std::vector<KeyRename> renames;
+        if (!PlanGroupMove(allApps, moved, group, groupPosition >= 0 ? allApps[groupPosition].depth : 0, renames))
         {
-            // If key doesn't exist, consider deletion successful
-            if (result == ERROR_FILE_NOT_FOUND)
-            {
-                return true;
-            }
-            return false;
+            MessageBoxW(hMainWindow, L"A group cannot be moved into itself, and groups can't nest that deep.", L"Information", MB_OK | MB_ICONINFORMATION);
+            return;
         }
+        if (renames.empty())
+            return;
+
+        std::wstring movedKey = renames[0].to;
+        PostWrite(
+            [this, renames]() -> long
+            {
+                // Renaming copies the whole subtree, and a failed move is renamed back
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                StageGroupMove(transaction, renames);
+                long result = transaction.Commit();
+                if (result == RegOk)
+                    history.RecordRenames(renames);
+                return result;
+            },
+            [this, movedKey](long result)
+            {
+                if (result == RegAlreadyExists)
+                {
+                    MessageBoxW(hMainWindow, L"The group already contains an item with the same registry key name.", L"Error", MB_OK | MB_ICONERROR);
+                    return;
+                }
+                if (result != RegOk)
+                {
+                    MessageBoxW(hMainWindow, L"Move failed! Please run as administrator.", L"Error", MB_OK | MB_ICONERROR);
+                    return;
+                }
 
-        // Enumerate and delete all subkeys
-        DWORD index = 0;
-        wchar_t childKeyName[256];
-        DWORD childKeySize = sizeof(childKeyName) / sizeof(wchar_t);
+                // Keep the moved item selected
+                int row = FindAppIndex(movedKey);
+                if (row >= 0)
+                    SendMessageW(hListBox, LB_SETCURSEL, row, 0);
+            });
+    }
 
-        // Note: index changes when deleting subkeys, so always enumerate from 0
-        while (RegEnumKeyExW(hKey, 0, childKeyName, &childKeySize, NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
-        {
-            std::wstring fullChildKey = subkey;
-            fullChildKey += L"\\";
-            fullChildKey += childKeyName;
+    // Dissolve the group at index: its members move up one level and the group is deleted
+    void FlattenMenuGroup(int index)
+    {
+        if (isEditing || WritePending())
+            return;
+
+        int position = appIndex.Find(VisibleApp(index).name);
+        if (position < 0 || !allApps[position].isGroup)
+            return;
 
-            if (!DeleteRegistryTree(hParentKey, fullChildKey.c_str()))
+        std::wstring group = allApps[position].name.str();
+        std::vector<KeyRename> renames;
+        PlanFlattenGroup(allApps, position, renames);
+        PostWrite(
+            [this, group, renames]() -> long
             {
-                RegCloseKey(hKey);
-                return false;
-            }
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                StageFlattenGroup(transaction, group, renames);
+                return transaction.Commit();
+            },
+            [this](long result)
+            {
+                if (result == RegAlreadyExists)
+                    MessageBoxW(hMainWindow, L"An item in the group has the same registry key name as one outside it.", L"Error", MB_OK | MB_ICONERROR);
+                else if (result != RegOk)
+                    MessageBoxW(hMainWindow, L"Failed to flatten group! Please run as administrator.", L"Error", MB_OK | MB_ICONERROR);
+            });
+    }
 
-            // Reset size
-            childKeySize = sizeof(childKeyName) / sizeof(wchar_t);
+    // Take the menu one step back (or forward again) through the history. Only the keys that
+    // differ between the two steps are written, as one transaction.
+    void StepHistory(bool redo)
+    {
+        if (isEditing || WritePending())
+            return;
+        if ((redo ? redoSteps : undoSteps) == 0)
+        {
+            MessageBeep(MB_ICONWARNING);
+            return;
         }
 
-        RegCloseKey(hKey);
-
-        // Delete current key
-        result = RegDeleteKeyW(hParentKey, subkey);
-        return (result == ERROR_SUCCESS) || (result == ERROR_FILE_NOT_FOUND);
+        PostWrite(
+            [this, redo]() -> long
+            {
+                std::function<void()> onCommit = [this]()
+                { NotifyShellChange(); };
+                return redo ? history.Redo(kRegClassesRoot, shellPath, onCommit, Journal())
+                            : history.Undo(kRegClassesRoot, shellPath, onCommit, Journal());
+            },
+            [this, redo](long result)
+            {
+                if (result == RegOk || result == RegNoMoreItems)
+                    return;
+                MessageBoxW(hMainWindow,
+                            redo ? L"Redo failed! The items involved were changed outside this program, or administrator rights are needed."
+                                 : L"Undo failed! The items involved were changed outside this program, or administrator rights are needed.",
+                            L"Error", MB_OK | MB_ICONERROR);
+            });
     }
 
     // Handle move up button click
     void OnMoveUpButtonClick()
     {
+        if (WritePending())
+            return;
+
         int selectedIndex = (int)SendMessageW(hListBox, LB_GETCURSEL, 0, 0);
         if (selectedIndex == LB_ERR || selectedIndex <= 0)
         {
@@ -1483,19 +2178,26 @@ public:
         }
 
         // Only allow moving items created by this program
-        if (!apps[selectedIndex].isCustom)
+        if (!VisibleApp(selectedIndex).isCustom)
         {
             MessageBoxW(hMainWindow, L"Can only move items created by this program (✅ marked items)", L"Information", MB_OK | MB_ICONINFORMATION);
             return;
         }
-
-        if (MoveRegistryItem(selectedIndex, selectedIndex - 1))
+        if (VisibleApp(selectedIndex).depth > 0)
         {
-            // Update selected item
-            SendMessageW(hListBox, LB_SETCURSEL, selectedIndex - 1, 0);
-            MessageBoxW(hMainWindow, L"Item moved up! Order in context menu also updated.", L"Success", MB_OK | MB_ICONINFORMATION);
+            MessageBoxW(hMainWindow, L"Items inside a group are ordered by key name - move the group instead.", L"Information", MB_OK | MB_ICONINFORMATION);
+            return;
         }
-        else
+
+        // Step over the members of an expanded group
+        int targetIndex = selectedIndex - 1;
+        while (targetIndex > 0 && targetIndex < (int)listView.RowCount() - 1 && VisibleApp(targetIndex).depth > 0)
+            targetIndex -= 1;
+
+        // The selection follows the item; the result is reported once the renames complete
+        if (!MoveRegistryItem(selectedIndex, targetIndex,
+                              L"Item moved up! Order in context menu also updated.",
+                              L"Move up failed! Please check if running as administrator or if move is legal."))
         {
             MessageBoxW(hMainWindow, L"Move up failed! Please check if running as administrator or if move is legal.", L"Error", MB_OK | MB_ICONERROR);
         }
@@ -1504,27 +2206,43 @@ public:
     // Handle move down button click
     void OnMoveDownButtonClick()
     {
+        if (WritePending())
+            return;
+
         int selectedIndex = (int)SendMessageW(hListBox, LB_GETCURSEL, 0, 0);
-        if (selectedIndex == LB_ERR || selectedIndex >= (int)apps.size() - 1)
+        if (selectedIndex == LB_ERR || selectedIndex >= (int)listView.RowCount() - 1)
         {
             MessageBoxW(hMainWindow, L"Please select a program first, and it cannot be the last item!", L"Information", MB_OK | MB_ICONINFORMATION);
             return;
         }
 
         // Only allow moving items created by this program
-        if (!apps[selectedIndex].isCustom)
+        if (!VisibleApp(selectedIndex).isCustom)
         {
             MessageBoxW(hMainWindow, L"Can only move items created by this program (✅ marked items)", L"Information", MB_OK | MB_ICONINFORMATION);
             return;
         }
+        if (VisibleApp(selectedIndex).depth > 0)
+        {
+            MessageBoxW(hMainWindow, L"Items inside a group are ordered by key name - move the group instead.", L"Information", MB_OK | MB_ICONINFORMATION);
+            return;
+        }
 
-        if (MoveRegistryItem(selectedIndex, selectedIndex + 1))
+        // Step over the members of an expanded group
+        int targetIndex = selectedIndex + 1;
+        while (targetIndex > 0 && targetIndex < (int)listView.RowCount() - 1 && VisibleApp(targetIndex).depth > 0)
+            targetIndex += 1;
+        // An expanded group at the bottom: nothing left to step over its members to
+        if (VisibleApp(targetIndex).depth > 0)
         {
-            // Update selected item
-            SendMessageW(hListBox, LB_SETCURSEL, selectedIndex + 1, 0);
-            MessageBoxW(hMainWindow, L"Item moved down! Order in context menu also updated.", L"Success", MB_OK | MB_ICONINFORMATION);
+            MessageBoxW(hMainWindow, L"Please select a program first, and it cannot be the last item!", L"Information", MB_OK | MB_ICONINFORMATION);
+            return;
         }
-        else
+
+        // The selection follows the item; the result is reported once the renames complete
+        if (!MoveRegistryItem(selectedIndex, targetIndex,
+                              L"Item moved down! Order in context menu also updated.",
+                              L"Move down failed! Please check if running as administrator or if move is legal."))
         {
             MessageBoxW(hMainWindow, L"Move down failed! Please check if running as administrator or if move is legal.", L"Error", MB_OK | MB_ICONERROR);
         }
@@ -1545,17 +2263,10 @@ public:
         ofn.nFilterIndex = 1;
         ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
 
-        if (GetOpenFileNameW(&ofn))
+        if (GetOpenFileNameW(&ofn) && !WritePending())
         {
-            if (AddAppToContextMenu(fileName))
-            {
-                MessageBoxW(hMainWindow,
-                            L"Program successfully added to desktop context menu!\n"
-                            L"Program icon will also display in menu.\n"
-                            L"May need to refresh desktop or restart Explorer to see changes.",
-                            L"Success", MB_OK | MB_ICONINFORMATION);
-            }
-            else
+            // Success is reported once the write completes
+            if (!AddAppToContextMenu(fileName))
             {
                 MessageBoxW(hMainWindow, L"Failed to add program! Please run as administrator.", L"Error", MB_OK | MB_ICONERROR);
             }
@@ -1571,18 +2282,21 @@ public:
             return;
         }
 
-        AppEntry &app = apps[selectedIndex];
+        AppEntry &app = VisibleApp(selectedIndex);
+        std::wstring keyName = app.name.str();
         std::wstring confirmMsg = L"Are you sure you want to remove this program from desktop context menu?\n\n";
         confirmMsg += L"Name: " + app.displayName + L"\n";
         confirmMsg += L"Path: " + app.path;
 
         if (MessageBoxW(hMainWindow, confirmMsg.c_str(), L"Confirm Deletion", MB_YESNO | MB_ICONQUESTION) == IDYES)
         {
-            if (RemoveAppFromContextMenu(selectedIndex))
-            {
-                MessageBoxW(hMainWindow, L"Program removed from desktop context menu!", L"Success", MB_OK | MB_ICONINFORMATION);
-            }
-            else
+            // The list may have been patched by a registry change while the dialog was open
+            selectedIndex = FindAppIndex(keyName);
+            if (WritePending())
+                return;
+
+            // Success is reported once the delete completes
+            if (!RemoveAppFromContextMenu(selectedIndex))
             {
                 MessageBoxW(hMainWindow, L"Failed to remove program!", L"Error", MB_OK | MB_ICONERROR);
             }
@@ -1600,17 +2314,9 @@ public:
         // Show refreshing prompt
         MessageBoxW(hMainWindow, L"Reloading menu items from registry...", L"Refreshing", MB_OK | MB_ICONINFORMATION);
 
-        // Force reload all menu items from registry
+        // Force reload all menu items from registry - totals are shown when it completes
+        reloadReport = true;
         ForceReloadFromRegistry();
-
-        // Show result statistics
-        wchar_t resultMsg[256];
-        swprintf(resultMsg, 256, L"Refresh complete!\nFound %d total menu items\n%d created by this program",
-                 (int)allApps.size(),
-                 (int)std::count_if(allApps.begin(), allApps.end(), [](const AppEntry &app)
-                                    { return app.isCustom; }));
-
-        MessageBoxW(hMainWindow, resultMsg, L"Refresh Complete", MB_OK | MB_ICONINFORMATION);
     }
 
     void OnShowAllCheckboxClick()
@@ -1679,24 +2385,70 @@ public:
             }
             else if (LOWORD(wParam) == 1101)
             { // Context menu: Open in Registry
-                if (contextMenuIndex >= 0 && contextMenuIndex < (int)apps.size())
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
                 {
                     OpenRegistryLocation(contextMenuIndex);
                 }
             }
             else if (LOWORD(wParam) == 1102)
             { // Context menu: Refresh this item
-                if (contextMenuIndex >= 0 && contextMenuIndex < (int)apps.size())
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
                 {
-                    RefreshSingleItemFromRegistry(apps[contextMenuIndex].name);
+                    RefreshSingleItemFromRegistry(VisibleApp(contextMenuIndex).name.str());
                     MessageBoxW(hMainWindow, L"Selected item refreshed!", L"Refresh", MB_OK | MB_ICONINFORMATION);
                 }
             }
+            else if (LOWORD(wParam) == 1106)
+            { // Context menu: Check for broken items
+                CheckItemHealth(true, true);
+            }
+            else if (LOWORD(wParam) == 1103)
+            { // Context menu: New group
+                CreateMenuGroup();
+            }
+            else if (LOWORD(wParam) == 1104)
+            { // Context menu: Move out of group
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
+                {
+                    PooledString name = VisibleApp(contextMenuIndex).name;
+                    MoveIntoGroup(contextMenuIndex, ParentGroupPath(ParentGroupPath(name)));
+                }
+            }
+            else if (LOWORD(wParam) == 1105)
+            { // Context menu: Flatten group
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
+                {
+                    FlattenMenuGroup(contextMenuIndex);
+                }
+            }
+            else if (LOWORD(wParam) == 1107)
+            { // Context menu or Ctrl+Z: Undo
+                StepHistory(false);
+            }
+            else if (LOWORD(wParam) == 1108)
+            { // Context menu or Ctrl+Y: Redo
+                StepHistory(true);
+            }
+            else if (LOWORD(wParam) >= 1200 && LOWORD(wParam) < 1200 + groupMenuKeys.size())
+            { // Context menu: Move into group
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
+                {
+                    MoveIntoGroup(contextMenuIndex, groupMenuKeys[LOWORD(wParam) - 1200]);
+                }
+            }
             break;
 
+        case WM_DRAWITEM:
+            if (wParam == 1001)
+            {
+                DrawListItem((const DRAWITEMSTRUCT *)lParam);
+                return TRUE;
+            }
+            return DefWindowProcW(hwnd, uMsg, wParam, lParam);
+
         case WM_SIZE:
             // Recalculate horizontal scroll range when window size changes
-            if (hListBox && !apps.empty())
+            if (hListBox && !listView.Empty())
             {
                 // Delay recalculation to ensure layout is complete
                 SetTimer(hMainWindow, 1001, 100, NULL); // Recalculate after 100ms
@@ -1711,6 +2463,24 @@ public:
             }
             break;
 
+        case WM_APP_WORKER_DONE:
+            ioWorker.RunCompletions();
+            iconWorker.RunCompletions();
+            break;
+
+        case WM_APP_REGISTRY_CHANGED:
+            shellWatcher.Acknowledge();
+            if (isEditing)
+            {
+                // Don't pull the list out from under the edit box
+                registrySyncDeferred = true;
+            }
+            else
+            {
+                SyncFromRegistry();
+            }
+            break;
+
         case WM_CONTEXTMENU:
             // Handle right-click menu
             if ((HWND)wParam == hListBox)
@@ -1726,7 +2496,7 @@ public:
                 if (HIWORD(index) == 0 && LOWORD(index) != LB_ERR) // Ensure within item range
                 {
                     int itemIndex = LOWORD(index);
-                    if (itemIndex >= 0 && itemIndex < (int)apps.size())
+                    if (itemIndex >= 0 && itemIndex < (int)listView.RowCount())
                     {
                         // Select the item
                         SendMessageW(hListBox, LB_SETCURSEL, itemIndex, 0);
@@ -1747,7 +2517,7 @@ public:
                 if (HIWORD(index) == 0 && LOWORD(index) != LB_ERR)
                 {
                     int itemIndex = LOWORD(index);
-                    if (itemIndex >= 0 && itemIndex < (int)apps.size())
+                    if (itemIndex >= 0 && itemIndex < (int)listView.RowCount())
                     {
                         // Select the item
                         SendMessageW(hListBox, LB_SETCURSEL, itemIndex, 0);
@@ -1759,11 +2529,8 @@ public:
 
         case WM_GETMINMAXINFO:
         {
-            // Get DPI scaling factor
-            HDC hdc = GetDC(hMainWindow);
-            int dpiX = GetDeviceCaps(hdc, LOGPIXELSX);
-            ReleaseDC(hMainWindow, hdc);
-            float scale = dpiX / 96.0f;
+            // DPI scaling factor, read at startup
+            float scale = screenDpi / 96.0f;
 
             // Lock window size based on DPI scaling
             MINMAXINFO *mmi = (MINMAXINFO *)lParam;
@@ -1775,13 +2542,24 @@ public:
         break;
 
         case WM_DESTROY:
+        {
+            // With a job in flight the tracker may be ahead of the list, so no snapshot then
+            bool idle = ioWorker.Idle();
+            ioWorker.Stop();
+            if (idle)
+                SaveMenuSnapshot();
+            iconWorker.Stop();
+            SaveIconCache();
+            shellNotify.Stop(); // Sends the last broadcast if one is still pending
+            shellWatcher.Stop();
             if (hContextMenu)
             {
                 DestroyMenu(hContextMenu);
                 hContextMenu = NULL;
             }
             PostQuitMessage(0);
-            break;
+        }
+        break;
 
         default:
             return DefWindowProcW(hwnd, uMsg, wParam, lParam);
@@ -1795,6 +2573,9 @@ public:
         MSG msg = {};
         while (GetMessage(&msg, NULL, 0, 0))
         {
+            // The edit box keeps its own Ctrl+Z while a name is being edited
+            if (!isEditing && hAccelerators && TranslateAcceleratorW(hMainWindow, hAccelerators, &msg))
+                continue;
             TranslateMessage(&msg);
             DispatchMessage(&msg);
         }
@@ -1802,9 +2583,101 @@ public:
     }
 };
 
+// Read a UTF-8 (optionally with BOM) or UTF-16LE (with BOM) text file for "apply"
+static bool ReadTextFile(const std::wstring &path, std::wstring &text)
+{
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    std::string bytes;
+    char buffer[65536];
+    DWORD bytesRead = 0;
+    while (ReadFile(hFile, buffer, sizeof(buffer), &bytesRead, NULL) && bytesRead > 0)
+        bytes.append(buffer, bytesRead);
+    CloseHandle(hFile);
+
+    if (bytes.size() >= 2 && (unsigned char)bytes[0] == 0xFF && (unsigned char)bytes[1] == 0xFE)
+        text.assign((const wchar_t *)(bytes.data() + 2), (bytes.size() - 2) / sizeof(wchar_t));
+    else
+        text = WideFromUtf8(bytes);
+    return true;
+}
+
+// Write command-line mode output to the console, or as UTF-8 when stdout is redirected
+static void WriteOutput(const std::string &utf8)
+{
+    HANDLE hOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (hOutput == NULL || hOutput == INVALID_HANDLE_VALUE)
+        hOutput = CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (hOutput == INVALID_HANDLE_VALUE)
+        return;
+
+    DWORD mode, written;
+    if (GetConsoleMode(hOutput, &mode))
+    {
+        std::wstring text = WideFromUtf8(utf8);
+        WriteConsoleW(hOutput, text.c_str(), (DWORD)text.length(), &written, NULL);
+    }
+    else
+    {
+        WriteFile(hOutput, utf8.data(), (DWORD)utf8.size(), &written, NULL);
+    }
+}
+
+// Command-line mode - no window, no message boxes, one JSON result on stdout
+static int RunHeadless(int argc, wchar_t **argv)
+{
+    // Attach to the console of the shell that started us so output is visible there
+    AttachConsole(ATTACH_PARENT_PROCESS);
+
+    // No timer thread: the run's changes are announced by the Flush below
+    Win32RegistryBackend registry;
+    Win32ShellNotifier shellNotifier;
+    ShellNotifyScheduler shellNotify(shellNotifier);
+    ContextMenuStore store(registry, [&shellNotify]()
+                           { shellNotify.Request(); });
+
+    // A journal of its own - the window may be running and writing its own meanwhile. Whatever an
+    // earlier run left half written is put back first; if that fails it is tried again next run.
+    Win32JournalFile journalFile;
+    RegistryJournal journal(journalFile);
+    if (journalFile.Open(LocalDataPath(L"registry-cli.journal", true)))
+    {
+        JournalRecoveryStats stats;
+        RecoverRegistryJournal(registry, journal, RecoverRollBack, &stats);
+        if (stats.interrupted > 0)
+            shellNotify.Request();
+        store.SetJournal(&journal);
+    }
+    Win32FileProbe fileProbe;
+    ContextMenuCli cli(store, ReadTextFile, fileProbe);
+
+    JsonWriter json;
+    std::vector<std::wstring> args(argv + 1, argv + argc);
+    int exitCode = cli.Run(args, json);
+
+    // One shell notification for the whole run, however many items changed
+    shellNotify.Flush();
+
+    WriteOutput(json.Text() + "\n");
+    return exitCode;
+}
+
 // Program entry point
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
 {
+    // Any arguments select the command-line mode
+    int argc = 0;
+    wchar_t **argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (argv && argc > 1)
+    {
+        int exitCode = RunHeadless(argc, argv);
+        LocalFree(argv);
+        return exitCode;
+    }
+    if (argv)
+        LocalFree(argv);
 
     // Set DPI awareness compatibility method
     HMODULE hUser32 = LoadLibraryW(L"user32.dll");
@@ -1860,7 +2733,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         return 1;
     }
 
-    RightClickManager manager;
+    Win32RegistryBackend registry;
+    RightClickManager manager(registry);
 
     // Check if another instance is already running
     if (manager.IsAlreadyRunning())
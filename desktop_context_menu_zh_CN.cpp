@@ -10,12 +10,34 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <memory>
+#include <unordered_set>
 #include <shlwapi.h>
 #include <shellscalingapi.h>
 
+#include "registry_backend_win32.h"
+#include "journal_file_win32.h"
+#include "file_probe_win32.h"
+#include "shell_enumerator.h"
+#include "registry_watcher.h"
+#include "context_menu_model.h"
+#include "menu_scope.h"
+#include "context_menu_cli.h"
+#include "health_check.h"
+#include "icon_source_win32.h"
+#include "list_view_model.h"
+#include "menu_snapshot.h"
+#include "menu_history.h"
+#include "registry_worker.h"
+#include "shell_notify.h"
+
 #define IDI_MAIN_ICON 101
 #define IDI_SMALL_ICON 102
 
+// Directory\Background\shell 发生变化时由注册表监视线程投递
+#define WM_APP_REGISTRY_CHANGED (WM_APP + 1)
+#define WM_APP_WORKER_DONE (WM_APP + 2)
+
 #ifndef GET_X_LPARAM
 #define GET_X_LPARAM(lParam) ((int)(short)LOWORD(lParam))
 #endif
@@ -31,21 +53,107 @@
 #pragma comment(lib, "shlwapi.lib")
 #pragma comment(lib, "Shcore.lib")
 
-// 应用程序结构
-struct AppEntry
+// 用列表框字体测量列表文本；只有需要测量时才获取 DC
+class ListTextMeasurer : public TextMeasurer
 {
-    std::wstring name;        // 注册表项名称
-    std::wstring path;        // 程序路径
-    std::wstring displayName; // 显示名称
-    std::wstring icon;        // 图标路径
-    bool isCustom;            // 是否由本程序创建
+private:
+    HWND hWnd;
+    HFONT hFont;
+    int dpi;
+    HDC hdc;
+    HFONT hOldFont;
+
+public:
+    ListTextMeasurer(HWND hwnd, HFONT font, int dpiX) : hWnd(hwnd), hFont(font), dpi(dpiX), hdc(NULL), hOldFont(NULL) {}
+
+    ~ListTextMeasurer()
+    {
+        if (hdc)
+        {
+            SelectObject(hdc, hOldFont);
+            ReleaseDC(hWnd, hdc);
+        }
+    }
+
+    std::uint64_t Context() const
+    {
+        return ((std::uint64_t)(std::uintptr_t)hFont << 16) ^ (std::uint64_t)dpi;
+    }
+
+    int Width(const std::wstring &text)
+    {
+        if (!hdc)
+        {
+            hdc = GetDC(hWnd);
+            if (!hdc)
+                return 0;
+            hOldFont = (HFONT)SelectObject(hdc, hFont);
+        }
+
+        SIZE size;
+        if (!GetTextExtentPoint32W(hdc, text.c_str(), (int)text.length(), &size))
+            return 0;
+        return size.cx;
+    }
 };
 
+// 向资源管理器通告菜单更改，使其丢弃缓存的关联
+class Win32ShellNotifier : public ShellNotifier
+{
+public:
+    void Notify()
+    {
+        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
+    }
+};
+
+// %LOCALAPPDATA%\RightClickManager\<fileName>；该文件夹不存在时为空
+static std::wstring LocalDataPath(const wchar_t *fileName, bool create)
+{
+    wchar_t folder[MAX_PATH];
+    if (FAILED(SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, folder)))
+        return std::wstring();
+    std::wstring path = std::wstring(folder) + L"\\RightClickManager";
+    if (create)
+        CreateDirectoryW(path.c_str(), NULL);
+    return path + L"\\" + fileName;
+}
+
 class RightClickManager
 {
 private:
-    std::vector<AppEntry> apps;
     std::vector<AppEntry> allApps; // 存储所有应用，用于过滤
+    std::shared_ptr<StringPool> appStrings; // allApps 的字符串 - 重新加载时随列表一起替换
+    AppIndex appIndex;             // 项名称 -> 在 allApps 中的位置
+    ListViewModel listView;        // 虚拟列表框的行，基于 allApps
+    RegistryBackend &registry;     // 所有注册表访问都经由此处
+    ShellKeyEnumerator shellEnumerator; // 可复用的单遍 shell 键读取器（仅限 I/O 工作线程）
+    ShellKeyTracker keyTracker;         // 每个已加载项的最后写入时间（仅限 I/O 工作线程）
+    MenuHistory history;                // 移除、添加和移动的撤销/重做历史（仅 I/O 工作线程）
+    Win32JournalFile journalFile;
+    RegistryJournal journal;            // 每个事务的预写记录（仅 I/O 工作线程）
+    Win32FileProbe fileProbe;
+    HealthChecker healthChecker;        // 程序与图标文件检查，结果带缓存（仅 I/O 工作线程）
+    MenuScope menuScope;                // 窗口管理的菜单 - 桌面菜单
+    std::wstring shellPath;             // menuScope 的 shell 键，构造后不再改变
+    Win32RegistryChangeSource shellChangeSource;
+    RegistryWatcher shellWatcher;       // 外部更改时投递 WM_APP_REGISTRY_CHANGED
+    bool registrySyncDeferred;          // 编辑期间收到了更改
+    RegistryWorker ioWorker;            // 在界面线程之外执行注册表读写
+    Win32IconSource iconSource;
+    IconCache iconCache;                // 行图标，按 (路径, 索引, 尺寸, DPI) 缓存，跨次运行保存
+    RegistryWorker iconWorker;          // 提取图标，使注册表 I/O 无需排在其后等待
+    HIMAGELIST hIconList;               // iconCache 图集的每个槽位对应一张图像
+    std::vector<IconKey> iconQueue;     // 已绘制但尚未解析的图标，留给下一个任务
+    std::unordered_set<IconKey, IconKeyHash, IconKeyEqual> iconQueued; // 已排队或正在解析
+    bool iconJobPosted;
+    int iconSize;                       // 像素，已按屏幕 DPI 缩放
+    Win32ShellNotifier shellNotifier;
+    ShellNotifyScheduler shellNotify;   // 每批连续更改只调用一次 SHChangeNotify
+    int pendingWrites;                  // 已投递但完成回调尚未运行的写入数
+    std::size_t undoSteps;              // 最近一次写入后的历史深度
+    std::size_t redoSteps;
+    bool reloadReport;                  // 下一次重新加载完成时显示统计
     HWND hMainWindow;
     HWND hListBox;
     HWND hAddButton;
@@ -62,7 +170,11 @@ private:
     int editingIndex;     // 正在编辑的项索引
     WNDPROC oldEditProc;  // 保存原来的编辑框过程
     HMENU hContextMenu;   // 右键菜单句柄
+    HMENU hGroupMenu;     // “移入分组”子菜单，每次打开菜单时重新填充
+    HACCEL hAccelerators; // Ctrl+Z / Ctrl+Y 快捷键
+    std::vector<std::wstring> groupMenuKeys; // 每个子菜单命令对应的分组键
     int contextMenuIndex; // 右键菜单对应的项索引
+    int screenDpi;        // 启动时读取一次
 
     static LRESULT CALLBACK EditBoxProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     {
@@ -101,65 +213,49 @@ private:
         return DefWindowProc(hwnd, uMsg, wParam, lParam);
     }
 
+    // 列表索引处显示的项
+    AppEntry &VisibleApp(int index)
+    {
+        return allApps[listView.Position(index)];
+    }
+
     // 按注册表项名称排序（保持注册表中的实际顺序）
     void SortAppsByRegistryKeyName()
     {
-        std::sort(allApps.begin(), allApps.end(), [](const AppEntry &a, const AppEntry &b)
-                  {
-                  // 按注册表项名称排序，保持注册表中的原始顺序
-                  return _wcsicmp(a.name.c_str(), b.name.c_str()) < 0; });
+        std::sort(allApps.begin(), allApps.end(), AppKeyNameLess);
+        appIndex.Rebuild(allApps);
+    }
+
+    // HKEY_CLASSES_ROOT 下菜单项键的路径
+    std::wstring ItemKeyPath(std::wstring_view keyName) const
+    {
+        std::wstring keyPath = shellPath + L"\\";
+        keyPath += keyName;
+        return keyPath;
     }
 
     // 从注册表刷新单个项的显示名称
     void RefreshSingleItemFromRegistry(const std::wstring &itemName)
     {
-        // 在 allApps 中查找对应的项
-        for (auto &app : allApps)
+        // 在 allApps 中查找对应的项；列表随后由其重新筛选
+        int index = appIndex.Find(itemName);
+        if (index >= 0)
         {
-            if (app.name == itemName)
-            {
-                // 从注册表重新读取显示名称
-                std::wstring displayPath = L"Directory\\Background\\shell\\";
-                displayPath += itemName;
-
-                HKEY hDisplayKey;
-                if (RegOpenKeyExW(HKEY_CLASSES_ROOT, displayPath.c_str(), 0, KEY_READ, &hDisplayKey) == ERROR_SUCCESS)
-                {
-                    wchar_t displayName[256];
-                    DWORD nameSize = sizeof(displayName);
-                    if (RegQueryValueExW(hDisplayKey, NULL, NULL, NULL, (LPBYTE)displayName, &nameSize) == ERROR_SUCCESS)
-                    {
-                        // 更新内存中的显示名称
-                        app.displayName = displayName;
-                    }
-                    RegCloseKey(hDisplayKey);
-                }
-                break;
-            }
-        }
+            // 从注册表重新读取显示名称
+            std::wstring displayPath = ItemKeyPath(itemName);
 
-        // 同时更新 apps 中的对应项
-        for (auto &app : apps)
-        {
-            if (app.name == itemName)
+            RegKey hDisplayKey;
+            if (registry.OpenKey(kRegClassesRoot, displayPath.c_str(), false, &hDisplayKey) == RegOk)
             {
-                // 从注册表重新读取显示名称
-                std::wstring displayPath = L"Directory\\Background\\shell\\";
-                displayPath += itemName;
-
-                HKEY hDisplayKey;
-                if (RegOpenKeyExW(HKEY_CLASSES_ROOT, displayPath.c_str(), 0, KEY_READ, &hDisplayKey) == ERROR_SUCCESS)
+                RegistryValueReader reader(registry);
+                std::wstring_view displayName;
+                if (reader.Read(hDisplayKey, DisplayNameValue(allApps[index]), displayName))
                 {
-                    wchar_t displayName[256];
-                    DWORD nameSize = sizeof(displayName);
-                    if (RegQueryValueExW(hDisplayKey, NULL, NULL, NULL, (LPBYTE)displayName, &nameSize) == ERROR_SUCCESS)
-                    {
-                        // 更新内存中的显示名称
-                        app.displayName = displayName;
-                    }
-                    RegCloseKey(hDisplayKey);
+                    // 更新内存中的显示名称
+                    allApps[index].displayName = appStrings->Intern(displayName);
+                    listView.Invalidate(itemName);
                 }
-                break;
+                registry.CloseKey(hDisplayKey);
             }
         }
 
@@ -167,309 +263,835 @@ private:
         FilterApps();
     }
 
-    // 系统内置的右键菜单项黑名单
-    std::vector<std::wstring> systemItems = {
-        L"New",
-        L"View",
-        L"SortBy",
-        L"Paste",
-        L"PasteShortcut",
-        L"DesktopBackground",
-        L"Settings",
-        L"Display",
-        L"GraphicsProperties",
-        L"NvDriverUpdate",
-        L"Share",
-        L"GrantAccess",
-        L"PinToQuickAccess",
-        L"IncludeInLibrary",
-        L"Properties",
-        L"Open",
-        L"OpenInNewWindow",
-        L"Print",
-        L"ScanWithMicrosoftDefender"};
-
 private:
-    // 生成注册表项名称 - 简化版本，不包含自动排序
-    std::wstring GenerateRegistryKey(const std::wstring &displayName)
+    // 移动注册表项 - 通过重命名注册表项来实现真正的顺序改变。
+    // 重命名完成后报告结果；无法移动时返回 false。
+    bool MoveRegistryItem(int fromIndex, int toIndex, const wchar_t *successMessage, const wchar_t *failureMessage)
     {
-        // 使用时间戳确保唯一性，避免自动排序
-        static int counter = 0;
-        counter++;
-
-        wchar_t keyName[256];
-        swprintf(keyName, 256, L"CustomApp_%s_%d", displayName.c_str(), counter);
-        return keyName;
-    }
-
-    // 移动注册表项 - 通过重命名注册表项来实现真正的顺序改变
-    bool MoveRegistryItem(int fromIndex, int toIndex)
-    {
-        if (fromIndex < 0 || toIndex < 0 || fromIndex >= (int)apps.size() || toIndex >= (int)apps.size())
+        if (fromIndex < 0 || toIndex < 0 || fromIndex >= (int)listView.RowCount() || toIndex >= (int)listView.RowCount())
             return false;
 
-        AppEntry &fromApp = apps[fromIndex];
-        AppEntry &toApp = apps[toIndex];
+        AppEntry &fromApp = VisibleApp(fromIndex);
+        AppEntry &toApp = VisibleApp(toIndex);
 
-        // 只允许移动自定义应用
-        if (!fromApp.isCustom || !toApp.isCustom)
+        // 只允许移动自定义应用，且只能在顶层移动
+        if (!fromApp.isCustom || !toApp.isCustom || fromApp.depth > 0 || toApp.depth > 0)
             return false;
+        std::wstring movedKey = fromApp.name.str();
 
         // 交换两个项在列表中的位置
-        std::swap(apps[fromIndex], apps[toIndex]);
+        listView.SwapRows(fromIndex, toIndex);
 
-        // 更新注册表中的顺序 - 通过重命名注册表项
-        if (!UpdateRegistryOrder())
+        // 计算使注册表项顺序与列表顺序一致所需的最少重命名
+        std::vector<KeyRename> renames;
+        if (!PlanOrderRenames(allApps, listView.Rows(), renames))
         {
-            // 如果更新注册表失败，恢复内存中的顺序
-            std::swap(apps[fromIndex], apps[toIndex]);
+            // 恢复内存中的顺序
+            listView.SwapRows(fromIndex, toIndex);
             return false;
         }
+        for (const auto &rename : renames)
+        {
+            if (CompareRegistryNames(rename.from, movedKey) == 0)
+                movedKey = rename.to;
+        }
 
-        // 更新列表显示
+        // 立即显示新顺序；重命名失败时从 allApps 重新过滤
         UpdateListBoxDisplay();
+        SendMessageW(hListBox, LB_SETCURSEL, toIndex, 0);
+
+        UpdateRegistryOrder(
+            renames,
+            [this, movedKey, successMessage, failureMessage](long result)
+            {
+                if (result != RegOk)
+                {
+                    FilterApps();
+                    MessageBoxW(hMainWindow, failureMessage, L"错误", MB_OK | MB_ICONERROR);
+                    return;
+                }
+
+                // 保持被移动的项处于选中状态
+                int row = FindAppIndex(movedKey);
+                if (row >= 0)
+                    SendMessageW(hListBox, LB_SETCURSEL, row, 0);
+                MessageBoxW(hMainWindow, successMessage, L"成功", MB_OK | MB_ICONINFORMATION);
+            });
         return true;
     }
 
-    // 更新注册表顺序 - 重新创建所有自定义项的注册表项以确保正确顺序
-    bool UpdateRegistryOrder()
+    // 更新注册表顺序 - 只重命名排序号必须改变的自定义项
+    void UpdateRegistryOrder(const std::vector<KeyRename> &renames, std::function<void(long)> done)
     {
-        // 收集所有自定义应用
-        std::vector<AppEntry> customApps;
-        for (const auto &app : apps)
-        {
-            if (app.isCustom)
+        PostWrite(
+            [this, renames]() -> long
             {
-                customApps.push_back(app);
-            }
+                if (renames.empty())
+                    return RegOk;
+
+                // 重命名会复制整个子树，本程序不管理的值也会保留。
+                // 任一重命名失败时，已完成的重命名会被改回。
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                transaction.Rename(L"", renames);
+                long result = transaction.Commit();
+                if (result == RegOk)
+                    history.RecordRenames(renames);
+                return result;
+            },
+            done);
+    }
+
+    // 在 I/O 工作线程上执行注册表写入。完成后先用发生变化的内容修补列表，
+    // 再在界面线程上运行 done(result)。
+    void PostWrite(std::function<long()> write, std::function<void(long)> done)
+    {
+        pendingWrites++;
+        ioWorker.Post(
+            RegistryWorker::JobWrite,
+            [this, write, done](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                // 在同一作业中读回写入所改变的内容，使列表不会落后于写入
+                long result = write();
+                std::size_t undo = history.UndoSteps(), redo = history.RedoSteps();
+                std::shared_ptr<ShellSync> sync = std::make_shared<ShellSync>();
+                ReadShellChanges(*sync);
+                return [this, result, undo, redo, sync, done]()
+                {
+                    pendingWrites--;
+                    undoSteps = undo;
+                    redoSteps = redo;
+                    ApplySync(*sync);
+                    done(result);
+                };
+            });
+    }
+
+    // 写入是根据列表计划的，因此在计划下一次写入前先等上一次完成
+    bool WritePending()
+    {
+        if (pendingWrites == 0)
+            return false;
+        MessageBeep(MB_ICONWARNING);
+        return true;
+    }
+
+    // 注册表事务的提交回调 - 调度器将一批连续的回调合并为一次广播
+    void NotifyShellChange()
+    {
+        // 刷新系统，使注册表更改生效
+        shellNotify.Request();
+    }
+
+    // 注册表事务的日志；日志文件无法打开时为 NULL - 此时写入照常进行，
+    // 只是崩溃后无法恢复
+    RegistryJournal *Journal()
+    {
+        return journalFile.IsOpen() ? &journal : NULL;
+    }
+
+    // 在读取菜单之前，还原上次运行中只写了一半的内容
+    void RecoverInterruptedWrites()
+    {
+        if (!journalFile.Open(LocalDataPath(L"registry.journal", true)))
+            return;
+
+        JournalRecoveryStats stats;
+        long result = RecoverRegistryJournal(registry, journal, RecoverRollBack, &stats);
+        if (stats.interrupted == 0)
+            return;
+        NotifyShellChange();
+
+        wchar_t message[512];
+        if (result == RegOk)
+        {
+            swprintf(message, 512,
+                     L"上次修改右键菜单的过程中程序被关闭。\n\n"
+                     L"已撤销 %d 项未完成的修改，菜单已恢复为修改之前的状态。",
+                     (int)stats.interrupted);
+            MessageBoxW(hMainWindow, message, L"已撤销未完成的修改", MB_OK | MB_ICONINFORMATION);
         }
+        else
+        {
+            swprintf(message, 512,
+                     L"上次修改右键菜单的过程中程序被关闭，"
+                     L"且未完成的修改无法撤销。错误代码：%d\n\n"
+                     L"下次启动时将再次尝试。请以管理员身份运行。",
+                     (int)result);
+            MessageBoxW(hMainWindow, message, L"错误", MB_OK | MB_ICONERROR);
+        }
+    }
 
-        // 为每个自定义应用重新创建注册表项（按新顺序）
-        int position = 1;
-        for (const auto &app : customApps)
+    // 按注册表项名称查找列表索引，未显示时返回 -1
+    int FindAppIndex(const std::wstring &keyName)
+    {
+        int index = appIndex.Find(keyName);
+        return index >= 0 ? listView.FindRow(index) : -1;
+    }
+
+    // 更新列表框显示 - 列表框只保存行数，绘制时才获取文本
+    void UpdateListBoxDisplay()
+    {
+        SendMessageW(hListBox, LB_SETCOUNT, listView.RowCount(), 0);
+        InvalidateRect(hListBox, NULL, TRUE);
+
+        // 设置水平滚动范围
+        UpdateHorizontalScroll();
+    }
+
+    // 绘制虚拟列表框的一行
+    void DrawListItem(const DRAWITEMSTRUCT *item)
+    {
+        if (item->itemID == (UINT)-1)
+            return;
+
+        bool selected = (item->itemState & ODS_SELECTED) != 0;
+        FillRect(item->hDC, &item->rcItem, GetSysColorBrush(selected ? COLOR_HIGHLIGHT : COLOR_WINDOW));
+
+        if (item->itemID < listView.RowCount())
         {
-            // 生成新的注册表项名称（带顺序编号）
-            wchar_t newKeyName[256];
-            swprintf(newKeyName, 256, L"%02d_CustomApp_%s", position, app.displayName.c_str());
+            const std::wstring &listText = listView.RowText(item->itemID);
+            HFONT hOldFont = hModernFont ? (HFONT)SelectObject(item->hDC, hModernFont) : NULL;
+            SetBkMode(item->hDC, TRANSPARENT);
+            SetTextColor(item->hDC, GetSysColor(selected ? COLOR_HIGHLIGHTTEXT : COLOR_WINDOWTEXT));
 
-            // 如果名称没有改变，跳过
-            if (app.name == newKeyName)
-            {
-                position++;
-                continue;
-            }
+            RECT textRect = item->rcItem;
+            textRect.left += IconColumnWidth();
+            DrawRowIcon(item->hDC, VisibleApp(item->itemID), item->rcItem);
+            DrawTextW(item->hDC, listText.c_str(), (int)listText.length(), &textRect,
+                      DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX);
+            if (hOldFont)
+                SelectObject(item->hDC, hOldFont);
+        }
 
-            // 创建新的注册表项
-            std::wstring newShellKey = L"Directory\\Background\\shell\\";
-            newShellKey += newKeyName;
+        if (item->itemState & ODS_FOCUS)
+            DrawFocusRect(item->hDC, &item->rcItem);
+    }
 
-            HKEY hNewKey;
-            if (RegCreateKeyExW(HKEY_CLASSES_ROOT, newShellKey.c_str(), 0, NULL, 0, KEY_ALL_ACCESS, NULL, &hNewKey, NULL) == ERROR_SUCCESS)
-            {
-                // 复制显示名称
-                RegSetValueExW(hNewKey, NULL, 0, REG_SZ,
-                               (const BYTE *)app.displayName.c_str(),
-                               (app.displayName.length() + 1) * sizeof(wchar_t));
+    // 行文本前的空间：图标及其两侧间距
+    int IconColumnWidth() const
+    {
+        return iconSize + (int)(6 * (screenDpi / 96.0f));
+    }
 
-                // 复制图标
-                if (!app.icon.empty())
-                {
-                    RegSetValueExW(hNewKey, L"Icon", 0, REG_SZ,
-                                   (const BYTE *)app.icon.c_str(),
-                                   (app.icon.length() + 1) * sizeof(wchar_t));
-                }
+    // 行显示的图标：其 Icon 值，否则为其程序的第一个图标
+    bool RowIconKey(const AppEntry &app, IconKey &key) const
+    {
+        int index = 0;
+        std::wstring_view file = SplitIconLocation(app.icon, &index);
+        if (file.empty())
+        {
+            file = app.path;
+            index = 0;
+        }
+        if (file.empty())
+            return false;
+        key.path.assign(file.data(), file.length());
+        key.index = index;
+        key.size = iconSize;
+        key.dpi = screenDpi;
+        return true;
+    }
 
-                RegCloseKey(hNewKey);
+    // 从缓存绘制行图标；不在缓存中（或为上次运行遗留）的图标
+    // 会排队交给图标工作线程，提取完成后显示
+    void DrawRowIcon(HDC hdc, const AppEntry &app, const RECT &rowRect)
+    {
+        IconKey key;
+        if (!hIconList || !RowIconKey(app, key))
+            return;
 
-                // 创建command子键
-                std::wstring newCommandKey = newShellKey + L"\\command";
-                if (RegCreateKeyExW(HKEY_CLASSES_ROOT, newCommandKey.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hNewKey, NULL) == ERROR_SUCCESS)
-                {
-                    std::wstring commandValue = L"\"";
-                    commandValue += app.path;
-                    commandValue += L"\"";
-
-                    RegSetValueExW(hNewKey, NULL, 0, REG_SZ,
-                                   (const BYTE *)commandValue.c_str(),
-                                   (commandValue.length() + 1) * sizeof(wchar_t));
-                    RegCloseKey(hNewKey);
-
-                    // 删除旧的注册表项
-                    std::wstring oldShellKey = L"Directory\\Background\\shell\\";
-                    oldShellKey += app.name;
-                    DeleteRegistryTree(HKEY_CLASSES_ROOT, oldShellKey.c_str());
-                }
-                else
+        bool stale = false;
+        int slot = iconCache.Find(key, &stale);
+        if (slot >= 0 && slot < ImageList_GetImageCount(hIconList))
+        {
+            int top = rowRect.top + (rowRect.bottom - rowRect.top - iconSize) / 2;
+            ImageList_Draw(hIconList, slot, hdc, rowRect.left + (int)(2 * (screenDpi / 96.0f)), top, ILD_TRANSPARENT);
+        }
+        if (slot == kIconUnknown || stale)
+            QueueIcon(key);
+    }
+
+    void QueueIcon(const IconKey &key)
+    {
+        if (!iconQueued.insert(key).second)
+            return;
+        iconQueue.push_back(key);
+        if (!iconJobPosted)
+            PostIconJob();
+    }
+
+    // 在图标工作线程上解析排队的图标 - 每次只有一个任务，
+    // 运行期间绘制的图标合并到下一个任务
+    void PostIconJob()
+    {
+        std::shared_ptr<std::vector<IconKey>> keys = std::make_shared<std::vector<IconKey>>();
+        keys->swap(iconQueue);
+        iconJobPosted = true;
+        iconWorker.Post(
+            RegistryWorker::JobCheck,
+            [this, keys](const std::atomic<bool> &cancelled) -> RegistryWorker::Completion
+            {
+                std::shared_ptr<std::vector<int>> changed = std::make_shared<std::vector<int>>();
+                iconCache.Resolve(iconSource, *keys, *changed, &cancelled);
+                return [this, keys, changed]()
                 {
-                    // 创建command失败，删除shell键
-                    RegDeleteKeyW(HKEY_CLASSES_ROOT, newShellKey.c_str());
-                    return false;
-                }
-            }
+                    iconJobPosted = false;
+                    for (const auto &key : *keys)
+                        iconQueued.erase(key);
+                    UpdateIconList(*changed);
+                    if (!iconQueue.empty())
+                        PostIconJob();
+                };
+            });
+    }
+
+    // 将变化的图集槽位复制到图像列表，其索引即槽位号
+    void UpdateIconList(const std::vector<int> &slots)
+    {
+        IconBitmap bitmap;
+        for (int slot : slots)
+        {
+            if (!iconCache.Bitmap(slot, bitmap))
+                continue;
+            HBITMAP image = CreateIconImage(bitmap, iconSize);
+            if (!image)
+                continue;
+            int count = ImageList_GetImageCount(hIconList);
+            if (slot < count)
+                ImageList_Replace(hIconList, slot, image, NULL);
             else
             {
-                return false;
+                // 槽位可按任意顺序填充；空缺处的图像在其槽位到达时替换
+                for (; count <= slot; count++)
+                    ImageList_Add(hIconList, image, NULL);
             }
+            DeleteObject(image);
+        }
+        if (!slots.empty())
+            InvalidateRect(hListBox, NULL, FALSE);
+    }
 
-            position++;
+    // 由 bitmap 生成 size x size 的 32 位 DIB，尺寸不同时裁剪或以透明填充
+    static HBITMAP CreateIconImage(const IconBitmap &bitmap, int size)
+    {
+        BITMAPINFO header = {};
+        header.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        header.bmiHeader.biWidth = size;
+        header.bmiHeader.biHeight = -size; // 首行在前，与 IconBitmap 的存储方式一致
+        header.bmiHeader.biPlanes = 1;
+        header.bmiHeader.biBitCount = 32;
+        header.bmiHeader.biCompression = BI_RGB;
+        void *bits = NULL;
+        HBITMAP image = CreateDIBSection(NULL, &header, DIB_RGB_COLORS, &bits, NULL, 0);
+        if (!image || !bits)
+            return image;
+
+        std::uint32_t *pixels = (std::uint32_t *)bits;
+        for (int y = 0; y < size; y++)
+        {
+            for (int x = 0; x < size; x++)
+            {
+                bool inside = x < bitmap.width && y < bitmap.height;
+                pixels[y * size + x] = inside ? bitmap.pixels[(std::size_t)y * bitmap.width + x] : 0;
+            }
         }
+        return image;
+    }
 
-        // 刷新系统
-        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
-        // 强制从注册表重新加载，确保内存数据与注册表完全一致
-        ForceReloadFromRegistry();
+    // 经由临时文件将 data 写入 path，因此崩溃不会留下不完整的文件
+    static bool WriteLocalDataFile(const std::wstring &path, const std::vector<std::uint8_t> &data)
+    {
+        std::wstring temporary = path + L".tmp";
+        HANDLE hFile = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+        DWORD written = 0;
+        bool saved = WriteFile(hFile, data.data(), (DWORD)data.size(), &written, NULL) && written == data.size();
+        CloseHandle(hFile);
+        if (!saved || !MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            DeleteFileW(temporary.c_str());
+            return false;
+        }
         return true;
     }
 
-    // 更新列表框显示
-    void UpdateListBoxDisplay()
+    // 在图标工作线程上、先于任何提取加载上次运行保存的图标。文件缺失或
+    // 无法读取只意味着所有图标重新提取。
+    void LoadIconCache()
     {
-        SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
-        for (const auto &app : apps)
+        iconWorker.Post(
+            RegistryWorker::JobCheck,
+            [this](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                std::wstring path = LocalDataPath(L"icons.cache", false);
+                HANDLE hFile = path.empty() ? INVALID_HANDLE_VALUE
+                                            : CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                                          FILE_ATTRIBUTE_NORMAL, NULL);
+                if (hFile == INVALID_HANDLE_VALUE)
+                    return RegistryWorker::Completion();
+
+                std::vector<std::uint8_t> data;
+                LARGE_INTEGER size;
+                DWORD bytesRead = 0;
+                bool read = GetFileSizeEx(hFile, &size) && size.QuadPart > 0 && size.QuadPart < (64 << 20);
+                if (read)
+                {
+                    data.resize((std::size_t)size.QuadPart);
+                    read = ReadFile(hFile, data.data(), (DWORD)data.size(), &bytesRead, NULL) && bytesRead == data.size();
+                }
+                CloseHandle(hFile);
+
+                std::shared_ptr<std::vector<int>> slots = std::make_shared<std::vector<int>>();
+                if (!read || !iconCache.Load(data.data(), data.size(), *slots))
+                    return RegistryWorker::Completion();
+                return [this, slots]()
+                { UpdateIconList(*slots); };
+            });
+    }
+
+    // 为下次运行保存缓存 - 须在图标工作线程停止后调用
+    void SaveIconCache()
+    {
+        std::wstring path = LocalDataPath(L"icons.cache", true);
+        if (path.empty())
+            return;
+        std::vector<std::uint8_t> data;
+        iconCache.Save(data);
+        WriteLocalDataFile(path, data);
+    }
+
+    // 用上次运行保存的快照（内存映射而非读取）填充列表，并在 I/O 工作线程上
+    // 对照注册表验证：跟踪器载入保存的键时间，再由一次同步
+    // 读取此后发生的变化。没有可用快照时返回 false。
+    bool LoadMenuSnapshot()
+    {
+        std::wstring path = LocalDataPath(L"menu.snapshot", false);
+        HANDLE hFile = path.empty() ? INVALID_HANDLE_VALUE
+                                    : CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                                  FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+
+        std::shared_ptr<MenuSnapshot> snapshot = std::make_shared<MenuSnapshot>();
+        bool read = false;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0 && size.QuadPart < (256 << 20))
         {
-            std::wstring listText = GetDisplayText(app);
-            SendMessageW(hListBox, LB_ADDSTRING, 0, (LPARAM)listText.c_str());
+            HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (hMapping)
+            {
+                const std::uint8_t *view = (const std::uint8_t *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+                if (view)
+                {
+                    read = ReadMenuSnapshot(view, (std::size_t)size.QuadPart, *snapshot);
+                    UnmapViewOfFile(view);
+                }
+                CloseHandle(hMapping);
+            }
         }
+        CloseHandle(hFile);
+        if (!read || CompareRegistryNames(snapshot->shellPath, shellPath) != 0)
+            return false;
 
-        // 设置水平滚动范围
-        UpdateHorizontalScroll();
+        allApps.swap(snapshot->entries);
+        appStrings = std::make_shared<StringPool>(std::move(snapshot->strings));
+        listView.InvalidateAll();
+        SortAppsByRegistryKeyName();
+        FilterApps();
+
+        bool posted = ioWorker.Post(
+            RegistryWorker::JobSync,
+            [this, snapshot](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                keyTracker.Clear();
+                for (const auto &stamp : snapshot->stamps)
+                    keyTracker.Record(stamp.keyName, stamp.lastWriteTime);
+                std::shared_ptr<ShellSync> sync = std::make_shared<ShellSync>();
+                ReadShellChanges(*sync);
+                return [this, sync]()
+                {
+                    // ApplySync 会检查重新读取的项；快照未变化时仍需进行首次检查
+                    bool checked = !sync->opened || !sync->changed.empty() || !sync->added.empty();
+                    ApplySync(*sync);
+                    if (!checked)
+                        CheckItemHealth(false, false);
+                };
+            });
+        if (!posted)
+            ForceReloadFromRegistry(); // 跟踪器未能载入
+        return true;
+    }
+
+    // 为下次启动保存列表 - 须在 I/O 工作线程停止后调用，且仅当它没有进行中的任务时：
+    // 否则跟踪器可能已看到列表尚未显示的变化，快照会让下次启动
+    // 漏掉这些变化
+    void SaveMenuSnapshot()
+    {
+        std::wstring path = LocalDataPath(L"menu.snapshot", true);
+        if (path.empty())
+            return;
+        std::vector<std::uint8_t> data;
+        WriteMenuSnapshot(shellPath, allApps, keyTracker, data);
+        WriteLocalDataFile(path, data);
     }
 
-    // 更新水平滚动范围
+    // 更新水平滚动范围 - 只测量上次之后新增或更改的行
     void UpdateHorizontalScroll()
     {
-        if (!apps.empty())
+        ListTextMeasurer measurer(hListBox, hModernFont, screenDpi);
+        listView.UpdateWidths(measurer);
+
+        if (!listView.Empty())
         {
-            HDC hdc = GetDC(hListBox);
-            if (hdc)
-            {
-                int maxWidth = 0;
-                HFONT hOldFont = (HFONT)SelectObject(hdc, hModernFont);
+            int horizontalExtent = listView.MaxWidth() + (int)(100 * (screenDpi / 96.0f));
+            SendMessage(hListBox, LB_SETHORIZONTALEXTENT, horizontalExtent, 0);
+        }
+    }
 
-                for (const auto &app : apps)
-                {
-                    std::wstring listText = GetDisplayText(app);
-                    SIZE size;
-                    if (GetTextExtentPoint32W(hdc, listText.c_str(), (int)listText.length(), &size))
-                    {
-                        if (size.cx > maxWidth)
-                        {
-                            maxWidth = size.cx;
-                        }
-                    }
-                }
+    // 同步在 I/O 工作线程上读到的内容，在界面线程上应用到 allApps
+    struct ShellSync
+    {
+        bool opened;                   // false：shell 键不可用，需要完全重新加载
+        ShellKeyChanges changes;
+        std::vector<AppEntry> changed; // changes.changed 中重新读取的项
+        std::vector<AppEntry> added;   // changes.added 中的项
+        StringPool strings;            // changed 和 added 的字符串，应用时重新驻留到 appStrings
+    };
+
+    // I/O 工作线程：把所有非系统项读入 entries 和 strings，被取消后提前停止
+    void ReadAllFromRegistry(std::vector<AppEntry> &entries, StringPool &strings, const std::atomic<bool> &cancelled)
+    {
+        keyTracker.Clear();
 
-                SelectObject(hdc, hOldFont);
-                ReleaseDC(hListBox, hdc);
+        shellEnumerator.EnumerateTree(
+            kRegClassesRoot, shellPath.c_str(),
+            [this, &cancelled](const wchar_t *keyName)
+            {
+                // 跳过系统项，无需打开它们 - 有更新的重新加载在等待时跳过全部
+                return cancelled || IsSystemItem(keyName);
+            },
+            [this, &entries, &strings](const ShellEntry &entry)
+            {
+                entries.push_back(MakeAppEntry(entry, strings));
+                if (entry.depth == 0)
+                    keyTracker.Record(entry.keyName, entry.lastWriteTime); // 分组代表其成员
+            });
+    }
 
-                // 计算DPI缩放
-                HDC hdcWindow = GetDC(hMainWindow);
-                int dpiX = GetDeviceCaps(hdcWindow, LOGPIXELSX);
-                ReleaseDC(hMainWindow, hdcWindow);
-                float scale = dpiX / 96.0f;
+    // I/O 工作线程：找出自上次读取以来发生变化的项，只读取这些项，
+    // 以及其中分组的全部成员
+    void ReadShellChanges(ShellSync &sync)
+    {
+        sync.opened = keyTracker.Diff(
+            registry, kRegClassesRoot, shellPath.c_str(),
+            [this](const wchar_t *keyName)
+            { return IsSystemItem(keyName); },
+            sync.changes);
+        if (!sync.opened || sync.changes.Empty())
+            return;
 
-                int horizontalExtent = maxWidth + (int)(100 * scale);
-                SendMessage(hListBox, LB_SETHORIZONTALEXTENT, horizontalExtent, 0);
+        ScopedRegKey shellKey(registry);
+        if (registry.OpenKey(kRegClassesRoot, shellPath.c_str(), false, shellKey.Receive()) != RegOk)
+            return;
+
+        auto skip = [this](const wchar_t *keyName)
+        { return IsSystemItem(keyName); };
+        for (const auto &keyName : sync.changes.changed)
+        {
+            // 已变化分组的成员先被移除，再作为新增项读回
+            shellEnumerator.ReadTree(
+                shellKey.Get(), keyName.c_str(), skip,
+                [&sync](const ShellEntry &entry)
+                { (entry.depth == 0 ? sync.changed : sync.added).push_back(MakeAppEntry(entry, sync.strings)); });
+        }
+        for (const auto &keyName : sync.changes.added)
+        {
+            if (!shellEnumerator.ReadTree(
+                    shellKey.Get(), keyName.c_str(), skip,
+                    [&sync](const ShellEntry &entry)
+                    { sync.added.push_back(MakeAppEntry(entry, sync.strings)); }))
+            {
+                // 已再次消失，交由下一次比较报告
+                keyTracker.Forget(keyName);
             }
         }
     }
 
-    // 强制从注册表重新加载所有菜单项
-    void ForceReloadFromRegistry()
+    // I/O 工作线程：让变化跟踪器感知顶层分组下的改动（见 StageTouchGroup）
+    void TouchGroup(std::wstring_view keyName)
+    {
+        if (keyName.find(L'\\') == std::wstring_view::npos)
+            return;
+        ScopedRegKey groupKey(registry);
+        if (registry.OpenKey(kRegClassesRoot, ItemKeyPath(TopKeyName(keyName)).c_str(), true, groupKey.Receive()) == RegOk)
+            SetStringValue(registry, groupKey.Get(), L"SubCommands", L"");
+    }
+
+    // 用同步读到的内容就地修补 allApps
+    void ApplySync(const ShellSync &sync)
     {
-        // 清空现有数据
-        allApps.clear();
-        apps.clear();
+        if (!sync.opened)
+        {
+            // shell 键不可用，回退到完全重建
+            ForceReloadFromRegistry();
+            return;
+        }
 
-        // 重置列表框
-        SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
+        if (sync.changes.Empty())
+            return;
 
-        // 直接从注册表重新读取
-        HKEY hKey;
-        if (RegOpenKeyExW(HKEY_CLASSES_ROOT, L"Directory\\Background\\shell", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+        // 趁索引中的位置仍有效，就地更新已更改的项
+        for (const auto &app : sync.changed)
         {
-            wchar_t subkeyName[256];
-            DWORD index = 0;
-            DWORD nameSize = sizeof(subkeyName) / sizeof(wchar_t);
+            int index = appIndex.Find(app.name);
+            if (index >= 0)
+                allApps[index] = InternAppEntry(app, *appStrings);
+        }
+        for (const auto &keyName : sync.changes.changed)
+            listView.Invalidate(keyName);
 
-            while (RegEnumKeyExW(hKey, index, subkeyName, &nameSize, NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
+        // 一次性移除已删除的项，以及已删除或重新读取的分组的成员
+        bool dropped = false;
+        if (!sync.changes.removed.empty() || !sync.changes.changed.empty())
+        {
+            std::vector<bool> removed(allApps.size(), false);
+            std::unordered_set<std::wstring, RegistryNameHash, RegistryNameEqual> groups(
+                sync.changes.changed.begin(), sync.changes.changed.end());
+            for (const auto &keyName : sync.changes.removed)
+            {
+                int index = appIndex.Find(keyName);
+                if (index >= 0)
+                    removed[index] = true;
+                listView.Invalidate(keyName);
+                groups.insert(keyName);
+            }
+            for (size_t i = 0; i < allApps.size(); i++)
             {
-                // 跳过系统项
-                if (!IsSystemItem(subkeyName))
+                if (allApps[i].depth > 0 && groups.count(TopKeyName(allApps[i].name)))
                 {
-                    AppEntry app;
-                    app.name = subkeyName;
-                    // 修改自定义应用识别逻辑
-                    app.isCustom = (wcsstr(subkeyName, L"CustomApp_") != nullptr);
+                    removed[i] = true;
+                    listView.Invalidate(allApps[i].name);
+                }
+            }
+            size_t kept = 0;
+            for (size_t i = 0; i < allApps.size(); i++)
+            {
+                if (removed[i])
+                    continue;
+                if (kept != i)
+                    allApps[kept] = std::move(allApps[i]);
+                kept++;
+            }
+            dropped = kept != allApps.size();
+            allApps.resize(kept);
+        }
 
-                    // 获取显示名称
-                    std::wstring displayPath = L"Directory\\Background\\shell\\";
-                    displayPath += subkeyName;
+        // 将新项插入到排序位置
+        for (const auto &app : sync.added)
+        {
+            allApps.insert(std::upper_bound(allApps.begin(), allApps.end(), app, AppKeyNameLess),
+                           InternAppEntry(app, *appStrings));
+            listView.Invalidate(app.name);
+        }
 
-                    HKEY hDisplayKey;
-                    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, displayPath.c_str(), 0, KEY_READ, &hDisplayKey) == ERROR_SUCCESS)
-                    {
-                        wchar_t displayName[256];
-                        DWORD nameSize = sizeof(displayName);
-                        if (RegQueryValueExW(hDisplayKey, NULL, NULL, NULL, (LPBYTE)displayName, &nameSize) == ERROR_SUCCESS)
-                        {
-                            app.displayName = displayName;
-                        }
-                        else
-                        {
-                            app.displayName = subkeyName;
-                        }
+        // 位置已变化 - 整批只重建一次索引
+        if (dropped || !sync.added.empty())
+            appIndex.Rebuild(allApps);
 
-                        // 获取图标
-                        wchar_t iconPath[1024];
-                        DWORD iconSize = sizeof(iconPath);
-                        if (RegQueryValueExW(hDisplayKey, L"Icon", NULL, NULL, (LPBYTE)iconPath, &iconSize) == ERROR_SUCCESS)
-                        {
-                            app.icon = iconPath;
-                        }
+        FilterApps();
 
-                        RegCloseKey(hDisplayKey);
-                    }
-                    else
-                    {
-                        app.displayName = subkeyName;
-                    }
+        // 重新读取的项尚未检查
+        if (!sync.changed.empty() || !sync.added.empty())
+            CheckItemHealth(false, false);
+    }
 
-                    // 获取程序路径
-                    std::wstring commandPath = displayPath + L"\\command";
-                    HKEY hCommandKey;
-                    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, commandPath.c_str(), 0, KEY_READ, &hCommandKey) == ERROR_SUCCESS)
-                    {
-                        wchar_t appPath[1024];
-                        DWORD pathSize = sizeof(appPath);
-                        if (RegQueryValueExW(hCommandKey, NULL, NULL, NULL, (LPBYTE)appPath, &pathSize) == ERROR_SUCCESS)
-                        {
-                            app.path = appPath;
-                            CleanAppPath(app.path);
-                        }
-                        RegCloseKey(hCommandKey);
-                    }
+    // 只重新读取自上次读取以来发生变化的项；读取完成时修补列表
+    void SyncFromRegistry()
+    {
+        ioWorker.Post(
+            RegistryWorker::JobSync,
+            [this](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                std::shared_ptr<ShellSync> sync = std::make_shared<ShellSync>();
+                ReadShellChanges(*sync);
+                return [this, sync]()
+                { ApplySync(*sync); };
+            });
+    }
 
-                    allApps.push_back(app);
-                }
-                index++;
-                nameSize = sizeof(subkeyName) / sizeof(wchar_t);
-            }
-            RegCloseKey(hKey);
-        }
+    // 强制从注册表重新加载所有菜单项；读取完成时替换列表。
+    // 连续的请求合并为一次读取，正在进行的读取会被放弃。
+    void ForceReloadFromRegistry()
+    {
+        ioWorker.Post(
+            RegistryWorker::JobReload,
+            [this](const std::atomic<bool> &cancelled) -> RegistryWorker::Completion
+            {
+                // 每次读取用新的字符串池：旧列表被替换时，其字符串一次性释放
+                std::shared_ptr<std::vector<AppEntry>> entries = std::make_shared<std::vector<AppEntry>>();
+                std::shared_ptr<StringPool> strings = std::make_shared<StringPool>();
+                ReadAllFromRegistry(*entries, *strings, cancelled);
+                if (cancelled)
+                    return nullptr;
+                return [this, entries, strings]()
+                { ApplyReload(*entries, strings); };
+            });
+    }
+
+    // 用完整读取的结果替换 allApps，其字符串位于 strings 中
+    void ApplyReload(std::vector<AppEntry> &entries, const std::shared_ptr<StringPool> &strings)
+    {
+        allApps.swap(entries);
+        appStrings = strings;
+        listView.InvalidateAll();
 
         // 重新排序并过滤应用列表
         SortAppsByRegistryKeyName();
         FilterApps();
+
+        // 用户主动刷新时也重新检查文件
+        CheckItemHealth(reloadReport, false);
+
+        if (reloadReport)
+        {
+            reloadReport = false;
+
+            // 显示结果统计
+            wchar_t resultMsg[256];
+            swprintf(resultMsg, 256, L"刷新完成！\n总共找到 %d 个菜单项\n其中 %d 个是本程序创建的",
+                     (int)allApps.size(),
+                     (int)std::count_if(allApps.begin(), allApps.end(), [](const AppEntry &app)
+                                        { return app.isCustom; }));
+
+            MessageBoxW(hMainWindow, resultMsg, L"刷新完成", MB_OK | MB_ICONINFORMATION);
+        }
+    }
+
+    // 在 I/O 工作线程上检查每个项的程序与图标文件，并标记失效的项。
+    // fresh 先丢弃缓存的结果；report 显示检查结果，并提供删除
+    // 本程序创建的失效项的选项。
+    void CheckItemHealth(bool fresh, bool report)
+    {
+        // 副本共用 allApps 的字符串，因此在应用结果前让字符串池保持存活
+        std::shared_ptr<std::vector<AppEntry>> entries = std::make_shared<std::vector<AppEntry>>(allApps);
+        std::shared_ptr<StringPool> strings = appStrings;
+        ioWorker.Post(
+            RegistryWorker::JobCheck,
+            [this, entries, strings, fresh, report](const std::atomic<bool> &) -> RegistryWorker::Completion
+            {
+                if (fresh)
+                    healthChecker.Forget();
+                std::shared_ptr<std::vector<unsigned>> health = std::make_shared<std::vector<unsigned>>();
+                healthChecker.Check(*entries, *health);
+                return [this, entries, strings, health, report]()
+                { ApplyHealth(*entries, *health, report); };
+            });
+    }
+
+    // 标记检查发现的失效项；检查发出后又有变化的项不做处理
+    void ApplyHealth(const std::vector<AppEntry> &checked, const std::vector<unsigned> &health, bool report)
+    {
+        bool marked = false;
+        for (size_t i = 0; i < checked.size(); i++)
+        {
+            int index = appIndex.Find(checked[i].name);
+            if (index < 0 || allApps[index].path != checked[i].path || allApps[index].icon != checked[i].icon)
+                continue;
+            if (allApps[index].health != health[i])
+            {
+                allApps[index].health = health[i];
+                listView.Invalidate(checked[i].name);
+                marked = true;
+            }
+        }
+        if (marked)
+            FilterApps();
+        if (!report)
+            return;
+
+        // 只提供删除本程序创建的项；其他项仅做标记
+        std::vector<std::wstring> removals;
+        int broken = 0;
+        for (const auto &app : allApps)
+        {
+            if (app.health == HealthOk)
+                continue;
+            broken++;
+            if (app.isCustom)
+                removals.push_back(app.name.str()); // 不会是分组 - 分组没有要检查的文件
+        }
+        if (broken == 0)
+        {
+            MessageBoxW(hMainWindow, L"未发现失效项 - 所有程序与图标文件都存在。", L"检查完成", MB_OK | MB_ICONINFORMATION);
+            return;
+        }
+
+        wchar_t message[512];
+        if (removals.empty())
+        {
+            swprintf(message, 512, L"发现 %d 个项的程序或图标文件已不存在（已标记 ⚠）。\n"
+                                   L"它们都不是本程序创建的；如不再需要，请逐个删除。",
+                     broken);
+            MessageBoxW(hMainWindow, message, L"检查完成", MB_OK | MB_ICONWARNING);
+            return;
+        }
+        swprintf(message, 512, L"发现 %d 个项的程序或图标文件已不存在（已标记 ⚠）。\n\n"
+                               L"是否删除其中由本程序创建的 %d 个项？",
+                 broken, (int)removals.size());
+        if (MessageBoxW(hMainWindow, message, L"检查完成", MB_YESNO | MB_ICONWARNING) == IDYES && !WritePending())
+            RemoveBrokenItems(removals);
+    }
+
+    // 在一个事务中删除这些项 - 要么全部删除，有一个失败则都不删除
+    void RemoveBrokenItems(const std::vector<std::wstring> &keyNames)
+    {
+        PostWrite(
+            [this, keyNames]() -> long
+            {
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                for (const auto &keyName : keyNames)
+                {
+                    transaction.DeleteTree(keyName);
+                    StageTouchGroup(transaction, keyName);
+                }
+                return transaction.Commit();
+            },
+            [this, keyNames](long result)
+            {
+                if (result != RegOk)
+                {
+                    MessageBoxW(hMainWindow, L"删除失效项失败！请以管理员身份运行。", L"错误", MB_OK | MB_ICONERROR);
+                    return;
+                }
+                wchar_t message[128];
+                swprintf(message, 128, L"已删除 %d 个失效项。", (int)keyNames.size());
+                MessageBoxW(hMainWindow, message, L"成功", MB_OK | MB_ICONINFORMATION);
+            });
     }
 
 public:
-    RightClickManager() : hMainWindow(NULL), hListBox(NULL), hAddButton(NULL),
+    explicit RightClickManager(RegistryBackend &backend)
+        : appStrings(std::make_shared<StringPool>()), listView(allApps, appIndex), registry(backend), shellEnumerator(backend), history(backend), journal(journalFile), healthChecker(fileProbe),
+          menuScope(MakeMenuScope(ScopeDesktop)), shellPath(menuScope.ShellPath()),
+          shellChangeSource(HKEY_CLASSES_ROOT, shellPath.c_str()),
+          shellWatcher(shellChangeSource, [this]()
+                       { PostMessageW(hMainWindow, WM_APP_REGISTRY_CHANGED, 0, 0); }),
+          registrySyncDeferred(false),
+          ioWorker([this]()
+                   { PostMessageW(hMainWindow, WM_APP_WORKER_DONE, 0, 0); }),
+          iconWorker([this]()
+                     { PostMessageW(hMainWindow, WM_APP_WORKER_DONE, 0, 0); }),
+          hIconList(NULL), iconJobPosted(false), iconSize(16),
+          shellNotify(shellNotifier),
+          pendingWrites(0), undoSteps(0), redoSteps(0), reloadReport(false), hMainWindow(NULL), hListBox(NULL), hAddButton(NULL),
                           hRemoveButton(NULL), hRefreshButton(NULL), hShowAllCheckbox(NULL),
                           hMoveUpButton(NULL), hMoveDownButton(NULL),
                           hEditBox(NULL), hMutex(NULL), showAllItems(false), isEditing(false),
                           hModernFont(NULL), editingIndex(-1), oldEditProc(NULL),
-                          hContextMenu(NULL), contextMenuIndex(-1) {}
+                          hContextMenu(NULL), hGroupMenu(NULL), hAccelerators(NULL), contextMenuIndex(-1), screenDpi(96) {}
 
     ~RightClickManager()
     {
@@ -485,8 +1107,19 @@ public:
         }
         if (hContextMenu)
         {
-            DestroyMenu(hContextMenu);
+            DestroyMenu(hContextMenu); // 分组子菜单也一并销毁
             hContextMenu = NULL;
+            hGroupMenu = NULL;
+        }
+        if (hIconList)
+        {
+            ImageList_Destroy(hIconList);
+            hIconList = NULL;
+        }
+        if (hAccelerators)
+        {
+            DestroyAcceleratorTable(hAccelerators);
+            hAccelerators = NULL;
         }
     }
 
@@ -499,13 +1132,53 @@ public:
             AppendMenuW(hContextMenu, MF_STRING, 1101, L"📁 在注册表中打开");
             AppendMenuW(hContextMenu, MF_SEPARATOR, 0, NULL);
             AppendMenuW(hContextMenu, MF_STRING, 1102, L"🔄 刷新此项");
+            AppendMenuW(hContextMenu, MF_STRING, 1106, L"🩺 检查失效项");
+            AppendMenuW(hContextMenu, MF_SEPARATOR, 0, NULL);
+            AppendMenuW(hContextMenu, MF_STRING, 1103, L"📂 新建分组");
+            hGroupMenu = CreatePopupMenu();
+            if (hGroupMenu)
+                AppendMenuW(hContextMenu, MF_POPUP, (UINT_PTR)hGroupMenu, L"➡ 移入分组");
+            AppendMenuW(hContextMenu, MF_STRING, 1104, L"⬅ 移出分组");
+            AppendMenuW(hContextMenu, MF_STRING, 1105, L"🧺 解散分组");
+            AppendMenuW(hContextMenu, MF_SEPARATOR, 0, NULL);
+            AppendMenuW(hContextMenu, MF_STRING, 1107, L"↩ 撤销\tCtrl+Z");
+            AppendMenuW(hContextMenu, MF_STRING, 1108, L"↪ 重做\tCtrl+Y");
+        }
+    }
+
+    // 用 index 处的项可以移入的所有分组填充“移入分组”子菜单
+    void UpdateGroupMenu(int index)
+    {
+        while (GetMenuItemCount(hGroupMenu) > 0)
+            DeleteMenu(hGroupMenu, 0, MF_BYPOSITION);
+        groupMenuKeys.clear();
+
+        const AppEntry &app = VisibleApp(index);
+        for (const auto &group : allApps)
+        {
+            if (!group.isGroup || groupMenuKeys.size() >= 100)
+                continue;
+            // 不能移入自身、自己的成员或当前所在的分组
+            if (CompareRegistryNames(group.name, app.name) == 0 || IsInGroup(group.name, app.name) ||
+                CompareRegistryNames(group.name, ParentGroupPath(app.name)) == 0)
+                continue;
+
+            std::wstring text(group.depth * 4, L' ');
+            text += group.displayName;
+            AppendMenuW(hGroupMenu, MF_STRING, 1200 + groupMenuKeys.size(), text.c_str());
+            groupMenuKeys.push_back(group.name.str());
         }
+        if (groupMenuKeys.empty())
+            AppendMenuW(hGroupMenu, MF_STRING | MF_GRAYED, 0, L"（没有其他分组）");
+
+        EnableMenuItem(hContextMenu, 1104, MF_BYCOMMAND | (app.depth > 0 ? MF_ENABLED : MF_GRAYED));
+        EnableMenuItem(hContextMenu, 1105, MF_BYCOMMAND | (app.isGroup ? MF_ENABLED : MF_GRAYED));
     }
 
     // 显示上下文菜单
     void ShowContextMenu(int x, int y, int index)
     {
-        if (index < 0 || index >= (int)apps.size())
+        if (index < 0 || index >= (int)listView.RowCount())
             return;
 
         contextMenuIndex = index;
@@ -517,6 +1190,11 @@ public:
 
         if (hContextMenu)
         {
+            if (hGroupMenu)
+                UpdateGroupMenu(index);
+            EnableMenuItem(hContextMenu, 1107, MF_BYCOMMAND | (undoSteps > 0 ? MF_ENABLED : MF_GRAYED));
+            EnableMenuItem(hContextMenu, 1108, MF_BYCOMMAND | (redoSteps > 0 ? MF_ENABLED : MF_GRAYED));
+
             // 获取列表项的矩形位置
             RECT itemRect;
             if (SendMessageW(hListBox, LB_GETITEMRECT, index, (LPARAM)&itemRect) != LB_ERR)
@@ -549,13 +1227,13 @@ public:
     // 打开注册表位置
     void OpenRegistryLocation(int index)
     {
-        if (index < 0 || index >= (int)apps.size())
+        if (index < 0 || index >= (int)listView.RowCount())
             return;
 
-        AppEntry &app = apps[index];
+        AppEntry &app = VisibleApp(index);
 
         // 构建注册表路径
-        std::wstring regPath = L"计算机\\HKEY_CLASSES_ROOT\\Directory\\Background\\shell\\" + app.name;
+        std::wstring regPath = L"计算机\\HKEY_CLASSES_ROOT\\" + ItemKeyPath(app.name);
 
         // 尝试使用 ShellExecute 打开注册表编辑器
         SHELLEXECUTEINFOW sei = {sizeof(sei)};
@@ -690,15 +1368,15 @@ public:
     // 处理列表框双击事件
     void OnListBoxDoubleClick()
     {
-        if (isEditing)
-            return; // 如果正在编辑，忽略双击
+        if (isEditing || WritePending())
+            return; // 如果正在编辑或仍有更改在写入，忽略双击
 
         int selectedIndex = (int)SendMessageW(hListBox, LB_GETCURSEL, 0, 0);
         if (selectedIndex == LB_ERR)
             return;
 
         // 只允许重命名本程序创建的项
-        if (selectedIndex >= 0 && selectedIndex < (int)apps.size() && apps[selectedIndex].isCustom)
+        if (selectedIndex >= 0 && selectedIndex < (int)listView.RowCount() && VisibleApp(selectedIndex).isCustom)
         {
             StartEditing(selectedIndex);
         }
@@ -722,12 +1400,12 @@ public:
         SendMessageW(hListBox, LB_GETITEMRECT, index, (LPARAM)&itemRect);
 
         // 调整编辑框位置，避开图标区域
-        itemRect.left += 30; // 为图标留出空间
+        itemRect.left += IconColumnWidth(); // 为图标留出空间
 
         // 创建编辑框
         hEditBox = CreateWindowW(
             L"EDIT",
-            apps[index].displayName.c_str(),
+            VisibleApp(index).displayName.c_str(),
             WS_CHILD | WS_VISIBLE | ES_AUTOHSCROLL | WS_BORDER,
             itemRect.left, itemRect.top,
             itemRect.right - itemRect.left - 5, itemRect.bottom - itemRect.top,
@@ -756,42 +1434,50 @@ public:
 
         if (saveChanges && hEditBox)
         {
-            // 获取编辑框中的新名称
-            wchar_t newName[256];
-            GetWindowTextW(hEditBox, newName, 256);
+            // 获取编辑框中的新名称，不限长度
+            std::vector<wchar_t> text(GetWindowTextLengthW(hEditBox) + 1, L'\0');
+            GetWindowTextW(hEditBox, text.data(), (int)text.size());
+            std::wstring newName = text.data();
 
-            if (wcslen(newName) > 0)
+            if (!newName.empty())
             {
-                AppEntry &app = apps[editingIndex];
-                std::wstring oldDisplayName = app.displayName;
-
-                // 检查名称是否真的改变了
-                if (lstrcmpiW(oldDisplayName.c_str(), newName) != 0)
-                {
-                    // 更新注册表中的显示名称
-                    std::wstring shellKey = L"Directory\\Background\\shell\\";
-                    shellKey += app.name;
-
-                    HKEY hKey;
-                    // 使用 RegCreateKeyExW 并请求 KEY_ALL_ACCESS 权限
-                    if (RegCreateKeyExW(HKEY_CLASSES_ROOT, shellKey.c_str(), 0, NULL,
-                                        REG_OPTION_NON_VOLATILE, KEY_ALL_ACCESS, NULL, &hKey, NULL) == ERROR_SUCCESS)
-                    {
-                        RegSetValueExW(hKey, NULL, 0, REG_SZ, (const BYTE *)newName, (wcslen(newName) + 1) * sizeof(wchar_t));
-                        RegCloseKey(hKey);
-
-                        // 刷新系统
-                        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
+                AppEntry &app = VisibleApp(editingIndex);
+                std::wstring oldDisplayName = app.displayName.str();
 
-                        // 直接从注册表重新读取该项的显示名称，确保数据同步
-                        RefreshSingleItemFromRegistry(app.name);
+                // 检查名称是否真的改变了
+                if (lstrcmpiW(oldDisplayName.c_str(), newName.c_str()) != 0)
+                {
+                    // 更新注册表中的显示名称（分组保存在 MUIVerb 中）
+                    std::wstring shellKey = ItemKeyPath(app.name);
+
+                    std::wstring displayName = newName;
+                    std::wstring keyName = app.name.str();
+                    const wchar_t *valueName = DisplayNameValue(app);
+                    PostWrite(
+                        [this, shellKey, displayName, keyName, valueName]() -> long
+                        {
+                            RegKey hKey;
+                            // 后端 CreateKey 以完全访问权限打开
+                            long result = registry.CreateKey(kRegClassesRoot, shellKey.c_str(), &hKey);
+                            if (result == RegOk)
+                            {
+                                result = SetStringValue(registry, hKey, valueName, displayName);
+                                registry.CloseKey(hKey);
+                                TouchGroup(keyName);
 
-                        MessageBoxW(hMainWindow, L"重命名成功！", L"成功", MB_OK | MB_ICONINFORMATION);
-                    }
-                    else
-                    {
-                        MessageBoxW(hMainWindow, L"重命名失败！请以管理员身份运行。", L"错误", MB_OK | MB_ICONERROR);
-                    }
+                                // 刷新系统
+                                NotifyShellChange();
+                            }
+                            return result;
+                        },
+                        [this](long result)
+                        {
+                            // 重命名的项已随写入的其他更改一起重新读取
+                            if (result == RegOk)
+                                MessageBoxW(hMainWindow, L"重命名成功！", L"成功", MB_OK | MB_ICONINFORMATION);
+                            else
+                                MessageBoxW(hMainWindow, L"重命名失败！请以管理员身份运行。", L"错误", MB_OK | MB_ICONERROR);
+                        });
                 }
                 else
                 {
@@ -816,6 +1502,13 @@ public:
         editingIndex = -1;
         isEditing = false;
         SetFocus(hListBox);
+
+        // 应用编辑期间到达的注册表更改
+        if (registrySyncDeferred)
+        {
+            registrySyncDeferred = false;
+            SyncFromRegistry();
+        }
     }
 
     // 取消编辑
@@ -874,6 +1567,7 @@ public:
         int dpiX = GetDeviceCaps(hdc, LOGPIXELSX);
         ReleaseDC(NULL, hdc);
         float scale = dpiX / 96.0f;
+        screenDpi = dpiX;
 
         // 创建主窗口
         WNDCLASSEXW wc = {};
@@ -919,10 +1613,28 @@ public:
         }
 
         CreateControls(hInstance);
-        LoadAllContextMenuItems();
+
+        // Ctrl+Shift+Z 同样是重做
+        ACCEL accelerators[] = {
+            {FVIRTKEY | FCONTROL, 'Z', 1107},
+            {FVIRTKEY | FCONTROL, 'Y', 1108},
+            {FVIRTKEY | FCONTROL | FSHIFT, 'Z', 1108},
+        };
+        hAccelerators = CreateAcceleratorTableW(accelerators, 3);
+
+        ioWorker.Start();
+        iconWorker.Start();
+        LoadIconCache();
+        shellNotify.Start();
+        RecoverInterruptedWrites();
+        if (!LoadMenuSnapshot())
+            LoadAllContextMenuItems();
         ShowWindow(hMainWindow, SW_SHOW);
         UpdateWindow(hMainWindow);
 
+        // 监视本程序或其他程序所做的更改
+        shellWatcher.Start();
+
         return true;
     }
 
@@ -950,7 +1662,7 @@ public:
             WS_EX_CLIENTEDGE,
             L"LISTBOX",
             L"",
-            WS_CHILD | WS_VISIBLE | LBS_NOTIFY | LBS_HASSTRINGS |
+            WS_CHILD | WS_VISIBLE | LBS_NOTIFY | LBS_OWNERDRAWFIXED | LBS_NODATA |
                 WS_VSCROLL | WS_HSCROLL | LBS_NOINTEGRALHEIGHT | LBS_DISABLENOSCROLL, // 添加 LBS_DISABLENOSCROLL 确保滚动条始终可用
             margin, margin,
             listBoxWidth, listBoxHeight,
@@ -963,6 +1675,10 @@ public:
         int itemHeight = (int)(24 * scale); // 稍微增加项高度以改善可读性
         SendMessage(hListBox, LB_SETITEMHEIGHT, 0, itemHeight);
 
+        // 行图标 - 图像在图标工作线程提取后加入
+        iconSize = (int)(16 * scale);
+        hIconList = ImageList_Create(iconSize, iconSize, ILC_COLOR32, 16, 16);
+
         // 添加按钮
         hAddButton = CreateWindowW(
             L"BUTTON",
@@ -1068,34 +1784,10 @@ public:
         SendMessage(hShowAllCheckbox, BM_SETCHECK, showAllItems ? BST_CHECKED : BST_UNCHECKED, 0);
     }
 
-    std::wstring GetDisplayText(const AppEntry &app, int maxDisplayLength = 100)
-    {
-        std::wstring baseText = app.isCustom ? L"✅ " : L"📌 ";
-        baseText += app.displayName + L" - " + app.path;
-
-        // 如果文本过长，进行适当截断（但这只是显示，完整内容仍可通过滚动查看）
-        if (baseText.length() > maxDisplayLength)
-        {
-            // 保留开头和结尾的重要信息
-            std::wstring shortened = baseText.substr(0, maxDisplayLength - 10) + L"..." +
-                                     baseText.substr(baseText.length() - 7);
-            return shortened;
-        }
-
-        return baseText;
-    }
-
     // 检查是否为系统项
     bool IsSystemItem(const std::wstring &itemName)
     {
-        for (const auto &systemItem : systemItems)
-        {
-            if (itemName == systemItem)
-            {
-                return true;
-            }
-        }
-        return false;
+        return IsSystemVerb(itemName.c_str());
     }
 
     // 加载所有右键菜单项
@@ -1108,89 +1800,8 @@ public:
             CancelEditing();
         }
 
-        // 清空现有数据
-        allApps.clear();
-        apps.clear();
-        SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
-
-        // 检查桌面右键菜单注册表位置
-        HKEY hKey;
-        if (RegOpenKeyExW(HKEY_CLASSES_ROOT, L"Directory\\Background\\shell", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
-        {
-            wchar_t subkeyName[256];
-            DWORD index = 0;
-            DWORD nameSize = sizeof(subkeyName) / sizeof(wchar_t);
-
-            while (RegEnumKeyExW(hKey, index, subkeyName, &nameSize, NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
-            {
-                // 跳过系统项
-                if (!IsSystemItem(subkeyName))
-                {
-                    AppEntry app;
-                    app.name = subkeyName;
-                    app.isCustom = (wcsstr(subkeyName, L"CustomApp_") != nullptr);
-
-                    // 获取显示名称
-                    std::wstring displayPath = L"Directory\\Background\\shell\\";
-                    displayPath += subkeyName;
-
-                    HKEY hDisplayKey;
-                    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, displayPath.c_str(), 0, KEY_READ, &hDisplayKey) == ERROR_SUCCESS)
-                    {
-                        wchar_t displayName[256];
-                        DWORD nameSize = sizeof(displayName);
-                        if (RegQueryValueExW(hDisplayKey, NULL, NULL, NULL, (LPBYTE)displayName, &nameSize) == ERROR_SUCCESS)
-                        {
-                            app.displayName = displayName;
-                        }
-                        else
-                        {
-                            app.displayName = subkeyName; // 如果没有显示名称，使用注册表项名
-                        }
-
-                        // 获取图标
-                        wchar_t iconPath[1024];
-                        DWORD iconSize = sizeof(iconPath);
-                        if (RegQueryValueExW(hDisplayKey, L"Icon", NULL, NULL, (LPBYTE)iconPath, &iconSize) == ERROR_SUCCESS)
-                        {
-                            app.icon = iconPath;
-                        }
-
-                        RegCloseKey(hDisplayKey);
-                    }
-                    else
-                    {
-                        app.displayName = subkeyName;
-                    }
-
-                    // 获取程序路径
-                    std::wstring commandPath = displayPath + L"\\command";
-                    HKEY hCommandKey;
-                    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, commandPath.c_str(), 0, KEY_READ, &hCommandKey) == ERROR_SUCCESS)
-                    {
-                        wchar_t appPath[1024];
-                        DWORD pathSize = sizeof(appPath);
-                        if (RegQueryValueExW(hCommandKey, NULL, NULL, NULL, (LPBYTE)appPath, &pathSize) == ERROR_SUCCESS)
-                        {
-                            app.path = appPath;
-                            CleanAppPath(app.path);
-                        }
-                        RegCloseKey(hCommandKey);
-                    }
-
-                    allApps.push_back(app);
-                }
-                index++;
-                nameSize = sizeof(subkeyName) / sizeof(wchar_t);
-            }
-            RegCloseKey(hKey);
-        }
-
-        // 按显示名称字母顺序排序
-        SortAppsByRegistryKeyName();
-
-        // 根据显示设置过滤应用列表
-        FilterApps();
+        // 读取桌面右键菜单注册表位置 - 读取完成时填充列表
+        ForceReloadFromRegistry();
     }
 
     // 根据显示设置过滤应用列表
@@ -1202,20 +1813,10 @@ public:
             CancelEditing();
         }
 
-        apps.clear();
-        SendMessageW(hListBox, LB_RESETCONTENT, 0, 0);
-
-        for (const auto &app : allApps)
-        {
-            if (showAllItems || app.isCustom)
-            {
-                apps.push_back(app);
-
-                // 使用优化后的显示文本
-                std::wstring listText = GetDisplayText(app);
-                SendMessageW(hListBox, LB_ADDSTRING, 0, (LPARAM)listText.c_str());
-            }
-        }
+        // 只把行数交给列表框；行文本在首次绘制时才格式化
+        listView.Filter(showAllItems);
+        SendMessageW(hListBox, LB_SETCOUNT, listView.RowCount(), 0);
+        InvalidateRect(hListBox, NULL, TRUE);
 
         // 设置水平滚动范围，使长文本可以滚动查看
         UpdateHorizontalScroll();
@@ -1236,135 +1837,90 @@ public:
 
         // 如果项目数量超过可视区域，垂直滚动条会自动显示
         // 我们可以通过选中第一个项目来给用户视觉反馈
-        if (!apps.empty())
+        if (!listView.Empty())
         {
             SendMessageW(hListBox, LB_SETCURSEL, 0, 0);
         }
     }
 
-    // 清理应用路径
-    void CleanAppPath(std::wstring &path)
-    {
-        // 移除引号
-        if (path.length() >= 2 && path[0] == L'\"' && path[path.length() - 1] == L'\"')
-        {
-            path = path.substr(1, path.length() - 2);
-        }
-        // 移除参数
-        size_t pos = path.find(L".exe");
-        if (pos != std::wstring::npos)
-        {
-            path = path.substr(0, pos + 4);
-        }
-    }
-
-    // 添加应用到桌面右键菜单
+    // 添加应用到桌面右键菜单 - 写入完成后报告结果。
+    // appPath 中没有可显示的文件名时返回 false。
     bool AddAppToContextMenu(const std::wstring &appPath)
     {
         // 获取程序名称
-        size_t lastSlash = appPath.find_last_of(L'\\');
-        size_t lastDot = appPath.find_last_of(L'.');
-        if (lastSlash == std::wstring::npos)
+        std::wstring appName;
+        if (!AppNameFromPath(appPath, appName))
             return false;
 
-        std::wstring appName = appPath.substr(lastSlash + 1);
-        if (lastDot != std::wstring::npos && lastDot > lastSlash)
-        {
-            appName = appPath.substr(lastSlash + 1, lastDot - lastSlash - 1);
-        }
-
-        // 生成注册表键名 - 使用简化版本，不包含自动排序
-        std::wstring registryKey = GenerateRegistryKey(appName);
-
-        // 创建注册表项
-        std::wstring shellKey = L"Directory\\Background\\shell\\";
-        shellKey += registryKey;
+        // 生成注册表键名 - 追加到最后一个自定义项之后
+        std::wstring registryKey = GenerateCustomKeyName(appIndex, appName);
 
-        HKEY hKey;
-        LONG result = RegCreateKeyExW(HKEY_CLASSES_ROOT, shellKey.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hKey, NULL);
-        if (result == ERROR_SUCCESS)
-        {
-            // 设置显示名称
-            result = RegSetValueExW(hKey, NULL, 0, REG_SZ, (const BYTE *)appName.c_str(), (appName.length() + 1) * sizeof(wchar_t));
-            if (result != ERROR_SUCCESS)
+        std::shared_ptr<int> failedStep = std::make_shared<int>(-1);
+        PostWrite(
+            [this, registryKey, appPath, appName, failedStep]() -> long
             {
-                // 添加错误信息
-                wchar_t errorMsg[256];
-                swprintf(errorMsg, 256, L"设置显示名称失败！错误代码: %d", result);
-                MessageBoxW(hMainWindow, errorMsg, L"错误", MB_OK | MB_ICONERROR);
-                RegCloseKey(hKey);
-                return false;
-            }
-
-            // 设置图标
-            std::wstring iconValue = L"\"";
-            iconValue += appPath;
-            iconValue += L"\"";
-
-            RegSetValueExW(hKey, L"Icon", 0, REG_SZ, (const BYTE *)iconValue.c_str(), (iconValue.length() + 1) * sizeof(wchar_t));
-
-            RegCloseKey(hKey);
-        }
-        else
-        {
-            // 添加错误信息
-            wchar_t errorMsg[256];
-            swprintf(errorMsg, 256, L"创建注册表项失败！错误代码: %d", result);
-            MessageBoxW(hMainWindow, errorMsg, L"错误", MB_OK | MB_ICONERROR);
-            return false;
-        }
-
-        // 创建command子键
-        std::wstring commandKey = shellKey + L"\\command";
-        if (RegCreateKeyExW(HKEY_CLASSES_ROOT, commandKey.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hKey, NULL) == ERROR_SUCCESS)
-        {
-            std::wstring commandValue = L"\"";
-            commandValue += appPath;
-            commandValue += L"\"";
-
-            result = RegSetValueExW(hKey, NULL, 0, REG_SZ, (const BYTE *)commandValue.c_str(), (commandValue.length() + 1) * sizeof(wchar_t));
-            RegCloseKey(hKey);
-
-            if (result == ERROR_SUCCESS)
+                // 暂存整个项，中途失败时不会留下创建了一半的注册表项
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                StageAddApp(transaction, registryKey, appPath, appName);
+
+                long result = transaction.Commit();
+                *failedStep = transaction.FailedOperation();
+                if (result == RegOk)
+                    history.RecordCreate(registryKey);
+                return result;
+            },
+            [this, failedStep](long result)
             {
-                // 刷新系统，使注册表更改立即生效
-                SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
+                if (result == RegOk)
+                {
+                    MessageBoxW(hMainWindow,
+                                L"程序已成功添加到桌面右键菜单！\n"
+                                L"程序图标也会显示在菜单中。\n"
+                                L"可能需要刷新桌面或重新启动资源管理器才能看到变化。",
+                                L"成功", MB_OK | MB_ICONINFORMATION);
+                    return;
+                }
+
+                // 为失败的步骤添加错误信息
+                const wchar_t *errorFormat = L"创建注册表项失败！错误代码: %d";
+                switch (*failedStep)
+                {
+                case AddStepDisplayName:
+                    errorFormat = L"设置显示名称失败！错误代码: %d";
+                    break;
+                case AddStepIcon:
+                    errorFormat = L"设置图标失败！错误代码: %d";
+                    break;
+                case AddStepCreateCommand:
+                    errorFormat = L"创建命令子键失败！错误代码: %d";
+                    break;
+                case AddStepCommand:
+                    errorFormat = L"设置命令失败！错误代码: %d";
+                    break;
+                }
 
-                // 重新加载所有菜单项
-                LoadAllContextMenuItems();
-                return true;
-            }
-            else
-            {
-                // 添加错误信息
                 wchar_t errorMsg[256];
-                swprintf(errorMsg, 256, L"设置命令失败！错误代码: %d", result);
+                swprintf(errorMsg, 256, errorFormat, result);
                 MessageBoxW(hMainWindow, errorMsg, L"错误", MB_OK | MB_ICONERROR);
-            }
-        }
-        else
-        {
-            // 添加错误信息
-            wchar_t errorMsg[256];
-            swprintf(errorMsg, 256, L"创建命令子键失败！错误代码: %d", GetLastError());
-            MessageBoxW(hMainWindow, errorMsg, L"错误", MB_OK | MB_ICONERROR);
-        }
-
-        return false;
+                MessageBoxW(hMainWindow, L"添加程序失败！请以管理员身份运行程序。", L"错误", MB_OK | MB_ICONERROR);
+            });
+        return true;
     }
 
-    // 从右键菜单删除应用
+    // 从右键菜单删除应用 - 删除完成后报告结果。
+    // 未删除任何内容（没有该行，或拒绝了警告）时返回 false。
     bool RemoveAppFromContextMenu(int index)
     {
-        if (index < 0 || index >= (int)apps.size())
+        if (index < 0 || index >= (int)listView.RowCount())
             return false;
 
-        AppEntry &app = apps[index];
+        AppEntry &app = VisibleApp(index);
 
         // 保存要删除的项信息
-        std::wstring deleteName = app.name;
-        std::wstring deleteDisplayName = app.displayName;
-        std::wstring deletePath = app.path;
+        std::wstring deleteName = app.name.str();
+        std::wstring deleteDisplayName = app.displayName.str();
+        std::wstring deletePath = app.path.str();
 
         // 对于非本程序创建的项，显示额外警告
         if (!app.isCustom)
@@ -1380,101 +1936,240 @@ public:
             }
         }
 
-        std::wstring shellKey = L"Directory\\Background\\shell\\";
-        shellKey += app.name;
+        std::wstring shellKey = ItemKeyPath(deleteName); // 显示警告期间 app 可能已被修补
 
-        // 先尝试正常删除
-        bool deleteSuccess = DeleteRegistryTree(HKEY_CLASSES_ROOT, shellKey.c_str());
+        PostWrite(
+            [this, shellKey, deleteName]() -> long
+            {
+                // 保存键中的内容，以便撤销删除
+                std::shared_ptr<KeySnapshot> tree = std::make_shared<KeySnapshot>();
+                ScopedRegKey key(registry);
+                bool captured = registry.OpenKey(kRegClassesRoot, shellKey.c_str(), false, key.Receive()) == RegOk &&
+                                CaptureKeyTree(registry, key.Get(), *tree) == RegOk;
+                key.Reset();
+
+                // 先尝试正常删除 - 分组会连同其全部成员一起删除。尽可能写入日志，
+                // 这样中途被打断的删除会在下次启动时还原，而不会留下不完整的菜单项
+                long result = RegWriteFault;
+                if (Journal())
+                {
+                    RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), nullptr, Journal());
+                    transaction.DeleteTree(deleteName);
+                    result = transaction.Commit();
+                }
+                if (result != RegOk)
+                    result = DeleteRegistryTree(kRegClassesRoot, shellKey.c_str());
+                if (result == RegOk)
+                {
+                    TouchGroup(deleteName);
+                    if (captured)
+                        history.RecordDelete(deleteName, tree);
 
-        if (!deleteSuccess)
-        {
-            // 如果正常删除失败，显示详细错误信息
-            DWORD errorCode = GetLastError();
-            wchar_t errorMsg[512];
-            swprintf(errorMsg, 512,
-                     L"删除失败！错误代码: %d\n\n"
-                     L"可能的原因：\n"
-                     L"• 注册表项被其他进程占用\n"
-                     L"• 权限不足\n"
-                     L"• 注册表项不存在\n\n"
-                     L"请尝试以管理员身份运行程序，或重启后重试。",
-                     errorCode);
+                    // 刷新系统
+                    NotifyShellChange();
+                }
+                return result;
+            },
+            [this](long result)
+            {
+                if (result != RegOk)
+                {
+                    // 如果正常删除失败，显示详细错误信息
+                    wchar_t errorMsg[512];
+                    swprintf(errorMsg, 512,
+                             L"删除失败！错误代码: %d\n\n"
+                             L"可能的原因：\n"
+                             L"• 注册表项被其他进程占用\n"
+                             L"• 权限不足\n"
+                             L"• 注册表项不存在\n\n"
+                             L"请尝试以管理员身份运行程序，或重启后重试。",
+                             (int)result);
+
+                    MessageBoxW(hMainWindow, errorMsg, L"删除失败", MB_OK | MB_ICONERROR);
+                    MessageBoxW(hMainWindow, L"删除程序失败！", L"错误", MB_OK | MB_ICONERROR);
+                    return;
+                }
 
-            MessageBoxW(hMainWindow, errorMsg, L"删除失败", MB_OK | MB_ICONERROR);
-            return false;
+                // 显示成功消息
+                MessageBoxW(hMainWindow,
+                            L"程序已从桌面右键菜单中删除！\n"
+                            L"如果菜单项仍然显示，请尝试刷新桌面(F5)或重启资源管理器。",
+                            L"删除成功", MB_OK | MB_ICONINFORMATION);
+                MessageBoxW(hMainWindow, L"程序已从桌面右键菜单中删除！", L"成功", MB_OK | MB_ICONINFORMATION);
+            });
+
+        return true;
+    }
+
+    // 删除注册表树 - 注册表项已不存在时返回 RegOk，否则返回失败状态
+    long DeleteRegistryTree(RegKey hParentKey, const wchar_t *subkey)
+    {
+        // 首先尝试后端的整树删除（Windows 上为 SHDeleteKeyW），它更可靠
+        long result = registry.DeleteTree(hParentKey, subkey);
+        if (result != RegOk && result != RegNotFound)
+        {
+            // 如果整树删除失败，回退到逐个删除，先删子键
+            result = DeleteKeyTree(registry, hParentKey, subkey);
         }
 
-        // 刷新系统
-        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
+        // 如果键不存在，认为删除成功
+        return result == RegNotFound ? RegOk : result;
+    }
 
-        // 直接从注册表重新加载
-        ForceReloadFromRegistry();
+    // 在顶层添加一个空的级联分组，并开始编辑其名称
+    void CreateMenuGroup()
+    {
+        if (isEditing || WritePending())
+            return;
 
-        // 显示成功消息
-        MessageBoxW(hMainWindow,
-                    L"程序已从桌面右键菜单中删除！\n"
-                    L"如果菜单项仍然显示，请尝试刷新桌面(F5)或重启资源管理器。",
-                    L"删除成功", MB_OK | MB_ICONINFORMATION);
+        std::wstring groupKey = GenerateCustomKeyName(appIndex, L"新建分组");
+        PostWrite(
+            [this, groupKey]() -> long
+            {
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                StageCreateGroup(transaction, L"", groupKey, L"新建分组");
+                return transaction.Commit();
+            },
+            [this, groupKey](long result)
+            {
+                if (result != RegOk)
+                {
+                    MessageBoxW(hMainWindow, L"创建分组失败！请以管理员身份运行。", L"错误", MB_OK | MB_ICONERROR);
+                    return;
+                }
 
-        return true;
+                int row = FindAppIndex(groupKey);
+                if (row >= 0)
+                {
+                    SendMessageW(hListBox, LB_SETCURSEL, row, 0);
+                    StartEditing(row);
+                }
+            });
     }
 
-    // 改进的递归删除注册表树方法
-    bool DeleteRegistryTree(HKEY hParentKey, const wchar_t *subkey)
+    // 把 index 处的项（如果是分组则连同其成员）移入 group（"" 表示顶层）。
+    // 键名保持不变，因此目标分组中不能已有同名键的项。
+    void MoveIntoGroup(int index, const std::wstring &group)
     {
-        // 首先尝试使用 SHDeleteKeyW，它更可靠
-        LONG result = SHDeleteKeyW(hParentKey, subkey);
-        if (result == ERROR_SUCCESS || result == ERROR_FILE_NOT_FOUND)
-        {
-            return true;
-        }
+        if (isEditing || WritePending())
+            return;
 
-        // 如果 SHDeleteKeyW 失败，回退到手动删除
-        HKEY hKey;
-        result = RegOpenKeyExW(hParentKey, subkey, 0, KEY_READ | KEY_WRITE, &hKey);
+        int position = appIndex.Find(VisibleApp(index).name);
+        int groupPosition = group.empty() ? -1 : appIndex.Find(group);
+        if (position < 0 || (!group.empty() && groupPosition < 0))
+            return;
 
-        if (result != ERROR_SUCCESS)
+        std::vector<std::size_t> moved(1, (std::size_t)position);
+        std::vector<KeyRename> renames;
+        if (!PlanGroupMove(allApps, moved, group, groupPosition >= 0 ? allApps[groupPosition].depth : 0, renames))
         {
-            // 如果键不存在，认为删除成功
-            if (result == ERROR_FILE_NOT_FOUND)
-            {
-                return true;
-            }
-            return false;
+            MessageBoxW(hMainWindow, L"分组不能移入自身，分组也不能嵌套这么深。", L"提示", MB_OK | MB_ICONINFORMATION);
+            return;
         }
+        if (renames.empty())
+            return;
+
+        std::wstring movedKey = renames[0].to;
+        PostWrite(
+            [this, renames]() -> long
+            {
+                // 重命名会复制整个子树，移动失败时会重命名回去
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                StageGroupMove(transaction, renames);
+                long result = transaction.Commit();
+                if (result == RegOk)
+                    history.RecordRenames(renames);
+                return result;
+            },
+            [this, movedKey](long result)
+            {
+                if (result == RegAlreadyExists)
+                {
+                    MessageBoxW(hMainWindow, L"该分组中已有注册表键名相同的项。", L"错误", MB_OK | MB_ICONERROR);
+                    return;
+                }
+                if (result != RegOk)
+                {
+                    MessageBoxW(hMainWindow, L"移动失败！请以管理员身份运行。", L"错误", MB_OK | MB_ICONERROR);
+                    return;
+                }
 
-        // 枚举并删除所有子键
-        DWORD index = 0;
-        wchar_t childKeyName[256];
-        DWORD childKeySize = sizeof(childKeyName) / sizeof(wchar_t);
+                // 保持移动后的项处于选中状态
+                int row = FindAppIndex(movedKey);
+                if (row >= 0)
+                    SendMessageW(hListBox, LB_SETCURSEL, row, 0);
+            });
+    }
 
-        // 注意：删除子键时索引会变化，所以总是从0开始枚举
-        while (RegEnumKeyExW(hKey, 0, childKeyName, &childKeySize, NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
-        {
-            std::wstring fullChildKey = subkey;
-            fullChildKey += L"\\";
-            fullChildKey += childKeyName;
+    // 解散 index 处的分组：其成员上移一级，分组本身被删除
+    void FlattenMenuGroup(int index)
+    {
+        if (isEditing || WritePending())
+            return;
+
+        int position = appIndex.Find(VisibleApp(index).name);
+        if (position < 0 || !allApps[position].isGroup)
+            return;
 
-            if (!DeleteRegistryTree(hParentKey, fullChildKey.c_str()))
+        std::wstring group = allApps[position].name.str();
+        std::vector<KeyRename> renames;
+        PlanFlattenGroup(allApps, position, renames);
+        PostWrite(
+            [this, group, renames]() -> long
             {
-                RegCloseKey(hKey);
-                return false;
-            }
+                RegistryTransaction transaction(registry, kRegClassesRoot, shellPath.c_str(), [this]()
+                                                { NotifyShellChange(); }, Journal());
+                StageFlattenGroup(transaction, group, renames);
+                return transaction.Commit();
+            },
+            [this](long result)
+            {
+                if (result == RegAlreadyExists)
+                    MessageBoxW(hMainWindow, L"分组中有项与分组外的项注册表键名相同。", L"错误", MB_OK | MB_ICONERROR);
+                else if (result != RegOk)
+                    MessageBoxW(hMainWindow, L"解散分组失败！请以管理员身份运行。", L"错误", MB_OK | MB_ICONERROR);
+            });
+    }
 
-            // 重置大小
-            childKeySize = sizeof(childKeyName) / sizeof(wchar_t);
+    // 沿历史将菜单后退一步（或重新前进一步）。只写入两步之间
+    // 有差异的键，并作为一个事务提交。
+    void StepHistory(bool redo)
+    {
+        if (isEditing || WritePending())
+            return;
+        if ((redo ? redoSteps : undoSteps) == 0)
+        {
+            MessageBeep(MB_ICONWARNING);
+            return;
         }
 
-        RegCloseKey(hKey);
-
-        // 删除当前键
-        result = RegDeleteKeyW(hParentKey, subkey);
-        return (result == ERROR_SUCCESS) || (result == ERROR_FILE_NOT_FOUND);
+        PostWrite(
+            [this, redo]() -> long
+            {
+                std::function<void()> onCommit = [this]()
+                { NotifyShellChange(); };
+                return redo ? history.Redo(kRegClassesRoot, shellPath, onCommit, Journal())
+                            : history.Undo(kRegClassesRoot, shellPath, onCommit, Journal());
+            },
+            [this, redo](long result)
+            {
+                if (result == RegOk || result == RegNoMoreItems)
+                    return;
+                MessageBoxW(hMainWindow,
+                            redo ? L"重做失败！相关项已被其他程序修改，或需要管理员权限。"
+                                 : L"撤销失败！相关项已被其他程序修改，或需要管理员权限。",
+                            L"错误", MB_OK | MB_ICONERROR);
+            });
     }
 
     // 处理上移按钮点击
     void OnMoveUpButtonClick()
     {
+        if (WritePending())
+            return;
+
         int selectedIndex = (int)SendMessageW(hListBox, LB_GETCURSEL, 0, 0);
         if (selectedIndex == LB_ERR || selectedIndex <= 0)
         {
@@ -1483,19 +2178,26 @@ public:
         }
 
         // 只允许移动本程序创建的项
-        if (!apps[selectedIndex].isCustom)
+        if (!VisibleApp(selectedIndex).isCustom)
         {
             MessageBoxW(hMainWindow, L"只能移动本程序创建的项目（✅ 标记的项）", L"提示", MB_OK | MB_ICONINFORMATION);
             return;
         }
-
-        if (MoveRegistryItem(selectedIndex, selectedIndex - 1))
+        if (VisibleApp(selectedIndex).depth > 0)
         {
-            // 更新选中项
-            SendMessageW(hListBox, LB_SETCURSEL, selectedIndex - 1, 0);
-            MessageBoxW(hMainWindow, L"项目已上移！右键菜单中的顺序也已更新。", L"成功", MB_OK | MB_ICONINFORMATION);
+            MessageBoxW(hMainWindow, L"分组内的项按键名排序 - 请改为移动分组。", L"提示", MB_OK | MB_ICONINFORMATION);
+            return;
         }
-        else
+
+        // 跳过展开分组的成员
+        int targetIndex = selectedIndex - 1;
+        while (targetIndex > 0 && targetIndex < (int)listView.RowCount() - 1 && VisibleApp(targetIndex).depth > 0)
+            targetIndex -= 1;
+
+        // 选中状态跟随该项；重命名完成后报告结果
+        if (!MoveRegistryItem(selectedIndex, targetIndex,
+                              L"项目已上移！右键菜单中的顺序也已更新。",
+                              L"上移失败！请检查是否以管理员身份运行或移动是否合法！。"))
         {
             MessageBoxW(hMainWindow, L"上移失败！请检查是否以管理员身份运行或移动是否合法！。", L"错误", MB_OK | MB_ICONERROR);
         }
@@ -1504,27 +2206,43 @@ public:
     // 处理下移按钮点击
     void OnMoveDownButtonClick()
     {
+        if (WritePending())
+            return;
+
         int selectedIndex = (int)SendMessageW(hListBox, LB_GETCURSEL, 0, 0);
-        if (selectedIndex == LB_ERR || selectedIndex >= (int)apps.size() - 1)
+        if (selectedIndex == LB_ERR || selectedIndex >= (int)listView.RowCount() - 1)
         {
             MessageBoxW(hMainWindow, L"请先选择一个程序，并且不能是最后一个项目！", L"提示", MB_OK | MB_ICONINFORMATION);
             return;
         }
 
         // 只允许移动本程序创建的项
-        if (!apps[selectedIndex].isCustom)
+        if (!VisibleApp(selectedIndex).isCustom)
         {
             MessageBoxW(hMainWindow, L"只能移动本程序创建的项目（✅ 标记的项）", L"提示", MB_OK | MB_ICONINFORMATION);
             return;
         }
+        if (VisibleApp(selectedIndex).depth > 0)
+        {
+            MessageBoxW(hMainWindow, L"分组内的项按键名排序 - 请改为移动分组。", L"提示", MB_OK | MB_ICONINFORMATION);
+            return;
+        }
 
-        if (MoveRegistryItem(selectedIndex, selectedIndex + 1))
+        // 跳过展开分组的成员
+        int targetIndex = selectedIndex + 1;
+        while (targetIndex > 0 && targetIndex < (int)listView.RowCount() - 1 && VisibleApp(targetIndex).depth > 0)
+            targetIndex += 1;
+        // 底部已展开的分组：成员之后没有可移到的位置
+        if (VisibleApp(targetIndex).depth > 0)
         {
-            // 更新选中项
-            SendMessageW(hListBox, LB_SETCURSEL, selectedIndex + 1, 0);
-            MessageBoxW(hMainWindow, L"项目已下移！右键菜单中的顺序也已更新。", L"成功", MB_OK | MB_ICONINFORMATION);
+            MessageBoxW(hMainWindow, L"请先选择一个程序，并且不能是最后一个项目！", L"提示", MB_OK | MB_ICONINFORMATION);
+            return;
         }
-        else
+
+        // 选中状态跟随该项；重命名完成后报告结果
+        if (!MoveRegistryItem(selectedIndex, targetIndex,
+                              L"项目已下移！右键菜单中的顺序也已更新。",
+                              L"下移失败！请检查是否以管理员身份运行或移动是否合法！"))
         {
             MessageBoxW(hMainWindow, L"下移失败！请检查是否以管理员身份运行或移动是否合法！", L"错误", MB_OK | MB_ICONERROR);
         }
@@ -1545,17 +2263,10 @@ public:
         ofn.nFilterIndex = 1;
         ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
 
-        if (GetOpenFileNameW(&ofn))
+        if (GetOpenFileNameW(&ofn) && !WritePending())
         {
-            if (AddAppToContextMenu(fileName))
-            {
-                MessageBoxW(hMainWindow,
-                            L"程序已成功添加到桌面右键菜单！\n"
-                            L"程序图标也会显示在菜单中。\n"
-                            L"可能需要刷新桌面或重新启动资源管理器才能看到变化。",
-                            L"成功", MB_OK | MB_ICONINFORMATION);
-            }
-            else
+            // 写入完成后报告成功
+            if (!AddAppToContextMenu(fileName))
             {
                 MessageBoxW(hMainWindow, L"添加程序失败！请以管理员身份运行程序。", L"错误", MB_OK | MB_ICONERROR);
             }
@@ -1571,18 +2282,21 @@ public:
             return;
         }
 
-        AppEntry &app = apps[selectedIndex];
+        AppEntry &app = VisibleApp(selectedIndex);
+        std::wstring keyName = app.name.str();
         std::wstring confirmMsg = L"确定要从桌面右键菜单中删除这个程序吗？\n\n";
         confirmMsg += L"名称: " + app.displayName + L"\n";
         confirmMsg += L"路径: " + app.path;
 
         if (MessageBoxW(hMainWindow, confirmMsg.c_str(), L"确认删除", MB_YESNO | MB_ICONQUESTION) == IDYES)
         {
-            if (RemoveAppFromContextMenu(selectedIndex))
-            {
-                MessageBoxW(hMainWindow, L"程序已从桌面右键菜单中删除！", L"成功", MB_OK | MB_ICONINFORMATION);
-            }
-            else
+            // 对话框打开期间列表可能已被注册表更改修补
+            selectedIndex = FindAppIndex(keyName);
+            if (WritePending())
+                return;
+
+            // 删除完成后报告成功
+            if (!RemoveAppFromContextMenu(selectedIndex))
             {
                 MessageBoxW(hMainWindow, L"删除程序失败！", L"错误", MB_OK | MB_ICONERROR);
             }
@@ -1600,17 +2314,9 @@ public:
         // 显示正在刷新的提示
         MessageBoxW(hMainWindow, L"正在从注册表重新加载菜单项...", L"刷新", MB_OK | MB_ICONINFORMATION);
 
-        // 强制从注册表重新读取所有菜单项
+        // 强制从注册表重新读取所有菜单项 - 完成时显示统计
+        reloadReport = true;
         ForceReloadFromRegistry();
-
-        // 显示结果统计
-        wchar_t resultMsg[256];
-        swprintf(resultMsg, 256, L"刷新完成！\n总共找到 %d 个菜单项\n其中 %d 个是本程序创建的",
-                 (int)allApps.size(),
-                 (int)std::count_if(allApps.begin(), allApps.end(), [](const AppEntry &app)
-                                    { return app.isCustom; }));
-
-        MessageBoxW(hMainWindow, resultMsg, L"刷新完成", MB_OK | MB_ICONINFORMATION);
     }
 
     void OnShowAllCheckboxClick()
@@ -1679,24 +2385,70 @@ public:
             }
             else if (LOWORD(wParam) == 1101)
             { // 上下文菜单：在注册表中打开
-                if (contextMenuIndex >= 0 && contextMenuIndex < (int)apps.size())
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
                 {
                     OpenRegistryLocation(contextMenuIndex);
                 }
             }
             else if (LOWORD(wParam) == 1102)
             { // 上下文菜单：刷新此项
-                if (contextMenuIndex >= 0 && contextMenuIndex < (int)apps.size())
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
                 {
-                    RefreshSingleItemFromRegistry(apps[contextMenuIndex].name);
+                    RefreshSingleItemFromRegistry(VisibleApp(contextMenuIndex).name.str());
                     MessageBoxW(hMainWindow, L"已刷新选中项！", L"刷新", MB_OK | MB_ICONINFORMATION);
                 }
             }
+            else if (LOWORD(wParam) == 1106)
+            { // 右键菜单：检查失效项
+                CheckItemHealth(true, true);
+            }
+            else if (LOWORD(wParam) == 1103)
+            { // 右键菜单：新建分组
+                CreateMenuGroup();
+            }
+            else if (LOWORD(wParam) == 1104)
+            { // 右键菜单：移出分组
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
+                {
+                    PooledString name = VisibleApp(contextMenuIndex).name;
+                    MoveIntoGroup(contextMenuIndex, ParentGroupPath(ParentGroupPath(name)));
+                }
+            }
+            else if (LOWORD(wParam) == 1105)
+            { // 右键菜单：解散分组
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
+                {
+                    FlattenMenuGroup(contextMenuIndex);
+                }
+            }
+            else if (LOWORD(wParam) == 1107)
+            { // 右键菜单或 Ctrl+Z：撤销
+                StepHistory(false);
+            }
+            else if (LOWORD(wParam) == 1108)
+            { // 右键菜单或 Ctrl+Y：重做
+                StepHistory(true);
+            }
+            else if (LOWORD(wParam) >= 1200 && LOWORD(wParam) < 1200 + groupMenuKeys.size())
+            { // 右键菜单：移入分组
+                if (contextMenuIndex >= 0 && contextMenuIndex < (int)listView.RowCount())
+                {
+                    MoveIntoGroup(contextMenuIndex, groupMenuKeys[LOWORD(wParam) - 1200]);
+                }
+            }
             break;
 
+        case WM_DRAWITEM:
+            if (wParam == 1001)
+            {
+                DrawListItem((const DRAWITEMSTRUCT *)lParam);
+                return TRUE;
+            }
+            return DefWindowProcW(hwnd, uMsg, wParam, lParam);
+
         case WM_SIZE:
             // 窗口大小改变时，重新计算水平滚动范围
-            if (hListBox && !apps.empty())
+            if (hListBox && !listView.Empty())
             {
                 // 延迟重新计算，确保布局已完成
                 SetTimer(hMainWindow, 1001, 100, NULL); // 100ms 后重新计算
@@ -1711,6 +2463,24 @@ public:
             }
             break;
 
+        case WM_APP_WORKER_DONE:
+            ioWorker.RunCompletions();
+            iconWorker.RunCompletions();
+            break;
+
+        case WM_APP_REGISTRY_CHANGED:
+            shellWatcher.Acknowledge();
+            if (isEditing)
+            {
+                // 不要在编辑框下方更换列表
+                registrySyncDeferred = true;
+            }
+            else
+            {
+                SyncFromRegistry();
+            }
+            break;
+
         case WM_CONTEXTMENU:
             // 处理右键菜单
             if ((HWND)wParam == hListBox)
@@ -1726,7 +2496,7 @@ public:
                 if (HIWORD(index) == 0 && LOWORD(index) != LB_ERR) // 确保在项范围内
                 {
                     int itemIndex = LOWORD(index);
-                    if (itemIndex >= 0 && itemIndex < (int)apps.size())
+                    if (itemIndex >= 0 && itemIndex < (int)listView.RowCount())
                     {
                         // 选中该项
                         SendMessageW(hListBox, LB_SETCURSEL, itemIndex, 0);
@@ -1747,7 +2517,7 @@ public:
                 if (HIWORD(index) == 0 && LOWORD(index) != LB_ERR)
                 {
                     int itemIndex = LOWORD(index);
-                    if (itemIndex >= 0 && itemIndex < (int)apps.size())
+                    if (itemIndex >= 0 && itemIndex < (int)listView.RowCount())
                     {
                         // 选中该项
                         SendMessageW(hListBox, LB_SETCURSEL, itemIndex, 0);
@@ -1759,11 +2529,8 @@ public:
 
         case WM_GETMINMAXINFO:
         {
-            // 获取DPI缩放因子
-            HDC hdc = GetDC(hMainWindow);
-            int dpiX = GetDeviceCaps(hdc, LOGPIXELSX);
-            ReleaseDC(hMainWindow, hdc);
-            float scale = dpiX / 96.0f;
+            // DPI缩放因子，启动时读取
+            float scale = screenDpi / 96.0f;
 
             // 根据DPI缩放锁定窗口大小
             MINMAXINFO *mmi = (MINMAXINFO *)lParam;
@@ -1775,13 +2542,24 @@ public:
         break;
 
         case WM_DESTROY:
+        {
+            // 有任务进行中时跟踪器可能领先于列表，此时不保存快照
+            bool idle = ioWorker.Idle();
+            ioWorker.Stop();
+            if (idle)
+                SaveMenuSnapshot();
+            iconWorker.Stop();
+            SaveIconCache();
+            shellNotify.Stop(); // 如有尚未发送的广播，在此发送
+            shellWatcher.Stop();
             if (hContextMenu)
             {
                 DestroyMenu(hContextMenu);
                 hContextMenu = NULL;
             }
             PostQuitMessage(0);
-            break;
+        }
+        break;
 
         default:
             return DefWindowProcW(hwnd, uMsg, wParam, lParam);
@@ -1795,6 +2573,9 @@ public:
         MSG msg = {};
         while (GetMessage(&msg, NULL, 0, 0))
         {
+            // 编辑名称时 Ctrl+Z 留给编辑框自己处理
+            if (!isEditing && hAccelerators && TranslateAcceleratorW(hMainWindow, hAccelerators, &msg))
+                continue;
             TranslateMessage(&msg);
             DispatchMessage(&msg);
         }
@@ -1802,9 +2583,101 @@ public:
     }
 };
 
+// 读取 "apply" 使用的文本文件：UTF-8（可带 BOM）或带 BOM 的 UTF-16LE
+static bool ReadTextFile(const std::wstring &path, std::wstring &text)
+{
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    std::string bytes;
+    char buffer[65536];
+    DWORD bytesRead = 0;
+    while (ReadFile(hFile, buffer, sizeof(buffer), &bytesRead, NULL) && bytesRead > 0)
+        bytes.append(buffer, bytesRead);
+    CloseHandle(hFile);
+
+    if (bytes.size() >= 2 && (unsigned char)bytes[0] == 0xFF && (unsigned char)bytes[1] == 0xFE)
+        text.assign((const wchar_t *)(bytes.data() + 2), (bytes.size() - 2) / sizeof(wchar_t));
+    else
+        text = WideFromUtf8(bytes);
+    return true;
+}
+
+// 将命令行模式的输出写到控制台；标准输出被重定向时写入 UTF-8
+static void WriteOutput(const std::string &utf8)
+{
+    HANDLE hOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (hOutput == NULL || hOutput == INVALID_HANDLE_VALUE)
+        hOutput = CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (hOutput == INVALID_HANDLE_VALUE)
+        return;
+
+    DWORD mode, written;
+    if (GetConsoleMode(hOutput, &mode))
+    {
+        std::wstring text = WideFromUtf8(utf8);
+        WriteConsoleW(hOutput, text.c_str(), (DWORD)text.length(), &written, NULL);
+    }
+    else
+    {
+        WriteFile(hOutput, utf8.data(), (DWORD)utf8.size(), &written, NULL);
+    }
+}
+
+// 命令行模式 - 无窗口、无消息框，在标准输出上输出一个 JSON 结果
+static int RunHeadless(int argc, wchar_t **argv)
+{
+    // 附加到启动本程序的命令行窗口，使输出显示在其中
+    AttachConsole(ATTACH_PARENT_PROCESS);
+
+    // 不启动计时线程：本次运行的更改由下面的 Flush 统一通告
+    Win32RegistryBackend registry;
+    Win32ShellNotifier shellNotifier;
+    ShellNotifyScheduler shellNotify(shellNotifier);
+    ContextMenuStore store(registry, [&shellNotify]()
+                           { shellNotify.Request(); });
+
+    // 使用单独的日志 - 窗口可能同时在运行并写入自己的日志。
+    // 先还原之前运行中只写了一半的内容；失败时下次运行再试。
+    Win32JournalFile journalFile;
+    RegistryJournal journal(journalFile);
+    if (journalFile.Open(LocalDataPath(L"registry-cli.journal", true)))
+    {
+        JournalRecoveryStats stats;
+        RecoverRegistryJournal(registry, journal, RecoverRollBack, &stats);
+        if (stats.interrupted > 0)
+            shellNotify.Request();
+        store.SetJournal(&journal);
+    }
+    Win32FileProbe fileProbe;
+    ContextMenuCli cli(store, ReadTextFile, fileProbe);
+
+    JsonWriter json;
+    std::vector<std::wstring> args(argv + 1, argv + argc);
+    int exitCode = cli.Run(args, json);
+
+    // 无论改动多少项，整个运行只通知系统一次
+    shellNotify.Flush();
+
+    WriteOutput(json.Text() + "\n");
+    return exitCode;
+}
+
 // 程序入口点
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
 {
+    // 带任何参数时进入命令行模式
+    int argc = 0;
+    wchar_t **argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (argv && argc > 1)
+    {
+        int exitCode = RunHeadless(argc, argv);
+        LocalFree(argv);
+        return exitCode;
+    }
+    if (argv)
+        LocalFree(argv);
 
     // 设置DPI感知的兼容性方法
     HMODULE hUser32 = LoadLibraryW(L"user32.dll");
@@ -1860,7 +2733,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         return 1;
     }
 
-    RightClickManager manager;
+    Win32RegistryBackend registry;
+    RightClickManager manager(registry);
 
     // 检查是否已有实例在运行
     if (manager.IsAlreadyRunning())
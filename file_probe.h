@@ -0,0 +1,60 @@
+#pragma once
+
+// File existence abstraction
+//
+// The health check only needs to know whether the program and icon a verb
+// points at are still there. FileProbe answers that for one path, so the
+// check runs against the real file system (Win32FileProbe) or against an
+// in-memory set of paths (MemoryFileProbe) on any platform.
+//
+// Paths are passed as the registry has them: they may contain environment
+// variables and may be bare file names that Windows finds through the
+// search path, so resolving them is the probe's job.
+//
+// Exists is called from several threads at once and must be safe for that.
+
+#include "registry_backend.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+class FileProbe
+{
+public:
+    virtual ~FileProbe() {}
+
+    // Whether path names an existing file or directory
+    virtual bool Exists(const std::wstring &path) = 0;
+};
+
+// Paths held in memory, compared case-insensitively like Windows does. Nothing is expanded or
+// searched. A per-call delay stands in for disk or network latency when benchmarking.
+class MemoryFileProbe : public FileProbe
+{
+private:
+    std::unordered_set<std::wstring, RegistryNameHash, RegistryNameEqual> files;
+    std::chrono::microseconds latency;
+    std::atomic<std::size_t> probes;
+
+public:
+    MemoryFileProbe() : latency(0), probes(0) {}
+
+    // Not safe while Exists runs on other threads - fill the set first
+    void AddFile(const std::wstring &path) { files.insert(path); }
+    void RemoveFile(const std::wstring &path) { files.erase(path); }
+    void SetLatency(std::chrono::microseconds delay) { latency = delay; }
+
+    // Number of Exists calls so far
+    std::size_t ProbeCount() const { return probes; }
+
+    bool Exists(const std::wstring &path)
+    {
+        probes++;
+        if (latency.count() > 0)
+            std::this_thread::sleep_for(latency);
+        return files.count(path) > 0;
+    }
+};
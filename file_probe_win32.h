@@ -0,0 +1,49 @@
+#pragma once
+
+// Win32 file probe - environment variables expanded, bare names found like CreateProcess finds them
+
+#include <windows.h>
+
+#include "file_probe.h"
+
+#include <vector>
+
+// "%SystemRoot%\system32\..." is common in verbs and icons; path itself if nothing expands
+inline std::wstring ExpandPathVariables(const std::wstring &path)
+{
+    if (path.find(L'%') == std::wstring::npos)
+        return path;
+    DWORD size = ExpandEnvironmentStringsW(path.c_str(), NULL, 0);
+    if (size == 0)
+        return path;
+    std::vector<wchar_t> buffer(size);
+    if (ExpandEnvironmentStringsW(path.c_str(), buffer.data(), size) == 0)
+        return path;
+    return buffer.data();
+}
+
+class Win32FileProbe : public FileProbe
+{
+public:
+    bool Exists(const std::wstring &path)
+    {
+        std::wstring expanded = ExpandPathVariables(path);
+
+        // "notepad", "shell32.dll": application directory, system directories, then PATH
+        if (expanded.find_first_of(L"\\/:") == std::wstring::npos)
+        {
+            wchar_t found[MAX_PATH];
+            return SearchPathW(NULL, expanded.c_str(), L".exe", MAX_PATH, found, NULL) > 0;
+        }
+
+        if (GetFileAttributesW(expanded.c_str()) != INVALID_FILE_ATTRIBUTES)
+            return true;
+
+        // CreateProcess appends ".exe" to a program path without an extension
+        std::size_t name = expanded.find_last_of(L"\\/");
+        if (expanded.find(L'.', name == std::wstring::npos ? 0 : name) != std::wstring::npos)
+            return false;
+        expanded += L".exe";
+        return GetFileAttributesW(expanded.c_str()) != INVALID_FILE_ATTRIBUTES;
+    }
+};
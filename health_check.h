@@ -0,0 +1,151 @@
+#pragma once
+
+// Broken entry health check
+//
+// A verb whose program was uninstalled still shows up in the menu, and
+// Explorer pays for each one while building it. HealthChecker looks at
+// every entry's program and icon file and flags the ones that are gone.
+//
+// Each distinct path is probed once per check, however many entries share
+// it, and the answer is cached in the HealthChecker so later checks (after
+// a reload, say) only probe paths they haven't seen; Forget drops the cache
+// when a fresh look is wanted. The probes that remain are spread over a
+// small pool of threads which claim them in shards from a shared counter,
+// as the HKCR audit does, so one slow network path doesn't stall the rest.
+//
+// Groups and verbs without a command (DelegateExecute handlers) have no
+// program to check; icons that are not files (resource URIs) are skipped.
+
+#include "context_menu_model.h"
+#include "file_probe.h"
+
+#include <atomic>
+#include <thread>
+
+// What a check found wrong with an entry
+enum HealthFlags : unsigned
+{
+    HealthOk = 0,
+    HealthMissingProgram = 1,
+    HealthMissingIcon = 2
+};
+
+struct HealthStats
+{
+    std::size_t paths;   // Distinct paths the entries refer to
+    std::size_t probed;  // Of those, probed now - the rest came from the cache
+    std::size_t broken;  // Entries with at least one flag
+    unsigned threads;
+};
+
+class HealthChecker
+{
+private:
+    static const unsigned kMaxThreads = 8;
+    static const std::size_t kShardSize = 16;
+
+    FileProbe &probe;
+    std::unordered_map<std::wstring, bool, RegistryNameHash, RegistryNameEqual> cache; // Path -> exists
+
+    HealthChecker(const HealthChecker &);
+    HealthChecker &operator=(const HealthChecker &);
+
+public:
+    explicit HealthChecker(FileProbe &fileProbe) : probe(fileProbe) {}
+
+    // Drop the cached answers, so the next check probes every path again
+    void Forget() { cache.clear(); }
+
+    std::size_t CacheSize() const { return cache.size(); }
+
+    // Check every entry; health receives a HealthFlags mask per entry, in entry order.
+    // threads 0 picks one per hardware thread, at most kMaxThreads. Not thread safe itself -
+    // call it from one thread at a time.
+    HealthStats Check(const std::vector<AppEntry> &entries, std::vector<unsigned> &health, unsigned threads = 0)
+    {
+        // Every path an entry refers to, once; slots (keyed by views of the entries' strings) index into paths
+        std::vector<std::wstring> paths;
+        std::unordered_map<std::wstring_view, std::size_t, RegistryNameHash, RegistryNameEqual> slots;
+        std::vector<std::size_t> programSlot(entries.size(), SIZE_MAX);
+        std::vector<std::size_t> iconSlot(entries.size(), SIZE_MAX);
+        auto slotOf = [&](std::wstring_view path) -> std::size_t
+        {
+            auto found = slots.find(path);
+            if (found != slots.end())
+                return found->second;
+            slots.emplace(path, paths.size());
+            paths.push_back(std::wstring(path));
+            return paths.size() - 1;
+        };
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            const AppEntry &app = entries[i];
+            if (app.isGroup)
+                continue;
+            if (!app.path.empty())
+                programSlot[i] = slotOf(app.path);
+            std::wstring_view icon = SplitIconLocation(app.icon, NULL);
+            if (!icon.empty())
+                iconSlot[i] = slotOf(icon);
+        }
+
+        // Cached answers first; only the rest is probed
+        std::vector<char> exists(paths.size(), 0);
+        std::vector<std::size_t> pending;
+        for (std::size_t i = 0; i < paths.size(); i++)
+        {
+            auto cached = cache.find(paths[i]);
+            if (cached != cache.end())
+                exists[i] = cached->second;
+            else
+                pending.push_back(i);
+        }
+
+        if (threads == 0)
+            threads = std::thread::hardware_concurrency();
+        if (threads > kMaxThreads)
+            threads = kMaxThreads;
+        std::size_t shards = (pending.size() + kShardSize - 1) / kShardSize;
+        if (threads > shards)
+            threads = (unsigned)shards;
+        if (threads == 0)
+            threads = 1;
+
+        // Each thread writes only the slots of the shards it claimed
+        std::atomic<std::size_t> nextShard(0);
+        auto scan = [&]()
+        {
+            for (;;)
+            {
+                std::size_t first = nextShard.fetch_add(1) * kShardSize;
+                if (first >= pending.size())
+                    return;
+                std::size_t last = std::min(first + kShardSize, pending.size());
+                for (std::size_t i = first; i < last; i++)
+                    exists[pending[i]] = probe.Exists(paths[pending[i]]);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; i++)
+            pool.push_back(std::thread(scan));
+        scan();
+        for (auto &worker : pool)
+            worker.join();
+
+        for (std::size_t i : pending)
+            cache[paths[i]] = exists[i] != 0;
+
+        HealthStats stats = {paths.size(), pending.size(), 0, threads};
+        health.assign(entries.size(), HealthOk);
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            if (programSlot[i] != SIZE_MAX && !exists[programSlot[i]])
+                health[i] |= HealthMissingProgram;
+            if (iconSlot[i] != SIZE_MAX && !exists[iconSlot[i]])
+                health[i] |= HealthMissingIcon;
+            if (health[i] != HealthOk)
+                stats.broken++;
+        }
+        return stats;
+    }
+};
@@ -0,0 +1,482 @@
+#pragma once
+
+// Icon extraction cache
+//
+// Extracting an icon loads the module it lives in, so it is far too slow to
+// do while painting the list. IconCache keeps extracted icons keyed by
+// (path, index, size, DPI); the window asks it for each row it paints and
+// queues the misses, and a worker extracts them in a batch (Resolve) through
+// an IconSource - the shell on Windows, a synthetic source in the tests.
+//
+// Pixels live in an atlas of slots that maps one to one onto the window's
+// image list. Many verbs show the same icon (every "Open with VS Code" entry,
+// shell32's generic icons under different paths), so a freshly extracted
+// bitmap that matches one already in the atlas shares its slot: slots are
+// reference counted and reused once the last entry using them is evicted.
+// Entries are evicted least recently used first once there are more than
+// the limit. A failed extraction is remembered too, so a broken icon isn't
+// retried on every paint.
+//
+// Save and Load carry the cache across runs. Loaded entries are shown at
+// once but are unverified: the next Resolve compares each one's file stamp
+// (the source's notion of the file's version, its write time on Windows)
+// and extracts again only those whose file changed.
+//
+// All members are thread safe; extraction runs outside the lock, so painting
+// never waits for it.
+
+#include "registry_backend.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Find results besides a slot
+const int kIconNone = -1;    // The key has no icon (extraction failed)
+const int kIconUnknown = -2; // Not in the cache yet
+
+struct IconKey
+{
+    std::wstring path; // As the registry has it - the source expands and searches
+    int index;         // Icon index, or -resource id
+    int size;          // Pixels, already scaled for dpi
+    int dpi;
+};
+
+struct IconKeyHash
+{
+    std::size_t operator()(const IconKey &key) const
+    {
+        std::size_t hash = HashRegistryName(key.path.c_str(), key.path.length());
+        hash ^= ((std::size_t)(unsigned)key.index * 31u + (std::size_t)(unsigned)key.size) * 1099511628211ull;
+        return hash ^ (std::size_t)(unsigned)key.dpi * 16777619u;
+    }
+};
+
+struct IconKeyEqual
+{
+    bool operator()(const IconKey &a, const IconKey &b) const
+    {
+        return a.index == b.index && a.size == b.size && a.dpi == b.dpi && CompareRegistryNames(a.path, b.path) == 0;
+    }
+};
+
+// 32-bit BGRA pixels with straight alpha, top row first
+struct IconBitmap
+{
+    int width;
+    int height;
+    std::vector<std::uint32_t> pixels;
+
+    IconBitmap() : width(0), height(0) {}
+};
+
+class IconSource
+{
+public:
+    virtual ~IconSource() {}
+
+    // Extract the icon key names, at key.size pixels; false if the file or icon doesn't exist
+    virtual bool Extract(const IconKey &key, IconBitmap &bitmap) = 0;
+
+    // Version of the file at path, 0 if it is missing; changes whenever the file does
+    virtual std::uint64_t FileStamp(const std::wstring &path) = 0;
+};
+
+struct IconCacheStats
+{
+    std::size_t lookups;     // Find calls
+    std::size_t hits;        // Of those, answered from the cache
+    std::size_t extractions; // Extract calls made by Resolve
+    std::size_t verified;    // Loaded entries whose stamp still matched
+    std::size_t evictions;
+    std::size_t shared;      // Extractions that reused an atlas slot with identical pixels
+};
+
+class IconCache
+{
+private:
+    static const std::uint32_t kFileMagic = 0x43494352; // "RCIC"
+    static const std::uint32_t kFileVersion = 1;
+    static const int kMaxIconSize = 256;
+
+    struct Entry
+    {
+        int slot;                               // Atlas slot, or kIconNone
+        std::uint64_t stamp;                    // FileStamp when extracted
+        bool verified;                          // Extracted or checked in this run
+        std::list<IconKey>::iterator recent;    // Position in the LRU list
+    };
+
+    struct Slot
+    {
+        IconBitmap bitmap;
+        std::uint64_t hash;
+        unsigned references; // 0: free
+    };
+
+    std::size_t maxEntries;
+    mutable std::mutex lock;
+    std::unordered_map<IconKey, Entry, IconKeyHash, IconKeyEqual> entries;
+    std::list<IconKey> recent; // Most recently used first
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    std::unordered_multimap<std::uint64_t, int> slotsByHash;
+    IconCacheStats stats;
+
+    IconCache(const IconCache &);
+    IconCache &operator=(const IconCache &);
+
+    static std::uint64_t HashBitmap(const IconBitmap &bitmap)
+    {
+        std::uint64_t hash = 14695981039346656037ull ^ ((std::uint64_t)bitmap.width << 32 | (std::uint32_t)bitmap.height);
+        for (std::uint32_t pixel : bitmap.pixels)
+            hash = (hash ^ pixel) * 1099511628211ull;
+        return hash;
+    }
+
+    // Lock held: a slot holding bitmap - an identical one if there is one - with a reference taken.
+    // changed receives the slot if its pixels are new.
+    int AddReference(IconBitmap &bitmap, std::vector<int> &changed)
+    {
+        std::uint64_t hash = HashBitmap(bitmap);
+        auto range = slotsByHash.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            Slot &slot = slots[it->second];
+            if (slot.bitmap.width == bitmap.width && slot.bitmap.height == bitmap.height &&
+                slot.bitmap.pixels == bitmap.pixels)
+            {
+                slot.references++;
+                stats.shared++;
+                return it->second;
+            }
+        }
+
+        int index;
+        if (!freeSlots.empty())
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            index = (int)slots.size();
+            slots.push_back(Slot());
+        }
+        slots[index].bitmap = std::move(bitmap);
+        slots[index].hash = hash;
+        slots[index].references = 1;
+        slotsByHash.emplace(hash, index);
+        changed.push_back(index);
+        return index;
+    }
+
+    // Lock held
+    void ReleaseReference(int index)
+    {
+        if (index < 0)
+            return;
+        Slot &slot = slots[index];
+        if (--slot.references > 0)
+            return;
+        auto range = slotsByHash.equal_range(slot.hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == index)
+            {
+                slotsByHash.erase(it);
+                break;
+            }
+        }
+        slot.bitmap = IconBitmap();
+        freeSlots.push_back(index);
+    }
+
+    // Lock held: add or replace key's entry, then evict down to the limit
+    void Store(const IconKey &key, int slot, std::uint64_t stamp, bool verified)
+    {
+        auto found = entries.find(key);
+        if (found != entries.end())
+        {
+            ReleaseReference(found->second.slot);
+            found->second.slot = slot;
+            found->second.stamp = stamp;
+            found->second.verified = verified;
+            recent.splice(recent.begin(), recent, found->second.recent);
+        }
+        else
+        {
+            recent.push_front(key);
+            Entry entry = {slot, stamp, verified, recent.begin()};
+            entries.emplace(key, entry);
+        }
+
+        while (entries.size() > maxEntries)
+        {
+            auto oldest = entries.find(recent.back());
+            ReleaseReference(oldest->second.slot);
+            entries.erase(oldest);
+            recent.pop_back();
+            stats.evictions++;
+        }
+    }
+
+    static void Put32(std::vector<std::uint8_t> &out, std::uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            out.push_back((std::uint8_t)(value >> (8 * i)));
+    }
+
+    static bool Get32(const std::uint8_t *&data, const std::uint8_t *end, std::uint32_t &value)
+    {
+        if (end - data < 4)
+            return false;
+        value = 0;
+        for (int i = 0; i < 4; i++)
+            value |= (std::uint32_t)data[i] << (8 * i);
+        data += 4;
+        return true;
+    }
+
+public:
+    explicit IconCache(std::size_t maximumEntries = 4096)
+        : maxEntries(maximumEntries ? maximumEntries : 1), stats() {}
+
+    // Slot showing key, kIconNone or kIconUnknown. stale (optional) is set when the answer came
+    // from a previous run and hasn't been checked yet - Resolve the key to check it.
+    int Find(const IconKey &key, bool *stale = NULL)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stats.lookups++;
+        if (stale)
+            *stale = false;
+        auto found = entries.find(key);
+        if (found == entries.end())
+            return kIconUnknown;
+        stats.hits++;
+        recent.splice(recent.begin(), recent, found->second.recent);
+        if (stale)
+            *stale = !found->second.verified;
+        return found->second.slot;
+    }
+
+    // Extract the keys not in the cache and check the stale ones, extracting again if their file
+    // changed. changed receives every atlas slot whose pixels are new, for the image list. Stops
+    // early once cancelled (optional) is set; the keys left over stay as they were.
+    void Resolve(IconSource &source, const std::vector<IconKey> &keys, std::vector<int> &changed,
+                 const std::atomic<bool> *cancelled = NULL)
+    {
+        for (const IconKey &key : keys)
+        {
+            if (cancelled && *cancelled)
+                return;
+            std::uint64_t cachedStamp = 0;
+            bool cached = false;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto found = entries.find(key);
+                if (found != entries.end())
+                {
+                    if (found->second.verified)
+                        continue; // Queued twice
+                    cached = true;
+                    cachedStamp = found->second.stamp;
+                }
+            }
+
+            std::uint64_t stamp = source.FileStamp(key.path);
+            if (cached && stamp == cachedStamp && stamp != 0)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto found = entries.find(key);
+                if (found != entries.end())
+                    found->second.verified = true;
+                stats.verified++;
+                continue;
+            }
+
+            IconBitmap bitmap;
+            bool extracted = source.Extract(key, bitmap) && bitmap.width > 0 && bitmap.height > 0 &&
+                             bitmap.pixels.size() == (std::size_t)bitmap.width * bitmap.height;
+
+            std::lock_guard<std::mutex> guard(lock);
+            stats.extractions++;
+            int slot = extracted ? AddReference(bitmap, changed) : kIconNone;
+            Store(key, slot, stamp, true);
+        }
+    }
+
+    // Copy of a slot's pixels; false if the slot is free
+    bool Bitmap(int slot, IconBitmap &bitmap) const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (slot < 0 || slot >= (int)slots.size() || slots[slot].references == 0)
+            return false;
+        bitmap = slots[slot].bitmap;
+        return true;
+    }
+
+    // Number of atlas slots, free ones included - the image list needs as many images
+    int SlotCount() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return (int)slots.size();
+    }
+
+    std::size_t Size() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return entries.size();
+    }
+
+    IconCacheStats Stats() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return stats;
+    }
+
+    // Serialise entries (most recently used first) and the slots they use; free slots are left out
+    void Save(std::vector<std::uint8_t> &out) const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        out.clear();
+        Put32(out, kFileMagic);
+        Put32(out, kFileVersion);
+
+        std::vector<int> savedSlot(slots.size(), -1);
+        std::uint32_t slotCount = 0;
+        for (std::size_t i = 0; i < slots.size(); i++)
+        {
+            if (slots[i].references > 0)
+                savedSlot[i] = (int)slotCount++;
+        }
+        Put32(out, slotCount);
+        for (const Slot &slot : slots)
+        {
+            if (slot.references == 0)
+                continue;
+            Put32(out, (std::uint32_t)slot.bitmap.width);
+            Put32(out, (std::uint32_t)slot.bitmap.height);
+            for (std::uint32_t pixel : slot.bitmap.pixels)
+                Put32(out, pixel);
+        }
+
+        Put32(out, (std::uint32_t)entries.size());
+        for (const IconKey &key : recent)
+        {
+            const Entry &entry = entries.find(key)->second;
+            Put32(out, (std::uint32_t)key.path.length());
+            for (wchar_t c : key.path)
+                Put32(out, (std::uint32_t)c);
+            Put32(out, (std::uint32_t)key.index);
+            Put32(out, (std::uint32_t)key.size);
+            Put32(out, (std::uint32_t)key.dpi);
+            Put32(out, (std::uint32_t)entry.stamp);
+            Put32(out, (std::uint32_t)(entry.stamp >> 32));
+            Put32(out, (std::uint32_t)(entry.slot < 0 ? entry.slot : savedSlot[entry.slot]));
+        }
+    }
+
+    // Replace the contents with a saved cache; changed receives every slot in use. All entries come
+    // back stale. False - and the cache left empty - if the data is truncated, from another version
+    // or inconsistent.
+    bool Load(const std::uint8_t *data, std::size_t size, std::vector<int> &changed)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.clear();
+        recent.clear();
+        slots.clear();
+        freeSlots.clear();
+        slotsByHash.clear();
+
+        const std::uint8_t *end = data + size;
+        std::uint32_t magic, version, slotCount;
+        if (!Get32(data, end, magic) || magic != kFileMagic || !Get32(data, end, version) || version != kFileVersion ||
+            !Get32(data, end, slotCount) || slotCount > (std::size_t)(end - data) / 12)
+            return false;
+
+        bool valid = true;
+        std::vector<Slot> loaded(slotCount);
+        for (std::uint32_t i = 0; i < slotCount && valid; i++)
+        {
+            std::uint32_t width, height;
+            valid = Get32(data, end, width) && Get32(data, end, height) && width > 0 && height > 0 &&
+                    width <= kMaxIconSize && height <= kMaxIconSize &&
+                    (std::size_t)(end - data) / 4 >= (std::size_t)width * height;
+            if (!valid)
+                break;
+            IconBitmap &bitmap = loaded[i].bitmap;
+            bitmap.width = (int)width;
+            bitmap.height = (int)height;
+            bitmap.pixels.resize((std::size_t)width * height);
+            for (std::uint32_t &pixel : bitmap.pixels)
+                Get32(data, end, pixel);
+            loaded[i].hash = HashBitmap(bitmap);
+            loaded[i].references = 0;
+        }
+
+        std::uint32_t entryCount = 0;
+        valid = valid && Get32(data, end, entryCount);
+        for (std::uint32_t i = 0; i < entryCount && valid; i++)
+        {
+            std::uint32_t length = 0;
+            valid = Get32(data, end, length) && length <= 32767 && (std::size_t)(end - data) / 4 >= length;
+            if (!valid)
+                break;
+            IconKey key;
+            key.path.resize(length);
+            for (std::uint32_t c = 0; c < length; c++)
+            {
+                std::uint32_t unit = 0;
+                Get32(data, end, unit);
+                key.path[c] = (wchar_t)unit;
+            }
+            std::uint32_t index, iconSize, dpi, stampLow, stampHigh, slot;
+            valid = Get32(data, end, index) && Get32(data, end, iconSize) && Get32(data, end, dpi) &&
+                    Get32(data, end, stampLow) && Get32(data, end, stampHigh) && Get32(data, end, slot) &&
+                    ((int)slot == kIconNone || slot < slotCount);
+            if (!valid || entries.size() >= maxEntries)
+                continue;
+            key.index = (int)index;
+            key.size = (int)iconSize;
+            key.dpi = (int)dpi;
+            if ((int)slot != kIconNone)
+                loaded[slot].references++;
+
+            // Saved most recent first, so appending keeps the order
+            recent.push_back(key);
+            Entry entry = {(int)slot, (std::uint64_t)stampHigh << 32 | stampLow, false, std::prev(recent.end())};
+            if (!entries.emplace(key, entry).second)
+            {
+                valid = false;
+                recent.pop_back();
+            }
+        }
+        if (!valid || data != end)
+        {
+            entries.clear();
+            recent.clear();
+            return false;
+        }
+
+        slots.swap(loaded);
+        for (int i = 0; i < (int)slots.size(); i++)
+        {
+            if (slots[i].references == 0)
+            {
+                slots[i].bitmap = IconBitmap();
+                freeSlots.push_back(i);
+                continue;
+            }
+            slotsByHash.emplace(slots[i].hash, i);
+            changed.push_back(i);
+        }
+        return true;
+    }
+};
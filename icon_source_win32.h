@@ -0,0 +1,103 @@
+#pragma once
+
+// Win32 icon source - icons extracted by the shell, stamped with the file's last write time
+
+#include <windows.h>
+#include <shlobj.h>
+
+#include "file_probe_win32.h"
+#include "icon_cache.h"
+
+class Win32IconSource : public IconSource
+{
+private:
+    // The file an icon path names: variables expanded, bare names ("shell32.dll") searched for.
+    // Empty if a bare name isn't found.
+    static std::wstring LocateFile(const std::wstring &path)
+    {
+        std::wstring expanded = ExpandPathVariables(path);
+        if (expanded.find_first_of(L"\\/:") != std::wstring::npos)
+            return expanded;
+        wchar_t found[MAX_PATH];
+        if (SearchPathW(NULL, expanded.c_str(), L".exe", MAX_PATH, found, NULL) == 0)
+            return std::wstring();
+        return found;
+    }
+
+    // Read an icon's pixels as 32-bit BGRA. Icons without an alpha channel take it from their mask.
+    static bool ReadPixels(HICON icon, IconBitmap &bitmap)
+    {
+        ICONINFO info;
+        if (!GetIconInfo(icon, &info))
+            return false;
+
+        bool read = false;
+        BITMAP color;
+        if (info.hbmColor && GetObjectW(info.hbmColor, sizeof(color), &color) && color.bmWidth > 0 &&
+            color.bmHeight > 0)
+        {
+            BITMAPINFO header = {};
+            header.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+            header.bmiHeader.biWidth = color.bmWidth;
+            header.bmiHeader.biHeight = -color.bmHeight; // Top row first
+            header.bmiHeader.biPlanes = 1;
+            header.bmiHeader.biBitCount = 32;
+            header.bmiHeader.biCompression = BI_RGB;
+
+            bitmap.width = color.bmWidth;
+            bitmap.height = color.bmHeight;
+            bitmap.pixels.assign((std::size_t)color.bmWidth * color.bmHeight, 0);
+            HDC screen = GetDC(NULL);
+            read = GetDIBits(screen, info.hbmColor, 0, color.bmHeight, bitmap.pixels.data(), &header,
+                             DIB_RGB_COLORS) == color.bmHeight;
+
+            bool hasAlpha = false;
+            for (std::size_t i = 0; i < bitmap.pixels.size() && !hasAlpha; i++)
+                hasAlpha = (bitmap.pixels[i] >> 24) != 0;
+            if (read && !hasAlpha)
+            {
+                // Set mask bits are transparent
+                std::vector<std::uint32_t> mask(bitmap.pixels.size(), 0);
+                bool masked = info.hbmMask && GetDIBits(screen, info.hbmMask, 0, color.bmHeight, mask.data(), &header,
+                                                        DIB_RGB_COLORS) == color.bmHeight;
+                for (std::size_t i = 0; i < bitmap.pixels.size(); i++)
+                {
+                    bool transparent = masked && (mask[i] & 0xFFFFFF) != 0;
+                    bitmap.pixels[i] = (bitmap.pixels[i] & 0xFFFFFF) | (transparent ? 0 : 0xFF000000u);
+                }
+            }
+            ReleaseDC(NULL, screen);
+        }
+
+        if (info.hbmColor)
+            DeleteObject(info.hbmColor);
+        if (info.hbmMask)
+            DeleteObject(info.hbmMask);
+        return read;
+    }
+
+public:
+    bool Extract(const IconKey &key, IconBitmap &bitmap)
+    {
+        std::wstring file = LocateFile(key.path);
+        if (file.empty())
+            return false;
+
+        HICON icon = NULL;
+        if (SHDefExtractIconW(file.c_str(), key.index, 0, &icon, NULL, MAKELONG(key.size, key.size)) != S_OK || !icon)
+            return false;
+        bool read = ReadPixels(icon, bitmap);
+        DestroyIcon(icon);
+        return read;
+    }
+
+    std::uint64_t FileStamp(const std::wstring &path)
+    {
+        std::wstring file = LocateFile(path);
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (file.empty() || !GetFileAttributesExW(file.c_str(), GetFileExInfoStandard, &data))
+            return 0;
+        std::uint64_t stamp = (std::uint64_t)data.ftLastWriteTime.dwHighDateTime << 32 | data.ftLastWriteTime.dwLowDateTime;
+        return stamp != 0 ? stamp : 1;
+    }
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+// Win32 journal storage - one file kept open for the life of the journal, flushed with FlushFileBuffers
+
+#include <windows.h>
+
+#include "registry_journal.h"
+
+class Win32JournalFile : public JournalStorage
+{
+private:
+    HANDLE hFile;
+
+    Win32JournalFile(const Win32JournalFile &);
+    Win32JournalFile &operator=(const Win32JournalFile &);
+
+    bool Seek(LONGLONG offset, DWORD method)
+    {
+        LARGE_INTEGER distance;
+        distance.QuadPart = offset;
+        return SetFilePointerEx(hFile, distance, NULL, method) != FALSE;
+    }
+
+public:
+    Win32JournalFile() : hFile(INVALID_HANDLE_VALUE) {}
+
+    ~Win32JournalFile() { Close(); }
+
+    // Open path, creating it if needed; no other process may open it meanwhile
+    bool Open(const std::wstring &path)
+    {
+        Close();
+        if (path.empty())
+            return false;
+        hFile = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+        return hFile != INVALID_HANDLE_VALUE;
+    }
+
+    void Close()
+    {
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(hFile);
+            hFile = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    bool IsOpen() const { return hFile != INVALID_HANDLE_VALUE; }
+
+    bool Read(std::vector<std::uint8_t> &data)
+    {
+        LARGE_INTEGER size;
+        if (!IsOpen() || !GetFileSizeEx(hFile, &size) || size.QuadPart > 0x7FFFFFFF || !Seek(0, FILE_BEGIN))
+            return false;
+        data.resize((std::size_t)size.QuadPart);
+
+        DWORD read = 0;
+        return data.empty() || (ReadFile(hFile, data.data(), (DWORD)data.size(), &read, NULL) && read == data.size());
+    }
+
+    bool Append(const std::uint8_t *data, std::size_t size)
+    {
+        DWORD written = 0;
+        return IsOpen() && Seek(0, FILE_END) && WriteFile(hFile, data, (DWORD)size, &written, NULL) &&
+               written == size;
+    }
+
+    bool Flush()
+    {
+        return IsOpen() && FlushFileBuffers(hFile);
+    }
+
+    bool Truncate(std::size_t size)
+    {
+        return IsOpen() && Seek((LONGLONG)size, FILE_BEGIN) && SetEndOfFile(hFile);
+    }
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+// Minimal streaming JSON writer for the command-line mode's output
+//
+// Output is compact UTF-8. Commas are inserted automatically; the caller is
+// responsible for balancing Begin/End calls and for calling Key() before
+// every value inside an object.
+
+#include "text_encoding.h"
+
+#include <cstdio>
+#include <vector>
+
+class JsonWriter
+{
+private:
+    std::string out;
+    std::vector<bool> hasItems; // One entry per open object/array
+    bool afterKey;
+
+    void BeforeValue()
+    {
+        if (afterKey)
+        {
+            afterKey = false;
+            return;
+        }
+        if (!hasItems.empty())
+        {
+            if (hasItems.back())
+                out += ',';
+            hasItems.back() = true;
+        }
+    }
+
+    void AppendEscaped(const std::string &utf8)
+    {
+        out += '"';
+        for (char ch : utf8)
+        {
+            unsigned char c = (unsigned char)ch;
+            switch (c)
+            {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (c < 0x20)
+                {
+                    char escape[8];
+                    snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    out += escape;
+                }
+                else
+                {
+                    out += ch;
+                }
+            }
+        }
+        out += '"';
+    }
+
+public:
+    JsonWriter() : afterKey(false) {}
+
+    void BeginObject()
+    {
+        BeforeValue();
+        out += '{';
+        hasItems.push_back(false);
+    }
+
+    void EndObject()
+    {
+        out += '}';
+        hasItems.pop_back();
+    }
+
+    void BeginArray()
+    {
+        BeforeValue();
+        out += '[';
+        hasItems.push_back(false);
+    }
+
+    void EndArray()
+    {
+        out += ']';
+        hasItems.pop_back();
+    }
+
+    void Key(const char *name)
+    {
+        BeforeValue();
+        AppendEscaped(name);
+        out += ':';
+        afterKey = true;
+    }
+
+    void String(std::wstring_view value)
+    {
+        BeforeValue();
+        AppendEscaped(Utf8FromWide(value));
+    }
+
+    void String(const char *value)
+    {
+        BeforeValue();
+        AppendEscaped(value);
+    }
+
+    void Number(long long value)
+    {
+        BeforeValue();
+        char text[32];
+        snprintf(text, sizeof(text), "%lld", value);
+        out += text;
+    }
+
+    void Bool(bool value)
+    {
+        BeforeValue();
+        out += value ? "true" : "false";
+    }
+
+    void Null()
+    {
+        BeforeValue();
+        out += "null";
+    }
+
+    const std::string &Text() const { return out; }
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+// View-model behind the virtual (LBS_NODATA) list box
+//
+// The list box stores nothing: it only knows the row count and asks for a
+// row's text when it paints it. ListViewModel maps rows to positions in the
+// entry list (the current filter) and formats each row's text once, caching
+// it by key name until that entry is reported changed. Filtering reuses the
+// row vector, so switching between "custom only" and "all" allocates nothing
+// once the list has been shown both ways. The cache is keyed by views of the
+// entries' pooled names, so InvalidateAll must follow a move to another pool.
+//
+// It also keeps the pixel width of every row for the list box's horizontal
+// extent. Widths come from a TextMeasurer and are remeasured only for rows
+// reported changed (or all rows, when the measurer's font or DPI differs);
+// the widest row is tracked in a width histogram, so adding, removing or
+// renaming an entry updates it without visiting the other rows.
+
+#include "context_menu_model.h"
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+
+// Measures text in the list's font
+class TextMeasurer
+{
+public:
+    virtual ~TextMeasurer() {}
+
+    // Identifies the font and DPI - widths measured under another context are dropped
+    virtual std::uint64_t Context() const = 0;
+
+    virtual int Width(const std::wstring &text) = 0;
+};
+
+class ListViewModel
+{
+private:
+    struct CachedRow
+    {
+        std::wstring text;
+        int width; // -1 until measured
+        bool custom;
+    };
+    typedef std::unordered_map<std::wstring_view, CachedRow, RegistryNameHash, RegistryNameEqual> RowCache;
+    typedef std::map<int, std::size_t> WidthCounts; // Width -> number of measured rows that wide
+
+    const std::vector<AppEntry> &entries;
+    const AppIndex &index;
+    std::vector<std::size_t> rows; // Positions in entries of the visible rows, in list order
+    RowCache rowCache;             // Key name -> formatted row text and width
+    std::size_t maxDisplayLength;
+    bool showAll;
+
+    WidthCounts widths[2];              // [custom] - only custom rows count while filtered
+    std::vector<std::wstring> unmeasured; // Keys invalidated since the last UpdateWidths
+    bool remeasureAll;
+    std::uint64_t measureContext;
+
+    CachedRow &Row(const AppEntry &app)
+    {
+        auto found = rowCache.find(app.name);
+        if (found == rowCache.end())
+        {
+            CachedRow row = {FormatRow(app, maxDisplayLength), -1, app.isCustom};
+            found = rowCache.emplace(app.name, row).first;
+        }
+        return found->second;
+    }
+
+    void Measure(const AppEntry &app, TextMeasurer &measurer)
+    {
+        CachedRow &row = Row(app);
+        if (row.width >= 0)
+            return;
+        row.width = measurer.Width(row.text);
+        widths[row.custom][row.width]++;
+    }
+
+    void Unmeasure(const CachedRow &row)
+    {
+        if (row.width < 0)
+            return;
+        WidthCounts &counts = widths[row.custom];
+        auto found = counts.find(row.width);
+        if (found != counts.end() && --found->second == 0)
+            counts.erase(found);
+    }
+
+    ListViewModel(const ListViewModel &);
+    ListViewModel &operator=(const ListViewModel &);
+
+public:
+    ListViewModel(const std::vector<AppEntry> &source, const AppIndex &sourceIndex, std::size_t maxLength = 100)
+        : entries(source), index(sourceIndex), maxDisplayLength(maxLength), showAll(false),
+          remeasureAll(true), measureContext(0) {}
+
+    // "✅ name - path" for custom items, "📌 name - path" for others, "📂 name ▸" for groups,
+    // "⚠" in front when the health check found the program or icon missing,
+    // indented by group depth and shortened in the middle past maxLength
+    static std::wstring FormatRow(const AppEntry &app, std::size_t maxLength)
+    {
+        std::wstring baseText(app.depth * 4, L' ');
+        if (app.health != 0)
+            baseText += L"\u26A0";
+        baseText += app.isGroup ? L"\U0001F4C2 " : app.isCustom ? L"\u2705 " : L"\U0001F4CC ";
+        baseText.reserve(baseText.length() + app.displayName.length() + 3 + app.path.length());
+        baseText += app.displayName;
+        if (app.isGroup)
+        {
+            baseText += L" \u25B8";
+        }
+        else
+        {
+            baseText += L" - ";
+            baseText += app.path;
+        }
+
+        // Truncate if text is too long (this is just for display, full content can still be viewed via scrolling)
+        if (baseText.length() > maxLength)
+        {
+            // Preserve important information at beginning and end
+            std::wstring shortened = baseText.substr(0, maxLength - 10);
+            shortened += L"...";
+            shortened.append(baseText, baseText.length() - 7, 7);
+            return shortened;
+        }
+        return baseText;
+    }
+
+    // Rebuild the rows from the entries: custom items only, or every item
+    void Filter(bool showAllItems)
+    {
+        showAll = showAllItems;
+        rows.clear();
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            if (showAll || entries[i].isCustom)
+                rows.push_back(i);
+        }
+    }
+
+    std::size_t RowCount() const { return rows.size(); }
+    bool Empty() const { return rows.empty(); }
+
+    // Position in entries of a row
+    std::size_t Position(std::size_t row) const { return rows[row]; }
+
+    // Row order, for planning a reorder from the list
+    const std::vector<std::size_t> &Rows() const { return rows; }
+
+    void SwapRows(std::size_t a, std::size_t b) { std::swap(rows[a], rows[b]); }
+
+    // Row showing entries[position], -1 if filtered out
+    int FindRow(std::size_t position) const
+    {
+        for (std::size_t i = 0; i < rows.size(); i++)
+        {
+            if (rows[i] == position)
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // Text of a row, formatted on first use
+    const std::wstring &RowText(std::size_t row)
+    {
+        return Row(entries[rows[row]]).text;
+    }
+
+    // The entry with this key name was added, changed or is gone
+    void Invalidate(std::wstring_view keyName)
+    {
+        auto found = rowCache.find(keyName);
+        if (found != rowCache.end())
+        {
+            Unmeasure(found->second);
+            rowCache.erase(found);
+        }
+        if (!remeasureAll)
+            unmeasured.push_back(std::wstring(keyName));
+    }
+
+    // Every entry was re-read (or the entries moved to another string pool)
+    void InvalidateAll()
+    {
+        rowCache.clear();
+        widths[0].clear();
+        widths[1].clear();
+        unmeasured.clear();
+        remeasureAll = true;
+    }
+
+    // Measure the rows invalidated since the last call; the key index must be current
+    void UpdateWidths(TextMeasurer &measurer)
+    {
+        if (measurer.Context() != measureContext)
+        {
+            // Font or DPI changed - keep the text, drop every width
+            for (auto &cached : rowCache)
+                cached.second.width = -1;
+            widths[0].clear();
+            widths[1].clear();
+            measureContext = measurer.Context();
+            remeasureAll = true;
+        }
+
+        if (remeasureAll)
+        {
+            for (const auto &app : entries)
+                Measure(app, measurer);
+            remeasureAll = false;
+        }
+        else
+        {
+            for (const auto &keyName : unmeasured)
+            {
+                int position = index.Find(keyName);
+                if (position >= 0)
+                    Measure(entries[position], measurer);
+            }
+        }
+        unmeasured.clear();
+    }
+
+    // Width of the widest visible row, as of the last UpdateWidths
+    int MaxWidth() const
+    {
+        int maxWidth = widths[1].empty() ? 0 : widths[1].rbegin()->first;
+        if (showAll && !widths[0].empty() && widths[0].rbegin()->first > maxWidth)
+            maxWidth = widths[0].rbegin()->first;
+        return maxWidth;
+    }
+};
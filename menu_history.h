@@ -0,0 +1,500 @@
+#pragma once
+
+// Undo/redo history of the menu
+//
+// Every step of the history is a whole menu state: verb key path -> verb.
+// Verbs are told apart by object, not by name - a rename moves the same
+// MenuVerb to another path, a delete leaves the path marked as gone. Two
+// states that differ by one removal or one reorder therefore differ in a few
+// paths only, and that is all a step costs: MenuState is a persistent hash
+// trie, so a new state copies the nodes on the way to the paths it changes
+// and shares every other node with the state it was made from.
+//
+// Comparing two states walks both tries at once and skips shared nodes, so
+// its cost follows the size of the change, not of the menu. A verb found
+// under another path becomes a rename, a verb that is only on one side a
+// delete or a restore - the smallest set of steps that turns one state into
+// the other, staged as one RegistryTransaction.
+//
+// The history only knows the paths it was told about. Keys it has never seen
+// are left alone by an undo, so changes made meanwhile by other programs
+// survive it; a change that collides with one (an undo recreating a key that
+// was added again meanwhile) fails as a whole and leaves the history where it
+// was. What a deleted verb held is captured before the delete, and captured
+// again whenever an undo or redo deletes a verb, so the step can be replayed
+// the other way.
+
+#include "context_menu_model.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// One verb key, whatever path it is under
+struct MenuVerb
+{
+    std::shared_ptr<const KeySnapshot> tree; // What the key held when it was last deleted, NULL before
+};
+
+class MenuState
+{
+public:
+    struct Slot
+    {
+        PooledString path;              // Relative to the shell key
+        std::uint32_t hash;             // Case-insensitive hash of path
+        std::shared_ptr<MenuVerb> verb; // NULL if nothing is at path
+    };
+
+private:
+    static const unsigned kBits = 4;      // Hash bits used per level
+    static const unsigned kFanout = 1u << kBits;
+    static const unsigned kMaxDepth = 32 / kBits;
+    static const std::size_t kLeafSlots = 8; // A fuller leaf is split while hash bits remain
+
+    // A leaf holds slots, a branch holds kFanout children (NULL where empty). Shared, never changed.
+    struct Node
+    {
+        std::vector<Slot> slots;
+        std::vector<std::shared_ptr<const Node>> children;
+    };
+
+    std::shared_ptr<const Node> root;
+    std::size_t size;
+
+    static std::uint32_t Hash(std::wstring_view path)
+    {
+        return (std::uint32_t)HashRegistryName(path.data(), path.length());
+    }
+
+    static unsigned ChildIndex(std::uint32_t hash, unsigned depth)
+    {
+        return (hash >> (depth * kBits)) & (kFanout - 1);
+    }
+
+    // Every slot below node
+    static void Collect(const Node *node, std::vector<const Slot *> &slots)
+    {
+        std::vector<const Node *> stack;
+        if (node)
+            stack.push_back(node);
+        while (!stack.empty())
+        {
+            const Node *item = stack.back();
+            stack.pop_back();
+            for (const Slot &slot : item->slots)
+                slots.push_back(&slot);
+            for (const auto &child : item->children)
+            {
+                if (child)
+                    stack.push_back(child.get());
+            }
+        }
+    }
+
+public:
+    MenuState() : size(0) {}
+
+    // Paths the state knows about, present or gone
+    std::size_t Size() const { return size; }
+
+    // The slot of path, NULL if the state doesn't know it
+    const Slot *Find(std::wstring_view path) const
+    {
+        std::uint32_t hash = Hash(path);
+        const Node *node = root.get();
+        for (unsigned depth = 0; node && !node->children.empty(); depth++)
+            node = node->children[ChildIndex(hash, depth)].get();
+        if (!node)
+            return NULL;
+        for (const Slot &slot : node->slots)
+        {
+            if (slot.hash == hash && CompareRegistryNames(slot.path, path) == 0)
+                return &slot;
+        }
+        return NULL;
+    }
+
+    // A copy of this state with verb (NULL for gone) at path; copies one node per level
+    MenuState With(PooledString path, std::shared_ptr<MenuVerb> verb) const
+    {
+        MenuState result(*this);
+        std::uint32_t hash = Hash(path);
+
+        std::shared_ptr<Node> copy = root ? std::make_shared<Node>(*root) : std::make_shared<Node>();
+        result.root = copy;
+        Node *node = copy.get();
+        unsigned depth = 0;
+        for (; !node->children.empty(); depth++)
+        {
+            std::shared_ptr<const Node> &child = node->children[ChildIndex(hash, depth)];
+            copy = child ? std::make_shared<Node>(*child) : std::make_shared<Node>();
+            child = copy;
+            node = copy.get();
+        }
+
+        for (Slot &slot : node->slots)
+        {
+            if (slot.hash == hash && CompareRegistryNames(slot.path, path) == 0)
+            {
+                slot.verb = verb;
+                return result;
+            }
+        }
+        Slot slot = {path, hash, verb};
+        node->slots.push_back(slot);
+        result.size++;
+
+        // Split an overfull leaf; if every slot lands in the same child, split that one too
+        while (node->slots.size() > kLeafSlots && depth < kMaxDepth)
+        {
+            std::vector<std::shared_ptr<Node>> children(kFanout);
+            for (const Slot &moved : node->slots)
+            {
+                std::shared_ptr<Node> &child = children[ChildIndex(moved.hash, depth)];
+                if (!child)
+                    child = std::make_shared<Node>();
+                child->slots.push_back(moved);
+            }
+            node->slots.clear();
+            node->children.assign(children.begin(), children.end());
+
+            Node *next = children[ChildIndex(hash, depth)].get();
+            if (next->slots.size() <= kLeafSlots)
+                break;
+            node = next;
+            depth++;
+        }
+        return result;
+    }
+
+    // Call onDifference(const Slot &mine, const Slot &theirs) for every path both states know
+    // whose verb differs. Nodes the two states share are skipped without looking inside.
+    template <typename DifferenceFn>
+    void Compare(const MenuState &other, DifferenceFn onDifference) const
+    {
+        struct Pending
+        {
+            const Node *mine;
+            const Node *theirs;
+        };
+
+        std::vector<Pending> stack;
+        std::vector<const Slot *> mine, theirs;
+        Pending first = {root.get(), other.root.get()};
+        stack.push_back(first);
+        while (!stack.empty())
+        {
+            Pending item = stack.back();
+            stack.pop_back();
+            if (item.mine == item.theirs || !item.mine || !item.theirs)
+                continue; // Shared, or one side knows nothing here
+
+            if (!item.mine->children.empty() && !item.theirs->children.empty())
+            {
+                for (unsigned i = 0; i < kFanout; i++)
+                {
+                    Pending child = {item.mine->children[i].get(), item.theirs->children[i].get()};
+                    stack.push_back(child);
+                }
+                continue;
+            }
+
+            // A leaf on either side - a path sits in the same place in both tries, so comparing
+            // the two subtrees here finds every difference below this point
+            mine.clear();
+            theirs.clear();
+            Collect(item.mine, mine);
+            Collect(item.theirs, theirs);
+            for (const Slot *slot : mine)
+            {
+                for (const Slot *match : theirs)
+                {
+                    if (match->hash != slot->hash || CompareRegistryNames(match->path, slot->path) != 0)
+                        continue;
+                    if (match->verb != slot->verb)
+                        onDifference(*slot, *match);
+                    break;
+                }
+            }
+        }
+    }
+};
+
+struct MenuStateChange
+{
+    std::wstring path;
+    std::shared_ptr<MenuVerb> verb;
+};
+
+// Registry steps that turn one menu state into another
+struct MenuStateDiff
+{
+    std::vector<MenuStateChange> deletes;  // Verbs only the first state has
+    std::vector<KeyRename> renames;        // Verbs both have, under different paths
+    std::vector<MenuStateChange> restores; // Verbs only the second state has
+
+    bool Empty() const { return deletes.empty() && renames.empty() && restores.empty(); }
+};
+
+inline void DiffMenuStates(const MenuState &from, const MenuState &to, MenuStateDiff &diff)
+{
+    diff = MenuStateDiff();
+
+    // Where each verb leaves and where it arrives
+    std::unordered_map<const MenuVerb *, const MenuState::Slot *> leaving, arriving;
+    from.Compare(to,
+                 [&](const MenuState::Slot &before, const MenuState::Slot &after)
+                 {
+                     if (before.verb)
+                         leaving[before.verb.get()] = &before;
+                     if (after.verb)
+                         arriving[after.verb.get()] = &after;
+                 });
+
+    for (const auto &entry : leaving)
+    {
+        auto it = arriving.find(entry.first);
+        if (it != arriving.end())
+        {
+            KeyRename rename = {entry.second->path.str(), it->second->path.str()};
+            diff.renames.push_back(rename);
+            arriving.erase(it);
+            continue;
+        }
+        MenuStateChange change = {entry.second->path.str(), entry.second->verb};
+        diff.deletes.push_back(change);
+    }
+    for (const auto &entry : arriving)
+    {
+        MenuStateChange change = {entry.second->path.str(), entry.second->verb};
+        diff.restores.push_back(change);
+    }
+
+    // Parents before their members, and the same order on every run
+    auto byPath = [](const MenuStateChange &a, const MenuStateChange &b)
+    { return CompareRegistryNames(a.path, b.path) < 0; };
+    std::sort(diff.deletes.begin(), diff.deletes.end(), byPath);
+    std::sort(diff.restores.begin(), diff.restores.end(), byPath);
+    std::sort(diff.renames.begin(), diff.renames.end(), [](const KeyRename &a, const KeyRename &b)
+              { return CompareRegistryNames(a.from, b.from) < 0; });
+}
+
+// Stage diff: deletes first (they may free a rename target), then renames, then restores. Every
+// top-level group with a changed member is touched once, as StageGroupMove does.
+inline void StageMenuStateDiff(RegistryTransaction &transaction, const MenuStateDiff &diff)
+{
+    std::vector<std::wstring> paths;
+    for (const auto &change : diff.deletes)
+    {
+        transaction.DeleteTree(change.path);
+        paths.push_back(change.path);
+    }
+    if (!diff.renames.empty())
+        transaction.Rename(L"", diff.renames);
+    for (const auto &rename : diff.renames)
+    {
+        paths.push_back(rename.from);
+        paths.push_back(rename.to);
+    }
+    for (const auto &change : diff.restores)
+    {
+        transaction.RestoreTree(change.path, change.verb->tree);
+        paths.push_back(change.path);
+    }
+
+    std::vector<std::wstring> groups;
+    for (const auto &keyPath : paths)
+    {
+        if (keyPath.find(L'\\') == std::wstring::npos)
+            continue;
+        std::wstring top = TopKeyName(keyPath);
+        if (std::find_if(groups.begin(), groups.end(), [&top](const std::wstring &group)
+                         { return CompareRegistryNames(group, top) == 0; }) == groups.end())
+            groups.push_back(top);
+    }
+    for (const auto &group : groups)
+        transaction.SetString(group, L"SubCommands", L"");
+}
+
+const std::size_t kMenuHistorySteps = 500;
+
+class MenuHistory
+{
+private:
+    struct Observed
+    {
+        std::wstring_view path;
+        bool present; // What the write found at path before it ran
+    };
+
+    RegistryBackend &backend;
+    std::size_t maxSteps;
+    std::deque<MenuState> states; // Oldest first; states[cursor] is what the registry holds
+    std::size_t cursor;
+    StringPool paths;             // Paths of every state
+
+    MenuHistory(const MenuHistory &);
+    MenuHistory &operator=(const MenuHistory &);
+
+    // The current state, extended with what a write found at paths it never saw before. If the
+    // state disagrees with what was found, something outside the history changed those keys and
+    // the history starts over from here.
+    MenuState Before(const std::vector<Observed> &observed)
+    {
+        MenuState state = states[cursor];
+        for (const Observed &item : observed)
+        {
+            const MenuState::Slot *slot = state.Find(item.path);
+            if (slot && (slot->verb != NULL) == item.present)
+                continue;
+            if (slot)
+            {
+                Clear();
+                return Before(observed);
+            }
+            state = state.With(paths.Intern(item.path), item.present ? std::make_shared<MenuVerb>() : NULL);
+        }
+        return state;
+    }
+
+    // Make after the newest step, in place of anything that could have been redone
+    void Push(const MenuState &before, const MenuState &after)
+    {
+        states[cursor] = before;
+        states.erase(states.begin() + cursor + 1, states.end());
+        states.push_back(after);
+        cursor++;
+        while (states.size() > maxSteps + 1)
+        {
+            states.pop_front();
+            cursor--;
+        }
+    }
+
+    // Bring the registry from states[cursor] to states[target] and move there
+    long MoveTo(std::size_t target, RegKey root, const std::wstring &basePath, std::function<void()> onCommit,
+                RegistryJournal *journal)
+    {
+        MenuStateDiff diff;
+        DiffMenuStates(states[cursor], states[target], diff);
+
+        // Read what the verbs about to go hold now, so the step can be replayed back
+        std::vector<std::shared_ptr<KeySnapshot>> captured(diff.deletes.size());
+        if (!diff.deletes.empty())
+        {
+            ScopedRegKey base(backend);
+            long status = backend.OpenKey(root, basePath.c_str(), false, base.Receive());
+            for (std::size_t i = 0; status == RegOk && i < diff.deletes.size(); i++)
+            {
+                ScopedRegKey key(backend);
+                captured[i] = std::make_shared<KeySnapshot>();
+                status = backend.OpenKey(base.Get(), diff.deletes[i].path.c_str(), false, key.Receive());
+                if (status == RegOk)
+                    status = CaptureKeyTree(backend, key.Get(), *captured[i]);
+            }
+            if (status != RegOk)
+                return status;
+        }
+        for (const auto &change : diff.restores)
+        {
+            if (!change.verb->tree)
+                return RegInvalidParameter; // Never captured - can't happen for a recorded delete
+        }
+
+        RegistryTransaction transaction(backend, root, basePath.c_str(), onCommit, journal);
+        StageMenuStateDiff(transaction, diff);
+        long status = transaction.Commit();
+        if (status != RegOk)
+            return status;
+
+        for (std::size_t i = 0; i < diff.deletes.size(); i++)
+            diff.deletes[i].verb->tree = captured[i];
+        cursor = target;
+        return RegOk;
+    }
+
+public:
+    // Keeps up to steps undo steps; the oldest are dropped beyond that
+    explicit MenuHistory(RegistryBackend &owner, std::size_t steps = kMenuHistorySteps)
+        : backend(owner), maxSteps(steps), states(1), cursor(0) {}
+
+    std::size_t UndoSteps() const { return cursor; }
+    std::size_t RedoSteps() const { return states.size() - 1 - cursor; }
+
+    // States held, counting the current one
+    std::size_t Size() const { return states.size(); }
+
+    // Forget every step
+    void Clear()
+    {
+        states.assign(1, MenuState());
+        cursor = 0;
+        paths.Clear();
+    }
+
+    // path (relative to the shell key) was created
+    void RecordCreate(std::wstring_view path)
+    {
+        std::vector<Observed> observed(1, Observed{path, false});
+        MenuState before = Before(observed);
+        Push(before, before.With(paths.Intern(path), std::make_shared<MenuVerb>()));
+    }
+
+    // path was deleted; tree is what it held just before
+    void RecordDelete(std::wstring_view path, std::shared_ptr<const KeySnapshot> tree)
+    {
+        std::vector<Observed> observed(1, Observed{path, true});
+        MenuState before = Before(observed);
+        before.Find(path)->verb->tree = tree;
+        Push(before, before.With(paths.Intern(path), NULL));
+    }
+
+    // A rename batch (paths relative to the shell key) was applied
+    void RecordRenames(const std::vector<KeyRename> &renames)
+    {
+        if (renames.empty())
+            return;
+
+        // Every source was there; a target was free unless another source leaves it
+        std::vector<Observed> observed;
+        for (const auto &rename : renames)
+            observed.push_back(Observed{rename.from, true});
+        for (const auto &rename : renames)
+        {
+            if (std::none_of(renames.begin(), renames.end(), [&rename](const KeyRename &other)
+                             { return CompareRegistryNames(other.from, rename.to) == 0; }))
+                observed.push_back(Observed{rename.to, false});
+        }
+        MenuState before = Before(observed);
+
+        MenuState after = before;
+        for (const auto &rename : renames)
+            after = after.With(paths.Intern(rename.from), NULL);
+        for (const auto &rename : renames)
+            after = after.With(paths.Intern(rename.to), before.Find(rename.from)->verb);
+        Push(before, after);
+    }
+
+    // Put the registry back one step, as one transaction below root\basePath. RegNoMoreItems if
+    // there is nothing to undo; on any failure nothing changes and the step stays. journal
+    // (optional) records the transaction as RegistryTransaction does.
+    long Undo(RegKey root, const std::wstring &basePath, std::function<void()> onCommit,
+              RegistryJournal *journal = NULL)
+    {
+        if (cursor == 0)
+            return RegNoMoreItems;
+        return MoveTo(cursor - 1, root, basePath, onCommit, journal);
+    }
+
+    // Apply the step Undo took back, the same way
+    long Redo(RegKey root, const std::wstring &basePath, std::function<void()> onCommit,
+              RegistryJournal *journal = NULL)
+    {
+        if (cursor + 1 >= states.size())
+            return RegNoMoreItems;
+        return MoveTo(cursor + 1, root, basePath, onCommit, journal);
+    }
+};
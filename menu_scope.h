@@ -0,0 +1,113 @@
+#pragma once
+
+// Context menu scopes
+//
+// A scope is where a verb shows up, i.e. which "...\shell" key below
+// HKEY_CLASSES_ROOT it is registered under:
+//
+//     desktop   Directory\Background\shell       desktop and folder background
+//     folder    Directory\shell                  folders
+//     drive     Drive\shell                      drives
+//     files     *\shell                          every file
+//     .ext      SystemFileAssociations\.ext\shell files with that extension,
+//                                                 whatever program owns it
+//
+// Each scope is a menu of its own: key names, sort keys and order are per
+// scope, so the same program can be listed in several of them.
+
+#include "registry_backend.h"
+
+#include <vector>
+
+enum MenuScopeKind
+{
+    ScopeDesktop,
+    ScopeFolder,
+    ScopeDrive,
+    ScopeAllFiles,
+    ScopeExtension
+};
+
+struct MenuScope
+{
+    MenuScopeKind kind;
+    std::wstring extension; // ScopeExtension only, with the leading dot
+
+    // Shell key of the scope, relative to HKEY_CLASSES_ROOT
+    std::wstring ShellPath() const
+    {
+        switch (kind)
+        {
+        case ScopeFolder:
+            return L"Directory\\shell";
+        case ScopeDrive:
+            return L"Drive\\shell";
+        case ScopeAllFiles:
+            return L"*\\shell";
+        case ScopeExtension:
+            return L"SystemFileAssociations\\" + extension + L"\\shell";
+        default:
+            return kDesktopShellPath;
+        }
+    }
+
+    // Name used on the command line
+    std::wstring Name() const
+    {
+        switch (kind)
+        {
+        case ScopeFolder:
+            return L"folder";
+        case ScopeDrive:
+            return L"drive";
+        case ScopeAllFiles:
+            return L"files";
+        case ScopeExtension:
+            return extension;
+        default:
+            return L"desktop";
+        }
+    }
+
+    bool operator==(const MenuScope &other) const
+    {
+        return kind == other.kind && (kind != ScopeExtension || CompareRegistryNames(extension, other.extension) == 0);
+    }
+};
+
+inline MenuScope MakeMenuScope(MenuScopeKind kind, const std::wstring &extension = std::wstring())
+{
+    MenuScope scope = {kind, kind == ScopeExtension ? extension : std::wstring()};
+    return scope;
+}
+
+// The fixed scopes, desktop first
+inline std::vector<MenuScope> BuiltInMenuScopes()
+{
+    std::vector<MenuScope> scopes;
+    scopes.push_back(MakeMenuScope(ScopeDesktop));
+    scopes.push_back(MakeMenuScope(ScopeFolder));
+    scopes.push_back(MakeMenuScope(ScopeDrive));
+    scopes.push_back(MakeMenuScope(ScopeAllFiles));
+    return scopes;
+}
+
+// Parse a scope name ("desktop", "folder", "drive", "files" or ".ext"); false if it is none of them
+inline bool ParseMenuScope(const std::wstring &text, MenuScope &scope)
+{
+    std::vector<MenuScope> builtIn = BuiltInMenuScopes();
+    for (const auto &candidate : builtIn)
+    {
+        if (CompareRegistryNames(text, candidate.Name()) == 0)
+        {
+            scope = candidate;
+            return true;
+        }
+    }
+
+    // An extension: a dot and at least one character that can be part of a key name
+    if (text.length() < 2 || text[0] != L'.' || text.find_first_of(L"\\/*?\" ") != std::wstring::npos)
+        return false;
+    scope = MakeMenuScope(ScopeExtension, text);
+    return true;
+}
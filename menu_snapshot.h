@@ -0,0 +1,250 @@
+#pragma once
+
+// Startup snapshot of the menu
+//
+// A full read of the shell key opens every verb, so the window would start
+// empty on a crowded menu. Instead, the last list the window showed is
+// written out on exit together with the last write time of every top-level
+// verb key (what ShellKeyTracker recorded when it was read). At the next
+// start the list is filled from the snapshot before any registry access,
+// the tracker is seeded with the saved times, and an ordinary sync pass
+// then reads just the keys that changed, appeared or disappeared while the
+// program wasn't running.
+//
+// The format is flat and 4-byte aligned, so it is parsed straight out of a
+// mapped view of the file in one pass:
+//
+//   header   "RCMS", version, size of the body in bytes, FNV-1a of the body
+//   body     shell path, entry count, entries, stamp count, stamps
+//   entry    flags (1 custom, 2 group), depth, then name, path, arguments,
+//            display name and icon as strings
+//   stamp    key name, last write time as two 32-bit halves (low first)
+//   string   length in UTF-16 code units, the units, padded to 4 bytes
+//
+// Integers are little-endian. Anything that doesn't add up - wrong magic or
+// version, a checksum mismatch, a length past the end - rejects the whole
+// snapshot, and the window falls back to a full read. Health flags are not
+// saved; the check runs again once the snapshot has been validated.
+
+#include "context_menu_model.h"
+#include "registry_watcher.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct MenuSnapshotStamp
+{
+    std::wstring keyName;
+    std::uint64_t lastWriteTime;
+};
+
+struct MenuSnapshot
+{
+    std::wstring shellPath; // Shell key the entries were read from
+    std::vector<AppEntry> entries;
+    StringPool strings;     // Strings of entries
+    std::vector<MenuSnapshotStamp> stamps;
+};
+
+class MenuSnapshotWriter
+{
+private:
+    std::vector<std::uint8_t> &out;
+
+    void Put16(std::uint32_t value)
+    {
+        out.push_back((std::uint8_t)value);
+        out.push_back((std::uint8_t)(value >> 8));
+    }
+
+public:
+    explicit MenuSnapshotWriter(std::vector<std::uint8_t> &buffer) : out(buffer) {}
+
+    void Put32(std::uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            out.push_back((std::uint8_t)(value >> (8 * i)));
+    }
+
+    void PutString(std::wstring_view text)
+    {
+        // Count UTF-16 units first - wchar_t is 32 bits outside Windows
+        std::uint32_t units = 0;
+        for (wchar_t c : text)
+            units += (std::uint32_t)c > 0xFFFF ? 2 : 1;
+        Put32(units);
+        for (wchar_t c : text)
+        {
+            std::uint32_t code = (std::uint32_t)c;
+            if (code > 0xFFFF)
+            {
+                code -= 0x10000;
+                Put16(0xD800 | (code >> 10));
+                Put16(0xDC00 | (code & 0x3FF));
+            }
+            else
+                Put16(code);
+        }
+        if (units % 2)
+            Put16(0);
+    }
+};
+
+class MenuSnapshotReader
+{
+private:
+    const std::uint8_t *data;
+    const std::uint8_t *end;
+
+public:
+    MenuSnapshotReader(const std::uint8_t *begin, std::size_t size) : data(begin), end(begin + size) {}
+
+    bool AtEnd() const { return data == end; }
+
+    bool Get32(std::uint32_t &value)
+    {
+        if (end - data < 4)
+            return false;
+        value = (std::uint32_t)data[0] | (std::uint32_t)data[1] << 8 | (std::uint32_t)data[2] << 16 |
+                (std::uint32_t)data[3] << 24;
+        data += 4;
+        return true;
+    }
+
+    bool GetString(std::wstring &text)
+    {
+        std::uint32_t units;
+        if (!Get32(units))
+            return false;
+        // units and its padding unit must fit; compared without adding, which could wrap
+        std::size_t room = (std::size_t)(end - data) / 2;
+        if (units > room || units % 2 > room - units)
+            return false;
+        text.clear();
+        text.reserve(units);
+        for (std::uint32_t i = 0; i < units; i++, data += 2)
+        {
+            std::uint32_t unit = (std::uint32_t)data[0] | (std::uint32_t)data[1] << 8;
+            if (sizeof(wchar_t) > 2 && unit >= 0xD800 && unit < 0xDC00 && i + 1 < units)
+            {
+                std::uint32_t low = (std::uint32_t)data[2] | (std::uint32_t)data[3] << 8;
+                if (low >= 0xDC00 && low < 0xE000)
+                {
+                    unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                    i++;
+                    data += 2;
+                }
+            }
+            text += (wchar_t)unit;
+        }
+        if (units % 2)
+            data += 2;
+        return true;
+    }
+};
+
+inline std::uint32_t MenuSnapshotChecksum(const std::uint8_t *data, std::size_t size)
+{
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+const std::uint32_t kMenuSnapshotMagic = 0x534D4352; // "RCMS"
+const std::uint32_t kMenuSnapshotVersion = 1;
+const std::size_t kMenuSnapshotHeaderSize = 16;
+
+// Serialise the list and the tracker's stamps, read from shellPath. Call it while nothing reads
+// the registry into the tracker, and only when the list shows everything the tracker has seen.
+inline void WriteMenuSnapshot(const std::wstring &shellPath, const std::vector<AppEntry> &entries,
+                              const ShellKeyTracker &tracker, std::vector<std::uint8_t> &out)
+{
+    out.assign(kMenuSnapshotHeaderSize, 0);
+    MenuSnapshotWriter writer(out);
+    writer.PutString(shellPath);
+
+    writer.Put32((std::uint32_t)entries.size());
+    for (const AppEntry &app : entries)
+    {
+        writer.Put32((app.isCustom ? 1u : 0u) | (app.isGroup ? 2u : 0u));
+        writer.Put32(app.depth);
+        writer.PutString(app.name);
+        writer.PutString(app.path);
+        writer.PutString(app.arguments);
+        writer.PutString(app.displayName);
+        writer.PutString(app.icon);
+    }
+
+    writer.Put32((std::uint32_t)tracker.Size());
+    tracker.ForEach(
+        [&writer](const std::wstring &keyName, std::uint64_t lastWriteTime)
+        {
+            writer.PutString(keyName);
+            writer.Put32((std::uint32_t)lastWriteTime);
+            writer.Put32((std::uint32_t)(lastWriteTime >> 32));
+        });
+
+    std::vector<std::uint8_t> header;
+    MenuSnapshotWriter headerWriter(header);
+    headerWriter.Put32(kMenuSnapshotMagic);
+    headerWriter.Put32(kMenuSnapshotVersion);
+    headerWriter.Put32((std::uint32_t)(out.size() - kMenuSnapshotHeaderSize));
+    headerWriter.Put32(MenuSnapshotChecksum(out.data() + kMenuSnapshotHeaderSize, out.size() - kMenuSnapshotHeaderSize));
+    std::copy(header.begin(), header.end(), out.begin());
+}
+
+// Parse a snapshot; false (snapshot left partly filled) if it is damaged or from another version
+inline bool ReadMenuSnapshot(const std::uint8_t *data, std::size_t size, MenuSnapshot &snapshot)
+{
+    MenuSnapshotReader header(data, size);
+    std::uint32_t magic, version, bodySize, checksum;
+    if (!header.Get32(magic) || magic != kMenuSnapshotMagic || !header.Get32(version) ||
+        version != kMenuSnapshotVersion || !header.Get32(bodySize) || !header.Get32(checksum) ||
+        bodySize != size - kMenuSnapshotHeaderSize ||
+        MenuSnapshotChecksum(data + kMenuSnapshotHeaderSize, bodySize) != checksum)
+        return false;
+
+    MenuSnapshotReader reader(data + kMenuSnapshotHeaderSize, bodySize);
+    std::uint32_t entryCount;
+    if (!reader.GetString(snapshot.shellPath) || !reader.Get32(entryCount) || entryCount > bodySize / 28)
+        return false;
+
+    // Strings are decoded into one buffer and interned from there
+    std::wstring text;
+    auto getString = [&](PooledString &value)
+    {
+        if (!reader.GetString(text))
+            return false;
+        value = snapshot.strings.Intern(text);
+        return true;
+    };
+
+    snapshot.entries.resize(entryCount);
+    for (AppEntry &app : snapshot.entries)
+    {
+        std::uint32_t flags, depth;
+        if (!reader.Get32(flags) || !reader.Get32(depth) || !getString(app.name) || !getString(app.path) ||
+            !getString(app.arguments) || !getString(app.displayName) || !getString(app.icon))
+            return false;
+        app.isCustom = (flags & 1) != 0;
+        app.isGroup = (flags & 2) != 0;
+        app.depth = depth;
+        app.health = 0;
+    }
+
+    std::uint32_t stampCount;
+    if (!reader.Get32(stampCount) || stampCount > bodySize / 12)
+        return false;
+    snapshot.stamps.resize(stampCount);
+    for (MenuSnapshotStamp &stamp : snapshot.stamps)
+    {
+        std::uint32_t low, high;
+        if (!reader.GetString(stamp.keyName) || !reader.Get32(low) || !reader.Get32(high))
+            return false;
+        stamp.lastWriteTime = (std::uint64_t)high << 32 | low;
+    }
+    return reader.AtEnd();
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+// Registry access abstraction
+//
+// RightClickManager never talks to the Win32 registry API directly. Every
+// open, query, write and delete goes through RegistryBackend, so the same
+// menu logic can run against the real HKEY_CLASSES_ROOT (Win32RegistryBackend)
+// or against an in-memory tree (MemoryRegistryBackend) on any platform.
+//
+// The interface deliberately mirrors the shape of the Win32 calls it replaces:
+// handle based, byte-sized value buffers, status codes with Win32 values.
+
+#include <cstdint>
+#include <cwchar>
+#include <cwctype>
+#include <string>
+#include <string_view>
+
+// Opaque key handle (HKEY on Windows)
+typedef std::uintptr_t RegKey;
+
+// Predefined keys
+const RegKey kRegNullKey = 0;
+const RegKey kRegClassesRoot = 1; // HKEY_CLASSES_ROOT
+
+// Desktop background context menu location
+const wchar_t *const kDesktopShellPath = L"Directory\\Background\\shell";
+
+// Status codes - numerically identical to the Win32 ERROR_* values
+enum RegStatus : long
+{
+    RegOk = 0,                 // ERROR_SUCCESS
+    RegNotFound = 2,           // ERROR_FILE_NOT_FOUND
+    RegAccessDenied = 5,       // ERROR_ACCESS_DENIED
+    RegInvalidHandle = 6,      // ERROR_INVALID_HANDLE
+    RegInvalidParameter = 87,  // ERROR_INVALID_PARAMETER
+    RegAlreadyExists = 183,    // ERROR_ALREADY_EXISTS
+    RegMoreData = 234,         // ERROR_MORE_DATA
+    RegNoMoreItems = 259,      // ERROR_NO_MORE_ITEMS
+    RegKeyHasChildren = 1020,  // ERROR_KEY_HAS_CHILDREN
+    RegWriteFault = 29         // ERROR_WRITE_FAULT
+};
+
+// Value types - numerically identical to REG_*
+enum RegValueType : std::uint32_t
+{
+    RegTypeNone = 0,
+    RegTypeSz = 1,
+    RegTypeExpandSz = 2,
+    RegTypeBinary = 3,
+    RegTypeDword = 4,
+    RegTypeMultiSz = 7
+};
+
+// Result of QueryInfoKey (RegQueryInfoKeyW), lengths in characters / bytes like Win32
+struct RegKeyInfo
+{
+    std::uint32_t subKeyCount;
+    std::uint32_t maxSubKeyLength;   // Characters, without terminator
+    std::uint32_t valueCount;
+    std::uint32_t maxValueNameLength; // Characters, without terminator
+    std::uint32_t maxValueDataSize;  // Bytes
+    std::uint64_t lastWriteTime;     // FILETIME on Windows, logical clock in memory
+};
+
+class RegistryBackend
+{
+public:
+    virtual ~RegistryBackend() {}
+
+    // Open an existing key; subKey may be NULL or empty to duplicate the handle
+    virtual long OpenKey(RegKey parent, const wchar_t *subKey, bool writable, RegKey *result) = 0;
+
+    // Open or create a key (and any missing intermediate keys)
+    virtual long CreateKey(RegKey parent, const wchar_t *subKey, RegKey *result) = 0;
+
+    virtual void CloseKey(RegKey key) = 0;
+
+    virtual long QueryInfoKey(RegKey key, RegKeyInfo *info) = 0;
+
+    // nameLength: in = buffer size in characters, out = characters written (without terminator)
+    virtual long EnumKey(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                         std::uint64_t *lastWriteTime) = 0;
+
+    // nameLength as for EnumKey; dataSize in bytes, data may be NULL to probe the size
+    virtual long EnumValue(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                           std::uint32_t *type, void *data, std::uint32_t *dataSize) = 0;
+
+    // valueName NULL or empty selects the default value; data may be NULL to probe the size
+    virtual long QueryValue(RegKey key, const wchar_t *valueName, std::uint32_t *type,
+                            void *data, std::uint32_t *dataSize) = 0;
+
+    virtual long SetValue(RegKey key, const wchar_t *valueName, std::uint32_t type,
+                          const void *data, std::uint32_t dataSize) = 0;
+
+    virtual long DeleteValue(RegKey key, const wchar_t *valueName) = 0;
+
+    // Delete a key that has no subkeys
+    virtual long DeleteKey(RegKey parent, const wchar_t *subKey) = 0;
+
+    // Delete a key and everything below it in one call, if the backend can.
+    // Returns RegInvalidParameter when unsupported so callers fall back to manual deletion.
+    virtual long DeleteTree(RegKey parent, const wchar_t *subKey) = 0;
+
+    // Expand the %VARIABLE% references of REG_EXPAND_SZ data (ExpandEnvironmentStringsW);
+    // unknown variables are left as written. length: in = buffer size in characters, out =
+    // characters needed including the terminator. RegMoreData if the buffer is too small.
+    virtual long ExpandString(const wchar_t *text, wchar_t *buffer, std::uint32_t *length) = 0;
+};
+
+// Closes a key handle on scope exit
+class ScopedRegKey
+{
+private:
+    RegistryBackend &backend;
+    RegKey key;
+
+    ScopedRegKey(const ScopedRegKey &);
+    ScopedRegKey &operator=(const ScopedRegKey &);
+
+public:
+    explicit ScopedRegKey(RegistryBackend &owner, RegKey handle = kRegNullKey) : backend(owner), key(handle) {}
+    ~ScopedRegKey() { Reset(); }
+
+    RegKey Get() const { return key; }
+    RegKey *Receive()
+    {
+        Reset();
+        return &key;
+    }
+    void Reset()
+    {
+        if (key != kRegNullKey)
+        {
+            backend.CloseKey(key);
+            key = kRegNullKey;
+        }
+    }
+};
+
+// Write a REG_SZ value including its terminator
+inline long SetStringValue(RegistryBackend &backend, RegKey key, const wchar_t *valueName, const std::wstring &value)
+{
+    return backend.SetValue(key, valueName, RegTypeSz, value.c_str(),
+                            (std::uint32_t)((value.length() + 1) * sizeof(wchar_t)));
+}
+
+// Case-insensitive key name comparison, matching the registry's own ordering
+inline int CompareRegistryNames(const wchar_t *a, std::size_t aLength, const wchar_t *b, std::size_t bLength)
+{
+    std::size_t count = aLength < bLength ? aLength : bLength;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        wint_t ca = std::towupper(a[i]);
+        wint_t cb = std::towupper(b[i]);
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+    if (aLength == bLength)
+        return 0;
+    return aLength < bLength ? -1 : 1;
+}
+
+inline int CompareRegistryNames(std::wstring_view a, std::wstring_view b)
+{
+    return CompareRegistryNames(a.data(), a.length(), b.data(), b.length());
+}
+
+// Case-insensitive FNV-1a hash, consistent with CompareRegistryNames
+inline std::size_t HashRegistryName(const wchar_t *name, std::size_t length)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        hash ^= (std::uint64_t)std::towupper(name[i]);
+        hash *= 1099511628211ull;
+    }
+    return (std::size_t)hash;
+}
+
+// Hash/equality functors for case-insensitive key name containers
+struct RegistryNameHash
+{
+    std::size_t operator()(std::wstring_view name) const
+    {
+        return HashRegistryName(name.data(), name.length());
+    }
+};
+
+struct RegistryNameEqual
+{
+    bool operator()(std::wstring_view a, std::wstring_view b) const
+    {
+        return CompareRegistryNames(a, b) == 0;
+    }
+};
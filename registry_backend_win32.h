@@ -0,0 +1,184 @@
+#pragma once
+
+// Win32 registry backend - thin pass-through to the advapi32 registry API
+
+#include <windows.h>
+#include <shlwapi.h>
+
+#include "registry_backend.h"
+#include "registry_watcher.h"
+
+class Win32RegistryBackend : public RegistryBackend
+{
+private:
+    static HKEY ToHkey(RegKey key)
+    {
+        if (key == kRegClassesRoot)
+            return HKEY_CLASSES_ROOT;
+        return (HKEY)key;
+    }
+
+public:
+    long OpenKey(RegKey parent, const wchar_t *subKey, bool writable, RegKey *result)
+    {
+        HKEY hKey;
+        LONG status = RegOpenKeyExW(ToHkey(parent), subKey, 0, writable ? (KEY_READ | KEY_WRITE) : KEY_READ, &hKey);
+        if (status == ERROR_SUCCESS)
+            *result = (RegKey)hKey;
+        return status;
+    }
+
+    long CreateKey(RegKey parent, const wchar_t *subKey, RegKey *result)
+    {
+        HKEY hKey;
+        LONG status = RegCreateKeyExW(ToHkey(parent), subKey, 0, NULL, REG_OPTION_NON_VOLATILE,
+                                      KEY_ALL_ACCESS, NULL, &hKey, NULL);
+        if (status == ERROR_SUCCESS)
+            *result = (RegKey)hKey;
+        return status;
+    }
+
+    void CloseKey(RegKey key)
+    {
+        if (key != kRegNullKey && key != kRegClassesRoot)
+            RegCloseKey((HKEY)key);
+    }
+
+    long QueryInfoKey(RegKey key, RegKeyInfo *info)
+    {
+        DWORD subKeys = 0, maxSubKeyLen = 0, values = 0, maxValueNameLen = 0, maxValueLen = 0;
+        FILETIME lastWrite = {};
+        LONG status = RegQueryInfoKeyW(ToHkey(key), NULL, NULL, NULL, &subKeys, &maxSubKeyLen, NULL,
+                                       &values, &maxValueNameLen, &maxValueLen, NULL, &lastWrite);
+        if (status == ERROR_SUCCESS)
+        {
+            info->subKeyCount = subKeys;
+            info->maxSubKeyLength = maxSubKeyLen;
+            info->valueCount = values;
+            info->maxValueNameLength = maxValueNameLen;
+            info->maxValueDataSize = maxValueLen;
+            info->lastWriteTime = ((std::uint64_t)lastWrite.dwHighDateTime << 32) | lastWrite.dwLowDateTime;
+        }
+        return status;
+    }
+
+    long EnumKey(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                 std::uint64_t *lastWriteTime)
+    {
+        DWORD length = *nameLength;
+        FILETIME lastWrite = {};
+        LONG status = RegEnumKeyExW(ToHkey(key), index, name, &length, NULL, NULL, NULL, &lastWrite);
+        *nameLength = length;
+        if (status == ERROR_SUCCESS && lastWriteTime)
+            *lastWriteTime = ((std::uint64_t)lastWrite.dwHighDateTime << 32) | lastWrite.dwLowDateTime;
+        return status;
+    }
+
+    long EnumValue(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                   std::uint32_t *type, void *data, std::uint32_t *dataSize)
+    {
+        DWORD length = *nameLength;
+        DWORD valueType = 0;
+        DWORD size = dataSize ? *dataSize : 0;
+        LONG status = RegEnumValueW(ToHkey(key), index, name, &length, NULL, &valueType,
+                                    (LPBYTE)data, dataSize ? &size : NULL);
+        *nameLength = length;
+        if (type)
+            *type = valueType;
+        if (dataSize)
+            *dataSize = size;
+        return status;
+    }
+
+    long QueryValue(RegKey key, const wchar_t *valueName, std::uint32_t *type,
+                    void *data, std::uint32_t *dataSize)
+    {
+        DWORD valueType = 0;
+        DWORD size = dataSize ? *dataSize : 0;
+        LONG status = RegQueryValueExW(ToHkey(key), valueName, NULL, &valueType, (LPBYTE)data, dataSize ? &size : NULL);
+        if (type)
+            *type = valueType;
+        if (dataSize)
+            *dataSize = size;
+        return status;
+    }
+
+    long SetValue(RegKey key, const wchar_t *valueName, std::uint32_t type,
+                  const void *data, std::uint32_t dataSize)
+    {
+        return RegSetValueExW(ToHkey(key), valueName, 0, type, (const BYTE *)data, dataSize);
+    }
+
+    long DeleteValue(RegKey key, const wchar_t *valueName)
+    {
+        return RegDeleteValueW(ToHkey(key), valueName);
+    }
+
+    long DeleteKey(RegKey parent, const wchar_t *subKey)
+    {
+        return RegDeleteKeyW(ToHkey(parent), subKey);
+    }
+
+    long DeleteTree(RegKey parent, const wchar_t *subKey)
+    {
+        // SHDeleteKeyW is more reliable than RegDeleteTreeW on the merged HKCR view
+        return SHDeleteKeyW(ToHkey(parent), subKey);
+    }
+
+    long ExpandString(const wchar_t *text, wchar_t *buffer, std::uint32_t *length)
+    {
+        DWORD needed = ExpandEnvironmentStringsW(text, buffer, *length);
+        if (needed == 0)
+            return (long)GetLastError();
+        bool fits = needed <= *length;
+        *length = needed;
+        return fits ? RegOk : RegMoreData;
+    }
+};
+
+// Change source on top of RegNotifyChangeKeyValue, watching a key and its subtree
+class Win32RegistryChangeSource : public RegistryChangeSource
+{
+private:
+    HKEY hKey;
+    HANDLE hChangeEvent;
+    HANDLE hStopEvent;
+
+public:
+    Win32RegistryChangeSource(HKEY hRoot, const wchar_t *subKey) : hKey(NULL)
+    {
+        RegOpenKeyExW(hRoot, subKey, 0, KEY_NOTIFY, &hKey);
+        hChangeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+        hStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    }
+
+    ~Win32RegistryChangeSource()
+    {
+        if (hKey)
+            RegCloseKey(hKey);
+        if (hChangeEvent)
+            CloseHandle(hChangeEvent);
+        if (hStopEvent)
+            CloseHandle(hStopEvent);
+    }
+
+    bool WaitForChange()
+    {
+        if (!hKey || !hChangeEvent || !hStopEvent)
+            return false;
+
+        // The registration is one-shot, so re-arm before every wait
+        if (RegNotifyChangeKeyValue(hKey, TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET,
+                                    hChangeEvent, TRUE) != ERROR_SUCCESS)
+            return false;
+
+        HANDLE handles[2] = {hStopEvent, hChangeEvent};
+        return WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1;
+    }
+
+    void Cancel()
+    {
+        if (hStopEvent)
+            SetEvent(hStopEvent);
+    }
+};
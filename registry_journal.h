@@ -0,0 +1,531 @@
+#pragma once
+
+// Write-ahead journal for registry transactions
+//
+// RegistryTransaction keeps what it needs to roll back in memory, so a process
+// that dies part way through a commit leaves the batch half applied: a reorder
+// with both CustomApp_X_3 and 02_CustomApp_X, a verb key without its command
+// subkey. With a RegistryJournal, a commit first appends a begin record with
+// the staged operations and a before image of everything they can touch: the
+// subtree of every key deleted or renamed, the old data of every value set,
+// the keys that don't exist yet, including the names a rename cycle may park
+// a key under. The record is written in one piece and flushed once, and only
+// then is the registry touched.
+//
+// Once the batch has landed, or has been rolled back cleanly, a short end
+// record follows without a flush of its own. It survives the process dying;
+// after a power loss it may be lost, but so may the batch itself (the
+// registry flushes lazily too), and rolling the batch back again is then
+// the right thing to do.
+//
+// At the next start RecoverRegistryJournal (registry_transaction.h) takes
+// every batch that began and never ended, newest first, and puts its before
+// images back. That needs no record of how far the batch got: deleting what
+// didn't exist and restoring what did gives the same result from any point,
+// and doing it twice is harmless. The batch can then be replayed as a fresh
+// transaction to complete it instead.
+//
+// The file is a sequence of records:
+//
+//   header   "RCMJ", kind (1 begin, 2 end), batch id, body size, FNV-1a of the body
+//   begin    root (two 32-bit halves, low first), base path, operation count,
+//            operations, image count, images
+//   end      empty body
+//
+// Integers are little-endian; strings and value data are a byte count, the
+// bytes (strings as UTF-8) and padding to 4 bytes. A record that is cut short
+// or fails its checksum is the tail of a write that never finished - its batch
+// never touched the registry - and everything from there on is dropped.
+
+#include "registry_tree.h"
+#include "text_encoding.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One staged step of a RegistryTransaction, in the form the journal records and replays
+struct RegistryOperation
+{
+    enum Kind
+    {
+        OpCreateKey,
+        OpSetValue,
+        OpDeleteValue,
+        OpDeleteTree,
+        OpRename,
+        OpRestoreTree
+    };
+
+    Kind kind;
+    std::wstring path;               // Key path relative to the base key
+    std::wstring name;               // Value name, or new key name for OpRename
+    std::uint32_t type;
+    std::vector<unsigned char> data;
+    std::vector<KeyRename> renames;  // OpRename batch
+    std::shared_ptr<const KeySnapshot> tree; // OpRestoreTree contents
+};
+
+// What part of the registry looked like before a batch, as far as the batch can change it
+struct RegistryImage
+{
+    enum Kind
+    {
+        ImageKey,  // path and its subtree
+        ImageValue // One value of path
+    };
+
+    Kind kind;
+    std::wstring path;   // Relative to the base key
+    bool present;        // Whether the key or value existed
+    KeySnapshot tree;    // ImageKey: the subtree if present, named after the last part of path
+    ValueSnapshot value; // ImageValue: the name, and type and data if present
+};
+
+struct RegistryJournalBatch
+{
+    std::uint32_t id;
+    RegKey root;
+    std::wstring basePath;
+    std::vector<RegistryOperation> operations;
+    std::vector<RegistryImage> images;
+};
+
+// Where the journal lives. Read and Truncate are only used while nothing is appended.
+class JournalStorage
+{
+public:
+    virtual ~JournalStorage() {}
+
+    virtual bool Read(std::vector<std::uint8_t> &data) = 0;
+    virtual bool Append(const std::uint8_t *data, std::size_t size) = 0;
+
+    // Make everything appended so far durable
+    virtual bool Flush() = 0;
+
+    // Drop everything past size
+    virtual bool Truncate(std::size_t size) = 0;
+};
+
+// Journal bytes held in memory. DropUnflushed stands in for a power loss; a process that
+// dies keeps everything appended, flushed or not.
+class MemoryJournalStorage : public JournalStorage
+{
+private:
+    std::vector<std::uint8_t> bytes;
+    std::size_t flushed;
+    std::size_t appends;
+    std::size_t flushes;
+
+public:
+    MemoryJournalStorage() : flushed(0), appends(0), flushes(0) {}
+
+    const std::vector<std::uint8_t> &Bytes() const { return bytes; }
+    std::size_t AppendCount() const { return appends; }
+    std::size_t FlushCount() const { return flushes; }
+
+    void DropUnflushed() { bytes.resize(flushed); }
+
+    bool Read(std::vector<std::uint8_t> &data)
+    {
+        data = bytes;
+        return true;
+    }
+
+    bool Append(const std::uint8_t *data, std::size_t size)
+    {
+        bytes.insert(bytes.end(), data, data + size);
+        appends++;
+        return true;
+    }
+
+    bool Flush()
+    {
+        flushed = bytes.size();
+        flushes++;
+        return true;
+    }
+
+    bool Truncate(std::size_t size)
+    {
+        if (size < bytes.size())
+            bytes.resize(size);
+        flushed = std::min(flushed, bytes.size());
+        return true;
+    }
+};
+
+class RegistryJournalWriter
+{
+private:
+    std::vector<std::uint8_t> &out;
+
+public:
+    explicit RegistryJournalWriter(std::vector<std::uint8_t> &buffer) : out(buffer) {}
+
+    void Put32(std::uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            out.push_back((std::uint8_t)(value >> (8 * i)));
+    }
+
+    void PutBytes(const void *data, std::size_t size)
+    {
+        Put32((std::uint32_t)size);
+        out.insert(out.end(), (const std::uint8_t *)data, (const std::uint8_t *)data + size);
+        out.resize(out.size() + (4 - size % 4) % 4, 0);
+    }
+
+    void PutString(std::wstring_view text)
+    {
+        std::string utf8 = Utf8FromWide(text);
+        PutBytes(utf8.data(), utf8.size());
+    }
+
+    // Pre-order, each key followed by its child count, without recursion
+    void PutTree(const KeySnapshot &tree)
+    {
+        std::vector<const KeySnapshot *> stack(1, &tree);
+        while (!stack.empty())
+        {
+            const KeySnapshot *key = stack.back();
+            stack.pop_back();
+            PutString(key->name);
+            Put32((std::uint32_t)key->values.size());
+            for (const ValueSnapshot &value : key->values)
+            {
+                PutString(value.name);
+                Put32(value.type);
+                PutBytes(value.data.data(), value.data.size());
+            }
+            Put32((std::uint32_t)key->children.size());
+            for (std::size_t i = key->children.size(); i-- > 0;)
+                stack.push_back(&key->children[i]);
+        }
+    }
+};
+
+class RegistryJournalReader
+{
+private:
+    const std::uint8_t *data;
+    const std::uint8_t *end;
+
+public:
+    RegistryJournalReader(const std::uint8_t *begin, std::size_t size) : data(begin), end(begin + size) {}
+
+    bool AtEnd() const { return data == end; }
+    std::size_t Left() const { return (std::size_t)(end - data); }
+
+    bool Get32(std::uint32_t &value)
+    {
+        if (end - data < 4)
+            return false;
+        value = (std::uint32_t)data[0] | (std::uint32_t)data[1] << 8 | (std::uint32_t)data[2] << 16 |
+                (std::uint32_t)data[3] << 24;
+        data += 4;
+        return true;
+    }
+
+    // A count of items at least minSize bytes each that can still be in the rest of the record
+    bool GetCount(std::uint32_t &count, std::size_t minSize)
+    {
+        return Get32(count) && count <= Left() / minSize;
+    }
+
+    bool GetBytes(std::vector<unsigned char> &bytes)
+    {
+        std::uint32_t size;
+        if (!Get32(size) || size > Left() || Left() - size < (4 - size % 4) % 4)
+            return false;
+        bytes.assign(data, data + size);
+        data += size + (4 - size % 4) % 4;
+        return true;
+    }
+
+    bool GetString(std::wstring &text)
+    {
+        std::vector<unsigned char> bytes;
+        if (!GetBytes(bytes))
+            return false;
+        text = WideFromUtf8(std::string(bytes.begin(), bytes.end()));
+        return true;
+    }
+
+    bool GetTree(KeySnapshot &tree)
+    {
+        std::vector<KeySnapshot *> stack(1, &tree);
+        while (!stack.empty())
+        {
+            KeySnapshot *key = stack.back();
+            stack.pop_back();
+            std::uint32_t count;
+            if (!GetString(key->name) || !GetCount(count, 12))
+                return false;
+            key->values.resize(count);
+            for (ValueSnapshot &value : key->values)
+            {
+                if (!GetString(value.name) || !Get32(value.type) || !GetBytes(value.data))
+                    return false;
+            }
+            if (!GetCount(count, 12))
+                return false;
+            key->children.resize(count);
+            for (std::size_t i = count; i-- > 0;)
+                stack.push_back(&key->children[i]);
+        }
+        return true;
+    }
+};
+
+const std::uint32_t kRegistryJournalMagic = 0x4A4D4352; // "RCMJ"
+const std::size_t kRegistryJournalHeaderSize = 20;
+const std::size_t kRegistryJournalCheckpointSize = 256 * 1024;
+
+class RegistryJournal
+{
+private:
+    enum RecordKind
+    {
+        RecordBegin = 1,
+        RecordEnd = 2
+    };
+
+    JournalStorage &storage;
+    bool loaded;
+    std::uint32_t nextId;
+    std::size_t size;               // Bytes in the storage
+    std::vector<std::uint32_t> open; // Batches begun and not ended
+
+    RegistryJournal(const RegistryJournal &);
+    RegistryJournal &operator=(const RegistryJournal &);
+
+    static std::uint32_t Checksum(const std::uint8_t *data, std::size_t length)
+    {
+        std::uint32_t hash = 2166136261u;
+        for (std::size_t i = 0; i < length; i++)
+            hash = (hash ^ data[i]) * 16777619u;
+        return hash;
+    }
+
+    bool AppendRecord(RecordKind kind, std::uint32_t id, const std::vector<std::uint8_t> &body)
+    {
+        std::vector<std::uint8_t> record;
+        record.reserve(kRegistryJournalHeaderSize + body.size());
+        RegistryJournalWriter writer(record);
+        writer.Put32(kRegistryJournalMagic);
+        writer.Put32(kind);
+        writer.Put32(id);
+        writer.Put32((std::uint32_t)body.size());
+        writer.Put32(Checksum(body.data(), body.size()));
+        record.insert(record.end(), body.begin(), body.end());
+        if (!storage.Append(record.data(), record.size()))
+            return false;
+        size += record.size();
+        return true;
+    }
+
+    static void PutBatch(RegistryJournalWriter &writer, const RegistryJournalBatch &batch)
+    {
+        writer.Put32((std::uint32_t)(std::uint64_t)batch.root);
+        writer.Put32((std::uint32_t)((std::uint64_t)batch.root >> 32));
+        writer.PutString(batch.basePath);
+
+        writer.Put32((std::uint32_t)batch.operations.size());
+        for (const RegistryOperation &operation : batch.operations)
+        {
+            writer.Put32(operation.kind);
+            writer.PutString(operation.path);
+            writer.PutString(operation.name);
+            writer.Put32(operation.type);
+            writer.PutBytes(operation.data.data(), operation.data.size());
+            writer.Put32((std::uint32_t)operation.renames.size());
+            for (const KeyRename &rename : operation.renames)
+            {
+                writer.PutString(rename.from);
+                writer.PutString(rename.to);
+            }
+            writer.Put32(operation.tree ? 1 : 0);
+            if (operation.tree)
+                writer.PutTree(*operation.tree);
+        }
+
+        writer.Put32((std::uint32_t)batch.images.size());
+        for (const RegistryImage &image : batch.images)
+        {
+            writer.Put32(image.kind);
+            writer.PutString(image.path);
+            writer.Put32(image.present ? 1 : 0);
+            if (image.kind == RegistryImage::ImageKey && image.present)
+                writer.PutTree(image.tree);
+            if (image.kind == RegistryImage::ImageValue)
+            {
+                writer.PutString(image.value.name);
+                writer.Put32(image.value.type);
+                writer.PutBytes(image.value.data.data(), image.value.data.size());
+            }
+        }
+    }
+
+    static bool GetBatch(RegistryJournalReader &reader, RegistryJournalBatch &batch)
+    {
+        std::uint32_t low, high, count;
+        if (!reader.Get32(low) || !reader.Get32(high) || !reader.GetString(batch.basePath) || !reader.GetCount(count, 28))
+            return false;
+        batch.root = (RegKey)((std::uint64_t)high << 32 | low);
+
+        batch.operations.resize(count);
+        for (RegistryOperation &operation : batch.operations)
+        {
+            std::uint32_t kind, renames, hasTree;
+            if (!reader.Get32(kind) || kind > RegistryOperation::OpRestoreTree || !reader.GetString(operation.path) ||
+                !reader.GetString(operation.name) || !reader.Get32(operation.type) || !reader.GetBytes(operation.data) ||
+                !reader.GetCount(renames, 8))
+                return false;
+            operation.kind = (RegistryOperation::Kind)kind;
+            operation.renames.resize(renames);
+            for (KeyRename &rename : operation.renames)
+            {
+                if (!reader.GetString(rename.from) || !reader.GetString(rename.to))
+                    return false;
+            }
+            if (!reader.Get32(hasTree))
+                return false;
+            if (hasTree)
+            {
+                std::shared_ptr<KeySnapshot> tree = std::make_shared<KeySnapshot>();
+                if (!reader.GetTree(*tree))
+                    return false;
+                operation.tree = tree;
+            }
+        }
+
+        if (!reader.GetCount(count, 12))
+            return false;
+        batch.images.resize(count);
+        for (RegistryImage &image : batch.images)
+        {
+            std::uint32_t kind, present;
+            if (!reader.Get32(kind) || kind > RegistryImage::ImageValue || !reader.GetString(image.path) ||
+                !reader.Get32(present))
+                return false;
+            image.kind = (RegistryImage::Kind)kind;
+            image.present = present != 0;
+            if (image.kind == RegistryImage::ImageKey && image.present && !reader.GetTree(image.tree))
+                return false;
+            if (image.kind == RegistryImage::ImageValue &&
+                (!reader.GetString(image.value.name) || !reader.Get32(image.value.type) || !reader.GetBytes(image.value.data)))
+                return false;
+        }
+        return reader.AtEnd();
+    }
+
+public:
+    explicit RegistryJournal(JournalStorage &file) : storage(file), loaded(false), nextId(1), size(0) {}
+
+    // Read the journal. interrupted receives every batch that began and never ended, oldest
+    // first. A torn record at the end is cut off. False if the storage can't be read.
+    bool Load(std::vector<RegistryJournalBatch> &interrupted)
+    {
+        interrupted.clear();
+        open.clear();
+        std::vector<std::uint8_t> data;
+        if (!storage.Read(data))
+            return false;
+
+        RegistryJournalReader reader(data.data(), data.size());
+        std::size_t valid = 0;
+        while (!reader.AtEnd())
+        {
+            std::uint32_t magic, kind, id, bodySize, checksum;
+            if (!reader.Get32(magic) || magic != kRegistryJournalMagic || !reader.Get32(kind) || !reader.Get32(id) ||
+                !reader.Get32(bodySize) || !reader.Get32(checksum) || bodySize > reader.Left())
+                break;
+            const std::uint8_t *body = data.data() + valid + kRegistryJournalHeaderSize;
+            if (Checksum(body, bodySize) != checksum)
+                break;
+
+            if (kind == RecordBegin)
+            {
+                RegistryJournalBatch batch;
+                RegistryJournalReader bodyReader(body, bodySize);
+                batch.id = id;
+                if (!GetBatch(bodyReader, batch))
+                    break;
+                interrupted.push_back(batch);
+            }
+            else if (kind == RecordEnd)
+            {
+                interrupted.erase(std::remove_if(interrupted.begin(), interrupted.end(),
+                                                 [id](const RegistryJournalBatch &batch)
+                                                 { return batch.id == id; }),
+                                  interrupted.end());
+            }
+            else
+            {
+                break;
+            }
+
+            valid += kRegistryJournalHeaderSize + bodySize;
+            reader = RegistryJournalReader(data.data() + valid, data.size() - valid);
+            nextId = std::max(nextId, id + 1);
+        }
+
+        if (valid < data.size() && !storage.Truncate(valid))
+            return false;
+        size = valid;
+        for (const RegistryJournalBatch &batch : interrupted)
+            open.push_back(batch.id);
+        loaded = true;
+        return true;
+    }
+
+    // Append the begin record of batch and flush it; id receives the batch's id. Nothing may be
+    // written to the registry for the batch unless this succeeded.
+    bool Begin(const RegistryJournalBatch &batch, std::uint32_t &id)
+    {
+        if (!loaded)
+        {
+            std::vector<RegistryJournalBatch> interrupted;
+            if (!Load(interrupted))
+                return false;
+        }
+
+        std::vector<std::uint8_t> body;
+        RegistryJournalWriter writer(body);
+        PutBatch(writer, batch);
+        id = nextId++;
+        if (!AppendRecord(RecordBegin, id, body) || !storage.Flush())
+            return false;
+        open.push_back(id);
+        return true;
+    }
+
+    // Mark batch id as done - applied, or rolled back without leaving anything behind
+    bool End(std::uint32_t id)
+    {
+        if (!AppendRecord(RecordEnd, id, std::vector<std::uint8_t>()))
+            return false;
+        open.erase(std::remove(open.begin(), open.end(), id), open.end());
+        Checkpoint(false);
+        return true;
+    }
+
+    // Empty the journal when no batch is open - always with force, else once it has grown
+    // past kRegistryJournalCheckpointSize
+    void Checkpoint(bool force)
+    {
+        if (!open.empty() || size == 0 || (!force && size < kRegistryJournalCheckpointSize))
+            return;
+        if (storage.Truncate(0))
+            size = 0;
+    }
+
+    // Batches begun and not ended
+    std::size_t OpenCount() const { return open.size(); }
+
+    // Bytes the journal holds
+    std::size_t Size() const { return size; }
+};
@@ -0,0 +1,663 @@
+#pragma once
+
+// In-memory registry backend
+//
+// Portable stand-in for HKEY_CLASSES_ROOT used to exercise load, reorder and
+// delete paths with tens of thousands of entries without a Windows machine.
+//
+// Layout:
+//   - every key lives in one contiguous node arena (std::vector<KeyNode>),
+//     freed nodes are recycled through a free list
+//   - every value lives in one contiguous value arena, keys hold value ids
+//   - each key owns a child index: a hash of the case-folded name for lookups,
+//     and an enumeration vector that is sorted and compacted lazily, so bulk
+//     inserts and deletes stay O(1) and the sort is paid once per enumeration
+//   - handles are slots in a handle table carrying the node generation, so a
+//     handle to a deleted (and possibly recycled) key fails cleanly
+//   - last write times come from a logical clock bumped on every mutation,
+//     which also wakes WaitForChange (the RegNotifyChangeKeyValue stand-in)
+//   - the tree is guarded by a reader/writer lock, so reads from many threads
+//     (the HKCR audit) run in parallel; the handle table has its own small lock
+//   - ExpandString looks variables up in a table filled with SetVariable,
+//     never in the process environment, so expansion is reproducible
+
+#include "registry_backend.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+class MemoryRegistryBackend : public RegistryBackend
+{
+private:
+    static constexpr std::uint32_t kNoNode = 0xFFFFFFFFu;
+    static constexpr std::uint32_t kRootNode = 0;
+    static constexpr RegKey kFirstHandle = 16; // Keep clear of predefined keys
+
+    struct ValueRecord
+    {
+        std::wstring name;
+        std::uint32_t type;
+        std::vector<unsigned char> data;
+    };
+
+    struct KeyNode
+    {
+        std::wstring name;
+        std::uint32_t parent;
+        std::uint32_t generation;
+        bool alive;
+        std::uint64_t lastWriteTime;
+        std::uint32_t indexInParent;                                // Slot in parent's children
+        std::vector<std::uint32_t> children;                        // Enumeration order, may hold kNoNode tombstones
+        std::unordered_multimap<std::size_t, std::uint32_t> lookup; // Case-folded name hash -> child
+        std::uint32_t liveChildren;
+        std::uint32_t maxChildNameLength;
+        bool childrenSorted;
+        std::vector<std::uint32_t> values; // Ids into valueArena, insertion order
+    };
+
+    struct HandleSlot
+    {
+        std::uint32_t node;
+        std::uint32_t generation;
+    };
+
+    std::vector<KeyNode> nodes;
+    std::vector<std::uint32_t> freeNodes;
+    std::vector<ValueRecord> valueArena;
+    std::vector<std::uint32_t> freeValues;
+    std::vector<HandleSlot> handles;
+    std::vector<std::uint32_t> freeHandles;
+    std::uint64_t clock;
+    std::unordered_map<std::wstring, std::wstring, RegistryNameHash, RegistryNameEqual> variables; // For ExpandString
+    mutable std::shared_mutex lock;    // Tree and variables: shared for reads, exclusive for writes
+    mutable std::mutex handleLock;     // Handle table, taken after lock when both are held
+
+    // Change notification, kept apart from the tree lock so waiters never block writers
+    std::mutex changeLock;
+    std::condition_variable changeSignal;
+    std::uint64_t changeSequence;
+
+    bool NameLess(std::uint32_t a, std::uint32_t b) const
+    {
+        return CompareRegistryNames(nodes[a].name, nodes[b].name) < 0;
+    }
+
+    void Touch(std::uint32_t node)
+    {
+        nodes[node].lastWriteTime = ++clock;
+        {
+            std::lock_guard<std::mutex> guard(changeLock);
+            changeSequence++;
+        }
+        changeSignal.notify_all();
+    }
+
+    static bool ChildrenNormalized(const KeyNode &node)
+    {
+        return node.childrenSorted && node.liveChildren == node.children.size();
+    }
+
+    // Drop tombstones and restore name order before enumeration; needs the exclusive lock
+    void NormalizeChildren(KeyNode &node)
+    {
+        if (ChildrenNormalized(node))
+            return;
+
+        node.children.erase(std::remove(node.children.begin(), node.children.end(), kNoNode), node.children.end());
+        if (!node.childrenSorted)
+        {
+            std::sort(node.children.begin(), node.children.end(), [this](std::uint32_t a, std::uint32_t b)
+                      { return NameLess(a, b); });
+            node.childrenSorted = true;
+        }
+
+        node.maxChildNameLength = 0;
+        for (std::size_t i = 0; i < node.children.size(); i++)
+        {
+            KeyNode &child = nodes[node.children[i]];
+            child.indexInParent = (std::uint32_t)i;
+            node.maxChildNameLength = std::max(node.maxChildNameLength, (std::uint32_t)child.name.length());
+        }
+    }
+
+    std::uint32_t FindChild(std::uint32_t parent, const wchar_t *name, std::size_t length) const
+    {
+        const KeyNode &node = nodes[parent];
+        auto range = node.lookup.equal_range(HashRegistryName(name, length));
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            const std::wstring &childName = nodes[it->second].name;
+            if (CompareRegistryNames(childName.c_str(), childName.length(), name, length) == 0)
+                return it->second;
+        }
+        return kNoNode;
+    }
+
+    std::uint32_t AllocateNode(std::uint32_t parent, const wchar_t *name, std::size_t length)
+    {
+        std::uint32_t id;
+        if (!freeNodes.empty())
+        {
+            id = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        else
+        {
+            id = (std::uint32_t)nodes.size();
+            nodes.push_back(KeyNode());
+            nodes[id].generation = 0;
+        }
+
+        KeyNode &node = nodes[id];
+        node.name.assign(name, length);
+        node.parent = parent;
+        node.alive = true;
+        node.children.clear();
+        node.lookup.clear();
+        node.liveChildren = 0;
+        node.maxChildNameLength = 0;
+        node.childrenSorted = true;
+        node.values.clear();
+        node.lastWriteTime = ++clock;
+
+        KeyNode &parentNode = nodes[parent];
+        if (parentNode.childrenSorted && !parentNode.children.empty())
+        {
+            // Appending in order keeps the enumeration vector sorted
+            std::uint32_t last = parentNode.children.back();
+            if (last == kNoNode || !NameLess(last, id))
+                parentNode.childrenSorted = false;
+        }
+        node.indexInParent = (std::uint32_t)parentNode.children.size();
+        parentNode.children.push_back(id);
+        parentNode.lookup.insert(std::make_pair(HashRegistryName(name, length), id));
+        parentNode.liveChildren++;
+        parentNode.maxChildNameLength = std::max(parentNode.maxChildNameLength, (std::uint32_t)length);
+        Touch(parent);
+        return id;
+    }
+
+    void FreeNode(std::uint32_t id)
+    {
+        KeyNode &node = nodes[id];
+        for (std::uint32_t valueId : node.values)
+        {
+            valueArena[valueId].data.clear();
+            valueArena[valueId].name.clear();
+            freeValues.push_back(valueId);
+        }
+        node.values.clear();
+        node.children.clear();
+        node.lookup.clear();
+        node.liveChildren = 0;
+        node.alive = false;
+        node.generation++;
+        freeNodes.push_back(id);
+    }
+
+    void UnlinkFromParent(std::uint32_t id)
+    {
+        KeyNode &node = nodes[id];
+        KeyNode &parentNode = nodes[node.parent];
+
+        auto range = parentNode.lookup.equal_range(HashRegistryName(node.name.c_str(), node.name.length()));
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == id)
+            {
+                parentNode.lookup.erase(it);
+                break;
+            }
+        }
+
+        // Leave a tombstone, compacted on the next enumeration
+        parentNode.children[node.indexInParent] = kNoNode;
+        parentNode.liveChildren--;
+        Touch(node.parent);
+    }
+
+    // Walk a backslash separated path; optionally create missing keys
+    std::uint32_t Resolve(std::uint32_t start, const wchar_t *path, bool create)
+    {
+        std::uint32_t current = start;
+        if (!path)
+            return current;
+
+        const wchar_t *segment = path;
+        while (*segment)
+        {
+            const wchar_t *end = segment;
+            while (*end && *end != L'\\')
+                end++;
+
+            std::size_t length = end - segment;
+            if (length > 0)
+            {
+                std::uint32_t child = FindChild(current, segment, length);
+                if (child == kNoNode)
+                {
+                    if (!create)
+                        return kNoNode;
+                    child = AllocateNode(current, segment, length);
+                }
+                current = child;
+            }
+            segment = *end ? end + 1 : end;
+        }
+        return current;
+    }
+
+    // Callers hold lock (shared or exclusive)
+    std::uint32_t NodeFromHandle(RegKey key) const
+    {
+        if (key == kRegClassesRoot)
+            return kRootNode;
+        HandleSlot slot;
+        {
+            std::lock_guard<std::mutex> guard(handleLock);
+            if (key < kFirstHandle || key - kFirstHandle >= handles.size())
+                return kNoNode;
+            slot = handles[key - kFirstHandle];
+        }
+        if (slot.node == kNoNode || !nodes[slot.node].alive || nodes[slot.node].generation != slot.generation)
+            return kNoNode;
+        return slot.node;
+    }
+
+    RegKey AllocateHandle(std::uint32_t node)
+    {
+        HandleSlot slot = {node, nodes[node].generation};
+        std::lock_guard<std::mutex> guard(handleLock);
+        if (!freeHandles.empty())
+        {
+            std::uint32_t index = freeHandles.back();
+            freeHandles.pop_back();
+            handles[index] = slot;
+            return kFirstHandle + index;
+        }
+        handles.push_back(slot);
+        return kFirstHandle + handles.size() - 1;
+    }
+
+    std::uint32_t FindValue(const KeyNode &node, const wchar_t *valueName) const
+    {
+        if (!valueName)
+            valueName = L"";
+        std::size_t length = std::wcslen(valueName);
+        for (std::uint32_t valueId : node.values)
+        {
+            const std::wstring &name = valueArena[valueId].name;
+            if (CompareRegistryNames(name.c_str(), name.length(), valueName, length) == 0)
+                return valueId;
+        }
+        return kNoNode;
+    }
+
+    static long CopyName(const std::wstring &source, wchar_t *name, std::uint32_t *nameLength)
+    {
+        if (!nameLength)
+            return RegInvalidParameter;
+        if (!name || *nameLength <= source.length())
+        {
+            *nameLength = (std::uint32_t)source.length();
+            return RegMoreData;
+        }
+        std::memcpy(name, source.c_str(), (source.length() + 1) * sizeof(wchar_t));
+        *nameLength = (std::uint32_t)source.length();
+        return RegOk;
+    }
+
+    static long CopyData(const ValueRecord &record, std::uint32_t *type, void *data, std::uint32_t *dataSize)
+    {
+        if (type)
+            *type = record.type;
+        if (!dataSize)
+            return data ? RegInvalidParameter : RegOk;
+
+        std::uint32_t size = (std::uint32_t)record.data.size();
+        if (data)
+        {
+            if (*dataSize < size)
+            {
+                *dataSize = size;
+                return RegMoreData;
+            }
+            if (size > 0)
+                std::memcpy(data, record.data.data(), size);
+        }
+        *dataSize = size;
+        return RegOk;
+    }
+
+    long CopyChild(const KeyNode &node, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                   std::uint64_t *lastWriteTime) const
+    {
+        if (index >= node.children.size())
+            return RegNoMoreItems;
+
+        const KeyNode &child = nodes[node.children[index]];
+        long status = CopyName(child.name, name, nameLength);
+        if (status == RegOk && lastWriteTime)
+            *lastWriteTime = child.lastWriteTime;
+        return status;
+    }
+
+public:
+    MemoryRegistryBackend() : clock(0), changeSequence(0)
+    {
+        nodes.push_back(KeyNode());
+        nodes[kRootNode].parent = kNoNode;
+        nodes[kRootNode].generation = 0;
+        nodes[kRootNode].alive = true;
+        nodes[kRootNode].indexInParent = 0;
+        nodes[kRootNode].liveChildren = 0;
+        nodes[kRootNode].maxChildNameLength = 0;
+        nodes[kRootNode].childrenSorted = true;
+        nodes[kRootNode].lastWriteTime = 0;
+    }
+
+    long OpenKey(RegKey parent, const wchar_t *subKey, bool writable, RegKey *result)
+    {
+        (void)writable;
+        std::shared_lock<std::shared_mutex> guard(lock);
+        std::uint32_t start = NodeFromHandle(parent);
+        if (start == kNoNode)
+            return RegInvalidHandle;
+        std::uint32_t node = Resolve(start, subKey, false);
+        if (node == kNoNode)
+            return RegNotFound;
+        *result = AllocateHandle(node);
+        return RegOk;
+    }
+
+    long CreateKey(RegKey parent, const wchar_t *subKey, RegKey *result)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        std::uint32_t start = NodeFromHandle(parent);
+        if (start == kNoNode)
+            return RegInvalidHandle;
+        std::uint32_t node = Resolve(start, subKey, true);
+        *result = AllocateHandle(node);
+        return RegOk;
+    }
+
+    void CloseKey(RegKey key)
+    {
+        std::lock_guard<std::mutex> guard(handleLock);
+        if (key < kFirstHandle || key - kFirstHandle >= handles.size())
+            return;
+        std::uint32_t index = (std::uint32_t)(key - kFirstHandle);
+        if (handles[index].node == kNoNode)
+            return;
+        handles[index].node = kNoNode;
+        freeHandles.push_back(index);
+    }
+
+    long QueryInfoKey(RegKey key, RegKeyInfo *info)
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        std::uint32_t id = NodeFromHandle(key);
+        if (id == kNoNode)
+            return RegInvalidHandle;
+
+        const KeyNode &node = nodes[id];
+        RegKeyInfo result = {};
+        result.subKeyCount = node.liveChildren;
+        result.maxSubKeyLength = node.maxChildNameLength; // Upper bound until the next enumeration
+        result.valueCount = (std::uint32_t)node.values.size();
+        result.lastWriteTime = node.lastWriteTime;
+        for (std::uint32_t valueId : node.values)
+        {
+            const ValueRecord &record = valueArena[valueId];
+            result.maxValueNameLength = std::max(result.maxValueNameLength, (std::uint32_t)record.name.length());
+            result.maxValueDataSize = std::max(result.maxValueDataSize, (std::uint32_t)record.data.size());
+        }
+        *info = result;
+        return RegOk;
+    }
+
+    long EnumKey(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                 std::uint64_t *lastWriteTime)
+    {
+        {
+            // Usually the children are already in order and a shared lock is enough
+            std::shared_lock<std::shared_mutex> guard(lock);
+            std::uint32_t id = NodeFromHandle(key);
+            if (id == kNoNode)
+                return RegInvalidHandle;
+            if (ChildrenNormalized(nodes[id]))
+                return CopyChild(nodes[id], index, name, nameLength, lastWriteTime);
+        }
+
+        std::unique_lock<std::shared_mutex> guard(lock);
+        std::uint32_t id = NodeFromHandle(key);
+        if (id == kNoNode)
+            return RegInvalidHandle;
+        NormalizeChildren(nodes[id]);
+        return CopyChild(nodes[id], index, name, nameLength, lastWriteTime);
+    }
+
+    long EnumValue(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                   std::uint32_t *type, void *data, std::uint32_t *dataSize)
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        std::uint32_t id = NodeFromHandle(key);
+        if (id == kNoNode)
+            return RegInvalidHandle;
+
+        const KeyNode &node = nodes[id];
+        if (index >= node.values.size())
+            return RegNoMoreItems;
+
+        const ValueRecord &record = valueArena[node.values[index]];
+        long status = CopyName(record.name, name, nameLength);
+        if (status != RegOk)
+            return status;
+        return CopyData(record, type, data, dataSize);
+    }
+
+    long QueryValue(RegKey key, const wchar_t *valueName, std::uint32_t *type,
+                    void *data, std::uint32_t *dataSize)
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        std::uint32_t id = NodeFromHandle(key);
+        if (id == kNoNode)
+            return RegInvalidHandle;
+
+        std::uint32_t valueId = FindValue(nodes[id], valueName);
+        if (valueId == kNoNode)
+            return RegNotFound;
+        return CopyData(valueArena[valueId], type, data, dataSize);
+    }
+
+    long SetValue(RegKey key, const wchar_t *valueName, std::uint32_t type,
+                  const void *data, std::uint32_t dataSize)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        std::uint32_t id = NodeFromHandle(key);
+        if (id == kNoNode)
+            return RegInvalidHandle;
+
+        std::uint32_t valueId = FindValue(nodes[id], valueName);
+        if (valueId == kNoNode)
+        {
+            if (!freeValues.empty())
+            {
+                valueId = freeValues.back();
+                freeValues.pop_back();
+            }
+            else
+            {
+                valueId = (std::uint32_t)valueArena.size();
+                valueArena.push_back(ValueRecord());
+            }
+            valueArena[valueId].name = valueName ? valueName : L"";
+            nodes[id].values.push_back(valueId);
+        }
+
+        ValueRecord &record = valueArena[valueId];
+        record.type = type;
+        const unsigned char *bytes = (const unsigned char *)data;
+        record.data.assign(bytes, bytes + (data ? dataSize : 0));
+        Touch(id);
+        return RegOk;
+    }
+
+    long DeleteValue(RegKey key, const wchar_t *valueName)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        std::uint32_t id = NodeFromHandle(key);
+        if (id == kNoNode)
+            return RegInvalidHandle;
+
+        KeyNode &node = nodes[id];
+        std::uint32_t valueId = FindValue(node, valueName);
+        if (valueId == kNoNode)
+            return RegNotFound;
+
+        node.values.erase(std::find(node.values.begin(), node.values.end(), valueId));
+        valueArena[valueId].data.clear();
+        valueArena[valueId].name.clear();
+        freeValues.push_back(valueId);
+        Touch(id);
+        return RegOk;
+    }
+
+    long DeleteKey(RegKey parent, const wchar_t *subKey)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        std::uint32_t start = NodeFromHandle(parent);
+        if (start == kNoNode)
+            return RegInvalidHandle;
+        std::uint32_t id = Resolve(start, subKey, false);
+        if (id == kNoNode)
+            return RegNotFound;
+        if (id == kRootNode || id == start)
+            return RegAccessDenied;
+        if (nodes[id].liveChildren > 0)
+            return RegKeyHasChildren;
+
+        UnlinkFromParent(id);
+        FreeNode(id);
+        return RegOk;
+    }
+
+    long DeleteTree(RegKey parent, const wchar_t *subKey)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        std::uint32_t start = NodeFromHandle(parent);
+        if (start == kNoNode)
+            return RegInvalidHandle;
+        std::uint32_t id = Resolve(start, subKey, false);
+        if (id == kNoNode)
+            return RegNotFound;
+        if (id == kRootNode || id == start)
+            return RegAccessDenied;
+
+        UnlinkFromParent(id);
+
+        // Free the whole subtree without recursion
+        std::vector<std::uint32_t> pending(1, id);
+        while (!pending.empty())
+        {
+            std::uint32_t current = pending.back();
+            pending.pop_back();
+            for (std::uint32_t child : nodes[current].children)
+            {
+                if (child != kNoNode)
+                    pending.push_back(child);
+            }
+            FreeNode(current);
+        }
+        return RegOk;
+    }
+
+    long ExpandString(const wchar_t *text, wchar_t *buffer, std::uint32_t *length)
+    {
+        std::wstring result;
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            const wchar_t *rest = text;
+            for (const wchar_t *open = std::wcschr(rest, L'%'); open; open = std::wcschr(rest, L'%'))
+            {
+                const wchar_t *close = std::wcschr(open + 1, L'%');
+                if (!close)
+                    break;
+                auto found = variables.find(std::wstring(open + 1, close));
+                if (found == variables.end())
+                {
+                    // Not a variable - the closing '%' may open the next reference
+                    result.append(rest, close);
+                    rest = close;
+                    continue;
+                }
+                result.append(rest, open);
+                result += found->second;
+                rest = close + 1;
+            }
+            result += rest;
+        }
+
+        std::uint32_t needed = (std::uint32_t)result.length() + 1;
+        bool fits = buffer && *length >= needed;
+        if (fits)
+            std::memcpy(buffer, result.c_str(), needed * sizeof(wchar_t));
+        *length = needed;
+        return fits ? RegOk : RegMoreData;
+    }
+
+    // Define a variable for ExpandString; names are case-insensitive, as in the environment
+    void SetVariable(const std::wstring &name, const std::wstring &value)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        variables[name] = value;
+    }
+
+    // Block until any key changes after *seen was observed, or until *cancelled is set
+    // and WakeWaiters() is called. Updates *seen; returns false when cancelled.
+    bool WaitForChange(std::uint64_t *seen, const std::atomic<bool> *cancelled)
+    {
+        std::unique_lock<std::mutex> guard(changeLock);
+        changeSignal.wait(guard, [&]
+                          { return changeSequence != *seen || cancelled->load(); });
+        if (cancelled->load())
+            return false;
+        *seen = changeSequence;
+        return true;
+    }
+
+    void WakeWaiters()
+    {
+        {
+            std::lock_guard<std::mutex> guard(changeLock);
+        }
+        changeSignal.notify_all();
+    }
+
+    std::uint64_t ChangeSequence()
+    {
+        std::lock_guard<std::mutex> guard(changeLock);
+        return changeSequence;
+    }
+
+    // Number of live keys, including the root
+    std::size_t KeyCount() const
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        return nodes.size() - freeNodes.size();
+    }
+
+    // Number of currently open handles
+    std::size_t OpenHandleCount() const
+    {
+        std::lock_guard<std::mutex> guard(handleLock);
+        return handles.size() - freeHandles.size();
+    }
+};
@@ -0,0 +1,746 @@
+#pragma once
+
+// Transactional batch writer
+//
+// RegistryTransaction stages key creates, value writes, deletes, renames and
+// restores of captured subtrees
+// below one base key and applies them in order on Commit(). Before each step
+// it records what it is about to overwrite (the old value, the subtree about to
+// be deleted, which part of a new path did not exist yet). If a step fails,
+// the recorded steps are undone in reverse, so a multi-key change either
+// lands completely or not at all.
+//
+// Handles opened while applying are cached by path for the whole commit, so a
+// batch that writes several values to the same key opens it once. The commit
+// callback runs once after a successful commit - the place for the single
+// SHChangeNotify of the batch.
+//
+// The registry itself is not transactional: another process can still see the
+// intermediate state while a commit is running, and a rollback step can fail
+// too (RollbackStatus reports that). Given a RegistryJournal, a commit first
+// records the batch and its before images there, so a batch cut short by the
+// process dying is rolled back (or completed) by RecoverRegistryJournal at the
+// next start.
+
+#include "registry_journal.h"
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+class RegistryTransaction
+{
+private:
+    typedef RegistryOperation Operation;
+
+    enum UndoKind
+    {
+        UndoDeleteTree,   // Remove a key this transaction created
+        UndoSetValue,     // Put back an overwritten or deleted value
+        UndoDeleteValue,  // Remove a value that did not exist before
+        UndoRestoreTree,  // Recreate a deleted subtree below path
+        UndoRename        // Rename path back to name (both relative to the base key)
+    };
+
+    struct UndoStep
+    {
+        UndoKind kind;
+        std::wstring path;
+        std::wstring name;
+        ValueSnapshot value;
+        KeySnapshot tree;
+    };
+
+    typedef std::unordered_map<std::wstring, RegKey, RegistryNameHash, RegistryNameEqual> HandleCache;
+    typedef std::unordered_set<std::wstring, RegistryNameHash, RegistryNameEqual> PathSet;
+
+    RegistryBackend &backend;
+    RegKey root;
+    std::wstring basePath;
+    std::function<void()> onCommit;
+    RegistryJournal *journal;
+
+    std::vector<Operation> operations;
+    std::vector<UndoStep> undoLog;
+    HandleCache handles;
+    RegKey baseKey;
+    int failedOperation;
+    long rollbackStatus;
+
+    RegistryTransaction(const RegistryTransaction &);
+    RegistryTransaction &operator=(const RegistryTransaction &);
+
+    static std::wstring ParentPath(const std::wstring &path)
+    {
+        size_t slash = path.rfind(L'\\');
+        return slash == std::wstring::npos ? std::wstring() : path.substr(0, slash);
+    }
+
+    static std::wstring LeafName(const std::wstring &path)
+    {
+        size_t slash = path.rfind(L'\\');
+        return slash == std::wstring::npos ? path : path.substr(slash + 1);
+    }
+
+    static std::wstring ChildPath(const std::wstring &path, const std::wstring &name)
+    {
+        return path.empty() ? name : path + L"\\" + name;
+    }
+
+    void CloseHandles()
+    {
+        for (auto &entry : handles)
+            backend.CloseKey(entry.second);
+        handles.clear();
+    }
+
+    // Open (or create) a key below the base key, reusing a handle from earlier steps
+    long OpenKey(const std::wstring &path, bool create, RegKey *result)
+    {
+        if (path.empty())
+        {
+            *result = baseKey;
+            return RegOk;
+        }
+
+        auto it = handles.find(path);
+        if (it != handles.end())
+        {
+            *result = it->second;
+            return RegOk;
+        }
+
+        RegKey key;
+        long status = create ? backend.CreateKey(baseKey, path.c_str(), &key)
+                             : backend.OpenKey(baseKey, path.c_str(), true, &key);
+        if (status != RegOk)
+            return status;
+        handles[path] = key;
+        *result = key;
+        return RegOk;
+    }
+
+    // Read a value into snapshot; RegNotFound when it does not exist
+    long CaptureValue(RegKey key, const std::wstring &valueName, ValueSnapshot &snapshot)
+    {
+        snapshot.name = valueName;
+        for (;;)
+        {
+            std::uint32_t size = (std::uint32_t)snapshot.data.size();
+            long status = backend.QueryValue(key, valueName.c_str(), &snapshot.type,
+                                             snapshot.data.empty() ? NULL : snapshot.data.data(), &size);
+            if (status == RegMoreData || (status == RegOk && size > snapshot.data.size()))
+            {
+                snapshot.data.resize(size);
+                continue;
+            }
+            if (status == RegOk)
+                snapshot.data.resize(size);
+            return status;
+        }
+    }
+
+    bool KeyExists(const std::wstring &path)
+    {
+        RegKey probe;
+        if (backend.OpenKey(baseKey, path.c_str(), false, &probe) != RegOk)
+            return false;
+        backend.CloseKey(probe);
+        return true;
+    }
+
+    // The first component of path that does not exist yet, empty if all of it does
+    std::wstring FirstMissingPrefix(const std::wstring &path)
+    {
+        size_t end = 0;
+        while (end != std::wstring::npos)
+        {
+            end = path.find(L'\\', end + 1);
+            std::wstring prefix = path.substr(0, end);
+            if (!KeyExists(prefix))
+                return prefix;
+        }
+        return std::wstring();
+    }
+
+    // Journal image of path and its subtree, once per path
+    long CaptureKeyImage(const std::wstring &path, PathSet &seen, std::vector<RegistryImage> &images)
+    {
+        if (!seen.insert(path).second)
+            return RegOk;
+
+        RegistryImage image;
+        image.kind = RegistryImage::ImageKey;
+        image.path = path;
+        image.present = false;
+        image.tree.name = LeafName(path);
+
+        ScopedRegKey key(backend);
+        long status = backend.OpenKey(baseKey, path.c_str(), false, key.Receive());
+        if (status == RegOk)
+        {
+            image.present = true;
+            status = CaptureKeyTree(backend, key.Get(), image.tree);
+        }
+        if (status != RegOk && status != RegNotFound)
+            return status;
+        images.push_back(image);
+        return RegOk;
+    }
+
+    // Before images of everything the staged operations can change, taken before any of them runs
+    long CaptureImages(std::vector<RegistryImage> &images)
+    {
+        PathSet keys;
+        PathSet values;
+        long status = RegOk;
+        for (size_t i = 0; status == RegOk && i < operations.size(); i++)
+        {
+            const Operation &operation = operations[i];
+            switch (operation.kind)
+            {
+            case Operation::OpCreateKey:
+            case Operation::OpRestoreTree:
+            {
+                // A restore may go where an earlier step of the batch deleted a key
+                std::wstring missing = FirstMissingPrefix(operation.path);
+                if (!missing.empty())
+                    status = CaptureKeyImage(missing, keys, images);
+                else if (operation.kind == Operation::OpRestoreTree)
+                    status = CaptureKeyImage(operation.path, keys, images);
+                break;
+            }
+            case Operation::OpSetValue:
+            case Operation::OpDeleteValue:
+            {
+                // A key that doesn't exist yet is covered by the step that creates it
+                ScopedRegKey key(backend);
+                if (!values.insert(operation.path + L'\0' + operation.name).second ||
+                    backend.OpenKey(baseKey, operation.path.c_str(), false, key.Receive()) != RegOk)
+                    break;
+                RegistryImage image;
+                image.kind = RegistryImage::ImageValue;
+                image.path = operation.path;
+                status = CaptureValue(key.Get(), operation.name, image.value);
+                image.present = status == RegOk;
+                if (status == RegOk || status == RegNotFound)
+                {
+                    images.push_back(image);
+                    status = RegOk;
+                }
+                break;
+            }
+            case Operation::OpDeleteTree:
+                status = CaptureKeyImage(operation.path, keys, images);
+                break;
+            case Operation::OpRename:
+            {
+                // Cycles are broken by parking a source whose target is another source under the
+                // first free name of source~, source~~, ... - at most once per such source, as the
+                // rename its move frees goes through next
+                std::vector<std::wstring> parkable;
+                for (const KeyRename &rename : operation.renames)
+                {
+                    status = CaptureKeyImage(ChildPath(operation.path, rename.from), keys, images);
+                    if (status == RegOk)
+                        status = CaptureKeyImage(ChildPath(operation.path, rename.to), keys, images);
+                    if (status != RegOk)
+                        break;
+                    for (const KeyRename &other : operation.renames)
+                    {
+                        if (&other != &rename && CompareRegistryNames(other.from, rename.to) == 0)
+                        {
+                            parkable.push_back(rename.from);
+                            break;
+                        }
+                    }
+                }
+                for (size_t j = 0; status == RegOk && j < parkable.size(); j++)
+                {
+                    // A name the batch renames something to is taken by the time a cycle is parked
+                    std::wstring parked = parkable[j] + L"~";
+                    auto taken = [&](const std::wstring &name)
+                    {
+                        for (const KeyRename &rename : operation.renames)
+                        {
+                            if (CompareRegistryNames(rename.to, name) == 0)
+                                return true;
+                        }
+                        return KeyExists(ChildPath(operation.path, name));
+                    };
+                    while (taken(parked))
+                        parked += L"~";
+                    status = CaptureKeyImage(ChildPath(operation.path, parked), keys, images);
+                }
+                break;
+            }
+            }
+        }
+        return status;
+    }
+
+    long ApplyCreateKey(const Operation &operation)
+    {
+        // Remember the first path component that does not exist yet - deleting it undoes the create
+        std::wstring missing = FirstMissingPrefix(operation.path);
+        if (!missing.empty())
+        {
+            UndoStep step;
+            step.kind = UndoDeleteTree;
+            step.path = missing;
+            undoLog.push_back(step);
+        }
+
+        RegKey key;
+        return OpenKey(operation.path, true, &key);
+    }
+
+    long ApplySetValue(const Operation &operation)
+    {
+        RegKey key;
+        long status = OpenKey(operation.path, false, &key);
+        if (status != RegOk)
+            return status;
+
+        UndoStep step;
+        step.path = operation.path;
+        status = CaptureValue(key, operation.name, step.value);
+        if (status == RegNotFound)
+        {
+            step.kind = UndoDeleteValue;
+            step.name = operation.name;
+        }
+        else if (status == RegOk)
+        {
+            step.kind = UndoSetValue;
+        }
+        else
+        {
+            return status;
+        }
+
+        if (operation.kind == Operation::OpDeleteValue)
+        {
+            if (step.kind == UndoDeleteValue)
+                return RegOk; // Nothing to delete
+            status = backend.DeleteValue(key, operation.name.c_str());
+        }
+        else
+        {
+            status = backend.SetValue(key, operation.name.c_str(), operation.type,
+                                      operation.data.empty() ? NULL : operation.data.data(),
+                                      (std::uint32_t)operation.data.size());
+        }
+        if (status == RegOk)
+            undoLog.push_back(step);
+        return status;
+    }
+
+    long ApplyDeleteTree(const Operation &operation)
+    {
+        UndoStep step;
+        step.kind = UndoRestoreTree;
+        step.path = ParentPath(operation.path);
+        step.tree.name = LeafName(operation.path);
+
+        ScopedRegKey key(backend);
+        long status = backend.OpenKey(baseKey, operation.path.c_str(), false, key.Receive());
+        if (status == RegNotFound)
+            return RegOk; // Already gone
+        if (status == RegOk)
+            status = CaptureKeyTree(backend, key.Get(), step.tree);
+        key.Reset();
+        if (status != RegOk)
+            return status;
+
+        // Cached handles may point into the subtree
+        CloseHandles();
+        status = backend.DeleteTree(baseKey, operation.path.c_str());
+        if (status == RegOk)
+            undoLog.push_back(step);
+        return status;
+    }
+
+    long ApplyRename(const Operation &operation)
+    {
+        CloseHandles();
+
+        RegKey parent;
+        long status = OpenKey(operation.path, false, &parent);
+        if (status != RegOk)
+            return status;
+
+        return ApplyRenames(backend, parent, operation.renames,
+                            [&](const wchar_t *from, const wchar_t *to)
+                            {
+                                long result = RenameKeyTree(backend, parent, from, to);
+                                if (result == RegOk)
+                                {
+                                    UndoStep step;
+                                    step.kind = UndoRename;
+                                    step.path = operation.path.empty() ? to : operation.path + L"\\" + to;
+                                    step.name = operation.path.empty() ? from : operation.path + L"\\" + from;
+                                    undoLog.push_back(step);
+                                }
+                                return result;
+                            });
+    }
+
+    long ApplyRestoreTree(const Operation &operation)
+    {
+        // Never merge into a key that exists - the result would be neither tree
+        if (KeyExists(operation.path))
+            return RegAlreadyExists;
+
+        // Created like any key, so a rollback deletes it again
+        long status = ApplyCreateKey(operation);
+        RegKey key;
+        if (status == RegOk)
+            status = OpenKey(operation.path, false, &key);
+        for (size_t i = 0; status == RegOk && i < operation.tree->values.size(); i++)
+        {
+            const ValueSnapshot &value = operation.tree->values[i];
+            status = backend.SetValue(key, value.name.c_str(), value.type,
+                                      value.data.empty() ? NULL : value.data.data(), (std::uint32_t)value.data.size());
+        }
+        for (size_t i = 0; status == RegOk && i < operation.tree->children.size(); i++)
+            status = RestoreKeyTree(backend, key, operation.tree->children[i]);
+        return status;
+    }
+
+    long Apply(const Operation &operation)
+    {
+        switch (operation.kind)
+        {
+        case Operation::OpCreateKey:
+            return ApplyCreateKey(operation);
+        case Operation::OpSetValue:
+        case Operation::OpDeleteValue:
+            return ApplySetValue(operation);
+        case Operation::OpDeleteTree:
+            return ApplyDeleteTree(operation);
+        case Operation::OpRename:
+            return ApplyRename(operation);
+        case Operation::OpRestoreTree:
+            return ApplyRestoreTree(operation);
+        }
+        return RegInvalidParameter;
+    }
+
+    // Undo applied steps newest first; keeps going past failures and reports the first one
+    long Rollback()
+    {
+        CloseHandles();
+
+        long result = RegOk;
+        for (size_t i = undoLog.size(); i-- > 0;)
+        {
+            const UndoStep &step = undoLog[i];
+            long status = RegOk;
+            ScopedRegKey key(backend);
+            switch (step.kind)
+            {
+            case UndoDeleteTree:
+                status = backend.DeleteTree(baseKey, step.path.c_str());
+                break;
+            case UndoSetValue:
+                status = backend.OpenKey(baseKey, step.path.c_str(), true, key.Receive());
+                if (status == RegOk)
+                    status = backend.SetValue(key.Get(), step.value.name.c_str(), step.value.type,
+                                              step.value.data.empty() ? NULL : step.value.data.data(),
+                                              (std::uint32_t)step.value.data.size());
+                break;
+            case UndoDeleteValue:
+                status = backend.OpenKey(baseKey, step.path.c_str(), true, key.Receive());
+                if (status == RegOk)
+                    status = backend.DeleteValue(key.Get(), step.name.c_str());
+                break;
+            case UndoRestoreTree:
+                status = step.path.empty() ? RegOk : backend.OpenKey(baseKey, step.path.c_str(), true, key.Receive());
+                if (status == RegOk)
+                    status = RestoreKeyTree(backend, step.path.empty() ? baseKey : key.Get(), step.tree);
+                break;
+            case UndoRename:
+                // Full paths, so renames that moved a key to another parent go back too
+                status = RenameKeyTree(backend, baseKey, step.path.c_str(), step.name.c_str());
+                break;
+            }
+            if (status != RegOk && status != RegNotFound && result == RegOk)
+                result = status;
+        }
+        undoLog.clear();
+        return result;
+    }
+
+public:
+    // All paths are relative to root\basePath, which must exist when committing. journal
+    // (optional) records every commit before it is applied.
+    RegistryTransaction(RegistryBackend &owner, RegKey rootKey, const wchar_t *base,
+                        std::function<void()> commitCallback = nullptr, RegistryJournal *commitJournal = NULL)
+        : backend(owner), root(rootKey), basePath(base ? base : L""), onCommit(commitCallback),
+          journal(commitJournal), baseKey(kRegNullKey), failedOperation(-1), rollbackStatus(RegOk) {}
+
+    ~RegistryTransaction() { CloseHandles(); }
+
+    // Create a key and any missing parents
+    void CreateKey(const std::wstring &path)
+    {
+        Operation operation;
+        operation.kind = Operation::OpCreateKey;
+        operation.path = path;
+        operations.push_back(operation);
+    }
+
+    // valueName NULL selects the default value; the key must exist or be created earlier in the batch
+    void SetValue(const std::wstring &path, const wchar_t *valueName, std::uint32_t type,
+                  const void *data, std::uint32_t dataSize)
+    {
+        Operation operation;
+        operation.kind = Operation::OpSetValue;
+        operation.path = path;
+        operation.name = valueName ? valueName : L"";
+        operation.type = type;
+        operation.data.assign((const unsigned char *)data, (const unsigned char *)data + dataSize);
+        operations.push_back(operation);
+    }
+
+    // Write a REG_SZ value including its terminator
+    void SetString(const std::wstring &path, const wchar_t *valueName, const std::wstring &value)
+    {
+        SetValue(path, valueName, RegTypeSz, value.c_str(), (std::uint32_t)((value.length() + 1) * sizeof(wchar_t)));
+    }
+
+    void DeleteValue(const std::wstring &path, const wchar_t *valueName)
+    {
+        Operation operation;
+        operation.kind = Operation::OpDeleteValue;
+        operation.path = path;
+        operation.name = valueName ? valueName : L"";
+        operations.push_back(operation);
+    }
+
+    // Delete a key and its subtree; a missing key is not an error
+    void DeleteTree(const std::wstring &path)
+    {
+        Operation operation;
+        operation.kind = Operation::OpDeleteTree;
+        operation.path = path;
+        operations.push_back(operation);
+    }
+
+    // Rename keys below parentPath ("" for the base key), ordered as ApplyRenames does
+    void Rename(const std::wstring &parentPath, const std::vector<KeyRename> &renames)
+    {
+        Operation operation;
+        operation.kind = Operation::OpRename;
+        operation.path = parentPath;
+        operation.renames = renames;
+        operations.push_back(operation);
+    }
+
+    // Recreate a captured subtree as path, whatever name tree carries. Fails with RegAlreadyExists
+    // if path exists; tree is shared, not copied, and must not change until the commit.
+    void RestoreTree(const std::wstring &path, std::shared_ptr<const KeySnapshot> tree)
+    {
+        Operation operation;
+        operation.kind = Operation::OpRestoreTree;
+        operation.path = path;
+        operation.tree = tree;
+        operations.push_back(operation);
+    }
+
+    // Stage an operation as recorded in a journal
+    void Add(const RegistryOperation &operation)
+    {
+        operations.push_back(operation);
+    }
+
+    bool Empty() const { return operations.empty(); }
+    std::size_t Size() const { return operations.size(); }
+    void Clear() { operations.clear(); }
+
+    // Index of the staged operation that failed in the last Commit, -1 if none
+    int FailedOperation() const { return failedOperation; }
+
+    // First error hit while rolling back the last Commit, RegOk if the rollback was clean
+    long RollbackStatus() const { return rollbackStatus; }
+
+    // Apply every staged operation, or none of them. The staged list is cleared either way.
+    // RegWriteFault if the journal couldn't record the batch; nothing was applied then.
+    long Commit()
+    {
+        failedOperation = -1;
+        rollbackStatus = RegOk;
+        if (operations.empty())
+            return RegOk;
+
+        ScopedRegKey base(backend);
+        long status = backend.OpenKey(root, basePath.c_str(), true, base.Receive());
+        if (status != RegOk)
+        {
+            failedOperation = 0;
+            operations.clear();
+            return status;
+        }
+        baseKey = base.Get();
+
+        std::uint32_t batchId = 0;
+        if (journal)
+        {
+            RegistryJournalBatch batch;
+            batch.root = root;
+            batch.basePath = basePath;
+            status = CaptureImages(batch.images);
+            batch.operations.swap(operations);
+            if (status == RegOk && !journal->Begin(batch, batchId))
+                status = RegWriteFault;
+            batch.operations.swap(operations);
+            if (status != RegOk)
+            {
+                failedOperation = 0;
+                operations.clear();
+                baseKey = kRegNullKey;
+                return status;
+            }
+        }
+
+        for (size_t i = 0; i < operations.size(); i++)
+        {
+            status = Apply(operations[i]);
+            if (status != RegOk)
+            {
+                failedOperation = (int)i;
+                rollbackStatus = Rollback();
+                break;
+            }
+        }
+
+        CloseHandles();
+        undoLog.clear();
+        operations.clear();
+        baseKey = kRegNullKey;
+
+        // A batch that left something behind stays open for recovery
+        if (journal && (status == RegOk || rollbackStatus == RegOk))
+            journal->End(batchId);
+
+        if (status == RegOk && onCommit)
+            onCommit();
+        return status;
+    }
+};
+
+enum JournalRecovery
+{
+    RecoverRollBack, // Put back what interrupted batches changed
+    RecoverComplete  // Put it back, then apply the batches again
+};
+
+struct JournalRecoveryStats
+{
+    std::size_t interrupted; // Batches found begun and not ended
+    std::size_t completed;   // Applied again
+    std::size_t rolledBack;  // Left rolled back
+};
+
+// Put back the keys and values batch can have changed, as they were before it began
+inline long RestoreJournalImages(RegistryBackend &backend, const RegistryJournalBatch &batch)
+{
+    ScopedRegKey base(backend);
+    long status = backend.OpenKey(batch.root, batch.basePath.c_str(), true, base.Receive());
+    if (status != RegOk)
+        return status;
+
+    // Whole keys first; value images may lie inside them
+    for (const RegistryImage &image : batch.images)
+    {
+        if (image.kind != RegistryImage::ImageKey || image.path.empty())
+            continue;
+        status = backend.DeleteTree(base.Get(), image.path.c_str());
+        if (status != RegOk && status != RegNotFound)
+            return status;
+        if (!image.present)
+            continue;
+
+        size_t slash = image.path.rfind(L'\\');
+        ScopedRegKey parent(backend);
+        if (slash != std::wstring::npos)
+        {
+            status = backend.CreateKey(base.Get(), image.path.substr(0, slash).c_str(), parent.Receive());
+            if (status != RegOk)
+                return status;
+        }
+        status = RestoreKeyTree(backend, slash == std::wstring::npos ? base.Get() : parent.Get(), image.tree);
+        if (status != RegOk)
+            return status;
+    }
+
+    for (const RegistryImage &image : batch.images)
+    {
+        if (image.kind != RegistryImage::ImageValue)
+            continue;
+        ScopedRegKey key(backend);
+        status = backend.OpenKey(base.Get(), image.path.c_str(), true, key.Receive());
+        if (status == RegNotFound)
+            continue; // The key didn't exist either
+        if (status == RegOk)
+        {
+            const ValueSnapshot &value = image.value;
+            status = image.present ? backend.SetValue(key.Get(), value.name.c_str(), value.type,
+                                                      value.data.empty() ? NULL : value.data.data(),
+                                                      (std::uint32_t)value.data.size())
+                                   : backend.DeleteValue(key.Get(), value.name.c_str());
+        }
+        if (status != RegOk && status != RegNotFound)
+            return status;
+    }
+    return RegOk;
+}
+
+// Roll back every batch in journal that began and never ended - newest first, so each one
+// finds the registry as it left it - and with RecoverComplete apply them again, oldest first.
+// Call it before anything else writes through the journal. The batches stay in the journal
+// until all of them have been put back; an error stops recovery, and the next run starts over.
+inline long RecoverRegistryJournal(RegistryBackend &backend, RegistryJournal &journal, JournalRecovery mode,
+                                   JournalRecoveryStats *stats = NULL)
+{
+    JournalRecoveryStats counts = {0, 0, 0};
+    std::vector<RegistryJournalBatch> batches;
+    long result = journal.Load(batches) ? RegOk : RegWriteFault;
+    counts.interrupted = batches.size();
+
+    for (size_t i = batches.size(); result == RegOk && i-- > 0;)
+        result = RestoreJournalImages(backend, batches[i]);
+
+    for (size_t i = 0; result == RegOk && i < batches.size(); i++)
+    {
+        if (mode == RecoverComplete)
+        {
+            // A fresh batch of its own, so a crash while completing is recovered the same way
+            RegistryTransaction transaction(backend, batches[i].root, batches[i].basePath.c_str(), nullptr, &journal);
+            for (const RegistryOperation &operation : batches[i].operations)
+                transaction.Add(operation);
+            if (transaction.Commit() == RegOk)
+                counts.completed++;
+            else
+                counts.rolledBack++;
+        }
+        else
+        {
+            counts.rolledBack++;
+        }
+    }
+
+    for (size_t i = 0; result == RegOk && i < batches.size(); i++)
+    {
+        if (!journal.End(batches[i].id))
+            result = RegWriteFault;
+    }
+    if (result == RegOk)
+        journal.Checkpoint(true);
+
+    if (stats)
+        *stats = counts;
+    return result;
+}
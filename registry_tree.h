@@ -0,0 +1,469 @@
+#pragma once
+
+// Subtree helpers on top of RegistryBackend
+//
+// The registry has no rename call that works on every Windows version, so a
+// key is renamed by copying its subtree to the new name and deleting the old
+// one. Copies, snapshots and deletes are iterative (explicit stack, no
+// recursion) and reuse one name and one data buffer for the whole tree.
+
+#include "registry_backend.h"
+
+#include <vector>
+
+// Call onValue(name, type, data, dataSize) -> long for every value of key; stops at the first non-RegOk result.
+// name and data are caller-provided scratch buffers, grown as needed and reusable across keys.
+template <typename ValueFn>
+long EnumerateValues(RegistryBackend &backend, RegKey key, std::vector<wchar_t> &name,
+                     std::vector<unsigned char> &data, ValueFn onValue)
+{
+    RegKeyInfo info;
+    long status = backend.QueryInfoKey(key, &info);
+    if (status != RegOk)
+        return status;
+    if (info.maxValueNameLength + 1 > name.size())
+        name.resize(info.maxValueNameLength + 1);
+    if (info.maxValueDataSize > data.size())
+        data.resize(info.maxValueDataSize);
+
+    std::uint32_t index = 0;
+    for (;;)
+    {
+        std::uint32_t nameLength = (std::uint32_t)name.size();
+        std::uint32_t type = 0;
+        std::uint32_t dataSize = (std::uint32_t)data.size();
+        status = backend.EnumValue(key, index, name.data(), &nameLength, &type,
+                                   data.empty() ? NULL : data.data(), &dataSize);
+        if (status == RegMoreData)
+        {
+            // Value grew after the info query - grow both buffers and retry the same index
+            name.resize(name.size() * 2);
+            if (dataSize > data.size())
+                data.resize(dataSize);
+            continue;
+        }
+        if (status == RegNoMoreItems)
+            return RegOk;
+        if (status != RegOk)
+            return status;
+
+        status = onValue((const wchar_t *)name.data(), type, (const void *)(data.empty() ? NULL : data.data()), dataSize);
+        if (status != RegOk)
+            return status;
+        index++;
+    }
+}
+
+// Copy every value of source into target, overwriting values with the same name
+inline long CopyKeyValues(RegistryBackend &backend, RegKey source, RegKey target,
+                          std::vector<wchar_t> &name, std::vector<unsigned char> &data)
+{
+    return EnumerateValues(backend, source, name, data,
+                           [&](const wchar_t *valueName, std::uint32_t type, const void *value, std::uint32_t size)
+                           { return backend.SetValue(target, valueName, type, value, size); });
+}
+
+// Copy the values and all subkeys of source below target
+inline long CopyKeyTree(RegistryBackend &backend, RegKey source, RegKey target)
+{
+    struct Pending
+    {
+        RegKey source;
+        RegKey target;
+        bool owned; // Handles opened here rather than by the caller
+    };
+
+    std::vector<Pending> stack;
+    std::vector<wchar_t> name(256);
+    std::vector<unsigned char> data(1024);
+    long result = RegOk;
+
+    Pending root = {source, target, false};
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        Pending item = stack.back();
+        stack.pop_back();
+
+        // After a failure keep popping only to close what is still open
+        if (result == RegOk)
+            result = CopyKeyValues(backend, item.source, item.target, name, data);
+
+        for (std::uint32_t index = 0; result == RegOk;)
+        {
+            std::uint32_t nameLength = (std::uint32_t)name.size();
+            long status = backend.EnumKey(item.source, index, name.data(), &nameLength, NULL);
+            if (status == RegMoreData)
+            {
+                name.resize(name.size() * 2);
+                continue;
+            }
+            if (status == RegNoMoreItems)
+                break;
+            if (status != RegOk)
+            {
+                result = status;
+                break;
+            }
+            index++;
+
+            Pending child = {kRegNullKey, kRegNullKey, true};
+            result = backend.OpenKey(item.source, name.data(), false, &child.source);
+            if (result != RegOk)
+                break;
+            result = backend.CreateKey(item.target, name.data(), &child.target);
+            if (result != RegOk)
+            {
+                backend.CloseKey(child.source);
+                break;
+            }
+            stack.push_back(child);
+        }
+
+        if (item.owned)
+        {
+            backend.CloseKey(item.source);
+            backend.CloseKey(item.target);
+        }
+    }
+    return result;
+}
+
+// Rename parent\oldName to parent\newName. Fails with RegAlreadyExists instead of merging into an existing key.
+inline long RenameKeyTree(RegistryBackend &backend, RegKey parent, const wchar_t *oldName, const wchar_t *newName)
+{
+    if (CompareRegistryNames(oldName, wcslen(oldName), newName, wcslen(newName)) == 0)
+        return RegOk;
+
+    ScopedRegKey oldKey(backend);
+    long status = backend.OpenKey(parent, oldName, false, oldKey.Receive());
+    if (status != RegOk)
+        return status;
+
+    ScopedRegKey newKey(backend);
+    if (backend.OpenKey(parent, newName, false, newKey.Receive()) == RegOk)
+        return RegAlreadyExists;
+
+    status = backend.CreateKey(parent, newName, newKey.Receive());
+    if (status != RegOk)
+        return status;
+
+    status = CopyKeyTree(backend, oldKey.Get(), newKey.Get());
+    newKey.Reset();
+    oldKey.Reset();
+    if (status != RegOk)
+    {
+        // Leave the original untouched and drop the partial copy
+        backend.DeleteTree(parent, newName);
+        return status;
+    }
+
+    status = backend.DeleteTree(parent, oldName);
+    if (status != RegOk)
+    {
+        // The delete may have removed part of the original - refill it from the copy, then drop the copy
+        if (backend.CreateKey(parent, oldName, oldKey.Receive()) == RegOk &&
+            backend.OpenKey(parent, newName, false, newKey.Receive()) == RegOk &&
+            CopyKeyTree(backend, newKey.Get(), oldKey.Get()) == RegOk)
+        {
+            newKey.Reset();
+            oldKey.Reset();
+            backend.DeleteTree(parent, newName);
+        }
+    }
+    return status;
+}
+
+// In-memory copy of a key and its subtree, used to restore deleted keys
+struct ValueSnapshot
+{
+    std::wstring name;
+    std::uint32_t type;
+    std::vector<unsigned char> data;
+};
+
+struct KeySnapshot
+{
+    std::wstring name; // Key name relative to its parent
+    std::vector<ValueSnapshot> values;
+    std::vector<KeySnapshot> children;
+};
+
+// Capture key and everything below it; snapshot.name is left to the caller
+inline long CaptureKeyTree(RegistryBackend &backend, RegKey key, KeySnapshot &snapshot)
+{
+    struct Pending
+    {
+        RegKey key;
+        KeySnapshot *snapshot;
+        bool owned;
+    };
+
+    std::vector<Pending> stack;
+    std::vector<wchar_t> name(256);
+    std::vector<unsigned char> data(1024);
+    long result = RegOk;
+
+    Pending root = {key, &snapshot, false};
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        Pending item = stack.back();
+        stack.pop_back();
+
+        if (result == RegOk)
+        {
+            item.snapshot->values.clear();
+            item.snapshot->children.clear();
+            result = EnumerateValues(backend, item.key, name, data,
+                                     [&](const wchar_t *valueName, std::uint32_t type, const void *value, std::uint32_t size)
+                                     {
+                                         ValueSnapshot copy;
+                                         copy.name = valueName;
+                                         copy.type = type;
+                                         copy.data.assign((const unsigned char *)value, (const unsigned char *)value + size);
+                                         item.snapshot->values.push_back(copy);
+                                         return (long)RegOk;
+                                     });
+        }
+
+        // Collect all child names first so the children vector is not resized while
+        // pointers into it sit on the stack
+        for (std::uint32_t index = 0; result == RegOk;)
+        {
+            std::uint32_t nameLength = (std::uint32_t)name.size();
+            long status = backend.EnumKey(item.key, index, name.data(), &nameLength, NULL);
+            if (status == RegMoreData)
+            {
+                name.resize(name.size() * 2);
+                continue;
+            }
+            if (status == RegNoMoreItems)
+                break;
+            if (status != RegOk)
+            {
+                result = status;
+                break;
+            }
+            index++;
+
+            KeySnapshot child;
+            child.name.assign(name.data(), nameLength);
+            item.snapshot->children.push_back(child);
+        }
+
+        for (size_t i = 0; result == RegOk && i < item.snapshot->children.size(); i++)
+        {
+            KeySnapshot &child = item.snapshot->children[i];
+            Pending next = {kRegNullKey, &child, true};
+            result = backend.OpenKey(item.key, child.name.c_str(), false, &next.key);
+            if (result == RegOk)
+                stack.push_back(next);
+        }
+
+        if (item.owned)
+            backend.CloseKey(item.key);
+    }
+    return result;
+}
+
+// Recreate a captured tree as parent\snapshot.name
+inline long RestoreKeyTree(RegistryBackend &backend, RegKey parent, const KeySnapshot &snapshot)
+{
+    struct Pending
+    {
+        RegKey parent;
+        const KeySnapshot *snapshot;
+        bool ownsParent; // Last child of a key closes the parent handle
+    };
+
+    std::vector<Pending> stack;
+    long result = RegOk;
+
+    Pending root = {parent, &snapshot, false};
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        Pending item = stack.back();
+        stack.pop_back();
+
+        RegKey key = kRegNullKey;
+        if (result == RegOk)
+            result = backend.CreateKey(item.parent, item.snapshot->name.c_str(), &key);
+        for (size_t i = 0; result == RegOk && i < item.snapshot->values.size(); i++)
+        {
+            const ValueSnapshot &value = item.snapshot->values[i];
+            result = backend.SetValue(key, value.name.c_str(), value.type,
+                                      value.data.empty() ? NULL : value.data.data(), (std::uint32_t)value.data.size());
+        }
+        if (item.ownsParent)
+            backend.CloseKey(item.parent);
+
+        if (key == kRegNullKey)
+            continue;
+        if (result != RegOk || item.snapshot->children.empty())
+        {
+            backend.CloseKey(key);
+            continue;
+        }
+
+        // The first child pushed is processed last and closes this key
+        for (size_t i = 0; i < item.snapshot->children.size(); i++)
+        {
+            Pending child = {key, &item.snapshot->children[i], i == 0};
+            stack.push_back(child);
+        }
+    }
+    return result;
+}
+
+// Delete parent\subKey and everything below it, children first. Each key is opened relative to
+// its parent's handle and its subkeys are listed once, so no path is rebuilt and no key is
+// enumerated again. RegNotFound if subKey does not exist; on failure part of the tree may be gone.
+inline long DeleteKeyTree(RegistryBackend &backend, RegKey parent, const wchar_t *subKey)
+{
+    struct Pending
+    {
+        RegKey key;
+        RegKey parent;
+        std::wstring name; // Relative to parent
+        size_t firstChild; // This key's subkeys are names[firstChild..]
+    };
+
+    std::vector<Pending> stack;
+    std::vector<std::wstring> names; // Subkeys not yet deleted, of every key on the stack
+    std::vector<wchar_t> name(256);
+    long result = RegOk;
+
+    Pending root = {kRegNullKey, parent, subKey, 0};
+    result = backend.OpenKey(parent, subKey, true, &root.key);
+    if (result != RegOk)
+        return result;
+    stack.push_back(root);
+
+    bool listChildren = true;
+    while (result == RegOk && !stack.empty())
+    {
+        Pending &item = stack.back();
+
+        // List the subkeys of a key just pushed
+        for (std::uint32_t index = 0; listChildren;)
+        {
+            std::uint32_t nameLength = (std::uint32_t)name.size();
+            long status = backend.EnumKey(item.key, index, name.data(), &nameLength, NULL);
+            if (status == RegMoreData)
+            {
+                name.resize(name.size() * 2);
+                continue;
+            }
+            if (status == RegNoMoreItems)
+                break;
+            if (status != RegOk)
+            {
+                result = status;
+                break;
+            }
+            index++;
+            names.push_back(std::wstring(name.data(), nameLength));
+        }
+        listChildren = false;
+        if (result != RegOk)
+            break;
+
+        if (names.size() > item.firstChild)
+        {
+            // Descend into the next subkey
+            Pending child = {kRegNullKey, item.key, names.back(), 0};
+            names.pop_back();
+            child.firstChild = names.size();
+            long status = backend.OpenKey(item.key, child.name.c_str(), true, &child.key);
+            if (status == RegNotFound)
+                continue; // Deleted by someone else meanwhile
+            if (status != RegOk)
+            {
+                result = status;
+                break;
+            }
+            stack.push_back(child);
+            listChildren = true;
+            continue;
+        }
+
+        // Every subkey is gone - delete the key itself through its parent's handle
+        backend.CloseKey(item.key);
+        long status = backend.DeleteKey(item.parent, item.name.c_str());
+        stack.pop_back();
+        if (status != RegOk && status != RegNotFound)
+            result = status;
+    }
+
+    // After a failure close whatever is still open
+    for (const auto &item : stack)
+        backend.CloseKey(item.key);
+    return result;
+}
+
+struct KeyRename
+{
+    std::wstring from;
+    std::wstring to;
+};
+
+// Apply a batch of renames under one parent. A target may be the current name of another
+// key in the batch; those renames are ordered so nothing is overwritten, and cycles are
+// broken through a temporary name. Stops at the first failure.
+// rename(const wchar_t *from, const wchar_t *to) -> long performs each single rename.
+template <typename RenameFn>
+long ApplyRenames(RegistryBackend &backend, RegKey parent, std::vector<KeyRename> renames, RenameFn rename)
+{
+    while (!renames.empty())
+    {
+        bool progress = false;
+        for (size_t i = 0; i < renames.size();)
+        {
+            long status = rename(renames[i].from.c_str(), renames[i].to.c_str());
+            if (status == RegOk)
+            {
+                renames.erase(renames.begin() + i);
+                progress = true;
+                continue;
+            }
+            if (status != RegAlreadyExists)
+                return status;
+
+            // Only wait for the target if another rename in the batch will free it
+            bool freedLater = false;
+            for (size_t j = 0; j < renames.size(); j++)
+            {
+                if (j != i && CompareRegistryNames(renames[j].from, renames[i].to) == 0)
+                    freedLater = true;
+            }
+            if (!freedLater)
+                return status;
+            i++;
+        }
+
+        if (!progress)
+        {
+            // Every remaining target is still taken by another remaining source - move one aside
+            std::wstring parked = renames[0].from + L"~";
+            ScopedRegKey probe(backend);
+            while (backend.OpenKey(parent, parked.c_str(), false, probe.Receive()) == RegOk)
+                parked += L"~";
+            probe.Reset();
+
+            long status = rename(renames[0].from.c_str(), parked.c_str());
+            if (status != RegOk)
+                return status;
+            renames[0].from = parked;
+        }
+    }
+    return RegOk;
+}
+
+inline long ApplyRenames(RegistryBackend &backend, RegKey parent, const std::vector<KeyRename> &renames)
+{
+    return ApplyRenames(backend, parent, renames,
+                        [&](const wchar_t *from, const wchar_t *to)
+                        { return RenameKeyTree(backend, parent, from, to); });
+}
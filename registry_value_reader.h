@@ -0,0 +1,116 @@
+#pragma once
+
+// String value reads into buffers sized from the key
+//
+// Verb keys hold a handful of string values - display name, MUIVerb, Icon,
+// SubCommands - and none of them has a length limit: a display name or an
+// icon path can be longer than any fixed buffer. RegistryValueReader reads
+// them into one buffer that is kept across reads and keys. Prepare sizes it
+// for the key's largest value with a single QueryInfoKey, so the reads that
+// follow never need a second round trip; a key that wasn't prepared (or a
+// value that grew in between) grows the buffer once and is read again.
+//
+// Only REG_SZ and REG_EXPAND_SZ values are accepted. Registry strings need
+// not be terminated, so the data is taken up to its first null or its end,
+// whichever comes first. REG_EXPAND_SZ data is expanded through the backend,
+// which is what RegGetValueW returns for it.
+
+#include "registry_backend.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+class RegistryValueReader
+{
+private:
+    RegistryBackend &backend;
+    std::vector<wchar_t> data;     // Raw value data plus a terminator
+    std::vector<wchar_t> expanded; // REG_EXPAND_SZ data after expansion
+
+    RegistryValueReader(const RegistryValueReader &);
+    RegistryValueReader &operator=(const RegistryValueReader &);
+
+    // Make room for a value of this many bytes, the terminator and an odd trailing byte
+    void Reserve(std::uint32_t bytes)
+    {
+        std::size_t needed = bytes / sizeof(wchar_t) + 2;
+        if (needed > data.size())
+            data.resize(needed);
+    }
+
+    // Expand the terminated text in data; the text as written if the backend can't expand it
+    std::wstring_view Expand(std::size_t length)
+    {
+        for (;;)
+        {
+            std::uint32_t size = (std::uint32_t)expanded.size();
+            long status = backend.ExpandString(data.data(), expanded.data(), &size);
+            if (status == RegMoreData && size > expanded.size())
+            {
+                expanded.resize(size);
+                continue;
+            }
+            if (status != RegOk || size == 0)
+                return std::wstring_view(data.data(), length);
+            return std::wstring_view(expanded.data(), size - 1);
+        }
+    }
+
+public:
+    explicit RegistryValueReader(RegistryBackend &owner) : backend(owner), data(256) {}
+
+    // Size the buffer for every value of key with one QueryInfoKey; info (optional) receives
+    // what the query returned. False if the key can't be queried - reads still work then.
+    bool Prepare(RegKey key, RegKeyInfo *info = NULL)
+    {
+        RegKeyInfo keyInfo;
+        if (backend.QueryInfoKey(key, &keyInfo) != RegOk)
+            return false;
+        Reserve(keyInfo.maxValueDataSize);
+        if (info)
+            *info = keyInfo;
+        return true;
+    }
+
+    // Read a string value (valueName NULL or empty for the default value). value points into
+    // the reader and stays valid until its next read. False if the value is missing, can't be
+    // read or is not REG_SZ or REG_EXPAND_SZ.
+    bool Read(RegKey key, const wchar_t *valueName, std::wstring_view &value)
+    {
+        for (;;)
+        {
+            std::uint32_t type = RegTypeNone;
+            std::uint32_t size = (std::uint32_t)((data.size() - 1) * sizeof(wchar_t));
+            long status = backend.QueryValue(key, valueName, &type, data.data(), &size);
+            if (status == RegMoreData)
+            {
+                Reserve(size);
+                continue;
+            }
+            if (status != RegOk || (type != RegTypeSz && type != RegTypeExpandSz))
+                return false;
+
+            std::size_t count = size / sizeof(wchar_t);
+            std::size_t length = 0;
+            while (length < count && data[length] != L'\0')
+                length++;
+            data[length] = L'\0';
+
+            value = std::wstring_view(data.data(), length);
+            if (type == RegTypeExpandSz && value.find(L'%') != std::wstring_view::npos)
+                value = Expand(length);
+            return true;
+        }
+    }
+
+    // Read a string value into value, as above
+    bool Read(RegKey key, const wchar_t *valueName, std::wstring &value)
+    {
+        std::wstring_view text;
+        if (!Read(key, valueName, text))
+            return false;
+        value.assign(text.data(), text.length());
+        return true;
+    }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+// Incremental reload support
+//
+// RegistryWatcher runs a background thread that blocks on a change source
+// (RegNotifyChangeKeyValue on Windows, the in-memory backend's change signal
+// in the tests) and calls back once per burst of changes until acknowledged.
+//
+// ShellKeyTracker remembers the last write time of every verb under a shell
+// key. Diff() only enumerates subkey names and timestamps - no key is opened -
+// and reports which verbs were added, changed or removed, so the caller
+// re-reads just those instead of rebuilding the whole list.
+//
+// Note: a verb's last write time moves when its own values or its list of
+// subkeys change, not when a value inside its "command" subkey is edited in
+// place. Whenever this program rewrites a command it also writes a value on
+// the verb itself (StageReconcile rewrites the display name if nothing else
+// changed), so that is not a gap for entries it manages; use a full reload to
+// pick up such external edits.
+
+#include "registry_backend.h"
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class RegistryChangeSource
+{
+public:
+    virtual ~RegistryChangeSource() {}
+
+    // Block until the watched key changes (true) or Cancel() is called (false)
+    virtual bool WaitForChange() = 0;
+
+    // Wake a blocked WaitForChange from another thread; further waits return false
+    virtual void Cancel() = 0;
+};
+
+class RegistryWatcher
+{
+private:
+    RegistryChangeSource &source;
+    std::function<void()> onChange;
+    std::thread worker;
+    std::atomic<bool> pending;
+
+    RegistryWatcher(const RegistryWatcher &);
+    RegistryWatcher &operator=(const RegistryWatcher &);
+
+    void Run()
+    {
+        while (source.WaitForChange())
+        {
+            // Only one notification in flight - a burst of writes becomes one callback
+            if (!pending.exchange(true))
+                onChange();
+        }
+    }
+
+public:
+    // onChange runs on the watcher thread; keep it short (e.g. post a window message)
+    RegistryWatcher(RegistryChangeSource &changeSource, std::function<void()> callback)
+        : source(changeSource), onChange(callback), pending(false) {}
+
+    ~RegistryWatcher() { Stop(); }
+
+    void Start()
+    {
+        if (!worker.joinable())
+            worker = std::thread(&RegistryWatcher::Run, this);
+    }
+
+    void Stop()
+    {
+        if (worker.joinable())
+        {
+            source.Cancel();
+            worker.join();
+        }
+    }
+
+    // Call before processing a notification so the next change is reported again
+    void Acknowledge()
+    {
+        pending = false;
+    }
+};
+
+// Verbs that appeared, changed or disappeared since the last Diff
+struct ShellKeyChanges
+{
+    std::vector<std::wstring> added;
+    std::vector<std::wstring> changed;
+    std::vector<std::wstring> removed;
+
+    bool Empty() const { return added.empty() && changed.empty() && removed.empty(); }
+    void Clear()
+    {
+        added.clear();
+        changed.clear();
+        removed.clear();
+    }
+};
+
+class ShellKeyTracker
+{
+private:
+    struct Stamp
+    {
+        std::uint64_t lastWriteTime;
+        std::uint32_t epoch;
+    };
+
+    std::unordered_map<std::wstring, Stamp, RegistryNameHash, RegistryNameEqual> stamps;
+    std::uint32_t epoch;
+    std::vector<wchar_t> nameBuffer;
+    std::wstring probe; // Reused lookup key, avoids an allocation per enumerated name
+
+public:
+    ShellKeyTracker() : epoch(0), nameBuffer(256) {}
+
+    void Clear() { stamps.clear(); }
+    std::size_t Size() const { return stamps.size(); }
+
+    // fn(keyName, lastWriteTime) for every recorded key, in no particular order
+    template <typename Fn>
+    void ForEach(Fn fn) const
+    {
+        for (const auto &stamp : stamps)
+            fn(stamp.first, stamp.second.lastWriteTime);
+    }
+
+    void Record(const std::wstring &keyName, std::uint64_t lastWriteTime)
+    {
+        Stamp stamp = {lastWriteTime, epoch};
+        stamps[keyName] = stamp;
+    }
+
+    void Forget(const std::wstring &keyName)
+    {
+        stamps.erase(keyName);
+    }
+
+    // Compare the live shell key against the recorded stamps and update them.
+    // skip(const wchar_t *keyName) filters verbs that are never tracked.
+    // Returns false if the shell key could not be opened.
+    template <typename SkipFn>
+    bool Diff(RegistryBackend &backend, RegKey root, const wchar_t *shellPath, SkipFn skip, ShellKeyChanges &changes)
+    {
+        changes.Clear();
+
+        ScopedRegKey shellKey(backend);
+        if (backend.OpenKey(root, shellPath, false, shellKey.Receive()) != RegOk)
+            return false;
+
+        RegKeyInfo info;
+        if (backend.QueryInfoKey(shellKey.Get(), &info) == RegOk && info.maxSubKeyLength + 1 > nameBuffer.size())
+            nameBuffer.resize(info.maxSubKeyLength + 1);
+
+        epoch++;
+        std::uint32_t index = 0;
+        for (;;)
+        {
+            std::uint32_t nameLength = (std::uint32_t)nameBuffer.size();
+            std::uint64_t lastWriteTime = 0;
+            long status = backend.EnumKey(shellKey.Get(), index, nameBuffer.data(), &nameLength, &lastWriteTime);
+            if (status == RegMoreData)
+            {
+                nameBuffer.resize(nameBuffer.size() * 2);
+                continue;
+            }
+            if (status != RegOk)
+                break;
+            index++;
+
+            if (skip((const wchar_t *)nameBuffer.data()))
+                continue;
+
+            probe.assign(nameBuffer.data(), nameLength);
+            auto it = stamps.find(probe);
+            if (it == stamps.end())
+            {
+                Stamp stamp = {lastWriteTime, epoch};
+                stamps.insert(std::make_pair(probe, stamp));
+                changes.added.push_back(probe);
+            }
+            else
+            {
+                if (it->second.lastWriteTime != lastWriteTime)
+                {
+                    it->second.lastWriteTime = lastWriteTime;
+                    changes.changed.push_back(it->first);
+                }
+                it->second.epoch = epoch;
+            }
+        }
+
+        // Anything not seen in this pass is gone
+        for (auto it = stamps.begin(); it != stamps.end();)
+        {
+            if (it->second.epoch != epoch)
+            {
+                changes.removed.push_back(it->first);
+                it = stamps.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+// Background registry I/O
+//
+// RegistryWorker runs queued jobs one at a time on its own thread, so the
+// window never waits on the registry. A job's work runs on the worker and
+// returns a completion - a closure holding its results - which the owner runs
+// on its own thread from RunCompletions(), after being notified (the window
+// posts itself a message).
+//
+// Writes and file checks always run, in the order posted. Reads are coalesced:
+// a sync posted while a sync or reload is already waiting is dropped, and a
+// reload replaces any read waiting after the last queued write or check. A
+// reload also cancels a read in progress when nothing else is queued, since
+// its result would be replaced at once. Cancelled work should stop early; its
+// completion is discarded.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class RegistryWorker
+{
+public:
+    enum JobKind
+    {
+        JobWrite,
+        JobSync,   // Re-read what changed since the last read
+        JobReload, // Re-read everything
+        JobCheck   // Not a registry read (health check, icon extraction) - runs in order like a write
+    };
+
+    typedef std::function<void()> Completion;
+    typedef std::function<Completion(const std::atomic<bool> &cancelled)> Work;
+
+private:
+    struct Job
+    {
+        JobKind kind;
+        Work work;
+    };
+
+    std::function<void()> notify;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<Job> queue;
+    std::deque<Completion> completions;
+    bool stopping;
+    bool running;
+    JobKind runningKind;
+    std::atomic<bool> cancelRunning;
+
+    static bool IsRead(JobKind kind)
+    {
+        return kind == JobSync || kind == JobReload;
+    }
+
+    RegistryWorker(const RegistryWorker &);
+    RegistryWorker &operator=(const RegistryWorker &);
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;)
+        {
+            wake.wait(guard, [this]
+                      { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+
+            Job job = std::move(queue.front());
+            queue.pop_front();
+            running = true;
+            runningKind = job.kind;
+            cancelRunning = false;
+            guard.unlock();
+
+            Completion done = job.work(cancelRunning);
+
+            guard.lock();
+            running = false;
+            if (!done || cancelRunning || stopping)
+                continue;
+            completions.push_back(std::move(done));
+
+            guard.unlock();
+            notify();
+            guard.lock();
+        }
+    }
+
+public:
+    // notify runs on the worker thread each time a completion is ready; keep it short
+    explicit RegistryWorker(std::function<void()> notifyCallback)
+        : notify(notifyCallback), stopping(false), running(false), runningKind(JobWrite), cancelRunning(false) {}
+
+    ~RegistryWorker() { Stop(); }
+
+    void Start()
+    {
+        if (!worker.joinable())
+            worker = std::thread(&RegistryWorker::Run, this);
+    }
+
+    // Cancel the running job, drop queued jobs and completions, and wait for the thread
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+            cancelRunning = true;
+            queue.clear();
+            completions.clear();
+        }
+        wake.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    // Queue a job; false if it was coalesced into a read already waiting (or the worker is stopping)
+    bool Post(JobKind kind, Work work)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping)
+                return false;
+
+            if (IsRead(kind))
+            {
+                // Reads queued after the last write - coalescing keeps this to at most one
+                std::size_t firstRead = queue.size();
+                while (firstRead > 0 && IsRead(queue[firstRead - 1].kind))
+                    firstRead--;
+
+                if (kind == JobSync && firstRead < queue.size())
+                    return false;
+
+                if (kind == JobReload)
+                {
+                    queue.erase(queue.begin() + firstRead, queue.end());
+                    if (running && IsRead(runningKind) && queue.empty())
+                        cancelRunning = true;
+                }
+            }
+
+            Job job = {kind, std::move(work)};
+            queue.push_back(std::move(job));
+        }
+        wake.notify_one();
+        return true;
+    }
+
+    // Run the completions of finished jobs, in order, on the calling thread
+    void RunCompletions()
+    {
+        for (;;)
+        {
+            Completion done;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (completions.empty())
+                    return;
+                done = std::move(completions.front());
+                completions.pop_front();
+            }
+            done();
+        }
+    }
+
+    // Jobs queued or running
+    bool Busy()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return running || !queue.empty();
+    }
+
+    // Nothing queued or running, and every completion has run
+    bool Idle()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return !running && queue.empty() && completions.empty();
+    }
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+// Minimal-move reordering of custom entries
+//
+// Explorer lists verbs in key-name order, so this program encodes the menu
+// position in the key name: "<NNNN>_CustomApp_<display name>", a fixed-width
+// four digit sort key. Sort keys are spread out with gaps, so most moves can
+// be expressed by renaming just the moved entry.
+//
+// PlanReorder takes the current sort keys in the desired order and keeps the
+// longest strictly increasing subsequence in place. Every other entry gets a
+// new sort key between its kept neighbours. When a gap is too small, the
+// window grows over the neighbouring kept entries until the keys fit, so
+// rebalancing stays local. Legacy names ("02_CustomApp_X",
+// "CustomApp_X_3") have no sort key and are migrated the first time they
+// take part in a reorder.
+
+#include <cwchar>
+#include <string>
+#include <string_view>
+#include <vector>
+
+const int kSortKeyDigits = 4;
+const int kSortKeyLimit = 10000; // Exclusive upper bound of a sort key
+const int kSortKeyGap = 64;      // Spacing used when appending
+
+// Parse the sort key of "<NNNN>_CustomApp_..." names; false for any other name
+inline bool ParseSortKey(std::wstring_view keyName, int *sortKey)
+{
+    static const wchar_t kMarker[] = L"_CustomApp_";
+    if (keyName.length() < (size_t)kSortKeyDigits + 11)
+        return false;
+
+    int value = 0;
+    for (int i = 0; i < kSortKeyDigits; i++)
+    {
+        wchar_t c = keyName[i];
+        if (c < L'0' || c > L'9')
+            return false;
+        value = value * 10 + (c - L'0');
+    }
+    if (keyName.compare(kSortKeyDigits, 11, kMarker) != 0)
+        return false;
+
+    *sortKey = value;
+    return true;
+}
+
+// Build "<NNNN>_CustomApp_<display name>"; backslashes would start a subkey, so they are replaced
+inline std::wstring FormatCustomKeyName(int sortKey, std::wstring_view displayName)
+{
+    wchar_t prefix[16];
+    swprintf(prefix, 16, L"%0*d_CustomApp_", kSortKeyDigits, sortKey);
+
+    std::wstring keyName = prefix;
+    for (wchar_t c : displayName)
+        keyName += (c == L'\\') ? L'_' : c;
+    return keyName;
+}
+
+// Sort key for an entry appended after lastSortKey (-1 when there is none), -1 if no room is left
+inline int NextSortKey(int lastSortKey)
+{
+    if (lastSortKey < 0)
+        return kSortKeyGap;
+    if (lastSortKey + kSortKeyGap < kSortKeyLimit)
+        return lastSortKey + kSortKeyGap;
+    if (lastSortKey + 1 < kSortKeyLimit)
+        return lastSortKey + (kSortKeyLimit - lastSortKey) / 2;
+    return -1;
+}
+
+struct ReorderMove
+{
+    size_t index; // Position in the desired order
+    int sortKey;  // New sort key for that entry
+};
+
+// sortKeys: current sort key of each entry in the desired order, -1 for entries without one.
+// Fills moves with the entries that must be renamed. Returns false if more entries exist than sort keys.
+inline bool PlanReorder(const std::vector<int> &sortKeys, std::vector<ReorderMove> &moves)
+{
+    moves.clear();
+    size_t count = sortKeys.size();
+    if (count > (size_t)kSortKeyLimit)
+        return false;
+
+    // Longest strictly increasing subsequence over the ranked entries (patience sorting)
+    std::vector<size_t> tails;                 // tails[k] = index ending the best run of length k+1
+    std::vector<size_t> previous(count, count); // Predecessor links for reconstruction
+    for (size_t i = 0; i < count; i++)
+    {
+        if (sortKeys[i] < 0)
+            continue;
+
+        size_t lo = 0, hi = tails.size();
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (sortKeys[tails[mid]] < sortKeys[i])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo > 0)
+            previous[i] = tails[lo - 1];
+        if (lo == tails.size())
+            tails.push_back(i);
+        else
+            tails[lo] = i;
+    }
+
+    std::vector<bool> kept(count, false);
+    if (!tails.empty())
+    {
+        for (size_t i = tails.back(); i != count; i = previous[i])
+            kept[i] = true;
+    }
+
+    // Give every run of moved entries fresh keys between its kept neighbours
+    size_t start = 0;
+    while (start < count)
+    {
+        if (kept[start])
+        {
+            start++;
+            continue;
+        }
+
+        size_t end = start;
+        while (end < count && !kept[end])
+            end++;
+
+        // Widen the window over kept neighbours until the run fits between them
+        for (;;)
+        {
+            int lower = start > 0 ? sortKeys[start - 1] : -1;
+            int upper = end < count ? sortKeys[end] : kSortKeyLimit;
+            if (upper - lower - 1 >= (int)(end - start))
+                break;
+
+            if (end < count)
+            {
+                kept[end] = false;
+                while (end < count && !kept[end])
+                    end++;
+            }
+            else
+            {
+                kept[start - 1] = false;
+                while (start > 0 && !kept[start - 1])
+                    start--;
+            }
+        }
+
+        // Runs the window grew back over are placed again below, not twice
+        while (!moves.empty() && moves.back().index >= start)
+            moves.pop_back();
+
+        // Spread evenly so later moves into this range find gaps again
+        int lower = start > 0 ? sortKeys[start - 1] : -1;
+        int upper = end < count ? sortKeys[end] : kSortKeyLimit;
+        int run = (int)(end - start);
+        for (int j = 0; j < run; j++)
+        {
+            ReorderMove move;
+            move.index = start + j;
+            move.sortKey = lower + (int)((long long)(upper - lower) * (j + 1) / (run + 1));
+            if (move.sortKey != sortKeys[move.index])
+                moves.push_back(move);
+        }
+        start = end;
+    }
+    return true;
+}
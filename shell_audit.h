@@ -0,0 +1,147 @@
+#pragma once
+
+// Whole-HKCR shell verb audit
+//
+// Slow right-click menus usually come from verbs registered well outside
+// Directory\Background\shell: under *\shell, Directory\shell, Drive\shell,
+// AllFilesystemObjects\shell and thousands of ProgIDs. AuditShellVerbs lists
+// every <class>\shell\<verb> below a root key and reports each verb with its
+// command, icon and owning class.
+//
+// The top-level class names are listed once; a pool of threads then claims
+// them in small shards from a shared counter, so a few classes with huge
+// shell keys don't leave the other threads idle. Each thread keeps its own
+// ShellKeyEnumerator (its buffers are not shared) and writes only the result
+// slots of the classes it claimed, so the only synchronisation is the
+// counter. Each thread interns into its own string pool; the results are
+// re-interned into the caller's pool once the threads are done, which also
+// shares the strings the threads found in common. Results come back in class
+// order, verbs in registry order.
+//
+// The backend must allow concurrent reads: the Win32 registry does, and the
+// in-memory backend takes its tree lock shared for reads.
+
+#include "context_menu_model.h"
+#include "shell_enumerator.h"
+
+#include <atomic>
+#include <thread>
+
+struct AuditedVerb
+{
+    std::wstring className; // Top-level key the verb is registered under
+    AppEntry app;           // Verb key, display name, icon and program path
+    std::wstring command;   // Raw command line, empty when the verb has none
+    bool system;            // One of the built-in verbs (IsSystemVerb)
+};
+
+struct AuditStats
+{
+    std::size_t classes;   // Top-level keys scanned
+    std::size_t shellKeys; // Classes that have a shell key
+    std::size_t verbs;
+    unsigned threads;
+};
+
+// Audit every root\<class>\shell\<verb>. threads 0 picks one per hardware thread. The verbs'
+// entries hold strings interned into strings. Returns RegOk, or the error from listing the top-level keys.
+inline long AuditShellVerbs(RegistryBackend &backend, RegKey root, unsigned threads,
+                            std::vector<AuditedVerb> &verbs, StringPool &strings, AuditStats *stats = NULL)
+{
+    static const std::size_t kShardSize = 64;
+
+    verbs.clear();
+    std::vector<std::wstring> classes;
+    std::vector<wchar_t> name(256);
+    for (std::uint32_t index = 0;;)
+    {
+        std::uint32_t nameLength = (std::uint32_t)name.size();
+        long status = backend.EnumKey(root, index, name.data(), &nameLength, NULL);
+        if (status == RegMoreData)
+        {
+            name.resize(name.size() * 2);
+            continue;
+        }
+        if (status == RegNoMoreItems)
+            break;
+        if (status != RegOk)
+            return status;
+        index++;
+        classes.push_back(std::wstring(name.data(), nameLength));
+    }
+
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    std::size_t shards = (classes.size() + kShardSize - 1) / kShardSize;
+    if (threads > shards)
+        threads = (unsigned)shards;
+    if (threads == 0)
+        threads = 1;
+
+    std::vector<std::vector<AuditedVerb>> found(classes.size());
+    std::vector<char> hasShell(classes.size(), 0);
+    std::vector<StringPool> threadStrings(threads);
+    std::atomic<std::size_t> nextShard(0);
+    auto scan = [&](unsigned thread)
+    {
+        ShellKeyEnumerator enumerator(backend);
+        std::wstring shellPath;
+        for (;;)
+        {
+            std::size_t first = nextShard.fetch_add(1) * kShardSize;
+            if (first >= classes.size())
+                return;
+            std::size_t last = std::min(first + kShardSize, classes.size());
+            for (std::size_t i = first; i < last; i++)
+            {
+                shellPath = classes[i];
+                shellPath += L"\\shell";
+                long count = enumerator.Enumerate(
+                    root, shellPath.c_str(),
+                    [](const wchar_t *)
+                    { return false; },
+                    [&](const ShellEntry &entry)
+                    {
+                        AuditedVerb verb;
+                        verb.className = classes[i];
+                        verb.app = MakeAppEntry(entry, threadStrings[thread]);
+                        verb.command = entry.command;
+                        verb.system = IsSystemVerb(entry.keyName.c_str());
+                        found[i].push_back(verb);
+                    });
+                hasShell[i] = count >= 0;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++)
+        pool.push_back(std::thread(scan, i));
+    scan(0);
+    for (auto &worker : pool)
+        worker.join();
+
+    std::size_t total = 0;
+    for (const auto &list : found)
+        total += list.size();
+    verbs.reserve(total);
+    std::size_t shellKeys = 0;
+    for (std::size_t i = 0; i < classes.size(); i++)
+    {
+        for (auto &verb : found[i])
+        {
+            verb.app = InternAppEntry(verb.app, strings);
+            verbs.push_back(std::move(verb));
+        }
+        shellKeys += hasShell[i];
+    }
+
+    if (stats)
+    {
+        stats->classes = classes.size();
+        stats->shellKeys = shellKeys;
+        stats->verbs = verbs.size();
+        stats->threads = threads;
+    }
+    return RegOk;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+// Single-pass enumeration of a "...\shell" key
+//
+// The shell key is opened once; each verb and its "command" subkey are opened
+// relative to the previous handle instead of from HKEY_CLASSES_ROOT with a
+// freshly built path. The subkey name buffer is sized from one QueryInfoKey
+// call, and values are read through a RegistryValueReader sized from each
+// verb key's info (the same query that supplies its last write time). All
+// buffers are reused across entries (and across reloads when the enumerator
+// object is kept), so the steady state allocates nothing per entry beyond
+// what the caller chooses to copy out.
+//
+// A verb with an empty "SubCommands" value is a cascading group: its members
+// are verbs under its own "shell" subkey. EnumerateTree reports them right
+// after their group, opening each nested shell key relative to the group's
+// handle, so the whole tree is still read in one pass.
+
+#include "registry_value_reader.h"
+
+#include <vector>
+
+// Deepest group nesting that is read (Explorer stops cascading well before this)
+const unsigned kMaxMenuGroupDepth = 16;
+
+// One verb under the shell key. Strings are reused between callbacks - copy what you keep.
+struct ShellEntry
+{
+    std::wstring keyName;         // Registry key name; "Group\shell\Verb" for group members
+    std::wstring displayName;     // Default value, else "MUIVerb", else keyName
+    std::wstring icon;            // "Icon" value, empty when missing
+    std::wstring command;         // Raw default value of "command", empty when missing
+    bool hasCommand;              // Whether the "command" subkey has a default value
+    bool isGroup;                 // Cascading group - members under its own "shell" subkey
+    unsigned depth;               // 0 for verbs of the shell key itself, 1 for members of a group, ...
+    std::uint64_t lastWriteTime;  // Last write time of the verb key
+};
+
+class ShellKeyEnumerator
+{
+private:
+    RegistryBackend &backend;
+    std::vector<wchar_t> nameBuffer;
+    RegistryValueReader values;
+    ShellEntry entry;
+    std::wstring pathPrefix; // "Group\shell\" path of the group being enumerated, empty at the top
+
+    // Read the verbs of an open shell key at depth, descending into groups while depth < maxDepth
+    template <typename SkipFn, typename EntryFn>
+    long EnumerateKey(RegKey shellKey, unsigned depth, unsigned maxDepth, SkipFn skip, EntryFn onEntry)
+    {
+        RegKeyInfo info;
+        if (backend.QueryInfoKey(shellKey, &info) == RegOk && info.maxSubKeyLength + 1 > nameBuffer.size())
+            nameBuffer.resize(info.maxSubKeyLength + 1);
+
+        long count = 0;
+        std::size_t prefixLength = pathPrefix.length();
+        std::uint32_t index = 0;
+        for (;;)
+        {
+            std::uint32_t nameLength = (std::uint32_t)nameBuffer.size();
+            std::uint64_t lastWriteTime = 0;
+            long status = backend.EnumKey(shellKey, index, nameBuffer.data(), &nameLength, &lastWriteTime);
+            if (status == RegMoreData)
+            {
+                // Key was added after the info query - grow and retry the same index
+                nameBuffer.resize(nameBuffer.size() * 2);
+                continue;
+            }
+            if (status != RegOk)
+                break;
+            index++;
+
+            if (skip((const wchar_t *)nameBuffer.data()))
+                continue;
+
+            if (!ReadEntry(shellKey, nameBuffer.data(), entry, &lastWriteTime))
+                continue;
+            entry.depth = depth;
+            if (prefixLength > 0)
+                entry.keyName.insert(0, pathPrefix);
+            onEntry((const ShellEntry &)entry);
+            count++;
+            if (!entry.isGroup || depth >= maxDepth)
+                continue;
+
+            // The members' shell key is opened through this one; nameBuffer is reused below
+            std::wstring groupShellPath(nameBuffer.data(), nameLength);
+            groupShellPath += L"\\shell";
+            ScopedRegKey groupShell(backend);
+            if (backend.OpenKey(shellKey, groupShellPath.c_str(), false, groupShell.Receive()) != RegOk)
+                continue;
+            pathPrefix += groupShellPath;
+            pathPrefix += L'\\';
+            count += EnumerateKey(groupShell.Get(), depth + 1, maxDepth, skip, onEntry);
+            pathPrefix.resize(prefixLength);
+        }
+        return count;
+    }
+
+public:
+    explicit ShellKeyEnumerator(RegistryBackend &owner) : backend(owner), nameBuffer(256), values(owner) {}
+
+    // Read a single verb relative to an already open shell key.
+    // knownLastWriteTime saves the info query when the caller got it from EnumKey.
+    bool ReadEntry(RegKey shellKey, const wchar_t *keyName, ShellEntry &result,
+                   const std::uint64_t *knownLastWriteTime = NULL)
+    {
+        ScopedRegKey verbKey(backend);
+        if (backend.OpenKey(shellKey, keyName, false, verbKey.Receive()) != RegOk)
+            return false;
+
+        // Several values are read from the verb key - size the buffer for all of them at once
+        RegKeyInfo info;
+        bool prepared = values.Prepare(verbKey.Get(), &info);
+        if (knownLastWriteTime)
+            result.lastWriteTime = *knownLastWriteTime;
+        else
+            result.lastWriteTime = prepared ? info.lastWriteTime : 0;
+
+        result.keyName = keyName;
+        if (!values.Read(verbKey.Get(), NULL, result.displayName) &&
+            !values.Read(verbKey.Get(), L"MUIVerb", result.displayName))
+            result.displayName = keyName; // Use registry key name if no display name
+        if (!values.Read(verbKey.Get(), L"Icon", result.icon))
+            result.icon.clear();
+
+        // A non-empty SubCommands lists CommandStore verbs instead - not a group this reader can expand
+        std::wstring_view subCommands;
+        result.isGroup = values.Read(verbKey.Get(), L"SubCommands", subCommands) && subCommands.empty();
+        result.depth = 0;
+
+        // The command key has one value; the buffer only grows if it is the longest yet
+        result.hasCommand = false;
+        result.command.clear();
+        ScopedRegKey commandKey(backend);
+        if (backend.OpenKey(verbKey.Get(), L"command", false, commandKey.Receive()) == RegOk)
+            result.hasCommand = values.Read(commandKey.Get(), NULL, result.command);
+        return true;
+    }
+
+    // Enumerate every verb under root\shellPath.
+    //   skip(const wchar_t *keyName) -> bool   : return true to skip a verb without opening it
+    //   onEntry(const ShellEntry &entry)        : called for every verb that was read
+    // Returns the number of entries passed to onEntry, or -1 if the shell key could not be opened.
+    template <typename SkipFn, typename EntryFn>
+    long Enumerate(RegKey root, const wchar_t *shellPath, SkipFn skip, EntryFn onEntry)
+    {
+        ScopedRegKey shellKey(backend);
+        if (backend.OpenKey(root, shellPath, false, shellKey.Receive()) != RegOk)
+            return -1;
+        pathPrefix.clear();
+        return EnumerateKey(shellKey.Get(), 0, 0, skip, onEntry);
+    }
+
+    // Enumerate like Enumerate, and the members of every group below it, each right after its
+    // group. skip sees the members' own key names; a skipped group is not entered.
+    template <typename SkipFn, typename EntryFn>
+    long EnumerateTree(RegKey root, const wchar_t *shellPath, SkipFn skip, EntryFn onEntry)
+    {
+        ScopedRegKey shellKey(backend);
+        if (backend.OpenKey(root, shellPath, false, shellKey.Receive()) != RegOk)
+            return -1;
+        pathPrefix.clear();
+        return EnumerateKey(shellKey.Get(), 0, kMaxMenuGroupDepth, skip, onEntry);
+    }
+
+    // Read one verb of an open shell key and, if it is a group, everything below it.
+    // Returns false if the verb could not be read.
+    template <typename SkipFn, typename EntryFn>
+    bool ReadTree(RegKey shellKey, const wchar_t *keyName, SkipFn skip, EntryFn onEntry)
+    {
+        if (!ReadEntry(shellKey, keyName, entry))
+            return false;
+        onEntry((const ShellEntry &)entry);
+        if (!entry.isGroup)
+            return true;
+
+        pathPrefix = keyName;
+        pathPrefix += L"\\shell";
+        ScopedRegKey groupShell(backend);
+        if (backend.OpenKey(shellKey, pathPrefix.c_str(), false, groupShell.Receive()) == RegOk)
+        {
+            pathPrefix += L'\\';
+            EnumerateKey(groupShell.Get(), 1, kMaxMenuGroupDepth, skip, onEntry);
+        }
+        return true;
+    }
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+// Coalesced shell change notifications
+//
+// Every change to the menu has to be announced to Explorer with
+// SHChangeNotify(SHCNE_ASSOCCHANGED), which makes it rebuild its association
+// caches - expensive on a loaded machine. ShellNotifyScheduler collects those
+// requests and broadcasts once per burst instead: after a quiet period with no
+// new request, or after maxDelay at the latest, so a long run of changes
+// is still announced while it lasts.
+//
+// Without Start() nothing is sent until Flush() - the command-line mode's one
+// broadcast per run. Stop() flushes what is still pending, so no change goes
+// unannounced when the window closes.
+//
+// The broadcast itself goes through a ShellNotifier, so the batching can be
+// exercised without a shell (the tests count broadcasts instead).
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+class ShellNotifier
+{
+public:
+    virtual ~ShellNotifier() {}
+
+    // Tell the shell that menu registrations changed; may run on the scheduler thread
+    virtual void Notify() = 0;
+};
+
+struct ShellNotifyStats
+{
+    std::uint64_t requests;   // Changes reported with Request()
+    std::uint64_t broadcasts; // Notifications actually sent
+
+    // Notifications a broadcast-per-change would have sent on top
+    std::uint64_t Saved() const { return requests > broadcasts ? requests - broadcasts : 0; }
+};
+
+class ShellNotifyScheduler
+{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    ShellNotifier &notifier;
+    Clock::duration quietPeriod;
+    Clock::duration maxDelay;
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    bool pending;
+    Clock::time_point firstRequest; // Of the pending burst
+    Clock::time_point lastRequest;
+    ShellNotifyStats stats;
+
+    ShellNotifyScheduler(const ShellNotifyScheduler &);
+    ShellNotifyScheduler &operator=(const ShellNotifyScheduler &);
+
+    // Send the pending broadcast, if any; called with guard held, returns with it held
+    bool Broadcast(std::unique_lock<std::mutex> &guard)
+    {
+        if (!pending)
+            return false;
+        pending = false;
+        stats.broadcasts++;
+
+        guard.unlock();
+        notifier.Notify();
+        guard.lock();
+        return true;
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;)
+        {
+            wake.wait(guard, [this]
+                      { return stopping || pending; });
+            if (stopping)
+                return;
+
+            // A new request only moves the deadline later - wake at the old one and look again
+            Clock::time_point due = lastRequest + quietPeriod;
+            if (firstRequest + maxDelay < due)
+                due = firstRequest + maxDelay;
+            if (Clock::now() < due)
+            {
+                wake.wait_until(guard, due);
+                continue;
+            }
+            Broadcast(guard);
+        }
+    }
+
+public:
+    ShellNotifyScheduler(ShellNotifier &target,
+                         std::chrono::milliseconds quiet = std::chrono::milliseconds(250),
+                         std::chrono::milliseconds longest = std::chrono::milliseconds(2000))
+        : notifier(target), quietPeriod(quiet), maxDelay(longest), stopping(false), pending(false)
+    {
+        stats.requests = 0;
+        stats.broadcasts = 0;
+    }
+
+    ~ShellNotifyScheduler() { Stop(); }
+
+    // Broadcast from a timer thread after each quiet period
+    void Start()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = false;
+        if (!worker.joinable())
+            worker = std::thread(&ShellNotifyScheduler::Run, this);
+    }
+
+    // Stop the timer thread and send what is still pending
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable())
+            worker.join();
+        Flush();
+    }
+
+    // A change landed; safe from any thread
+    void Request()
+    {
+        bool first;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            Clock::time_point now = Clock::now();
+            first = !pending;
+            if (first)
+                firstRequest = now;
+            lastRequest = now;
+            pending = true;
+            stats.requests++;
+        }
+        if (first)
+            wake.notify_one();
+    }
+
+    // Broadcast now if a change is pending; false if there was nothing to send
+    bool Flush()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        return Broadcast(guard);
+    }
+
+    ShellNotifyStats Stats()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return stats;
+    }
+};
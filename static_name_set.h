@@ -0,0 +1,80 @@
+#pragma once
+
+// Compile-time perfect hash set of wide strings
+//
+// The table is built while compiling: a seed is searched for that maps every
+// name to its own slot, so a lookup is one hash and at most one string
+// comparison, however long the list gets. Matching is exact (case-sensitive).
+// Declare instances constexpr and static_assert Valid() - if no seed works,
+// the build fails instead of the lookup silently degrading.
+
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+
+template <std::size_t Count, std::size_t Slots>
+class StaticNameSet
+{
+private:
+    static_assert((Slots & (Slots - 1)) == 0, "Slots must be a power of two");
+    static_assert(Count < Slots, "Slots must exceed the number of names");
+
+    static constexpr std::uint32_t kMaxSeed = 4096;
+
+    const wchar_t *const *names;
+    std::uint32_t seed; // 0 if no collision-free seed was found
+    short slots[Slots]; // Index into names, -1 for an empty slot
+
+    static constexpr std::uint32_t Hash(const wchar_t *name, std::uint32_t seed)
+    {
+        std::uint32_t hash = 2166136261u ^ (seed * 0x9E3779B9u);
+        for (; *name; name++)
+        {
+            hash ^= (std::uint32_t)*name;
+            hash *= 16777619u;
+        }
+        return hash ^ (hash >> 15);
+    }
+
+    constexpr bool TrySeed(std::uint32_t candidate)
+    {
+        for (std::size_t i = 0; i < Slots; i++)
+            slots[i] = -1;
+        for (std::size_t i = 0; i < Count; i++)
+        {
+            std::size_t slot = Hash(names[i], candidate) & (Slots - 1);
+            if (slots[slot] >= 0)
+                return false;
+            slots[slot] = (short)i;
+        }
+        return true;
+    }
+
+public:
+    constexpr explicit StaticNameSet(const wchar_t *const (&list)[Count]) : names(list), seed(0), slots()
+    {
+        for (std::uint32_t candidate = 1; candidate <= kMaxSeed; candidate++)
+        {
+            if (TrySeed(candidate))
+            {
+                seed = candidate;
+                return;
+            }
+        }
+    }
+
+    constexpr bool Valid() const { return seed != 0; }
+
+    bool Contains(const wchar_t *name) const
+    {
+        short index = slots[Hash(name, seed) & (Slots - 1)];
+        return index >= 0 && wcscmp(names[index], name) == 0;
+    }
+};
+
+// Deduce Count from the array: MakeStaticNameSet<64>(names)
+template <std::size_t Slots, std::size_t Count>
+constexpr StaticNameSet<Count, Slots> MakeStaticNameSet(const wchar_t *const (&list)[Count])
+{
+    return StaticNameSet<Count, Slots>(list);
+}
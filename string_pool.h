@@ -0,0 +1,249 @@
+#pragma once
+
+// Interned string pool
+//
+// The menu lists keep five strings per entry, and most of them repeat: the
+// icon is usually the program path, the same launcher backs many verbs, and
+// "%1" is nearly every verb's arguments. Held as std::wstring each would be
+// its own heap block, copied again whenever an entry is.
+//
+// StringPool stores each distinct string once, in large chunks it allocates
+// as it fills them, and hands out PooledString handles: one pointer, cheap to
+// copy, comparing equal by content. Strings are never freed one at a time -
+// the whole pool goes at once when its owner drops it (a reload builds the
+// list into a fresh pool and the old one is released with the old list).
+//
+// Each string is stored as its length followed by the characters and a
+// terminating null, so c_str() needs no copy. A handle is valid as long as
+// the pool that made it; the empty string needs no pool at all. A pool may be
+// moved - its chunks stay where they are - but is not thread safe: one
+// thread interns at a time.
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class PooledString
+{
+private:
+    const wchar_t *text; // Null-terminated, the length is stored just before it
+
+    struct Empty
+    {
+        std::uint32_t length;
+        wchar_t text[2];
+    };
+
+    static const wchar_t *EmptyText()
+    {
+        static const Empty empty = {0, {0, 0}};
+        return empty.text;
+    }
+
+    explicit PooledString(const wchar_t *pooled) : text(pooled) {}
+
+    friend class StringPool;
+
+public:
+    PooledString() : text(EmptyText()) {}
+
+    const wchar_t *c_str() const { return text; }
+    const wchar_t *data() const { return text; }
+
+    std::size_t length() const
+    {
+        std::uint32_t count;
+        std::memcpy(&count, (const char *)text - sizeof(count), sizeof(count));
+        return count;
+    }
+
+    bool empty() const { return text[0] == 0; }
+    wchar_t operator[](std::size_t index) const { return text[index]; }
+
+    std::wstring_view view() const { return std::wstring_view(text, length()); }
+    operator std::wstring_view() const { return view(); }
+    std::wstring str() const { return std::wstring(text, length()); }
+
+    std::size_t find(wchar_t c, std::size_t pos = 0) const { return view().find(c, pos); }
+    std::size_t find(std::wstring_view part, std::size_t pos = 0) const { return view().find(part, pos); }
+    std::size_t rfind(std::wstring_view part, std::size_t pos = std::wstring_view::npos) const { return view().rfind(part, pos); }
+    std::size_t find_last_of(wchar_t c) const { return view().find_last_of(c); }
+};
+
+static_assert(sizeof(PooledString) == sizeof(void *), "PooledString is meant to be one pointer");
+
+inline bool operator==(const PooledString &a, const PooledString &b)
+{
+    return a.c_str() == b.c_str() || a.view() == b.view();
+}
+inline bool operator!=(const PooledString &a, const PooledString &b) { return !(a == b); }
+inline bool operator==(const PooledString &a, std::wstring_view b) { return a.view() == b; }
+inline bool operator!=(const PooledString &a, std::wstring_view b) { return a.view() != b; }
+inline bool operator==(std::wstring_view a, const PooledString &b) { return a == b.view(); }
+inline bool operator!=(std::wstring_view a, const PooledString &b) { return a != b.view(); }
+
+inline std::wstring operator+(const std::wstring &a, const PooledString &b)
+{
+    std::wstring result(a);
+    result.append(b.c_str(), b.length());
+    return result;
+}
+inline std::wstring operator+(const PooledString &a, const wchar_t *b) { return a.str() + b; }
+
+struct StringPoolStats
+{
+    std::size_t interned; // Intern calls
+    std::size_t strings;  // Distinct strings stored
+    std::size_t bytes;    // Chunk bytes in use
+    std::size_t chunks;   // Chunk allocations
+    std::size_t reserved; // Chunk bytes allocated
+};
+
+class StringPool
+{
+private:
+    static const std::size_t kChunkSize = 64 * 1024;
+    static const std::size_t kHeaderSize = sizeof(std::uint32_t);
+
+    struct ChunkDelete
+    {
+        void operator()(char *chunk) const { ::operator delete(chunk); }
+    };
+
+    std::vector<std::unique_ptr<char[], ChunkDelete>> chunks;
+    char *next;       // Free space in the last chunk
+    std::size_t left; // Bytes of it
+    std::vector<const wchar_t *> table; // Open addressing, power-of-two size, NULL for a free slot
+    std::vector<std::uint32_t> hashes;  // Hash of each occupied slot
+    StringPoolStats stats;
+
+    StringPool(const StringPool &);
+    StringPool &operator=(const StringPool &);
+
+    static std::uint32_t Hash(std::wstring_view text)
+    {
+        std::uint32_t hash = 2166136261u;
+        for (wchar_t c : text)
+            hash = (hash ^ (std::uint32_t)c) * 16777619u;
+        return hash;
+    }
+
+    // Copy text into the arena behind its length, padded so the next length stays aligned
+    const wchar_t *Store(std::wstring_view text)
+    {
+        std::size_t bytes = kHeaderSize + (text.length() + 1) * sizeof(wchar_t);
+        bytes = (bytes + kHeaderSize - 1) & ~(kHeaderSize - 1);
+        if (bytes > left)
+        {
+            std::size_t size = bytes > kChunkSize ? bytes : kChunkSize;
+            chunks.push_back(std::unique_ptr<char[], ChunkDelete>((char *)::operator new(size)));
+            next = chunks.back().get();
+            left = size;
+            stats.chunks++;
+            stats.reserved += size;
+        }
+
+        std::uint32_t length = (std::uint32_t)text.length();
+        std::memcpy(next, &length, kHeaderSize);
+        wchar_t *stored = (wchar_t *)(next + kHeaderSize);
+        if (!text.empty())
+            std::memcpy(stored, text.data(), text.length() * sizeof(wchar_t));
+        stored[text.length()] = 0;
+        next += bytes;
+        left -= bytes;
+        stats.bytes += bytes;
+        return stored;
+    }
+
+    void Grow()
+    {
+        std::vector<const wchar_t *> oldTable(table.empty() ? 256 : table.size() * 2, NULL);
+        std::vector<std::uint32_t> oldHashes(oldTable.size(), 0);
+        oldTable.swap(table);
+        oldHashes.swap(hashes);
+        std::size_t mask = table.size() - 1;
+        for (std::size_t i = 0; i < oldTable.size(); i++)
+        {
+            if (!oldTable[i])
+                continue;
+            std::size_t slot = oldHashes[i] & mask;
+            while (table[slot])
+                slot = (slot + 1) & mask;
+            table[slot] = oldTable[i];
+            hashes[slot] = oldHashes[i];
+        }
+    }
+
+public:
+    StringPool() : next(NULL), left(0), stats() {}
+
+    StringPool(StringPool &&other)
+        : chunks(std::move(other.chunks)), next(other.next), left(other.left), table(std::move(other.table)),
+          hashes(std::move(other.hashes)), stats(other.stats)
+    {
+        other.Clear();
+    }
+
+    StringPool &operator=(StringPool &&other)
+    {
+        if (this != &other)
+        {
+            chunks = std::move(other.chunks);
+            next = other.next;
+            left = other.left;
+            table = std::move(other.table);
+            hashes = std::move(other.hashes);
+            stats = other.stats;
+            other.Clear();
+        }
+        return *this;
+    }
+
+    // The pooled copy of text - the same handle for every equal string (compared exactly)
+    PooledString Intern(std::wstring_view text)
+    {
+        stats.interned++;
+        if (text.empty())
+            return PooledString();
+
+        // Keep the table at most half full
+        if ((stats.strings + 1) * 2 > table.size())
+            Grow();
+
+        std::uint32_t hash = Hash(text);
+        std::size_t mask = table.size() - 1;
+        std::size_t slot = hash & mask;
+        for (; table[slot]; slot = (slot + 1) & mask)
+        {
+            if (hashes[slot] == hash && PooledString(table[slot]).view() == text)
+                return PooledString(table[slot]);
+        }
+
+        table[slot] = Store(text);
+        hashes[slot] = hash;
+        stats.strings++;
+        return PooledString(table[slot]);
+    }
+
+    // Free every chunk at once; all handles from this pool become invalid
+    void Clear()
+    {
+        chunks.clear();
+        next = NULL;
+        left = 0;
+        table.clear();
+        hashes.clear();
+        stats = StringPoolStats();
+    }
+
+    StringPoolStats Stats() const { return stats; }
+
+    // Bytes held: chunks plus the lookup table
+    std::size_t MemoryUsage() const
+    {
+        return stats.reserved + table.size() * (sizeof(const wchar_t *) + sizeof(std::uint32_t));
+    }
+};
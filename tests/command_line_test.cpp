@@ -0,0 +1,258 @@
+// Command-line splitting: known answers for the sample corpus, a fuzzer that checks
+// NextCommandArgument/UnquoteCommandArgument against a plain CommandLineToArgvW-rules
+// reference and SplitCommandLine's invariants on mutated corpus lines, and a benchmark.
+// Arguments: fuzz cases and benchmark rounds over the corpus.
+
+#include "command_line.h"
+#include "synthetic_hive.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+// Every allocation in the program is counted, so the split can be shown not to allocate
+static std::size_t allocations = 0;
+
+void *operator new(std::size_t size)
+{
+    allocations++;
+    void *block = std::malloc(size ? size : 1);
+    if (!block)
+        throw std::bad_alloc();
+    return block;
+}
+
+void operator delete(void *block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void *block, std::size_t) noexcept
+{
+    std::free(block);
+}
+
+static const std::size_t kCorpusSize = sizeof(kSampleShellCommands) / sizeof(kSampleShellCommands[0]);
+
+// The argument rules written out the obvious way, one character at a time
+static std::vector<std::wstring> ReferenceArguments(std::wstring_view text)
+{
+    std::vector<std::wstring> args;
+    std::size_t i = 0;
+    for (;;)
+    {
+        while (i < text.length() && IsCommandLineSpace(text[i]))
+            i++;
+        if (i == text.length())
+            return args;
+
+        std::wstring arg;
+        bool inQuotes = false;
+        while (i < text.length())
+        {
+            wchar_t c = text[i];
+            if (c == L'\\')
+            {
+                std::size_t count = 0;
+                while (i < text.length() && text[i] == L'\\')
+                    count++, i++;
+                if (i < text.length() && text[i] == L'\"')
+                {
+                    arg.append(count / 2, L'\\');
+                    if (count % 2 == 1)
+                    {
+                        arg += L'\"';
+                        i++;
+                    }
+                }
+                else
+                    arg.append(count, L'\\');
+            }
+            else if (c == L'\"')
+            {
+                if (inQuotes && i + 1 < text.length() && text[i + 1] == L'\"')
+                {
+                    arg += L'\"';
+                    i += 2;
+                }
+                else
+                {
+                    inQuotes = !inQuotes;
+                    i++;
+                }
+            }
+            else if (!inQuotes && IsCommandLineSpace(c))
+                break;
+            else
+            {
+                arg += c;
+                i++;
+            }
+        }
+        args.push_back(arg);
+    }
+}
+
+static std::vector<std::wstring> SplitArguments(std::wstring_view text)
+{
+    std::vector<std::wstring> args;
+    std::wstring_view raw;
+    std::wstring value;
+    while (NextCommandArgument(text, raw))
+    {
+        UnquoteCommandArgument(raw, value);
+        args.push_back(value);
+    }
+    return args;
+}
+
+static bool Within(std::wstring_view part, std::wstring_view whole)
+{
+    return part.empty() || (part.data() >= whole.data() && part.data() + part.length() <= whole.data() + whole.length());
+}
+
+// What SplitCommandLine promises for any input; false on the first broken promise
+static bool CheckSplit(std::wstring_view command)
+{
+    CommandLineParts parts = SplitCommandLine(command);
+    std::wstring_view trimmed = TrimCommandLine(command);
+    if (!Within(parts.executable, command) || !Within(parts.arguments, command))
+        return false;
+    if (parts.arguments != TrimCommandLine(parts.arguments))
+        return false;
+    if (trimmed.empty())
+        return parts.executable.empty() && parts.arguments.empty() && !parts.quoted;
+    if (parts.quoted != (trimmed[0] == L'\"'))
+        return false;
+    if (parts.quoted)
+        return parts.executable.find(L'\"') == std::wstring_view::npos && parts.executable.data() == trimmed.data() + 1;
+
+    // Unquoted: a prefix of the line ending at a word end, one word unless it names an executable
+    if (parts.executable.data() != trimmed.data() || parts.executable.empty() ||
+        IsCommandLineSpace(parts.executable.back()))
+        return false;
+    std::size_t end = parts.executable.length();
+    if (end < trimmed.length() && !IsCommandLineSpace(trimmed[end]))
+        return false;
+    bool oneWord = parts.executable.find_first_of(L" \t") == std::wstring_view::npos;
+    return oneWord || HasExecutableExtension(parts.executable);
+}
+
+static void TestCorpus()
+{
+    struct Expected
+    {
+        const wchar_t *executable;
+        const wchar_t *arguments;
+    };
+    static const Expected kExpected[kCorpusSize] = {
+        {L"C:\\Program Files\\Synthetic\\app.exe", L"\"%1\""},
+        {L"%SystemRoot%\\system32\\NOTEPAD.EXE", L"%1"},
+        {L"C:\\Program Files\\Synthetic Tools\\tool.exe", L"-open \"%1\""},
+        {L"C:\\tools.exe.d\\run.exe", L"--file=\"%1\""},
+        {L"C:\\tools.exe.d\\run.exe", L"%1"},
+        {L"%SystemRoot%\\System32\\rundll32.exe",
+         L"\"%ProgramFiles%\\Windows Photo Viewer\\PhotoViewer.dll\", ImageView_Fullscreen %1"},
+        {L"cmd.exe", L"/s /k pushd \"%V\""},
+        {L"C:\\Scripts\\build.cmd", L"\"%1\" %*"},
+        {L"C:\\Scripts\\deploy.bat", L"%1"},
+        {L"powershell.exe", L"-NoExit -Command \"Set-Location -LiteralPath '%V'\""},
+        {L"C:\\Program Files\\Git\\git-bash.exe", L"\"--cd=%v.\""},
+        {L"wscript.exe", L"\"C:\\Scripts\\run me.vbs\" \"%1\""},
+        {L"C:\\Program Files\\Synthetic\\app.exe", L"/arg \"a \\\"quoted\\\" word\" C:\\dir\\ \"C:\\dir\\\\\""},
+        {L"notepad", L"%1"},
+        {L"C:\\Unterminated\\app.exe %1", L""}};
+
+    for (std::size_t i = 0; i < kCorpusSize; i++)
+    {
+        CommandLineParts parts = SplitCommandLine(kSampleShellCommands[i]);
+        CHECK(parts.executable == kExpected[i].executable);
+        CHECK(parts.arguments == kExpected[i].arguments);
+        CHECK(CheckSplit(kSampleShellCommands[i]));
+        CHECK(SplitArguments(parts.arguments) == ReferenceArguments(parts.arguments));
+    }
+
+    CHECK((SplitArguments(kExpected[12].arguments) ==
+           std::vector<std::wstring>{L"/arg", L"a \"quoted\" word", L"C:\\dir\\", L"C:\\dir\\"}));
+    CHECK((SplitArguments(L"\"a\"\"b\" c\\\\\\\"d") == std::vector<std::wstring>{L"a\"b", L"c\\\"d"}));
+}
+
+// Random lines from the characters that matter, and corpus lines with random edits
+static void Fuzz(unsigned cases)
+{
+    static const wchar_t kAlphabet[] = L"  \t\"\"\\\\aZ.exe%1:,";
+    std::mt19937 random(20240601);
+    unsigned badSplits = 0, badArguments = 0;
+    std::wstring command;
+    for (unsigned n = 0; n < cases; n++)
+    {
+        if (n % 2 == 0)
+        {
+            command.assign(random() % 24, L' ');
+            for (wchar_t &c : command)
+                c = kAlphabet[random() % (sizeof(kAlphabet) / sizeof(kAlphabet[0]) - 1)];
+        }
+        else
+        {
+            command = kSampleShellCommands[random() % kCorpusSize];
+            for (unsigned edits = 1 + random() % 3; edits > 0 && !command.empty(); edits--)
+            {
+                std::size_t at = random() % command.length();
+                switch (random() % 3)
+                {
+                case 0:
+                    command.erase(at, 1);
+                    break;
+                case 1:
+                    command.insert(command.begin() + at, kAlphabet[random() % (sizeof(kAlphabet) / sizeof(kAlphabet[0]) - 1)]);
+                    break;
+                default:
+                    command.resize(at);
+                    break;
+                }
+            }
+        }
+
+        if (!CheckSplit(command))
+            badSplits++;
+        if (SplitArguments(command) != ReferenceArguments(command))
+            badArguments++;
+    }
+    CHECK(badSplits == 0);
+    CHECK(badArguments == 0);
+}
+
+// Split every corpus line and walk its arguments, rounds times; none of it may allocate
+static void Benchmark(unsigned rounds)
+{
+    std::vector<std::wstring_view> corpus(kSampleShellCommands, kSampleShellCommands + kCorpusSize);
+    std::size_t checksum = 0;
+    std::size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned round = 0; round < rounds; round++)
+    {
+        for (std::wstring_view command : corpus)
+        {
+            CommandLineParts parts = SplitCommandLine(command);
+            std::wstring_view rest = parts.arguments, raw;
+            checksum += parts.executable.length();
+            while (NextCommandArgument(rest, raw))
+                checksum += raw.length();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(allocations == before);
+    std::size_t lines = (std::size_t)rounds * corpus.size();
+    std::printf("split: %zu command lines, %.1f ns each (checksum %zu)\n", lines,
+                lines ? seconds * 1e9 / lines : 0.0, checksum);
+}
+
+int main(int argc, char **argv)
+{
+    TestCorpus();
+    Fuzz(argc > 1 ? (unsigned)std::atoi(argv[1]) : 200000);
+    Benchmark(argc > 2 ? (unsigned)std::atoi(argv[2]) : 20000);
+    return TestResult("command_line_test");
+}
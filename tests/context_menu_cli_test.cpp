@@ -0,0 +1,64 @@
+// Command-line mode on the in-memory registry
+
+#include "context_menu_cli.h"
+#include "registry_memory.h"
+#include "test_util.h"
+
+#include <map>
+
+static std::size_t CountVerbs(RegistryBackend &backend, const wchar_t *shellPath)
+{
+    ScopedRegKey key(backend);
+    RegKeyInfo info;
+    if (backend.OpenKey(kRegClassesRoot, shellPath, false, key.Receive()) != RegOk ||
+        backend.QueryInfoKey(key.Get(), &info) != RegOk)
+        return 0;
+    return info.subKeyCount;
+}
+
+// apply --scope sets the default for every line; a line's own --scope applies to that line only
+static void TestApplyScope()
+{
+    MemoryRegistryBackend backend;
+    MakeTestVerb(backend, kDesktopShellPath, L"ThirdParty", L"Third party", L"other.exe");
+
+    std::map<std::wstring, std::wstring> files;
+    files[L"commands.txt"] = L"add C:\\a.exe\n"
+                             L"add C:\\b.exe --scope drive\n"
+                             L"# comment\n"
+                             L"add C:\\c.exe\n"
+                             L"rename a Renamed\n";
+    auto readFile = [&files](const std::wstring &path, std::wstring &text)
+    {
+        auto it = files.find(path);
+        if (it == files.end())
+            return false;
+        text = it->second;
+        return true;
+    };
+
+    ContextMenuStore store(backend);
+    MemoryFileProbe probe;
+    ContextMenuCli cli(store, readFile, probe);
+    JsonWriter json;
+    CHECK(cli.Run({L"apply", L"commands.txt", L"--scope", L"folder"}, json) == 0);
+    CHECK(json.Text().find("\"ok\":true") != std::string::npos);
+    CHECK(CountVerbs(backend, L"Directory\\shell") == 2);
+    CHECK(CountVerbs(backend, L"Drive\\shell") == 1);
+    CHECK(CountVerbs(backend, kDesktopShellPath) == 1);
+
+    // Without --scope the lines default to the desktop
+    ContextMenuStore desktopStore(backend);
+    ContextMenuCli desktopCli(desktopStore, readFile, probe);
+    JsonWriter second;
+    files[L"desktop.txt"] = L"add C:\\d.exe --scope files\nadd C:\\e.exe\n";
+    CHECK(desktopCli.Run({L"apply", L"desktop.txt"}, second) == 0);
+    CHECK(CountVerbs(backend, kDesktopShellPath) == 2);
+    CHECK(CountVerbs(backend, L"*\\shell") == 1);
+}
+
+int main()
+{
+    TestApplyScope();
+    return TestResult("context_menu_cli_test");
+}
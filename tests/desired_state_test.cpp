@@ -0,0 +1,65 @@
+// Reconcile regression tests on the in-memory registry
+
+#include "context_menu_store.h"
+#include "registry_memory.h"
+#include "registry_watcher.h"
+#include "test_util.h"
+
+static const std::wstring kShell = kDesktopShellPath;
+
+static bool NeverSkip(const wchar_t *)
+{
+    return false;
+}
+
+static std::vector<DesiredEntry> ParseOrFail(const std::wstring &text)
+{
+    std::vector<DesiredEntry> desired;
+    std::wstring error;
+    CHECK(ParseDesiredMenu(text, desired, error));
+    return desired;
+}
+
+static void TestCommandOnlyUpdateIsSeen()
+{
+    MemoryRegistryBackend backend;
+    MakeTestVerb(backend, kShell, FormatCustomKeyName(kSortKeyGap, L"Notepad"), L"Notepad", L"\"C:\\Old\\notepad.exe\"");
+    MakeTestVerb(backend, kShell, FormatCustomKeyName(2 * kSortKeyGap, L"Paint"), L"Paint", L"\"C:\\paint.exe\"");
+
+    ContextMenuStore store(backend);
+    CHECK(store.Load());
+    ShellKeyTracker tracker;
+    ShellKeyChanges changes;
+    CHECK(tracker.Diff(backend, kRegClassesRoot, kShell.c_str(), NeverSkip, changes));
+    CHECK(changes.added.size() == 2);
+
+    // Only the program path moves; the icon is given so it stays the same too
+    std::vector<DesiredEntry> desired = ParseOrFail(L"[Notepad]\npath = C:\\New\\notepad.exe\n"
+                                                    L"icon = \"C:\\Old\\notepad.exe\"\n"
+                                                    L"[Paint]\npath = C:\\paint.exe\n");
+    std::vector<ReconcileStep> plan;
+    CHECK(store.Reconcile(desired, false, plan, NULL) == RegOk);
+    CHECK(plan.size() == 1 && plan[0].action == ReconcileUpdate && plan[0].setCommand);
+    CHECK(!plan[0].setDisplayName && !plan[0].setIcon);
+
+    CHECK(tracker.Diff(backend, kRegClassesRoot, kShell.c_str(), NeverSkip, changes));
+    CHECK(changes.added.empty() && changes.removed.empty());
+    CHECK((changes.changed == std::vector<std::wstring>{FormatCustomKeyName(kSortKeyGap, L"Notepad")}));
+
+    ContextMenuStore reloaded(backend);
+    CHECK(reloaded.Load());
+    int notepad = reloaded.Find(FormatCustomKeyName(kSortKeyGap, L"Notepad"));
+    CHECK(notepad >= 0 && reloaded.Entries()[notepad].displayName == L"Notepad");
+    CHECK(notepad >= 0 && reloaded.Entries()[notepad].path == L"C:\\New\\notepad.exe");
+
+    // Applying the same file again writes nothing and the tracker stays quiet
+    std::size_t operations = 1;
+    CHECK(store.Reconcile(desired, false, plan, &operations) == RegOk && plan.empty() && operations == 0);
+    CHECK(tracker.Diff(backend, kRegClassesRoot, kShell.c_str(), NeverSkip, changes) && changes.Empty());
+}
+
+int main()
+{
+    TestCommandOnlyUpdateIsSeen();
+    return TestResult("desired_state_test");
+}
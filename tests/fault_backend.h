@@ -0,0 +1,111 @@
+#pragma once
+
+// Registry backend wrapper that fails on purpose
+//
+// Every write (CreateKey, SetValue, DeleteValue, DeleteKey, DeleteTree) is
+// counted. FailAt(n) makes the nth write from then on a fault: the handler,
+// if any, runs first - a crash test kills the process there - and otherwise
+// the write is not made and RegWriteFault comes back. Only that one write
+// fails, so a rollback that follows goes through. With SplitTrees, DeleteTree
+// goes key by key through the wrapper, so a fault can land inside it.
+
+#include "registry_tree.h"
+
+#include <functional>
+
+class FaultInjectingBackend : public RegistryBackend
+{
+private:
+    RegistryBackend &inner;
+    long writes;
+    long failAt; // 0: never
+    bool splitTrees;
+    std::function<void()> onFault;
+
+    FaultInjectingBackend(const FaultInjectingBackend &);
+    FaultInjectingBackend &operator=(const FaultInjectingBackend &);
+
+    bool Fault()
+    {
+        if (++writes != failAt)
+            return false;
+        if (onFault)
+            onFault();
+        return true;
+    }
+
+public:
+    explicit FaultInjectingBackend(RegistryBackend &backend)
+        : inner(backend), writes(0), failAt(0), splitTrees(false) {}
+
+    // Fail the nth write from now (0: none); handler runs at that point
+    void FailAt(long write, std::function<void()> handler = nullptr)
+    {
+        writes = 0;
+        failAt = write;
+        onFault = handler;
+    }
+
+    void SplitTrees(bool split) { splitTrees = split; }
+
+    // Writes since the last FailAt, the failed one included
+    long Writes() const { return writes; }
+
+    long OpenKey(RegKey parent, const wchar_t *subKey, bool writable, RegKey *result)
+    {
+        return inner.OpenKey(parent, subKey, writable, result);
+    }
+
+    long CreateKey(RegKey parent, const wchar_t *subKey, RegKey *result)
+    {
+        return Fault() ? RegWriteFault : inner.CreateKey(parent, subKey, result);
+    }
+
+    void CloseKey(RegKey key) { inner.CloseKey(key); }
+
+    long QueryInfoKey(RegKey key, RegKeyInfo *info) { return inner.QueryInfoKey(key, info); }
+
+    long EnumKey(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                 std::uint64_t *lastWriteTime)
+    {
+        return inner.EnumKey(key, index, name, nameLength, lastWriteTime);
+    }
+
+    long EnumValue(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                   std::uint32_t *type, void *data, std::uint32_t *dataSize)
+    {
+        return inner.EnumValue(key, index, name, nameLength, type, data, dataSize);
+    }
+
+    long QueryValue(RegKey key, const wchar_t *valueName, std::uint32_t *type, void *data, std::uint32_t *dataSize)
+    {
+        return inner.QueryValue(key, valueName, type, data, dataSize);
+    }
+
+    long SetValue(RegKey key, const wchar_t *valueName, std::uint32_t type, const void *data, std::uint32_t dataSize)
+    {
+        return Fault() ? RegWriteFault : inner.SetValue(key, valueName, type, data, dataSize);
+    }
+
+    long DeleteValue(RegKey key, const wchar_t *valueName)
+    {
+        return Fault() ? RegWriteFault : inner.DeleteValue(key, valueName);
+    }
+
+    long DeleteKey(RegKey parent, const wchar_t *subKey)
+    {
+        return Fault() ? RegWriteFault : inner.DeleteKey(parent, subKey);
+    }
+
+    long DeleteTree(RegKey parent, const wchar_t *subKey)
+    {
+        if (splitTrees)
+            return DeleteKeyTree(*this, parent, subKey);
+        return Fault() ? RegWriteFault : inner.DeleteTree(parent, subKey);
+    }
+
+    long ExpandString(const wchar_t *text, wchar_t *buffer, std::uint32_t *length)
+    {
+        return inner.ExpandString(text, buffer, length);
+    }
+};
@@ -0,0 +1,133 @@
+// Health check on a synthetic menu: flags, the path cache and the thread pool. Arguments:
+// entry count, distinct programs and probe latency in microseconds (the benchmark is the
+// timing line; a latency stands in for a slow disk or network share).
+
+#include "health_check.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <cstdlib>
+
+// Fill entries and probe with a synthetic menu for benchmarking the check: entryCount entries
+// over distinctPrograms programs (so paths repeat, as shared launchers do), every missingEvery-th
+// program absent from the probe. Icons point at the program, every third one at a shared DLL.
+// The entries' strings are interned into strings.
+static void BuildSyntheticHealthEntries(MemoryFileProbe &probe, std::vector<AppEntry> &entries, StringPool &strings,
+                                        std::size_t entryCount, std::size_t distinctPrograms, std::size_t missingEvery)
+{
+    static const wchar_t kSharedIcon[] = L"C:\\Windows\\System32\\shell32.dll";
+    probe.AddFile(kSharedIcon);
+    if (distinctPrograms == 0)
+        distinctPrograms = 1;
+
+    wchar_t path[128];
+    for (std::size_t p = 0; p < distinctPrograms; p++)
+    {
+        swprintf(path, 128, L"C:\\Program Files\\Synthetic%zu\\app%zu.exe", p, p);
+        if (missingEvery == 0 || p % missingEvery != missingEvery - 1)
+            probe.AddFile(path);
+    }
+
+    entries.clear();
+    entries.reserve(entryCount);
+    for (std::size_t i = 0; i < entryCount; i++)
+    {
+        std::size_t p = i % distinctPrograms;
+        AppEntry app;
+        swprintf(path, 128, L"%04zu_CustomApp_Synthetic%zu", i, i);
+        app.name = strings.Intern(path);
+        swprintf(path, 128, L"Synthetic %zu", i);
+        app.displayName = strings.Intern(path);
+        swprintf(path, 128, L"C:\\Program Files\\Synthetic%zu\\app%zu.exe", p, p);
+        app.path = strings.Intern(path);
+        app.arguments = strings.Intern(L"\"%1\"");
+        app.icon = strings.Intern(i % 3 == 2 ? std::wstring(kSharedIcon) + L",-4" : L"\"" + app.path + L"\",0");
+        app.isCustom = true;
+        app.isGroup = false;
+        app.depth = 0;
+        app.health = HealthOk;
+        entries.push_back(app);
+    }
+}
+
+static const std::size_t kMissingEvery = 7;
+
+static void TestCheck(std::size_t entryCount, std::size_t distinctPrograms, unsigned latency)
+{
+    MemoryFileProbe probe;
+    std::vector<AppEntry> entries;
+    StringPool strings;
+    BuildSyntheticHealthEntries(probe, entries, strings, entryCount, distinctPrograms, kMissingEvery);
+
+    // Each distinct path is probed once, shared icons included
+    HealthChecker checker(probe);
+    std::vector<unsigned> serial;
+    HealthStats stats = checker.Check(entries, serial, 1);
+    CHECK(stats.paths == distinctPrograms + 1 && stats.probed == stats.paths && stats.threads == 1);
+    CHECK(probe.ProbeCount() == stats.paths);
+
+    std::size_t broken = 0;
+    bool flagged = true;
+    for (std::size_t i = 0; i < entryCount; i++)
+    {
+        bool missing = (i % distinctPrograms) % kMissingEvery == kMissingEvery - 1;
+        unsigned expected = HealthOk;
+        if (missing)
+            expected = i % 3 == 2 ? HealthMissingProgram : HealthMissingProgram | HealthMissingIcon;
+        flagged = flagged && serial[i] == expected;
+        broken += missing;
+    }
+    CHECK(flagged);
+    CHECK(stats.broken == broken);
+
+    // The next check comes from the cache
+    std::vector<unsigned> cached;
+    stats = checker.Check(entries, cached, 1);
+    CHECK(stats.probed == 0 && cached == serial && probe.ProbeCount() == distinctPrograms + 1);
+
+    // A fresh look on several threads finds a newly missing file and agrees on the rest
+    probe.RemoveFile(L"C:\\Windows\\System32\\shell32.dll");
+    probe.SetLatency(std::chrono::microseconds(latency));
+    checker.Forget();
+    std::vector<unsigned> parallel;
+    auto start = std::chrono::steady_clock::now();
+    stats = checker.Check(entries, parallel, 4);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(stats.probed == stats.paths && checker.CacheSize() == stats.paths);
+    bool agreed = parallel.size() == serial.size();
+    for (std::size_t i = 0; agreed && i < entryCount; i++)
+        agreed = parallel[i] == (i % 3 == 2 ? serial[i] | HealthMissingIcon : serial[i]);
+    CHECK(agreed);
+    std::printf("health: %zu entries, %zu paths, %u threads, %u us latency, %.3f s\n", entryCount, stats.paths,
+                stats.threads, latency, seconds);
+}
+
+// Groups have nothing to check, resource icons are skipped
+static void TestSkipped()
+{
+    MemoryFileProbe probe;
+    StringPool strings;
+    AppEntry group = {};
+    group.name = strings.Intern(L"0064_CustomApp_Tools");
+    group.isGroup = true;
+    group.icon = strings.Intern(L"C:\\missing.ico");
+    AppEntry packaged = {};
+    packaged.name = strings.Intern(L"Packaged");
+    packaged.icon = strings.Intern(L"@{Microsoft.App_1.0?ms-resource://icon}");
+
+    HealthChecker checker(probe);
+    std::vector<unsigned> health;
+    HealthStats stats = checker.Check({group, packaged}, health);
+    CHECK(stats.paths == 0 && stats.broken == 0 && probe.ProbeCount() == 0);
+    CHECK((health == std::vector<unsigned>{HealthOk, HealthOk}));
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t entryCount = argc > 1 ? (std::size_t)std::atol(argv[1]) : 5000;
+    std::size_t distinctPrograms = argc > 2 ? (std::size_t)std::atol(argv[2]) : 500;
+    unsigned latency = argc > 3 ? (unsigned)std::atoi(argv[3]) : 0;
+    TestSkipped();
+    TestCheck(entryCount, distinctPrograms > 0 ? distinctPrograms : 1, latency);
+    return TestResult("health_check_test");
+}
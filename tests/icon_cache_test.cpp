@@ -0,0 +1,197 @@
+// Icon cache on a synthetic source: sharing of identical icons, eviction, failures, and the
+// saved cache across runs. Arguments: distinct paths, lookups and extraction latency in
+// microseconds (the benchmark is the timing and hit-rate line).
+
+#include "icon_cache.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+// Deterministic icons for benchmarking and testing the cache: every path "exists" unless marked
+// missing, and paths in the same group (by hash) share one image, the way icons in shared DLLs do.
+// A per-extraction delay stands in for loading the module.
+class SyntheticIconSource : public IconSource
+{
+private:
+    std::size_t distinctImages;
+    std::chrono::microseconds latency;
+    std::mutex lock;
+    std::unordered_map<std::wstring, std::uint64_t, RegistryNameHash, RegistryNameEqual> stamps; // Overrides
+    std::atomic<std::size_t> extractions;
+
+public:
+    explicit SyntheticIconSource(std::size_t images = 64)
+        : distinctImages(images ? images : 1), latency(0), extractions(0) {}
+
+    void SetLatency(std::chrono::microseconds delay) { latency = delay; }
+
+    // Stamp 0 makes the file missing
+    void SetStamp(const std::wstring &path, std::uint64_t stamp)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stamps[path] = stamp;
+    }
+
+    std::size_t ExtractionCount() const { return extractions; }
+
+    std::uint64_t FileStamp(const std::wstring &path)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = stamps.find(path);
+        return found != stamps.end() ? found->second : 1;
+    }
+
+    bool Extract(const IconKey &key, IconBitmap &bitmap)
+    {
+        extractions++;
+        if (latency.count() > 0)
+            std::this_thread::sleep_for(latency);
+        std::uint64_t stamp = FileStamp(key.path);
+        if (stamp == 0 || key.size <= 0 || key.size > 256)
+            return false;
+
+        std::size_t image = (HashRegistryName(key.path.c_str(), key.path.length()) + (std::size_t)key.index) % distinctImages;
+        bitmap.width = key.size;
+        bitmap.height = key.size;
+        bitmap.pixels.resize((std::size_t)key.size * key.size);
+        for (std::size_t i = 0; i < bitmap.pixels.size(); i++)
+            bitmap.pixels[i] = 0xFF000000u | (std::uint32_t)((image * 2654435761u + stamp * 40503u + i) & 0xFFFFFF);
+        return true;
+    }
+};
+
+static IconKey MakeKey(const std::wstring &path, int index = 0)
+{
+    IconKey key = {path, index, 16, 96};
+    return key;
+}
+
+static void TestSharingAndFailures()
+{
+    SyntheticIconSource source(1); // Every icon looks the same
+    IconCache cache;
+    std::vector<int> changed;
+    std::vector<IconKey> keys = {MakeKey(L"C:\\a.exe"), MakeKey(L"C:\\B.EXE"), MakeKey(L"C:\\b.exe", 1)};
+    CHECK(cache.Find(keys[0]) == kIconUnknown);
+    cache.Resolve(source, keys, changed);
+    CHECK(source.ExtractionCount() == 3 && changed.size() == 1 && cache.SlotCount() == 1);
+    CHECK(cache.Find(keys[0]) == changed[0] && cache.Find(keys[1]) == changed[0]);
+    CHECK(cache.Stats().shared == 2);
+
+    // Case doesn't make a different key; a missing file is remembered, not retried
+    CHECK(cache.Find(MakeKey(L"c:\\A.exe")) == changed[0]);
+    source.SetStamp(L"C:\\gone.exe", 0);
+    cache.Resolve(source, {MakeKey(L"C:\\gone.exe"), MakeKey(L"C:\\gone.exe")}, changed);
+    CHECK(cache.Find(MakeKey(L"C:\\gone.exe")) == kIconNone);
+    CHECK(source.ExtractionCount() == 4);
+
+    IconBitmap bitmap;
+    CHECK(cache.Bitmap(changed[0], bitmap) && bitmap.width == 16 && bitmap.pixels.size() == 256);
+    CHECK(!cache.Bitmap(5, bitmap));
+}
+
+static void TestEviction()
+{
+    SyntheticIconSource source(1000);
+    IconCache cache(3);
+    std::vector<int> changed;
+    cache.Resolve(source, {MakeKey(L"a"), MakeKey(L"b"), MakeKey(L"c")}, changed);
+    CHECK(cache.Find(MakeKey(L"a")) >= 0); // Now the most recent
+    cache.Resolve(source, {MakeKey(L"d")}, changed);
+    CHECK(cache.Size() == 3 && cache.Stats().evictions == 1);
+    CHECK(cache.Find(MakeKey(L"b")) == kIconUnknown);
+    CHECK(cache.Find(MakeKey(L"a")) >= 0 && cache.Find(MakeKey(L"d")) >= 0);
+
+    // The evicted entry's slot is reused rather than the atlas growing
+    int slots = cache.SlotCount();
+    cache.Resolve(source, {MakeKey(L"e")}, changed);
+    CHECK(cache.SlotCount() == slots);
+}
+
+static void TestSaveAndLoad()
+{
+    SyntheticIconSource source(8);
+    IconCache cache;
+    std::vector<int> changed;
+    std::vector<IconKey> keys;
+    for (int i = 0; i < 20; i++)
+        keys.push_back(MakeKey(L"C:\\Apps\\app" + std::to_wstring(i) + L".exe", i % 3));
+    keys.push_back(MakeKey(L"C:\\missing.exe"));
+    source.SetStamp(L"C:\\missing.exe", 0);
+    cache.Resolve(source, keys, changed);
+    std::vector<std::uint8_t> saved;
+    cache.Save(saved);
+
+    // Next run: everything shows at once but stale; only the changed file is extracted again
+    IconCache loaded;
+    std::vector<int> loadedSlots;
+    CHECK(loaded.Load(saved.data(), saved.size(), loadedSlots));
+    CHECK(loaded.Size() == keys.size() && (int)loadedSlots.size() == cache.SlotCount());
+    bool stale = false;
+    CHECK(loaded.Find(keys[0], &stale) >= 0 && stale);
+    CHECK(loaded.Find(keys.back()) == kIconNone);
+
+    SyntheticIconSource later(8);
+    later.SetStamp(L"C:\\missing.exe", 0);
+    later.SetStamp(keys[4].path, 2);
+    loaded.Resolve(later, keys, changed);
+    CHECK(later.ExtractionCount() == 2); // The changed file, and the missing one (stamp 0 never verifies)
+    CHECK(loaded.Stats().verified == keys.size() - 2);
+    CHECK(loaded.Find(keys[0], &stale) >= 0 && !stale);
+
+    // Anything damaged is refused and leaves the cache empty
+    std::vector<std::uint8_t> damaged(saved.begin(), saved.end() - 1);
+    CHECK(!loaded.Load(damaged.data(), damaged.size(), loadedSlots) && loaded.Size() == 0);
+    damaged = saved;
+    damaged[4] ^= 1; // Version
+    CHECK(!loaded.Load(damaged.data(), damaged.size(), loadedSlots));
+    damaged = saved;
+    damaged[8] = 0xFF; // Slot count
+    CHECK(!loaded.Load(damaged.data(), damaged.size(), loadedSlots));
+}
+
+// Skewed lookups over paths, misses resolved in batches by a worker thread the way the window does
+static void Benchmark(std::size_t paths, std::size_t lookups, unsigned latency)
+{
+    SyntheticIconSource source(paths / 4 + 1);
+    source.SetLatency(std::chrono::microseconds(latency));
+    IconCache cache(paths / 2 + 1);
+    std::mt19937 random(7);
+    std::vector<IconKey> misses;
+    std::vector<int> changed;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < lookups; i++)
+    {
+        // Squaring a uniform number makes low path numbers much more frequent
+        double u = (double)random() / random.max();
+        IconKey key = MakeKey(L"C:\\Apps\\app" + std::to_wstring((std::size_t)(u * u * paths)) + L".exe");
+        if (cache.Find(key) == kIconUnknown)
+            misses.push_back(key);
+        if (misses.size() == 64 || i + 1 == lookups)
+        {
+            std::thread worker([&]() { cache.Resolve(source, misses, changed); });
+            worker.join();
+            misses.clear();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    IconCacheStats stats = cache.Stats();
+    // A key missed twice in one batch is extracted once
+    CHECK(stats.lookups == lookups && stats.extractions <= lookups - stats.hits);
+    std::printf("icons: %zu lookups over %zu paths, %.1f%% hits, %zu extractions, %zu shared, %zu evictions, %.3f s\n",
+                lookups, paths, stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0, stats.extractions,
+                stats.shared, stats.evictions, seconds);
+}
+
+int main(int argc, char **argv)
+{
+    TestSharingAndFailures();
+    TestEviction();
+    TestSaveAndLoad();
+    Benchmark(argc > 1 ? (std::size_t)std::atol(argv[1]) : 2000, argc > 2 ? (std::size_t)std::atol(argv[2]) : 50000,
+              argc > 3 ? (unsigned)std::atoi(argv[3]) : 0);
+    return TestResult("icon_cache_test");
+}
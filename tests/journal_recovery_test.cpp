@@ -0,0 +1,435 @@
+// Journal recovery under crashes. Each menu operation runs in a child process that is killed
+// (SIGKILL) at one of its registry writes or journal appends and flushes; the registry as it was
+// at that moment and the journal file are then recovered, and must come back exactly as before
+// the operation (RecoverRollBack) or exactly as after it (RecoverComplete, once the batch was
+// recorded). Recovery itself is killed part way too and run again. In-process write faults,
+// power loss and a torn journal tail are covered as well. Argument: recovery kill points per
+// operation kill point (default 3).
+
+#include "context_menu_store.h"
+#include "fault_backend.h"
+#include "registry_memory.h"
+#include "test_util.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const std::wstring kShell = kDesktopShellPath;
+static const char *const kJournalFile = "journal_recovery_test.journal";
+static const char *const kDumpFile = "journal_recovery_test.dump";
+
+static std::wstring KeyOf(const ContextMenuStore &store, const std::wstring &displayName)
+{
+    for (const AppEntry &app : store.Entries())
+    {
+        if (app.displayName == displayName)
+            return app.name.str();
+    }
+    return std::wstring();
+}
+
+static void BuildMenu(MemoryRegistryBackend &backend)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        std::wstring display = L"App " + std::to_wstring(i);
+        MakeTestVerb(backend, kShell, FormatCustomKeyName((i + 1) * kSortKeyGap, display), display, L"app.exe");
+    }
+    MakeTestGroup(backend, kShell, L"0900_CustomApp_Tools", L"Tools");
+    std::wstring members = kShell + L"\\0900_CustomApp_Tools\\shell";
+    MakeTestVerb(backend, members, L"0064_CustomApp_A", L"A", L"a.exe");
+    MakeTestVerb(backend, members, L"0128_CustomApp_B", L"B", L"b.exe");
+    MakeTestVerb(backend, kShell, L"ThirdParty", L"Third party", L"other.exe");
+}
+
+struct Scenario
+{
+    const char *name;
+    std::function<long(ContextMenuStore &)> run;
+};
+
+static std::vector<Scenario> Scenarios()
+{
+    std::vector<Scenario> scenarios;
+    scenarios.push_back({"reorder", [](ContextMenuStore &store)
+                         { return store.Reorder({KeyOf(store, L"App 4"), KeyOf(store, L"App 0"), KeyOf(store, L"App 5")}); }});
+    scenarios.push_back({"add", [](ContextMenuStore &store)
+                         { return store.Add(L"C:\\New\\new.exe", L"", NULL, NULL); }});
+    scenarios.push_back({"remove", [](ContextMenuStore &store)
+                         { return store.Remove(L"0900_CustomApp_Tools"); }});
+    scenarios.push_back({"rename", [](ContextMenuStore &store)
+                         { return store.Rename(KeyOf(store, L"A"), L"Renamed"); }});
+    scenarios.push_back({"group move", [](ContextMenuStore &store)
+                         { return store.MoveToGroup({KeyOf(store, L"App 3"), KeyOf(store, L"App 1")}, L"0900_CustomApp_Tools"); }});
+    scenarios.push_back({"flatten", [](ContextMenuStore &store)
+                         { return store.FlattenGroup(L"0900_CustomApp_Tools"); }});
+    scenarios.push_back({"reconcile", [](ContextMenuStore &store)
+                         {
+                             std::vector<DesiredEntry> desired;
+                             std::wstring error;
+                             ParseDesiredMenu(L"[App 5]\npath = app.exe\n[App 0]\npath = C:\\New\\app0.exe\n"
+                                              L"[App 1]\npath = app.exe\n[Fresh]\npath = fresh.exe\n",
+                                              desired, error);
+                             std::vector<ReconcileStep> plan;
+                             return store.Reconcile(desired, false, plan, NULL);
+                         }});
+    return scenarios;
+}
+
+// The shell key's tree, which is all the operations touch
+static KeySnapshot CaptureShell(RegistryBackend &backend)
+{
+    KeySnapshot tree;
+    ScopedRegKey key(backend);
+    if (backend.OpenKey(kRegClassesRoot, kShell.c_str(), false, key.Receive()) == RegOk)
+        CaptureKeyTree(backend, key.Get(), tree);
+    tree.name = L"shell";
+    return tree;
+}
+
+static void SaveDump(RegistryBackend &backend)
+{
+    std::vector<std::uint8_t> out;
+    RegistryJournalWriter writer(out);
+    writer.PutTree(CaptureShell(backend));
+    FILE *file = std::fopen(kDumpFile, "wb");
+    if (file)
+    {
+        std::fwrite(out.data(), 1, out.size(), file);
+        std::fclose(file);
+    }
+}
+
+static bool LoadDump(MemoryRegistryBackend &backend)
+{
+    std::vector<std::uint8_t> data;
+    FILE *file = std::fopen(kDumpFile, "rb");
+    if (!file)
+        return false;
+    std::uint8_t block[4096];
+    std::size_t read;
+    while ((read = std::fread(block, 1, sizeof(block), file)) > 0)
+        data.insert(data.end(), block, block + read);
+    std::fclose(file);
+
+    KeySnapshot tree;
+    RegistryJournalReader reader(data.data(), data.size());
+    ScopedRegKey parent(backend);
+    return reader.GetTree(tree) && backend.CreateKey(kRegClassesRoot, L"Directory\\Background", parent.Receive()) == RegOk &&
+           RestoreKeyTree(backend, parent.Get(), tree) == RegOk;
+}
+
+// Save what the registry holds, then die the way a killed process does
+static void DumpAndDie(RegistryBackend &backend)
+{
+    SaveDump(backend);
+    raise(SIGKILL);
+}
+
+// The journal in a file. A process that dies keeps what it wrote, flushed or not; the fault
+// points kill it half way through an append, or just before or after a flush.
+class KillableJournalFile : public JournalStorage
+{
+private:
+    int fd;
+    std::function<void()> die;
+    int appends;
+    int flushes;
+
+public:
+    int tearAppend;      // Write half of this append, then die
+    int killBeforeFlush;
+    int killAfterFlush;
+
+    KillableJournalFile(bool fresh, std::function<void()> onDie)
+        : die(onDie), appends(0), flushes(0), tearAppend(0), killBeforeFlush(0), killAfterFlush(0)
+    {
+        fd = open(kJournalFile, O_RDWR | O_CREAT | O_APPEND | (fresh ? O_TRUNC : 0), 0644);
+    }
+
+    ~KillableJournalFile() { close(fd); }
+
+    bool Read(std::vector<std::uint8_t> &data)
+    {
+        data.clear();
+        std::uint8_t block[4096];
+        ssize_t read;
+        lseek(fd, 0, SEEK_SET);
+        while ((read = ::read(fd, block, sizeof(block))) > 0)
+            data.insert(data.end(), block, block + read);
+        return read == 0;
+    }
+
+    bool Append(const std::uint8_t *data, std::size_t size)
+    {
+        if (++appends == tearAppend)
+        {
+            if (write(fd, data, size / 2) < 0)
+                return false;
+            die();
+        }
+        return write(fd, data, size) == (ssize_t)size;
+    }
+
+    bool Flush()
+    {
+        if (++flushes == killBeforeFlush)
+            die();
+        bool ok = fsync(fd) == 0;
+        if (flushes == killAfterFlush)
+            die();
+        return ok;
+    }
+
+    bool Truncate(std::size_t size) { return ftruncate(fd, (off_t)size) == 0; }
+};
+
+struct CrashPoint
+{
+    long write;     // Registry write to die at, 0: none
+    bool splitTrees;
+    int tearAppend; // Journal fault points, 0: none
+    int killBeforeFlush;
+    int killAfterFlush;
+    long recoveryWrite; // Kill the first recovery at this write, 0: don't
+};
+
+struct Outcome
+{
+    bool died;
+    long status; // Of the final recovery
+    JournalRecoveryStats stats;
+    std::wstring state;
+};
+
+// Run scenario in a child that dies at point, recover what it left, and report the result
+static Outcome Crash(const Scenario &scenario, const CrashPoint &point, JournalRecovery mode)
+{
+    Outcome outcome = {false, RegOk, {0, 0, 0}, L""};
+    std::remove(kDumpFile);
+    {
+        KillableJournalFile fresh(true, nullptr);
+    }
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        MemoryRegistryBackend memory;
+        BuildMenu(memory);
+        FaultInjectingBackend faults(memory);
+        faults.SplitTrees(point.splitTrees);
+        std::function<void()> die = [&memory]() { DumpAndDie(memory); };
+        KillableJournalFile file(false, die);
+        file.tearAppend = point.tearAppend;
+        file.killBeforeFlush = point.killBeforeFlush;
+        file.killAfterFlush = point.killAfterFlush;
+        RegistryJournal journal(file);
+        ContextMenuStore store(faults);
+        store.SetJournal(&journal);
+        if (!store.Load())
+            _exit(3);
+        faults.FailAt(point.write, die);
+        long status = scenario.run(store);
+        SaveDump(memory);
+        _exit(status == RegOk ? 0 : 4);
+    }
+    int result = 0;
+    waitpid(child, &result, 0);
+    outcome.died = WIFSIGNALED(result) && WTERMSIG(result) == SIGKILL;
+    CHECK(outcome.died || (WIFEXITED(result) && WEXITSTATUS(result) == 0));
+
+    if (point.recoveryWrite)
+    {
+        // Recovery dies part way; the next one has to get there all the same
+        child = fork();
+        if (child == 0)
+        {
+            MemoryRegistryBackend memory;
+            if (!LoadDump(memory))
+                _exit(3);
+            FaultInjectingBackend faults(memory);
+            faults.SplitTrees(true);
+            faults.FailAt(point.recoveryWrite, [&memory]() { DumpAndDie(memory); });
+            KillableJournalFile file(false, nullptr);
+            RegistryJournal journal(file);
+            RecoverRegistryJournal(faults, journal, mode);
+            SaveDump(memory);
+            _exit(0);
+        }
+        waitpid(child, &result, 0);
+    }
+
+    MemoryRegistryBackend memory;
+    CHECK(LoadDump(memory));
+    KillableJournalFile file(false, nullptr);
+    RegistryJournal journal(file);
+    outcome.status = RecoverRegistryJournal(memory, journal, mode, &outcome.stats);
+    outcome.state = DumpTestKey(memory, kShell);
+
+    // Recovered for good: nothing left open, and running it again changes nothing
+    JournalRecoveryStats again;
+    CHECK(RecoverRegistryJournal(memory, journal, mode, &again) == RegOk && again.interrupted == 0);
+    CHECK(journal.OpenCount() == 0 && DumpTestKey(memory, kShell) == outcome.state);
+    return outcome;
+}
+
+// The menu before and after an uninterrupted run
+static void ReferenceStates(const Scenario &scenario, std::wstring &before, std::wstring &after)
+{
+    MemoryRegistryBackend memory;
+    BuildMenu(memory);
+    before = DumpTestKey(memory, kShell);
+    MemoryJournalStorage storage;
+    RegistryJournal journal(storage);
+    ContextMenuStore store(memory);
+    store.SetJournal(&journal);
+    CHECK(store.Load());
+    CHECK(scenario.run(store) == RegOk);
+    after = DumpTestKey(memory, kShell);
+    CHECK(after != before && journal.OpenCount() == 0);
+}
+
+// A write that fails without a crash rolls the operation back in process and closes its batch
+static void TestWriteFaults(const Scenario &scenario, const std::wstring &before)
+{
+    bool clean = true;
+    for (long write = 1;; write++)
+    {
+        MemoryRegistryBackend memory;
+        BuildMenu(memory);
+        FaultInjectingBackend faults(memory);
+        MemoryJournalStorage storage;
+        RegistryJournal journal(storage);
+        ContextMenuStore store(faults);
+        store.SetJournal(&journal);
+        CHECK(store.Load());
+        faults.FailAt(write);
+        if (scenario.run(store) == RegOk)
+        {
+            CHECK(faults.Writes() < write);
+            break;
+        }
+        clean = clean && DumpTestKey(memory, kShell) == before && journal.OpenCount() == 0;
+    }
+    if (!clean)
+        std::fprintf(stderr, "%s: a failed write left changes behind\n", scenario.name);
+    CHECK(clean);
+}
+
+static void TestKillPoints(const Scenario &scenario, long recoveryKills)
+{
+    std::wstring before, after;
+    ReferenceStates(scenario, before, after);
+    TestWriteFaults(scenario, before);
+
+    int points = 0;
+    for (int split = 0; split < 2; split++)
+    {
+        for (long write = 1;; write++)
+        {
+            CrashPoint point = {write, split != 0, 0, 0, 0, 0};
+            Outcome rolledBack = Crash(scenario, point, RecoverRollBack);
+            if (!rolledBack.died)
+            {
+                CHECK(rolledBack.state == after);
+                break;
+            }
+            points++;
+
+            // Dying before the batch was recorded (creating the shell key, say) leaves nothing to complete
+            bool recorded = rolledBack.stats.interrupted == 1;
+            const std::wstring &completed = recorded ? after : before;
+            Outcome done = Crash(scenario, point, RecoverComplete);
+            bool ok = rolledBack.status == RegOk && rolledBack.state == before && rolledBack.stats.interrupted <= 1 &&
+                      done.status == RegOk && done.state == completed && done.stats.completed == (recorded ? 1u : 0u);
+            for (long recovery = 1; recovery <= recoveryKills; recovery++)
+            {
+                point.recoveryWrite = recovery;
+                ok = ok && Crash(scenario, point, RecoverRollBack).state == before;
+                ok = ok && Crash(scenario, point, RecoverComplete).state == completed;
+            }
+            if (!ok)
+                std::fprintf(stderr, "%s: wrong recovery after a kill at write %ld%s\n", scenario.name, write,
+                             split ? " (trees key by key)" : "");
+            CHECK(ok);
+        }
+    }
+
+    // The journal's own fault points: the begin record torn or around its flush, the end record torn
+    CrashPoint torn = {0, false, 1, 0, 0, 0};
+    Outcome outcome = Crash(scenario, torn, RecoverComplete);
+    CHECK(outcome.died && outcome.state == before && outcome.stats.interrupted == 0);
+    CrashPoint beforeFlush = {0, false, 0, 1, 0, 0};
+    outcome = Crash(scenario, beforeFlush, RecoverRollBack);
+    CHECK(outcome.died && outcome.state == before && outcome.stats.interrupted == 1);
+    CrashPoint afterFlush = {0, false, 0, 0, 1, 0};
+    outcome = Crash(scenario, afterFlush, RecoverComplete);
+    CHECK(outcome.died && outcome.state == after);
+    CrashPoint tornEnd = {0, false, 2, 0, 0, 0};
+    outcome = Crash(scenario, tornEnd, RecoverRollBack);
+    CHECK(outcome.died && outcome.state == before && outcome.stats.interrupted == 1);
+    outcome = Crash(scenario, tornEnd, RecoverComplete);
+    CHECK(outcome.died && outcome.state == after);
+
+    std::printf("%s: %d registry kill points, %ld recovery kills each, journal kill points ok\n", scenario.name,
+                points, recoveryKills);
+}
+
+// Power loss: an end record that was never flushed is lost, the flushed begin record is not
+static void TestPowerLoss()
+{
+    std::vector<Scenario> scenarios = Scenarios();
+    MemoryRegistryBackend memory;
+    BuildMenu(memory);
+    MemoryJournalStorage storage;
+    RegistryJournal journal(storage);
+    ContextMenuStore store(memory);
+    store.SetJournal(&journal);
+    CHECK(store.Load());
+    CHECK(scenarios[1].run(store) == RegOk);
+    std::wstring first = DumpTestKey(memory, kShell);
+    CHECK(scenarios[0].run(store) == RegOk);
+    CHECK(storage.FlushCount() == 2 && storage.AppendCount() == 4);
+
+    storage.DropUnflushed();
+    RegistryJournal restarted(storage);
+    JournalRecoveryStats stats;
+    CHECK(RecoverRegistryJournal(memory, restarted, RecoverRollBack, &stats) == RegOk && stats.interrupted == 1);
+    CHECK(DumpTestKey(memory, kShell) == first);
+}
+
+// A batch whose commit failed and rolled back is closed; a torn tail is cut off on load
+static void TestTornTail()
+{
+    MemoryRegistryBackend memory;
+    BuildMenu(memory);
+    MemoryJournalStorage storage;
+    RegistryJournal journal(storage);
+    RegistryTransaction transaction(memory, kRegClassesRoot, kShell.c_str(), nullptr, &journal);
+    transaction.SetString(L"NoSuchKey", L"Icon", L"x");
+    CHECK(transaction.Commit() == RegNotFound && journal.OpenCount() == 0);
+
+    std::vector<std::uint8_t> bytes = storage.Bytes();
+    bytes.resize(bytes.size() - 3);
+    MemoryJournalStorage torn;
+    torn.Append(bytes.data(), bytes.size());
+    RegistryJournal reopened(torn);
+    std::vector<RegistryJournalBatch> open;
+    CHECK(reopened.Load(open) && open.size() == 1 && torn.Bytes().size() < bytes.size());
+}
+
+int main(int argc, char **argv)
+{
+    long recoveryKills = argc > 1 ? std::atol(argv[1]) : 3;
+    for (const Scenario &scenario : Scenarios())
+        TestKillPoints(scenario, recoveryKills);
+    TestPowerLoss();
+    TestTornTail();
+    std::remove(kJournalFile);
+    std::remove(kDumpFile);
+    return TestResult("journal_recovery_test");
+}
@@ -0,0 +1,367 @@
+// Virtual list view-model: row text as the old list box drew it, formatting only the rows
+// reported changed, row mapping under the custom-only/all filter, incremental row widths
+// under a counting measurer, and benchmarks of both.
+// Argument: entry count for the benchmarks (100000 is the size to try by hand).
+
+#include "list_view_model.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <cstdlib>
+
+static void AddEntry(std::vector<AppEntry> &entries, StringPool &strings, const std::wstring &name,
+                     const std::wstring &displayName, const std::wstring &path, bool isCustom)
+{
+    AppEntry app = {};
+    app.name = strings.Intern(name);
+    app.path = strings.Intern(path);
+    app.displayName = strings.Intern(displayName);
+    app.isCustom = isCustom;
+    entries.push_back(app);
+}
+
+// Ten units per character, counting the calls; SetContext stands in for a font or DPI change
+class CountingTextMeasurer : public TextMeasurer
+{
+private:
+    std::uint64_t context;
+
+public:
+    std::size_t calls;
+
+    CountingTextMeasurer() : context(1), calls(0) {}
+
+    void SetContext(std::uint64_t value) { context = value; }
+
+    std::uint64_t Context() const { return context; }
+
+    int Width(const std::wstring &text)
+    {
+        calls++;
+        return (int)text.length() * 10;
+    }
+};
+
+// The list box text before the view-model, for a top-level item that passed its health check
+static std::wstring OldDisplayText(const AppEntry &app, std::size_t maxDisplayLength = 100)
+{
+    std::wstring baseText = app.isCustom ? L"\u2705 " : L"\U0001F4CC ";
+    baseText += app.displayName.str() + L" - " + app.path.str();
+    if (baseText.length() > maxDisplayLength)
+        return baseText.substr(0, maxDisplayLength - 10) + L"..." + baseText.substr(baseText.length() - 7);
+    return baseText;
+}
+
+static void TestFormat()
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    AddEntry(entries, strings, L"0064_CustomApp_Notepad", L"Notepad", L"C:\\Windows\\notepad.exe", true);
+    AddEntry(entries, strings, L"ThirdParty", L"Third party", L"C:\\Other\\other.exe", false);
+    AddEntry(entries, strings, L"0128_CustomApp_Long", std::wstring(80, L'n'),
+             L"C:\\Program Files\\Some Vendor\\Long Product Name\\bin\\tool.exe", true);
+    for (const AppEntry &app : entries)
+    {
+        CHECK(ListViewModel::FormatRow(app, 100) == OldDisplayText(app));
+        CHECK(ListViewModel::FormatRow(app, 40) == OldDisplayText(app, 40));
+    }
+    CHECK(ListViewModel::FormatRow(entries[0], 100) == L"\u2705 Notepad - C:\\Windows\\notepad.exe");
+    std::wstring shortened = ListViewModel::FormatRow(entries[2], 100);
+    CHECK(shortened.length() == 100);
+    CHECK(shortened.compare(shortened.length() - 10, 10, L"...ool.exe") == 0);
+
+    // What the old text had no room for: groups, nesting and the health mark
+    AppEntry group = {};
+    group.name = strings.Intern(L"0192_CustomApp_Tools");
+    group.displayName = strings.Intern(L"Tools");
+    group.isCustom = true;
+    group.isGroup = true;
+    CHECK(ListViewModel::FormatRow(group, 100) == L"\U0001F4C2 Tools \u25B8");
+    AppEntry member = entries[0];
+    member.depth = 1;
+    member.health = 1;
+    CHECK(ListViewModel::FormatRow(member, 100) == L"    \u26A0" + OldDisplayText(entries[0]));
+
+    AppIndex index;
+    index.Rebuild(entries);
+    ListViewModel model(entries, index);
+    model.Filter(true);
+    CHECK(model.RowCount() == entries.size());
+    for (std::size_t row = 0; row < model.RowCount(); row++)
+        CHECK(model.RowText(row) == OldDisplayText(entries[model.Position(row)]));
+}
+
+// A changed entry is re-formatted once reported; the others keep their cached text
+static void TestInvalidate()
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    AddEntry(entries, strings, L"0064_CustomApp_A", L"A", L"C:\\a.exe", true);
+    AddEntry(entries, strings, L"0128_CustomApp_B", L"B", L"C:\\b.exe", true);
+    AddEntry(entries, strings, L"0192_CustomApp_C", L"C", L"C:\\c.exe", true);
+    AppIndex index;
+    index.Rebuild(entries);
+    ListViewModel model(entries, index);
+    model.Filter(false);
+    for (std::size_t row = 0; row < model.RowCount(); row++)
+        model.RowText(row);
+
+    // Change every entry behind the model's back, but report only B
+    entries[0].displayName = strings.Intern(L"A2");
+    entries[1].displayName = strings.Intern(L"B2");
+    entries[2].displayName = strings.Intern(L"C2");
+    model.Invalidate(L"0128_CustomApp_B");
+    CHECK(model.RowText(0) == L"\u2705 A - C:\\a.exe");
+    CHECK(model.RowText(1) == L"\u2705 B2 - C:\\b.exe");
+    CHECK(model.RowText(2) == L"\u2705 C - C:\\c.exe");
+
+    // Key names match case-insensitively, as in the registry
+    model.Invalidate(L"0192_customapp_c");
+    CHECK(model.RowText(2) == L"\u2705 C2 - C:\\c.exe");
+
+    model.InvalidateAll();
+    CHECK(model.RowText(0) == L"\u2705 A2 - C:\\a.exe");
+}
+
+// "Show all" maps rows over every entry, the default over the custom ones only
+static void TestFilter()
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    AddEntry(entries, strings, L"0064_CustomApp_A", L"A", L"C:\\a.exe", true);
+    AddEntry(entries, strings, L"Other1", L"Other 1", L"C:\\o1.exe", false);
+    AddEntry(entries, strings, L"0128_CustomApp_B", L"B", L"C:\\b.exe", true);
+    AddEntry(entries, strings, L"Other2", L"Other 2", L"C:\\o2.exe", false);
+    AppIndex index;
+    index.Rebuild(entries);
+    ListViewModel model(entries, index);
+    CHECK(model.Empty());
+
+    model.Filter(false);
+    CHECK(model.RowCount() == 2);
+    CHECK(model.Position(0) == 0 && model.Position(1) == 2);
+    CHECK(model.FindRow(2) == 1);
+    CHECK(model.FindRow(1) == -1);
+    CHECK(model.RowText(1) == L"\u2705 B - C:\\b.exe");
+
+    model.Filter(true);
+    CHECK(model.RowCount() == 4);
+    for (std::size_t row = 0; row < 4; row++)
+        CHECK(model.Position(row) == row && model.FindRow(row) == (int)row);
+    CHECK(model.RowText(1) == L"\U0001F4CC Other 1 - C:\\o1.exe");
+    CHECK(model.RowText(2) == L"\u2705 B - C:\\b.exe");
+
+    model.SwapRows(0, 3);
+    CHECK(model.Position(0) == 3 && model.FindRow(0) == 3);
+
+    model.Filter(false);
+    CHECK(model.RowCount() == 2 && model.Position(0) == 0 && model.Position(1) == 2);
+}
+
+static int RowWidth(const AppEntry &app)
+{
+    return (int)ListViewModel::FormatRow(app, 100).length() * 10;
+}
+
+// Widest row the slow way
+static int ExpectedMaxWidth(const std::vector<AppEntry> &entries, bool showAll)
+{
+    int maxWidth = 0;
+    for (const AppEntry &app : entries)
+    {
+        if ((showAll || app.isCustom) && RowWidth(app) > maxWidth)
+            maxWidth = RowWidth(app);
+    }
+    return maxWidth;
+}
+
+// Keep entries sorted and indexed the way the window does, reporting each change to the model
+static void InsertEntry(std::vector<AppEntry> &entries, AppIndex &index, ListViewModel &model, StringPool &strings,
+                        const std::wstring &name, const std::wstring &displayName, bool isCustom)
+{
+    std::vector<AppEntry> added;
+    AddEntry(added, strings, name, displayName, L"C:\\x.exe", isCustom);
+    auto at = std::upper_bound(entries.begin(), entries.end(), added[0], AppKeyNameLess);
+    std::size_t position = at - entries.begin();
+    entries.insert(at, added[0]);
+    index.Inserted(entries, position);
+    model.Invalidate(entries[position].name);
+}
+
+static void EraseEntry(std::vector<AppEntry> &entries, AppIndex &index, ListViewModel &model, std::wstring_view name)
+{
+    int position = index.Find(name);
+    PooledString keyName = entries[position].name;
+    model.Invalidate(keyName);
+    entries.erase(entries.begin() + position);
+    index.Erased(entries, position, keyName);
+}
+
+// Only rows reported changed are measured again, and the widest row stays right as rows come and go
+static void TestWidths()
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    AddEntry(entries, strings, L"0064_CustomApp_A", L"A", L"C:\\x.exe", true);
+    AddEntry(entries, strings, L"0128_CustomApp_B", L"Bbbbbbbb", L"C:\\x.exe", true);
+    AddEntry(entries, strings, L"0192_CustomApp_C", L"Cccc", L"C:\\x.exe", true);
+    AddEntry(entries, strings, L"Other", L"Other item, wider than the rest", L"C:\\x.exe", false);
+    AppIndex index;
+    index.Rebuild(entries);
+    ListViewModel model(entries, index);
+    model.Filter(false);
+
+    CountingTextMeasurer measurer;
+    model.UpdateWidths(measurer);
+    CHECK(measurer.calls == 4);
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, false));
+    model.Filter(true);
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, true));
+    model.Filter(false);
+
+    // Nothing changed: nothing measured
+    measurer.calls = 0;
+    model.UpdateWidths(measurer);
+    CHECK(measurer.calls == 0);
+
+    // Add a new widest custom row
+    InsertEntry(entries, index, model, strings, L"0256_CustomApp_D", L"Dddddddddddddddd", true);
+    model.UpdateWidths(measurer);
+    CHECK(measurer.calls == 1);
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, false) && model.MaxWidth() == RowWidth(entries[3]));
+
+    // Rename B (remove the old key, add the new one): one measurement
+    measurer.calls = 0;
+    EraseEntry(entries, index, model, L"0128_CustomApp_B");
+    InsertEntry(entries, index, model, strings, L"0128_CustomApp_B2", L"B2", true);
+    model.UpdateWidths(measurer);
+    CHECK(measurer.calls == 1);
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, false));
+
+    // Remove a narrow row, then the widest: the next widest takes over, nothing is measured
+    measurer.calls = 0;
+    EraseEntry(entries, index, model, L"0064_CustomApp_A");
+    model.UpdateWidths(measurer);
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, false));
+    EraseEntry(entries, index, model, L"0256_CustomApp_D");
+    model.UpdateWidths(measurer);
+    CHECK(measurer.calls == 0);
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, false));
+    model.Filter(true);
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, true));
+
+    // Two rows of the same width: removing one keeps the width
+    model.Filter(false);
+    InsertEntry(entries, index, model, strings, L"0320_CustomApp_E", L"Cccc", true);
+    model.UpdateWidths(measurer);
+    int twice = model.MaxWidth();
+    EraseEntry(entries, index, model, L"0192_CustomApp_C");
+    model.UpdateWidths(measurer);
+    CHECK(model.MaxWidth() == twice && twice == ExpectedMaxWidth(entries, false));
+
+    // New font or DPI: every row measured again
+    measurer.calls = 0;
+    measurer.SetContext(2);
+    model.UpdateWidths(measurer);
+    CHECK(measurer.calls == entries.size());
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, false));
+
+    // Everything re-read: every row measured again, once
+    measurer.calls = 0;
+    model.InvalidateAll();
+    model.UpdateWidths(measurer);
+    model.UpdateWidths(measurer);
+    CHECK(measurer.calls == entries.size());
+    model.Filter(true);
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, true));
+}
+
+// Paint every row cold and cached, then after one entry changes; the cached pass is a lookup per row
+static void Benchmark(std::size_t count)
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    entries.reserve(count);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::wstring number = std::to_wstring(i);
+        AddEntry(entries, strings, FormatCustomKeyName((int)(i + 1) * kSortKeyGap, L"App" + number), L"App " + number,
+                 L"C:\\Program Files\\Vendor " + number + L"\\app.exe", i % 4 != 3);
+    }
+    AppIndex index;
+    index.Rebuild(entries);
+    ListViewModel model(entries, index);
+
+    std::size_t characters = 0;
+    auto paint = [&]()
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t row = 0; row < model.RowCount(); row++)
+            characters += model.RowText(row).length();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    model.Filter(false);
+    double cold = paint();
+    model.Filter(true);
+    double all = paint();
+    double cached = paint();
+    if (count > 0)
+        model.Invalidate(entries[count / 2].name);
+    double changed = paint();
+    CHECK(model.RowCount() == count);
+    std::printf("list view: %zu rows, cold %.3f ms, show all %.3f ms, cached %.3f ms, one changed %.3f ms "
+                "(%zu characters)\n",
+                count, cold * 1e3, all * 1e3, cached * 1e3, changed * 1e3, characters);
+}
+
+// Measure every row, then the pass after one entry is renamed, which measures that row only
+static void WidthBenchmark(std::size_t count)
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    entries.reserve(count + 1);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::wstring number = std::to_wstring(i);
+        AddEntry(entries, strings, FormatCustomKeyName((int)(i + 1) * kSortKeyGap, L"App" + number), L"App " + number,
+                 L"C:\\Program Files\\Vendor " + number + L"\\app.exe", true);
+    }
+    AppIndex index;
+    index.Rebuild(entries);
+    ListViewModel model(entries, index);
+    model.Filter(false);
+
+    CountingTextMeasurer measurer;
+    auto start = std::chrono::steady_clock::now();
+    model.UpdateWidths(measurer);
+    double full = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(measurer.calls == count);
+
+    measurer.calls = 0;
+    if (count > 0)
+    {
+        std::wstring name = entries[count / 2].name.str();
+        EraseEntry(entries, index, model, name);
+        InsertEntry(entries, index, model, strings, name + L"x", L"Renamed", true);
+    }
+    start = std::chrono::steady_clock::now();
+    model.UpdateWidths(measurer);
+    double renamed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(measurer.calls == (count > 0 ? 1u : 0u));
+    CHECK(model.MaxWidth() == ExpectedMaxWidth(entries, false));
+    std::printf("list widths: %zu rows, all measured %.3f ms, one renamed %.3f ms (%zu measured)\n", count,
+                full * 1e3, renamed * 1e3, measurer.calls);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t count = argc > 1 ? (std::size_t)std::atol(argv[1]) : 5000;
+    TestFormat();
+    TestInvalidate();
+    TestFilter();
+    TestWidths();
+    Benchmark(count);
+    WidthBenchmark(count);
+    return TestResult("list_view_model_test");
+}
@@ -0,0 +1,188 @@
+// Undo/redo history on the in-memory registry: remove, move and add, then undo back to each
+// earlier state and redo forward again, writing only the verbs that differ between states.
+
+#include "context_menu_store.h"
+#include "fault_backend.h"
+#include "menu_history.h"
+#include "registry_memory.h"
+#include "test_util.h"
+
+#include <map>
+
+static const std::wstring kShell = kDesktopShellPath;
+
+// Last write time of every verb key under the shell key
+static std::map<std::wstring, std::uint64_t> VerbStamps(RegistryBackend &backend)
+{
+    std::map<std::wstring, std::uint64_t> stamps;
+    ScopedRegKey shellKey(backend);
+    if (backend.OpenKey(kRegClassesRoot, kShell.c_str(), false, shellKey.Receive()) != RegOk)
+        return stamps;
+    wchar_t name[256];
+    for (std::uint32_t i = 0;; i++)
+    {
+        std::uint32_t length = 256;
+        std::uint64_t lastWriteTime = 0;
+        if (backend.EnumKey(shellKey.Get(), i, name, &length, &lastWriteTime) != RegOk)
+            break;
+        stamps[name] = lastWriteTime;
+    }
+    return stamps;
+}
+
+// Verbs added, removed or written between two VerbStamps
+static std::vector<std::wstring> Touched(const std::map<std::wstring, std::uint64_t> &before,
+                                         const std::map<std::wstring, std::uint64_t> &after)
+{
+    std::vector<std::wstring> touched;
+    for (const auto &stamp : before)
+    {
+        auto it = after.find(stamp.first);
+        if (it == after.end() || it->second != stamp.second)
+            touched.push_back(stamp.first);
+    }
+    for (const auto &stamp : after)
+    {
+        if (!before.count(stamp.first))
+            touched.push_back(stamp.first);
+    }
+    std::sort(touched.begin(), touched.end());
+    return touched;
+}
+
+static std::wstring KeyOf(const ContextMenuStore &store, const std::wstring &displayName)
+{
+    for (const AppEntry &app : store.Entries())
+    {
+        if (app.displayName == displayName)
+            return app.name.str();
+    }
+    return std::wstring();
+}
+
+static void TestUndoRedo()
+{
+    MemoryRegistryBackend memory;
+    FaultInjectingBackend backend(memory);
+    for (int i = 0; i < 20; i++)
+    {
+        std::wstring display = L"App " + std::to_wstring(i);
+        MakeTestVerb(memory, kShell, FormatCustomKeyName((i + 1) * kSortKeyGap, display), display,
+                     L"\"C:\\Apps\\app" + std::to_wstring(i) + L".exe\" \"%V\"");
+    }
+    ContextMenuStore store(backend);
+    CHECK(store.Load());
+    MenuHistory history(backend);
+    std::vector<std::wstring> states(1, DumpTestKey(memory, kShell));
+    std::vector<std::map<std::wstring, std::uint64_t>> stamps(1, VerbStamps(memory));
+
+    // Remove, capturing the verb first as the window does
+    std::wstring removed = KeyOf(store, L"App 5");
+    std::shared_ptr<KeySnapshot> tree = std::make_shared<KeySnapshot>();
+    {
+        ScopedRegKey key(backend);
+        CHECK(backend.OpenKey(kRegClassesRoot, (kShell + L"\\" + removed).c_str(), false, key.Receive()) == RegOk);
+        CHECK(CaptureKeyTree(backend, key.Get(), *tree) == RegOk);
+    }
+    CHECK(store.Remove(removed) == RegOk);
+    history.RecordDelete(removed, tree);
+    states.push_back(DumpTestKey(memory, kShell));
+    stamps.push_back(VerbStamps(memory));
+
+    // Move one verb to the top: one rename
+    std::wstring moved = KeyOf(store, L"App 12");
+    std::vector<KeyRename> renames;
+    backend.FailAt(0);
+    CHECK(store.Reorder({moved}, &renames) == RegOk);
+    long moveWrites = backend.Writes();
+    CHECK(renames.size() == 1);
+    history.RecordRenames(renames);
+    states.push_back(DumpTestKey(memory, kShell));
+    stamps.push_back(VerbStamps(memory));
+
+    // Add
+    std::wstring added;
+    int failedStep = 0;
+    CHECK(store.Add(L"C:\\Tools\\new.exe", L"New tool", &added, &failedStep) == RegOk);
+    history.RecordCreate(added);
+    states.push_back(DumpTestKey(memory, kShell));
+    stamps.push_back(VerbStamps(memory));
+    CHECK(history.UndoSteps() == 3 && history.RedoSteps() == 0);
+
+    // Undo to each earlier state; only the verbs of that step are written
+    const std::vector<std::vector<std::wstring>> stepVerbs = {
+        {removed}, {moved, renames[0].to}, {added}};
+    for (std::size_t step = 3; step > 0; step--)
+    {
+        std::map<std::wstring, std::uint64_t> before = VerbStamps(memory);
+        backend.FailAt(0);
+        CHECK(history.Undo(kRegClassesRoot, kShell, nullptr) == RegOk);
+        CHECK(DumpTestKey(memory, kShell) == states[step - 1]);
+        std::vector<std::wstring> expected = stepVerbs[step - 1];
+        std::sort(expected.begin(), expected.end());
+        CHECK(Touched(before, VerbStamps(memory)) == expected);
+        if (step == 2)
+            CHECK(backend.Writes() == moveWrites); // Renaming back costs what renaming did
+    }
+    CHECK(history.Undo(kRegClassesRoot, kShell, nullptr) == RegNoMoreItems);
+    CHECK(history.UndoSteps() == 0 && history.RedoSteps() == 3);
+
+    // And forward again
+    for (std::size_t step = 1; step <= 3; step++)
+    {
+        std::map<std::wstring, std::uint64_t> before = VerbStamps(memory);
+        CHECK(history.Redo(kRegClassesRoot, kShell, nullptr) == RegOk);
+        CHECK(DumpTestKey(memory, kShell) == states[step]);
+        std::vector<std::wstring> expected = stepVerbs[step - 1];
+        std::sort(expected.begin(), expected.end());
+        CHECK(Touched(before, VerbStamps(memory)) == expected);
+    }
+    CHECK(history.Redo(kRegClassesRoot, kShell, nullptr) == RegNoMoreItems);
+
+    // A verb another program added meanwhile is left alone by an undo
+    MakeTestVerb(memory, kShell, L"ThirdParty", L"Third party", L"other.exe");
+    std::wstring thirdParty = DumpTestKey(memory, kShell + L"\\ThirdParty");
+    CHECK(history.Undo(kRegClassesRoot, kShell, nullptr) == RegOk);
+    CHECK(DumpTestKey(memory, kShell + L"\\ThirdParty") == thirdParty);
+    CHECK(DumpTestKey(memory, kShell + L"\\" + added).empty());
+
+    // A new change drops what could have been redone
+    CHECK(store.Load());
+    std::wstring other = KeyOf(store, L"App 0");
+    CHECK(store.Remove(other) == RegOk);
+    history.RecordDelete(other, std::make_shared<KeySnapshot>());
+    CHECK(history.RedoSteps() == 0 && history.UndoSteps() == 3);
+}
+
+// A failed write leaves the registry and the step where they were
+static void TestFailedUndo()
+{
+    MemoryRegistryBackend memory;
+    FaultInjectingBackend backend(memory);
+    MakeTestVerb(memory, kShell, FormatCustomKeyName(kSortKeyGap, L"A"), L"A", L"a.exe");
+    ContextMenuStore store(backend);
+    CHECK(store.Load());
+    MenuHistory history(backend);
+
+    std::wstring added;
+    int failedStep = 0;
+    CHECK(store.Add(L"C:\\Tools\\b.exe", L"B", &added, &failedStep) == RegOk);
+    history.RecordCreate(added);
+    std::wstring state = DumpTestKey(memory, kShell);
+
+    backend.FailAt(1);
+    CHECK(history.Undo(kRegClassesRoot, kShell, nullptr) != RegOk);
+    CHECK(DumpTestKey(memory, kShell) == state);
+    CHECK(history.UndoSteps() == 1);
+
+    backend.FailAt(0);
+    CHECK(history.Undo(kRegClassesRoot, kShell, nullptr) == RegOk);
+    CHECK(DumpTestKey(memory, kShell + L"\\" + added).empty());
+}
+
+int main()
+{
+    TestUndoRedo();
+    TestFailedUndo();
+    return TestResult("menu_history_test");
+}
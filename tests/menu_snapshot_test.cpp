@@ -0,0 +1,118 @@
+// Startup snapshot: round trip, and rejection of truncated, corrupted and hostile files
+
+#include "menu_snapshot.h"
+#include "test_util.h"
+
+static void AddEntry(std::vector<AppEntry> &entries, StringPool &strings, const std::wstring &name,
+                     const std::wstring &displayName, bool isGroup, unsigned depth)
+{
+    AppEntry app = {};
+    app.name = strings.Intern(name);
+    app.path = strings.Intern(isGroup ? L"" : L"C:\\Apps\\app.exe");
+    app.arguments = strings.Intern(isGroup ? L"" : L"\"%1\"");
+    app.displayName = strings.Intern(displayName);
+    app.icon = strings.Intern(L"\"C:\\Apps\\app.exe\",0");
+    app.isCustom = true;
+    app.isGroup = isGroup;
+    app.depth = depth;
+    app.health = 2; // As if a check had flagged it - not saved
+    entries.push_back(app);
+}
+
+// A snapshot whose body is exactly body, with a correct header and checksum
+static std::vector<std::uint8_t> WithHeader(const std::vector<std::uint8_t> &body)
+{
+    std::vector<std::uint8_t> out;
+    MenuSnapshotWriter writer(out);
+    writer.Put32(kMenuSnapshotMagic);
+    writer.Put32(kMenuSnapshotVersion);
+    writer.Put32((std::uint32_t)body.size());
+    writer.Put32(MenuSnapshotChecksum(body.data(), body.size()));
+    out.insert(out.end(), body.begin(), body.end());
+    return out;
+}
+
+static void TestRoundTrip()
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    AddEntry(entries, strings, L"0064_CustomApp_Notepad", L"Notepad", false, 0);
+    AddEntry(entries, strings, L"0128_CustomApp_Tools", L"Tools \U0001F527", true, 0); // Needs a surrogate pair
+    AddEntry(entries, strings, L"0128_CustomApp_Tools\\shell\\0064_CustomApp_A", L"A\u00e9", false, 1);
+    ShellKeyTracker tracker;
+    tracker.Record(L"0064_CustomApp_Notepad", 0x0123456789ABCDEFull);
+    tracker.Record(L"0128_CustomApp_Tools", 7);
+
+    std::vector<std::uint8_t> data;
+    WriteMenuSnapshot(kDesktopShellPath, entries, tracker, data);
+    CHECK(data.size() % 4 == 0);
+
+    MenuSnapshot snapshot;
+    CHECK(ReadMenuSnapshot(data.data(), data.size(), snapshot));
+    CHECK(snapshot.shellPath == kDesktopShellPath && snapshot.entries.size() == entries.size());
+    bool same = true;
+    for (std::size_t i = 0; i < entries.size() && i < snapshot.entries.size(); i++)
+    {
+        const AppEntry &a = entries[i], &b = snapshot.entries[i];
+        same = same && a.name == b.name && a.path == b.path && a.arguments == b.arguments &&
+               a.displayName == b.displayName && a.icon == b.icon && a.isCustom == b.isCustom &&
+               a.isGroup == b.isGroup && a.depth == b.depth && b.health == 0;
+    }
+    CHECK(same);
+    CHECK(snapshot.stamps.size() == 2);
+    for (const MenuSnapshotStamp &stamp : snapshot.stamps)
+        CHECK(stamp.lastWriteTime == (stamp.keyName == L"0064_CustomApp_Notepad" ? 0x0123456789ABCDEFull : 7));
+
+    // Every truncation and every flipped bit is rejected
+    std::size_t accepted = 0;
+    for (std::size_t size = 0; size < data.size(); size++)
+    {
+        MenuSnapshot partial;
+        accepted += ReadMenuSnapshot(data.data(), size, partial);
+    }
+    for (std::size_t i = 0; i < data.size(); i++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+        {
+            std::vector<std::uint8_t> damaged = data;
+            damaged[i] ^= (std::uint8_t)(1 << bit);
+            MenuSnapshot partial;
+            accepted += ReadMenuSnapshot(damaged.data(), damaged.size(), partial);
+        }
+    }
+    CHECK(accepted == 0);
+}
+
+// Lengths that only a checksum-correct but hostile file would hold
+static void TestHostileLengths()
+{
+    const std::uint32_t kLengths[] = {0xFFFFFFFFu, 0xFFFFFFFEu, 0x80000001u, 3};
+    for (std::uint32_t length : kLengths)
+    {
+        std::vector<std::uint8_t> body;
+        MenuSnapshotWriter writer(body);
+        writer.Put32(length); // Shell path length, with only four units behind it
+        writer.Put32(0x00410041);
+        writer.Put32(0x00410041);
+        std::vector<std::uint8_t> data = WithHeader(body);
+        MenuSnapshot snapshot;
+        CHECK(!ReadMenuSnapshot(data.data(), data.size(), snapshot));
+    }
+
+    // The same shape with an honest length and empty lists parses
+    std::vector<std::uint8_t> body;
+    MenuSnapshotWriter writer(body);
+    writer.PutString(L"AAAA");
+    writer.Put32(0);
+    writer.Put32(0);
+    std::vector<std::uint8_t> data = WithHeader(body);
+    MenuSnapshot snapshot;
+    CHECK(ReadMenuSnapshot(data.data(), data.size(), snapshot) && snapshot.shellPath == L"AAAA");
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestHostileLengths();
+    return TestResult("menu_snapshot_test");
+}
@@ -0,0 +1,287 @@
+// Load, reorder and delete regression tests on the in-memory registry, and timed runs of
+// each. Argument: verb count for the timed runs (100000 is the size to try by hand).
+
+#include "context_menu_store.h"
+#include "registry_memory.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <cstdlib>
+
+static const std::wstring kShell = kDesktopShellPath;
+
+static std::vector<std::wstring> CustomDisplayNames(const ContextMenuStore &store)
+{
+    std::vector<std::wstring> names;
+    for (const AppEntry &app : store.Entries())
+    {
+        if (app.isCustom && app.depth == 0)
+            names.push_back(app.displayName.str());
+    }
+    return names;
+}
+
+static std::wstring KeyOf(const ContextMenuStore &store, const std::wstring &displayName)
+{
+    for (const AppEntry &app : store.Entries())
+    {
+        if (app.displayName == displayName)
+            return app.name.str();
+    }
+    return std::wstring();
+}
+
+static void TestBackendBasics()
+{
+    MemoryRegistryBackend backend;
+    RegKey key;
+    CHECK(backend.CreateKey(kRegClassesRoot, L"A\\b\\C", &key) == RegOk);
+    backend.CloseKey(key);
+
+    // Lookups ignore case, enumeration is sorted
+    RegKey a;
+    CHECK(backend.OpenKey(kRegClassesRoot, L"a\\B", false, &a) == RegOk);
+    RegKey created;
+    backend.CreateKey(a, L"zz", &created);
+    backend.CloseKey(created);
+    backend.CreateKey(a, L"Aa", &created);
+    backend.CloseKey(created);
+    wchar_t name[64];
+    std::vector<std::wstring> names;
+    for (std::uint32_t i = 0;; i++)
+    {
+        std::uint32_t length = 64;
+        if (backend.EnumKey(a, i, name, &length, NULL) != RegOk)
+            break;
+        names.push_back(name);
+    }
+    CHECK((names == std::vector<std::wstring>{L"Aa", L"C", L"zz"}));
+
+    // A key with children can't be deleted on its own; a handle to a deleted key stops working
+    RegKey c;
+    CHECK(backend.OpenKey(a, L"C", true, &c) == RegOk);
+    CHECK(backend.DeleteKey(kRegClassesRoot, L"A\\b") == RegKeyHasChildren);
+    CHECK(backend.DeleteTree(kRegClassesRoot, L"A\\b") == RegOk);
+    SetTestString(backend, c, L"x", L"y");
+    std::uint32_t size = 0;
+    CHECK(backend.QueryValue(c, L"x", NULL, NULL, &size) != RegOk);
+    CHECK(backend.OpenKey(kRegClassesRoot, L"A\\b", false, &key) == RegNotFound);
+    backend.CloseKey(c);
+    backend.CloseKey(a);
+}
+
+static void TestLoad()
+{
+    MemoryRegistryBackend backend;
+    const int count = 2000;
+    for (int i = 0; i < count; i++)
+    {
+        std::wstring display = L"App " + std::to_wstring(i);
+        MakeTestVerb(backend, kShell, FormatCustomKeyName(i * 4, display), display, L"\"C:\\Apps\\app.exe\" \"%V\"");
+    }
+    MakeTestVerb(backend, kShell, L"Open", L"Open", L"explorer.exe");
+    MakeTestVerb(backend, kShell, L"ThirdParty", L"Third party", L"other.exe");
+    MakeTestGroup(backend, kShell, L"9999_CustomApp_Tools", L"Tools");
+    MakeTestVerb(backend, kShell + L"\\9999_CustomApp_Tools\\shell", L"0064_CustomApp_Inner", L"Inner", L"inner.exe");
+
+    ContextMenuStore store(backend);
+    CHECK(store.Load());
+    const std::vector<AppEntry> &entries = store.Entries();
+    CHECK(entries.size() == (std::size_t)count + 3); // Not the system verb
+    CHECK(store.Find(L"Open") < 0);
+    CHECK(store.Find(L"ThirdParty") >= 0 && !entries[store.Find(L"ThirdParty")].isCustom);
+
+    int inner = store.Find(L"9999_CustomApp_Tools\\shell\\0064_CustomApp_Inner");
+    CHECK(inner >= 0 && entries[inner].depth == 1 && entries[inner].displayName == L"Inner");
+    int group = store.Find(L"9999_CustomApp_Tools");
+    CHECK(group >= 0 && entries[group].isGroup && entries[group].displayName == L"Tools");
+
+    int first = store.Find(FormatCustomKeyName(0, L"App 0"));
+    CHECK(first >= 0 && entries[first].path == L"C:\\Apps\\app.exe" && entries[first].arguments == L"\"%V\"");
+}
+
+static void TestReorder()
+{
+    MemoryRegistryBackend backend;
+    for (int i = 0; i < 10; i++)
+    {
+        std::wstring display = L"App " + std::to_wstring(i);
+        MakeTestVerb(backend, kShell, FormatCustomKeyName((i + 1) * kSortKeyGap, display), display, L"app.exe");
+    }
+    // Legacy names take part too
+    MakeTestVerb(backend, kShell, L"CustomApp_Legacy_3", L"Legacy", L"legacy.exe");
+
+    ContextMenuStore store(backend);
+    CHECK(store.Load());
+    std::wstring before = DumpTestKey(backend, kShell);
+
+    // Moving one item renames just that one, plus the legacy name that gets its sort key
+    std::vector<KeyRename> renames;
+    CHECK(store.Reorder({KeyOf(store, L"App 7")}, &renames) == RegOk);
+    CHECK(renames.size() == 2);
+    std::vector<std::wstring> expected = {L"App 7", L"App 0", L"App 1", L"App 2", L"App 3", L"App 4",
+                                          L"App 5", L"App 6", L"App 8", L"App 9", L"Legacy"};
+    CHECK(CustomDisplayNames(store) == expected);
+
+    // The registry says the same: a fresh load sees the new order, and no verb lost anything
+    ContextMenuStore reloaded(backend);
+    CHECK(reloaded.Load());
+    CHECK(CustomDisplayNames(reloaded) == expected);
+    std::wstring command = DumpTestKey(backend, kShell + L"\\" + KeyOf(reloaded, L"App 7") + L"\\command");
+    CHECK(command.find(L"|=1:") != std::wstring::npos);
+
+    // Full reversal, legacy name first
+    std::vector<std::wstring> reversed;
+    for (auto it = expected.rbegin(); it != expected.rend(); ++it)
+        reversed.push_back(KeyOf(store, *it));
+    CHECK(store.Reorder(reversed) == RegOk);
+    CHECK(CustomDisplayNames(store) == std::vector<std::wstring>(expected.rbegin(), expected.rend()));
+    for (const AppEntry &app : store.Entries())
+    {
+        int sortKey;
+        CHECK(ParseSortKey(app.name, &sortKey));
+    }
+
+    // Reordering into the current order writes nothing
+    std::wstring settled = DumpTestKey(backend, kShell);
+    CHECK(settled != before);
+    reversed.clear();
+    for (auto it = expected.rbegin(); it != expected.rend(); ++it)
+        reversed.push_back(KeyOf(store, *it));
+    renames.clear();
+    CHECK(store.Reorder(reversed, &renames) == RegOk && renames.empty());
+    CHECK(DumpTestKey(backend, kShell) == settled);
+
+    // Unknown and non-custom names are rejected without a write
+    MakeTestVerb(backend, kShell, L"ThirdParty", L"Third party", L"other.exe");
+    CHECK(store.Load());
+    settled = DumpTestKey(backend, kShell);
+    CHECK(store.Reorder({L"NoSuchKey"}) == RegNotFound);
+    CHECK(store.Reorder({L"ThirdParty"}) == RegInvalidParameter);
+    CHECK(DumpTestKey(backend, kShell) == settled);
+}
+
+static void TestDelete()
+{
+    MemoryRegistryBackend backend;
+    for (int i = 0; i < 5; i++)
+    {
+        std::wstring display = L"App " + std::to_wstring(i);
+        MakeTestVerb(backend, kShell, FormatCustomKeyName((i + 1) * kSortKeyGap, display), display, L"app.exe");
+    }
+    MakeTestGroup(backend, kShell, L"0900_CustomApp_Tools", L"Tools");
+    std::wstring members = kShell + L"\\0900_CustomApp_Tools\\shell";
+    MakeTestVerb(backend, members, L"0064_CustomApp_A", L"A", L"a.exe");
+    MakeTestVerb(backend, members, L"0128_CustomApp_B", L"B", L"b.exe");
+
+    ContextMenuStore store(backend);
+    CHECK(store.Load());
+    std::size_t count = store.Entries().size();
+
+    // One item: the key and its command go, nothing else changes
+    std::wstring app2 = KeyOf(store, L"App 2");
+    CHECK(store.Remove(app2) == RegOk);
+    CHECK(store.Find(app2) < 0 && store.Entries().size() == count - 1);
+    RegKey key;
+    CHECK(backend.OpenKey(kRegClassesRoot, (kShell + L"\\" + app2).c_str(), false, &key) == RegNotFound);
+
+    // A group member: the group is touched so change trackers see it
+    RegKey group;
+    backend.OpenKey(kRegClassesRoot, (kShell + L"\\0900_CustomApp_Tools").c_str(), false, &group);
+    RegKeyInfo info;
+    backend.QueryInfoKey(group, &info);
+    std::uint64_t stamp = info.lastWriteTime;
+    CHECK(store.Remove(L"0900_CustomApp_Tools\\shell\\0064_CustomApp_A") == RegOk);
+    backend.QueryInfoKey(group, &info);
+    CHECK(info.lastWriteTime != stamp);
+    backend.CloseKey(group);
+
+    // A group takes its members along; missing keys count as removed
+    std::vector<long> statuses;
+    CHECK(store.RemoveMany({L"0900_CustomApp_Tools", KeyOf(store, L"App 0"), L"Gone"}, &statuses) == RegOk);
+    CHECK((statuses == std::vector<long>{RegOk, RegOk, RegOk}));
+    CHECK(CustomDisplayNames(store) == (std::vector<std::wstring>{L"App 1", L"App 3", L"App 4"}));
+
+    ContextMenuStore reloaded(backend);
+    CHECK(reloaded.Load());
+    CHECK(reloaded.Entries().size() == 3);
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Load count verbs, move the last custom one to the top, reverse the custom ones, then delete
+// every other verb. Sort keys are four digits, so past 4000 verbs the rest are third-party ones.
+static void Benchmark(std::size_t count)
+{
+    MemoryRegistryBackend backend;
+    std::size_t custom = count < 4000 ? count : 4000;
+    int step = kSortKeyLimit / (int)(custom + 1);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::wstring display = L"App " + std::to_wstring(i);
+        std::wstring keyName = i < custom ? FormatCustomKeyName((int)(i + 1) * step, display) : L"Vendor" + std::to_wstring(i);
+        MakeTestVerb(backend, kShell, keyName, display, L"\"C:\\Apps\\app.exe\" \"%V\"");
+    }
+
+    ContextMenuStore store(backend);
+    auto start = std::chrono::steady_clock::now();
+    CHECK(store.Load());
+    double load = SecondsSince(start);
+    CHECK(store.Entries().size() == count);
+
+    std::vector<std::wstring> keys;
+    for (const AppEntry &app : store.Entries())
+    {
+        if (app.isCustom)
+            keys.push_back(app.name.str());
+    }
+
+    // The gap in front of the first sort key leaves room: one rename
+    std::vector<KeyRename> renames;
+    start = std::chrono::steady_clock::now();
+    if (!keys.empty())
+        CHECK(store.Reorder({keys.back()}, &renames) == RegOk);
+    double moveOne = SecondsSince(start);
+    CHECK(renames.size() == (keys.empty() ? 0u : 1u));
+
+    keys.clear();
+    for (auto it = store.Entries().rbegin(); it != store.Entries().rend(); ++it)
+    {
+        if (it->isCustom)
+            keys.push_back(it->name.str());
+    }
+    renames.clear();
+    start = std::chrono::steady_clock::now();
+    CHECK(store.Reorder(keys, &renames) == RegOk);
+    double reverse = SecondsSince(start);
+
+    std::vector<std::wstring> doomed;
+    for (std::size_t i = 0; i < store.Entries().size(); i += 2)
+        doomed.push_back(store.Entries()[i].name.str());
+    std::vector<long> statuses;
+    start = std::chrono::steady_clock::now();
+    CHECK(store.RemoveMany(doomed, &statuses) == RegOk);
+    double remove = SecondsSince(start);
+    CHECK(store.Entries().size() == count - doomed.size());
+
+    ContextMenuStore reloaded(backend);
+    CHECK(reloaded.Load());
+    CHECK(reloaded.Entries().size() == count - doomed.size());
+
+    std::printf("registry: %zu verbs, load %.1f ms, move one %.3f ms, reverse %.1f ms (%zu renames), "
+                "delete %zu %.1f ms\n",
+                count, load * 1e3, moveOne * 1e3, reverse * 1e3, renames.size(), doomed.size(), remove * 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    TestBackendBasics();
+    TestLoad();
+    TestReorder();
+    TestDelete();
+    Benchmark(argc > 1 ? (std::size_t)std::atol(argv[1]) : 2000);
+    return TestResult("registry_memory_test");
+}
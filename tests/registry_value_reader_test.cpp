@@ -0,0 +1,186 @@
+// String value reads on the in-memory registry: the buffer grows on RegMoreData or is sized
+// up front by Prepare, data without a terminating null is read to its end, other value types
+// are rejected, and REG_EXPAND_SZ data comes back expanded, at any length.
+
+#include "fault_backend.h"
+#include "registry_memory.h"
+#include "registry_value_reader.h"
+#include "test_util.h"
+
+// Counts QueryValue calls, so a read can be shown to need one round trip or two
+class QueryCountingBackend : public FaultInjectingBackend
+{
+public:
+    long queries;
+
+    explicit QueryCountingBackend(RegistryBackend &backend) : FaultInjectingBackend(backend), queries(0) {}
+
+    long QueryValue(RegKey key, const wchar_t *valueName, std::uint32_t *type, void *data, std::uint32_t *dataSize)
+    {
+        queries++;
+        return FaultInjectingBackend::QueryValue(key, valueName, type, data, dataSize);
+    }
+};
+
+static void SetRaw(RegistryBackend &backend, RegKey key, const wchar_t *valueName, std::uint32_t type,
+                   const void *data, std::uint32_t size)
+{
+    CHECK(backend.SetValue(key, valueName, type, data, size) == RegOk);
+}
+
+// Longer than the reader's first buffer (255 characters and a terminator) and the old fixed buffers (1024)
+static void TestLongValues()
+{
+    MemoryRegistryBackend memory;
+    QueryCountingBackend backend(memory);
+    ScopedRegKey key(backend);
+    CHECK(backend.CreateKey(kRegClassesRoot, L"Long", key.Receive()) == RegOk);
+
+    const std::size_t lengths[] = {0, 1, 254, 255, 256, 300, 1023, 1024, 1025, 5000};
+    for (std::size_t length : lengths)
+    {
+        std::wstring text(length, L'x');
+        for (std::size_t i = 0; i < length; i++)
+            text[i] = (wchar_t)(L'a' + i % 26);
+        SetTestString(backend, key.Get(), L"Value", text);
+
+        // Unprepared: a value past the buffer costs one more query, then fits
+        RegistryValueReader reader(backend);
+        std::wstring_view value;
+        backend.queries = 0;
+        CHECK(reader.Read(key.Get(), L"Value", value) && value == text);
+        CHECK(backend.queries == (length + 1 > 255 ? 2 : 1));
+        backend.queries = 0;
+        CHECK(reader.Read(key.Get(), L"Value", value) && value == text);
+        CHECK(backend.queries == 1);
+
+        // Prepared: one query per read from the start
+        RegistryValueReader prepared(backend);
+        RegKeyInfo info;
+        CHECK(prepared.Prepare(key.Get(), &info));
+        CHECK(info.maxValueDataSize == (length + 1) * sizeof(wchar_t));
+        backend.queries = 0;
+        std::wstring copy;
+        CHECK(prepared.Read(key.Get(), L"Value", copy) && copy == text);
+        CHECK(backend.queries == 1);
+    }
+
+    // A value that grew after Prepare is still read whole
+    RegistryValueReader reader(backend);
+    CHECK(reader.Prepare(key.Get()));
+    SetTestString(backend, key.Get(), L"Grown", std::wstring(20000, L'g'));
+    std::wstring_view value;
+    CHECK(reader.Read(key.Get(), L"Grown", value) && value == std::wstring(20000, L'g'));
+}
+
+// Registry strings need not end in a null: read to the first null or the end of the data
+static void TestUnterminated()
+{
+    MemoryRegistryBackend backend;
+    ScopedRegKey key(backend);
+    CHECK(backend.CreateKey(kRegClassesRoot, L"Raw", key.Receive()) == RegOk);
+    RegistryValueReader reader(backend);
+    std::wstring_view value;
+
+    SetRaw(backend, key.Get(), L"NoNull", RegTypeSz, L"abc", 3 * sizeof(wchar_t));
+    CHECK(reader.Read(key.Get(), L"NoNull", value) && value == L"abc");
+
+    // Exactly filling the reader's buffer, no null: the terminator still has room
+    std::wstring full(255, L'f');
+    SetRaw(backend, key.Get(), L"Full", RegTypeSz, full.data(), (std::uint32_t)(full.length() * sizeof(wchar_t)));
+    CHECK(reader.Read(key.Get(), L"Full", value) && value == full);
+    std::wstring longer(3000, L'l');
+    SetRaw(backend, key.Get(), L"Longer", RegTypeSz, longer.data(), (std::uint32_t)(longer.length() * sizeof(wchar_t)));
+    CHECK(reader.Read(key.Get(), L"Longer", value) && value == longer);
+
+    // Odd byte count: the stray byte is dropped
+    SetRaw(backend, key.Get(), L"Odd", RegTypeSz, L"abcd", 3 * sizeof(wchar_t) + 1);
+    CHECK(reader.Read(key.Get(), L"Odd", value) && value == L"abc");
+
+    // Embedded null: the text ends there
+    SetRaw(backend, key.Get(), L"Embedded", RegTypeSz, L"ab\0cd", 6 * sizeof(wchar_t));
+    CHECK(reader.Read(key.Get(), L"Embedded", value) && value == L"ab");
+
+    SetRaw(backend, key.Get(), L"Empty", RegTypeSz, L"", 0);
+    CHECK(reader.Read(key.Get(), L"Empty", value) && value.empty());
+
+    // The default value, by NULL or empty name
+    SetTestString(backend, key.Get(), NULL, L"default");
+    CHECK(reader.Read(key.Get(), NULL, value) && value == L"default");
+    CHECK(reader.Read(key.Get(), L"", value) && value == L"default");
+}
+
+static void TestWrongTypes()
+{
+    MemoryRegistryBackend backend;
+    ScopedRegKey key(backend);
+    CHECK(backend.CreateKey(kRegClassesRoot, L"Types", key.Receive()) == RegOk);
+    RegistryValueReader reader(backend);
+    std::wstring_view value;
+    std::wstring copy = L"unchanged";
+
+    std::uint32_t number = 0x00410041; // "AA" if it were read as text
+    SetRaw(backend, key.Get(), L"Dword", RegTypeDword, &number, sizeof(number));
+    SetRaw(backend, key.Get(), L"Binary", RegTypeBinary, L"text", 5 * sizeof(wchar_t));
+    SetRaw(backend, key.Get(), L"Multi", RegTypeMultiSz, L"a\0b\0", 5 * sizeof(wchar_t));
+    SetRaw(backend, key.Get(), L"None", RegTypeNone, L"text", 5 * sizeof(wchar_t));
+    CHECK(!reader.Read(key.Get(), L"Dword", value));
+    CHECK(!reader.Read(key.Get(), L"Binary", value));
+    CHECK(!reader.Read(key.Get(), L"Multi", value));
+    CHECK(!reader.Read(key.Get(), L"None", copy));
+    CHECK(!reader.Read(key.Get(), L"Missing", copy));
+    CHECK(copy == L"unchanged");
+
+    // A long binary value is rejected after the buffer grows, not misread
+    std::vector<unsigned char> blob(4000, 0x41);
+    SetRaw(backend, key.Get(), L"Blob", RegTypeBinary, blob.data(), (std::uint32_t)blob.size());
+    CHECK(!reader.Read(key.Get(), L"Blob", value));
+}
+
+static void TestExpand()
+{
+    MemoryRegistryBackend backend;
+    backend.SetVariable(L"SystemRoot", L"C:\\Windows");
+    backend.SetVariable(L"Long", std::wstring(2000, L'v'));
+    ScopedRegKey key(backend);
+    CHECK(backend.CreateKey(kRegClassesRoot, L"Expand", key.Receive()) == RegOk);
+    RegistryValueReader reader(backend);
+    std::wstring_view value;
+
+    auto setExpand = [&](const wchar_t *name, const std::wstring &text)
+    {
+        SetRaw(backend, key.Get(), name, RegTypeExpandSz, text.c_str(), (std::uint32_t)((text.length() + 1) * sizeof(wchar_t)));
+    };
+    setExpand(L"Icon", L"%SystemRoot%\\system32\\shell32.dll,-4");
+    CHECK(reader.Read(key.Get(), L"Icon", value) && value == L"C:\\Windows\\system32\\shell32.dll,-4");
+
+    // Names ignore case; unknown names and lone percent signs stay as written
+    setExpand(L"Mixed", L"%systemroot%\\%Unknown%\\100%");
+    CHECK(reader.Read(key.Get(), L"Mixed", value) && value == L"C:\\Windows\\%Unknown%\\100%");
+
+    // Expanding past every buffer the reader has
+    setExpand(L"Grows", L"%Long%\\%Long%");
+    CHECK(reader.Read(key.Get(), L"Grows", value) && value == std::wstring(2000, L'v') + L"\\" + std::wstring(2000, L'v'));
+
+    // REG_SZ is never expanded
+    SetTestString(backend, key.Get(), L"Plain", L"%SystemRoot%");
+    CHECK(reader.Read(key.Get(), L"Plain", value) && value == L"%SystemRoot%");
+
+    // Unterminated REG_EXPAND_SZ is expanded up to its end
+    SetRaw(backend, key.Get(), L"NoNull", RegTypeExpandSz, L"%SystemRoot%", 12 * sizeof(wchar_t));
+    CHECK(reader.Read(key.Get(), L"NoNull", value) && value == L"C:\\Windows");
+
+    // After an expanded read, a plain one points at the raw data again
+    std::wstring copy;
+    CHECK(reader.Read(key.Get(), L"Icon", copy) && copy == L"C:\\Windows\\system32\\shell32.dll,-4");
+    CHECK(reader.Read(key.Get(), L"Plain", value) && value == L"%SystemRoot%");
+}
+
+int main()
+{
+    TestLongValues();
+    TestUnterminated();
+    TestWrongTypes();
+    TestExpand();
+    return TestResult("registry_value_reader_test");
+}
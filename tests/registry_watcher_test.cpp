@@ -0,0 +1,159 @@
+// Change watcher on the in-memory registry: a burst of writes is one callback until it is
+// acknowledged, and Stop wakes a watcher blocked with nothing changing.
+
+#include "registry_memory.h"
+#include "registry_watcher.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+using std::chrono::milliseconds;
+
+// Stand-in change source for the in-memory backend (wakes on any change in the tree)
+class MemoryRegistryChangeSource : public RegistryChangeSource
+{
+private:
+    MemoryRegistryBackend &backend;
+    std::uint64_t seen;
+    std::atomic<bool> cancelled;
+
+public:
+    explicit MemoryRegistryChangeSource(MemoryRegistryBackend &owner)
+        : backend(owner), seen(owner.ChangeSequence()), cancelled(false) {}
+
+    bool WaitForChange()
+    {
+        return backend.WaitForChange(&seen, &cancelled);
+    }
+
+    void Cancel()
+    {
+        cancelled = true;
+        backend.WakeWaiters();
+    }
+};
+
+// Counts callbacks; Wait blocks until there have been count of them or the timeout passes
+class CallbackCounter
+{
+private:
+    std::mutex lock;
+    std::condition_variable changed;
+    int calls;
+
+public:
+    CallbackCounter() : calls(0) {}
+
+    void operator()()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            calls++;
+        }
+        changed.notify_all();
+    }
+
+    bool Wait(int count, milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        return changed.wait_for(guard, timeout, [this, count]
+                                { return calls >= count; });
+    }
+
+    int Calls()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return calls;
+    }
+};
+
+static void WriteValue(MemoryRegistryBackend &backend, int value)
+{
+    ScopedRegKey key(backend);
+    backend.CreateKey(kRegClassesRoot, L"Directory\\Background\\shell\\Watched", key.Receive());
+    SetTestString(backend, key.Get(), L"Value", std::to_wstring(value));
+}
+
+// Writes while a notification is unacknowledged add no callbacks; after Acknowledge the next write does
+static void TestBurstIsOneCallback()
+{
+    MemoryRegistryBackend backend;
+    MemoryRegistryChangeSource source(backend);
+    CallbackCounter counter;
+    RegistryWatcher watcher(source, [&counter] { counter(); });
+    watcher.Start();
+
+    for (int i = 0; i < 100; i++)
+        WriteValue(backend, i);
+    CHECK(counter.Wait(1, milliseconds(5000)));
+
+    for (int i = 0; i < 100; i++)
+        WriteValue(backend, i);
+    std::this_thread::sleep_for(milliseconds(100));
+    CHECK(counter.Calls() == 1);
+
+    // Acknowledged with nothing new: still quiet
+    watcher.Acknowledge();
+    std::this_thread::sleep_for(milliseconds(100));
+    CHECK(counter.Calls() == 1);
+
+    WriteValue(backend, 1000);
+    CHECK(counter.Wait(2, milliseconds(5000)));
+    std::this_thread::sleep_for(milliseconds(50));
+    CHECK(counter.Calls() == 2);
+
+    // Reads are not changes
+    watcher.Acknowledge();
+    ScopedRegKey key(backend);
+    backend.OpenKey(kRegClassesRoot, L"Directory\\Background\\shell\\Watched", false, key.Receive());
+    std::uint32_t size = 0;
+    backend.QueryValue(key.Get(), L"Value", NULL, NULL, &size);
+    std::this_thread::sleep_for(milliseconds(100));
+    CHECK(counter.Calls() == 2);
+    watcher.Stop();
+}
+
+// A change made before Start is still reported: the source starts from its construction
+static void TestChangeBeforeStart()
+{
+    MemoryRegistryBackend backend;
+    MemoryRegistryChangeSource source(backend);
+    CallbackCounter counter;
+    WriteValue(backend, 1);
+    RegistryWatcher watcher(source, [&counter] { counter(); });
+    watcher.Start();
+    CHECK(counter.Wait(1, milliseconds(5000)));
+}
+
+// Stop returns promptly while the watcher is blocked, and the source stays cancelled
+static void TestStopWakesBlockedWait()
+{
+    MemoryRegistryBackend backend;
+    MemoryRegistryChangeSource source(backend);
+    CallbackCounter counter;
+    RegistryWatcher watcher(source, [&counter] { counter(); });
+    watcher.Start();
+    std::this_thread::sleep_for(milliseconds(50)); // Let it block
+
+    auto start = std::chrono::steady_clock::now();
+    watcher.Stop();
+    CHECK(std::chrono::steady_clock::now() - start < milliseconds(2000));
+    CHECK(counter.Calls() == 0);
+
+    WriteValue(backend, 1);
+    CHECK(!source.WaitForChange());
+    CHECK(counter.Calls() == 0);
+
+    // A second Stop, and the destructor's, do nothing
+    watcher.Stop();
+}
+
+int main()
+{
+    TestBurstIsOneCallback();
+    TestChangeBeforeStart();
+    TestStopWakesBlockedWait();
+    return TestResult("registry_watcher_test");
+}
@@ -0,0 +1,262 @@
+// Background registry worker on the in-memory registry: queued syncs merge, a reload
+// replaces the reads waiting behind the last write, a read in progress is abandoned
+// for a reload, and writes run and complete in the order posted.
+
+#include "registry_memory.h"
+#include "registry_worker.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <future>
+
+static const wchar_t kCounterPath[] = L"Software\\WorkerTest";
+
+// Holds the worker inside a job until Open, so the test can queue behind it
+class Gate
+{
+private:
+    std::promise<void> started;
+    std::promise<void> opened;
+    std::shared_future<void> openedFuture;
+
+public:
+    Gate() : openedFuture(opened.get_future().share()) {}
+
+    // Called by the job: report that it is running, then wait to be let through
+    void Pass()
+    {
+        started.set_value();
+        openedFuture.wait();
+    }
+
+    void WaitStarted() { started.get_future().wait(); }
+    void Open() { opened.set_value(); }
+};
+
+static void WriteCounter(RegistryBackend &backend, std::uint32_t value)
+{
+    ScopedRegKey key(backend);
+    backend.CreateKey(kRegClassesRoot, kCounterPath, key.Receive());
+    backend.SetValue(key.Get(), L"Counter", RegTypeDword, &value, sizeof(value));
+}
+
+static std::uint32_t ReadCounter(RegistryBackend &backend)
+{
+    ScopedRegKey key(backend);
+    std::uint32_t value = 0, type = 0, size = sizeof(value);
+    if (backend.OpenKey(kRegClassesRoot, kCounterPath, false, key.Receive()) != RegOk ||
+        backend.QueryValue(key.Get(), L"Counter", &type, &value, &size) != RegOk)
+        return 0;
+    return value;
+}
+
+// What the jobs did on the worker, and which completions ran on the owner's thread
+struct JobLog
+{
+    std::vector<std::wstring> ran;
+    std::vector<std::wstring> done;
+    std::vector<std::uint32_t> seen; // Counter values read, by completion
+};
+
+// Wait for the queue to empty, then run what finished
+static void Drain(RegistryWorker &worker)
+{
+    while (worker.Busy())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    worker.RunCompletions();
+    CHECK(worker.Idle());
+}
+
+// A read job, logged by name when it runs and when its completion runs
+static RegistryWorker::Work Read(RegistryBackend &backend, JobLog &log, const std::wstring &name)
+{
+    return [&backend, &log, name](const std::atomic<bool> &) -> RegistryWorker::Completion
+    {
+        log.ran.push_back(name);
+        std::uint32_t value = ReadCounter(backend);
+        return [&log, name, value]()
+        {
+            log.done.push_back(name);
+            log.seen.push_back(value);
+        };
+    };
+}
+
+static RegistryWorker::Work Write(RegistryBackend &backend, JobLog &log, const std::wstring &name, std::uint32_t value,
+                                  Gate *gate = nullptr)
+{
+    return [&backend, &log, name, value, gate](const std::atomic<bool> &) -> RegistryWorker::Completion
+    {
+        if (gate)
+            gate->Pass();
+        log.ran.push_back(name);
+        WriteCounter(backend, value);
+        return [&log, name]()
+        { log.done.push_back(name); };
+    };
+}
+
+typedef std::vector<std::wstring> Names;
+
+// Syncs posted while one is waiting merge into it
+static void TestSyncsMerge()
+{
+    MemoryRegistryBackend backend;
+    JobLog log;
+    Gate gate;
+    RegistryWorker worker([] {});
+    worker.Start();
+
+    CHECK(worker.Post(RegistryWorker::JobWrite, Write(backend, log, L"write", 7, &gate)));
+    gate.WaitStarted();
+    CHECK(worker.Post(RegistryWorker::JobSync, Read(backend, log, L"sync")));
+    CHECK(!worker.Post(RegistryWorker::JobSync, Read(backend, log, L"sync 2")));
+    CHECK(!worker.Post(RegistryWorker::JobSync, Read(backend, log, L"sync 3")));
+    gate.Open();
+    Drain(worker);
+
+    CHECK((log.ran == Names{L"write", L"sync"}));
+    CHECK((log.done == Names{L"write", L"sync"}));
+    CHECK((log.seen == std::vector<std::uint32_t>{7}));
+
+    // A sync posted behind a waiting reload merges into the reload
+    Gate second;
+    log = JobLog();
+    CHECK(worker.Post(RegistryWorker::JobWrite, Write(backend, log, L"write", 8, &second)));
+    second.WaitStarted();
+    CHECK(worker.Post(RegistryWorker::JobReload, Read(backend, log, L"reload")));
+    CHECK(!worker.Post(RegistryWorker::JobSync, Read(backend, log, L"sync")));
+    second.Open();
+    Drain(worker);
+    CHECK((log.ran == Names{L"write", L"reload"}));
+    CHECK((log.seen == std::vector<std::uint32_t>{8}));
+}
+
+// A reload replaces the reads waiting after the last queued write, not those before it
+static void TestReloadReplacesWaitingReads()
+{
+    MemoryRegistryBackend backend;
+    JobLog log;
+    Gate gate;
+    RegistryWorker worker([] {});
+    worker.Start();
+
+    CHECK(worker.Post(RegistryWorker::JobWrite, Write(backend, log, L"write 1", 1, &gate)));
+    gate.WaitStarted();
+    CHECK(worker.Post(RegistryWorker::JobSync, Read(backend, log, L"sync 1")));
+    CHECK(worker.Post(RegistryWorker::JobWrite, Write(backend, log, L"write 2", 2)));
+    CHECK(worker.Post(RegistryWorker::JobSync, Read(backend, log, L"sync 2")));
+    CHECK(worker.Post(RegistryWorker::JobReload, Read(backend, log, L"reload")));
+    gate.Open();
+    Drain(worker);
+
+    CHECK((log.ran == Names{L"write 1", L"sync 1", L"write 2", L"reload"}));
+    CHECK((log.done == log.ran));
+    CHECK((log.seen == std::vector<std::uint32_t>{1, 2}));
+}
+
+// A read in progress is abandoned for a reload when nothing else is queued; its completion is dropped
+static void TestRunningReadAbandoned()
+{
+    MemoryRegistryBackend backend;
+    WriteCounter(backend, 5);
+    JobLog log;
+    Gate gate;
+    std::atomic<bool> sawCancel(false);
+    RegistryWorker worker([] {});
+    worker.Start();
+
+    auto abandonable = [&log, &sawCancel](Gate &running) -> RegistryWorker::Work
+    {
+        return [&log, &sawCancel, &running](const std::atomic<bool> &cancelled) -> RegistryWorker::Completion
+        {
+            running.Pass();
+            sawCancel = cancelled.load();
+            log.ran.push_back(L"sync");
+            return [&log]()
+            { log.done.push_back(L"sync"); };
+        };
+    };
+
+    CHECK(worker.Post(RegistryWorker::JobSync, abandonable(gate)));
+    gate.WaitStarted();
+    CHECK(worker.Post(RegistryWorker::JobReload, Read(backend, log, L"reload")));
+    gate.Open();
+    Drain(worker);
+
+    CHECK(sawCancel);
+    CHECK((log.ran == Names{L"sync", L"reload"}));
+    CHECK((log.done == Names{L"reload"}));
+    CHECK((log.seen == std::vector<std::uint32_t>{5}));
+
+    // With a write queued behind it the read finishes - its result is not replaced at once
+    Gate second;
+    log = JobLog();
+    CHECK(worker.Post(RegistryWorker::JobSync, abandonable(second)));
+    second.WaitStarted();
+    CHECK(worker.Post(RegistryWorker::JobWrite, Write(backend, log, L"write", 6)));
+    CHECK(worker.Post(RegistryWorker::JobReload, Read(backend, log, L"reload")));
+    second.Open();
+    Drain(worker);
+    CHECK(!sawCancel);
+    CHECK((log.done == Names{L"sync", L"write", L"reload"}));
+    CHECK((log.seen == std::vector<std::uint32_t>{6}));
+}
+
+// Writes and checks, with reads posted between them, run and complete in the order posted
+static void TestWritesInOrder()
+{
+    MemoryRegistryBackend backend;
+    JobLog log;
+    std::atomic<int> notified(0);
+    RegistryWorker worker([&notified] { notified++; });
+    worker.Start();
+
+    const std::uint32_t kWrites = 300;
+    Names expected;
+    for (std::uint32_t i = 1; i <= kWrites; i++)
+    {
+        std::wstring name = L"write " + std::to_wstring(i);
+        CHECK(worker.Post(i % 3 == 0 ? RegistryWorker::JobCheck : RegistryWorker::JobWrite,
+                          Write(backend, log, name, i)));
+        expected.push_back(name);
+        if (i % 10 == 0)
+            worker.Post(i % 20 == 0 ? RegistryWorker::JobReload : RegistryWorker::JobSync, Read(backend, log, L"read"));
+    }
+    Drain(worker);
+
+    Names ran, done;
+    for (const auto &name : log.ran)
+    {
+        if (name != L"read")
+            ran.push_back(name);
+    }
+    for (const auto &name : log.done)
+    {
+        if (name != L"read")
+            done.push_back(name);
+    }
+    CHECK(ran == expected);
+    CHECK(done == expected);
+    CHECK(ReadCounter(backend) == kWrites);
+    CHECK(notified == (int)log.done.size());
+
+    // Every read that completed saw a later state than the one before it
+    CHECK(!log.seen.empty());
+    for (std::size_t i = 1; i < log.seen.size(); i++)
+        CHECK(log.seen[i - 1] < log.seen[i]);
+
+    // Stopped: nothing more is taken
+    worker.Stop();
+    CHECK(!worker.Post(RegistryWorker::JobWrite, Write(backend, log, L"late", 0)));
+    CHECK(ReadCounter(backend) == kWrites);
+}
+
+int main()
+{
+    TestSyncsMerge();
+    TestReloadReplacesWaitingReads();
+    TestRunningReadAbandoned();
+    TestWritesInOrder();
+    return TestResult("registry_worker_test");
+}
@@ -0,0 +1,148 @@
+// PlanReorder regression test and fuzz, and new key names once the sort keys run out
+
+#include "context_menu_store.h"
+#include "registry_memory.h"
+#include "reorder_planner.h"
+#include "test_util.h"
+
+#include <random>
+
+// Apply moves to sortKeys; false (with a note) if the plan is not a valid reorder
+static bool CheckPlan(const std::vector<int> &sortKeys, const std::vector<ReorderMove> &moves)
+{
+    std::vector<int> keys = sortKeys;
+    std::vector<bool> moved(keys.size(), false);
+    for (const ReorderMove &move : moves)
+    {
+        if (move.index >= keys.size() || moved[move.index] || move.sortKey < 0 || move.sortKey >= kSortKeyLimit)
+            return false;
+        moved[move.index] = true;
+        keys[move.index] = move.sortKey;
+    }
+    for (std::size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] < 0 || (i > 0 && keys[i] <= keys[i - 1]))
+            return false;
+    }
+    return true;
+}
+
+static void TestWideningOverEarlierRuns()
+{
+    // An unranked entry before a key at the limit: the window for the last entry grows back
+    // over the first run, which must not be planned twice
+    std::vector<int> sortKeys = {-1, 9999, -1};
+    std::vector<ReorderMove> moves;
+    CHECK(PlanReorder(sortKeys, moves));
+    CHECK(moves.size() == 3);
+    CHECK(CheckPlan(sortKeys, moves));
+
+    sortKeys = {-1, 9998, 9999, -1, -1};
+    CHECK(PlanReorder(sortKeys, moves));
+    CHECK(CheckPlan(sortKeys, moves));
+
+    // The same through the store: one rename per key, and the transaction goes through
+    MemoryRegistryBackend backend;
+    std::wstring shell = kDesktopShellPath;
+    MakeTestVerb(backend, shell, L"CustomApp_A_1", L"A", L"a.exe");
+    MakeTestVerb(backend, shell, L"9999_CustomApp_B", L"B", L"b.exe");
+    MakeTestVerb(backend, shell, L"CustomApp_C_2", L"C", L"c.exe");
+    ContextMenuStore store(backend);
+    CHECK(store.Load());
+    std::vector<KeyRename> renames;
+    CHECK(store.Reorder({L"CustomApp_A_1", L"9999_CustomApp_B", L"CustomApp_C_2"}, &renames) == RegOk);
+    CHECK(renames.size() == 3);
+    std::vector<std::wstring> order;
+    for (const AppEntry &app : store.Entries())
+        order.push_back(app.displayName.str());
+    CHECK((order == std::vector<std::wstring>{L"A", L"B", L"C"}));
+}
+
+static void TestKeptEntriesStay()
+{
+    // Already in order: nothing moves. One entry out of place: only it moves.
+    std::vector<int> sortKeys = {64, 128, 192, 256};
+    std::vector<ReorderMove> moves;
+    CHECK(PlanReorder(sortKeys, moves) && moves.empty());
+
+    sortKeys = {256, 64, 128, 192};
+    CHECK(PlanReorder(sortKeys, moves) && moves.size() == 1 && moves[0].index == 0);
+    CHECK(CheckPlan(sortKeys, moves));
+
+    // More entries than sort keys
+    CHECK(!PlanReorder(std::vector<int>(kSortKeyLimit + 1, -1), moves));
+}
+
+static void Fuzz(unsigned cases)
+{
+    std::mt19937 random(12345);
+    unsigned invalid = 0;
+    std::vector<int> sortKeys;
+    std::vector<ReorderMove> moves;
+    for (unsigned n = 0; n < cases; n++)
+    {
+        // Crowded near the ends of the key range, where windows have to widen
+        std::size_t count = 1 + random() % 24;
+        sortKeys.assign(count, -1);
+        for (int &key : sortKeys)
+        {
+            switch (random() % 4)
+            {
+            case 0:
+                break;
+            case 1:
+                key = kSortKeyLimit - 1 - (int)(random() % 16);
+                break;
+            case 2:
+                key = (int)(random() % 16);
+                break;
+            default:
+                key = (int)(random() % kSortKeyLimit);
+                break;
+            }
+        }
+        if (!PlanReorder(sortKeys, moves) || !CheckPlan(sortKeys, moves))
+            invalid++;
+    }
+    CHECK(invalid == 0);
+}
+
+// Past the last sort key a new item gets an unranked name, whatever the display name's length
+static void TestUnrankedKeyNames()
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    AppEntry last = {};
+    last.name = strings.Intern(FormatCustomKeyName(kSortKeyLimit - 1, L"Last"));
+    last.isCustom = true;
+    entries.push_back(last);
+    AppIndex index;
+    index.Rebuild(entries);
+
+    CHECK(GenerateCustomKeyName(index, L"Tool") == L"CustomApp_Tool_2");
+
+    // Longer than the fixed buffer the name used to be printed into
+    std::wstring longName(400, L'n');
+    std::wstring keyName = GenerateCustomKeyName(index, longName);
+    CHECK(keyName == L"CustomApp_" + longName + L"_2");
+
+    // A taken candidate is skipped
+    AppEntry taken = last;
+    taken.name = strings.Intern(L"CustomApp_Tool_2");
+    entries.push_back(taken);
+    index.Rebuild(entries);
+    CHECK(GenerateCustomKeyName(index, L"Tool") == L"CustomApp_Tool_3");
+
+    // With room left, the next sort key
+    index.Clear();
+    CHECK(GenerateCustomKeyName(index, L"Tool") == FormatCustomKeyName(kSortKeyGap, L"Tool"));
+}
+
+int main(int argc, char **argv)
+{
+    TestWideningOverEarlierRuns();
+    TestKeptEntriesStay();
+    TestUnrankedKeyNames();
+    Fuzz(argc > 1 ? (unsigned)std::atoi(argv[1]) : 200000);
+    return TestResult("reorder_planner_test");
+}
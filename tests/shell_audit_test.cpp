@@ -0,0 +1,89 @@
+// Whole-HKCR audit on a synthetic hive: the sharded scan finds every verb, in class order,
+// whatever the thread count. Arguments: class count and verbs per class (the benchmark is
+// the timing line; 20000 classes is the size the audit has to handle in seconds).
+
+#include "shell_audit.h"
+#include "synthetic_hive.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <cstdlib>
+
+static std::size_t ExpectedVerbs(std::size_t classCount, std::size_t verbsPerClass)
+{
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < classCount; i++)
+    {
+        if (i % 3 != 2)
+            total += 1 + i % verbsPerClass;
+    }
+    return total;
+}
+
+static bool SameVerbs(const std::vector<AuditedVerb> &a, const std::vector<AuditedVerb> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].className != b[i].className || a[i].app.name != b[i].app.name || a[i].command != b[i].command ||
+            a[i].system != b[i].system)
+            return false;
+    }
+    return true;
+}
+
+static void TestAudit(std::size_t classCount, std::size_t verbsPerClass)
+{
+    MemoryRegistryBackend backend;
+    BuildSyntheticShellHive(backend, classCount, verbsPerClass);
+
+    StringPool strings;
+    std::vector<AuditedVerb> serial;
+    AuditStats stats;
+    CHECK(AuditShellVerbs(backend, kRegClassesRoot, 1, serial, strings, &stats) == RegOk);
+    CHECK(stats.classes == classCount && stats.threads == 1);
+    CHECK(stats.shellKeys == classCount - classCount / 3);
+    CHECK(serial.size() == ExpectedVerbs(classCount, verbsPerClass) && stats.verbs == serial.size());
+
+    // Class order (the registry's); "Open", "Properties" and "Share" flagged as built in, not "print"
+    bool ordered = true, flagged = true;
+    for (std::size_t i = 1; i < serial.size(); i++)
+        ordered = ordered && CompareRegistryNames(serial[i - 1].className, serial[i].className) <= 0;
+    for (const AuditedVerb &verb : serial)
+    {
+        bool system = verb.app.name == L"Open" || verb.app.name == L"Properties" || verb.app.name == L"Share";
+        flagged = flagged && verb.system == system && !verb.command.empty() &&
+                  verb.app.displayName == L"Synthetic verb";
+    }
+    CHECK(ordered);
+    CHECK(flagged);
+
+    StringPool parallelStrings;
+    std::vector<AuditedVerb> parallel;
+    auto start = std::chrono::steady_clock::now();
+    CHECK(AuditShellVerbs(backend, kRegClassesRoot, 4, parallel, parallelStrings, &stats) == RegOk);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(SameVerbs(serial, parallel));
+    std::printf("audit: %zu classes, %zu verbs, %u threads, %.3f s\n", classCount, parallel.size(), stats.threads,
+                seconds);
+}
+
+static void TestEmptyRoot()
+{
+    MemoryRegistryBackend backend;
+    StringPool strings;
+    std::vector<AuditedVerb> verbs;
+    AuditStats stats;
+    CHECK(AuditShellVerbs(backend, kRegClassesRoot, 4, verbs, strings, &stats) == RegOk);
+    CHECK(verbs.empty() && stats.classes == 0 && stats.threads == 1);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t classCount = argc > 1 ? (std::size_t)std::atol(argv[1]) : 3000;
+    std::size_t verbsPerClass = argc > 2 ? (std::size_t)std::atol(argv[2]) : 8;
+    TestEmptyRoot();
+    TestAudit(classCount, verbsPerClass > 0 ? verbsPerClass : 1);
+    return TestResult("shell_audit_test");
+}
@@ -0,0 +1,264 @@
+// Shell key enumeration on the in-memory registry: names longer than the buffer the key info
+// promised, missing and wrong-type values, nested groups with their "Group\shell\Member" paths
+// and depths, and the group depth limit.
+
+#include "context_menu_model.h"
+#include "fault_backend.h"
+#include "registry_memory.h"
+#include "test_util.h"
+
+static const std::wstring kShell = kDesktopShellPath;
+
+// Reports subkey names shorter than they are, as when a key is added after the info query
+class StaleInfoBackend : public FaultInjectingBackend
+{
+public:
+    long moreData; // RegMoreData answers from EnumKey
+
+    explicit StaleInfoBackend(RegistryBackend &backend) : FaultInjectingBackend(backend), moreData(0) {}
+
+    long QueryInfoKey(RegKey key, RegKeyInfo *info)
+    {
+        long status = FaultInjectingBackend::QueryInfoKey(key, info);
+        if (status == RegOk && info->maxSubKeyLength > 8)
+            info->maxSubKeyLength = 8;
+        return status;
+    }
+
+    long EnumKey(RegKey key, std::uint32_t index, wchar_t *name, std::uint32_t *nameLength,
+                 std::uint64_t *lastWriteTime)
+    {
+        long status = FaultInjectingBackend::EnumKey(key, index, name, nameLength, lastWriteTime);
+        if (status == RegMoreData)
+            moreData++;
+        return status;
+    }
+};
+
+// Owned copies of what the enumerator reported
+static std::vector<ShellEntry> EnumerateAll(ShellKeyEnumerator &enumerator, const std::wstring &shellPath,
+                                            bool tree = true, long *count = NULL)
+{
+    std::vector<ShellEntry> entries;
+    auto skip = [](const wchar_t *keyName)
+    { return IsSystemVerb(keyName); };
+    auto collect = [&entries](const ShellEntry &entry)
+    { entries.push_back(entry); };
+    long result = tree ? enumerator.EnumerateTree(kRegClassesRoot, shellPath.c_str(), skip, collect)
+                       : enumerator.Enumerate(kRegClassesRoot, shellPath.c_str(), skip, collect);
+    if (count)
+        *count = result;
+    return entries;
+}
+
+static const ShellEntry *FindEntry(const std::vector<ShellEntry> &entries, const std::wstring &keyName)
+{
+    for (const ShellEntry &entry : entries)
+    {
+        if (entry.keyName == keyName)
+            return &entry;
+    }
+    return NULL;
+}
+
+// Names past the first buffer and past what the key info said: the buffer grows on RegMoreData
+static void TestLongNames()
+{
+    MemoryRegistryBackend memory;
+    std::wstring longName(300, L'L'), longerName(1200, L'M');
+    MakeTestVerb(memory, kShell, L"Short", L"Short", L"short.exe");
+    MakeTestVerb(memory, kShell, longName, L"Long", L"long.exe");
+    MakeTestGroup(memory, kShell, longerName, L"Longer group");
+    MakeTestVerb(memory, kShell + L"\\" + longerName + L"\\shell", longName + L"2", L"Member", L"member.exe");
+
+    StaleInfoBackend backend(memory);
+    ShellKeyEnumerator enumerator(backend);
+    long count = 0;
+    std::vector<ShellEntry> entries = EnumerateAll(enumerator, kShell, true, &count);
+    CHECK(count == 4 && entries.size() == 4);
+    CHECK(backend.moreData > 0);
+    const ShellEntry *longEntry = FindEntry(entries, longName);
+    CHECK(longEntry && longEntry->displayName == L"Long" && longEntry->command == L"long.exe");
+    const ShellEntry *group = FindEntry(entries, longerName);
+    CHECK(group && group->isGroup && group->depth == 0);
+    const ShellEntry *member = FindEntry(entries, longerName + L"\\shell\\" + longName + L"2");
+    CHECK(member && member->depth == 1 && member->displayName == L"Member");
+
+    // Once grown, a second pass needs no retry
+    backend.moreData = 0;
+    CHECK(EnumerateAll(enumerator, kShell).size() == 4);
+    CHECK(backend.moreData == 0);
+
+    // Honest key info sizes the buffer up front
+    ShellKeyEnumerator direct(memory);
+    CHECK(EnumerateAll(direct, kShell).size() == 4);
+}
+
+// Display name falls back from the default value to MUIVerb to the key name; values of the
+// wrong type count as missing, and nothing carries over from the previous verb
+static void TestMissingAndWrongTypeValues()
+{
+    MemoryRegistryBackend backend;
+    MakeTestVerb(backend, kShell, L"A_Full", L"Full", L"full.exe");
+    std::uint32_t number = 7;
+    auto verb = [&backend](const std::wstring &keyName, std::function<void(RegKey)> fill)
+    {
+        ScopedRegKey key(backend);
+        CHECK(backend.CreateKey(kRegClassesRoot, (kShell + L"\\" + keyName).c_str(), key.Receive()) == RegOk);
+        fill(key.Get());
+    };
+    verb(L"B_Bare", [](RegKey) {});
+    verb(L"C_MuiVerb", [&](RegKey key)
+         { SetTestString(backend, key, L"MUIVerb", L"From MUIVerb"); });
+    verb(L"D_DwordName", [&](RegKey key)
+         {
+             backend.SetValue(key, NULL, RegTypeDword, &number, sizeof(number));
+             SetTestString(backend, key, L"MUIVerb", L"Fallback");
+             backend.SetValue(key, L"Icon", RegTypeBinary, L"x.ico", 6 * sizeof(wchar_t));
+         });
+    verb(L"E_EmptyCommand", [&](RegKey key)
+         {
+             ScopedRegKey command(backend);
+             backend.CreateKey(key, L"command", command.Receive());
+         });
+    verb(L"F_DwordCommand", [&](RegKey key)
+         {
+             ScopedRegKey command(backend);
+             backend.CreateKey(key, L"command", command.Receive());
+             backend.SetValue(command.Get(), NULL, RegTypeDword, &number, sizeof(number));
+         });
+    verb(L"G_CommandStore", [&](RegKey key)
+         {
+             SetTestString(backend, key, L"SubCommands", L"Windows.copy;Windows.paste");
+             ScopedRegKey shell(backend);
+             backend.CreateKey(key, L"shell", shell.Receive());
+         });
+    verb(L"H_DwordSubCommands", [&](RegKey key)
+         { backend.SetValue(key, L"SubCommands", RegTypeDword, &number, sizeof(number)); });
+    verb(L"I_ExpandIcon", [&](RegKey key)
+         {
+             std::wstring icon = L"%SystemRoot%\\app.ico";
+             backend.SetValue(key, L"Icon", RegTypeExpandSz, icon.c_str(), (std::uint32_t)((icon.length() + 1) * sizeof(wchar_t)));
+         });
+    backend.SetVariable(L"SystemRoot", L"C:\\Windows");
+
+    ShellKeyEnumerator enumerator(backend);
+    std::vector<ShellEntry> entries = EnumerateAll(enumerator, kShell);
+    CHECK(entries.size() == 9);
+
+    const ShellEntry *full = FindEntry(entries, L"A_Full");
+    CHECK(full && full->displayName == L"Full" && full->icon == L"full.exe" && full->hasCommand &&
+          full->command == L"full.exe" && !full->isGroup);
+    const ShellEntry *bare = FindEntry(entries, L"B_Bare");
+    CHECK(bare && bare->displayName == L"B_Bare" && bare->icon.empty() && !bare->hasCommand && bare->command.empty());
+    const ShellEntry *mui = FindEntry(entries, L"C_MuiVerb");
+    CHECK(mui && mui->displayName == L"From MUIVerb");
+    const ShellEntry *dword = FindEntry(entries, L"D_DwordName");
+    CHECK(dword && dword->displayName == L"Fallback" && dword->icon.empty());
+    const ShellEntry *empty = FindEntry(entries, L"E_EmptyCommand");
+    CHECK(empty && !empty->hasCommand && empty->command.empty());
+    const ShellEntry *dwordCommand = FindEntry(entries, L"F_DwordCommand");
+    CHECK(dwordCommand && !dwordCommand->hasCommand && dwordCommand->command.empty());
+    const ShellEntry *commandStore = FindEntry(entries, L"G_CommandStore");
+    CHECK(commandStore && !commandStore->isGroup);
+    const ShellEntry *dwordSub = FindEntry(entries, L"H_DwordSubCommands");
+    CHECK(dwordSub && !dwordSub->isGroup);
+    const ShellEntry *expand = FindEntry(entries, L"I_ExpandIcon");
+    CHECK(expand && expand->icon == L"C:\\Windows\\app.ico");
+
+    // Missing shell key
+    long count = 0;
+    CHECK(EnumerateAll(enumerator, L"NoSuchClass\\shell", true, &count).empty() && count == -1);
+}
+
+// Members follow their group with the "Group\shell\Member" path and one more level of depth
+static void TestNestedGroups()
+{
+    MemoryRegistryBackend backend;
+    std::wstring outer = kShell + L"\\0064_CustomApp_Outer\\shell";
+    std::wstring inner = outer + L"\\0064_CustomApp_Inner\\shell";
+    MakeTestGroup(backend, kShell, L"0064_CustomApp_Outer", L"Outer");
+    MakeTestVerb(backend, outer, L"0032_CustomApp_Before", L"Before", L"before.exe");
+    MakeTestGroup(backend, outer, L"0064_CustomApp_Inner", L"Inner");
+    MakeTestVerb(backend, inner, L"0064_CustomApp_Deep", L"Deep", L"deep.exe");
+    MakeTestVerb(backend, inner, L"Open", L"Open", L"explorer.exe"); // Skipped at any depth
+    MakeTestVerb(backend, outer, L"0128_CustomApp_After", L"After", L"after.exe");
+    MakeTestVerb(backend, kShell, L"0128_CustomApp_Top", L"Top", L"top.exe");
+    MakeTestGroup(backend, kShell, L"Open", L"Open group"); // A skipped group is not entered
+    MakeTestVerb(backend, kShell + L"\\Open\\shell", L"Hidden", L"Hidden", L"hidden.exe");
+
+    ShellKeyEnumerator enumerator(backend);
+    long count = 0;
+    std::vector<ShellEntry> entries = EnumerateAll(enumerator, kShell, true, &count);
+    const wchar_t *expected[] = {
+        L"0064_CustomApp_Outer",
+        L"0064_CustomApp_Outer\\shell\\0032_CustomApp_Before",
+        L"0064_CustomApp_Outer\\shell\\0064_CustomApp_Inner",
+        L"0064_CustomApp_Outer\\shell\\0064_CustomApp_Inner\\shell\\0064_CustomApp_Deep",
+        L"0064_CustomApp_Outer\\shell\\0128_CustomApp_After",
+        L"0128_CustomApp_Top"};
+    const unsigned depths[] = {0, 1, 1, 2, 1, 0};
+    CHECK(count == 6 && entries.size() == 6);
+    for (std::size_t i = 0; i < entries.size() && i < 6; i++)
+        CHECK(entries[i].keyName == expected[i] && entries[i].depth == depths[i]);
+    CHECK(entries.size() == 6 && entries[0].isGroup && entries[2].isGroup && entries[3].command == L"deep.exe");
+
+    // Enumerate stays at the top
+    std::vector<ShellEntry> top = EnumerateAll(enumerator, kShell, false, &count);
+    CHECK(count == 2 && top.size() == 2 && top[0].keyName == expected[0] && top[1].keyName == expected[5]);
+
+    // ReadTree of one group from its open shell key gives the same paths and depths
+    std::vector<ShellEntry> subtree;
+    ScopedRegKey shellKey(backend);
+    CHECK(backend.OpenKey(kRegClassesRoot, kShell.c_str(), false, shellKey.Receive()) == RegOk);
+    CHECK(enumerator.ReadTree(
+        shellKey.Get(), L"0064_CustomApp_Outer", [](const wchar_t *keyName)
+        { return IsSystemVerb(keyName); },
+        [&subtree](const ShellEntry &entry)
+        { subtree.push_back(entry); }));
+    CHECK(subtree.size() == 5);
+    for (std::size_t i = 0; i < subtree.size() && i < 5; i++)
+        CHECK(subtree[i].keyName == expected[i] && subtree[i].depth == depths[i]);
+    CHECK(!enumerator.ReadTree(
+        shellKey.Get(), L"Missing", [](const wchar_t *)
+        { return false; },
+        [](const ShellEntry &) {}));
+
+    // The last write time is the verb key's
+    RegKeyInfo info;
+    ScopedRegKey top0(backend);
+    backend.OpenKey(shellKey.Get(), L"0128_CustomApp_Top", false, top0.Receive());
+    backend.QueryInfoKey(top0.Get(), &info);
+    CHECK(entries.size() == 6 && entries[5].lastWriteTime == info.lastWriteTime && info.lastWriteTime != 0);
+}
+
+// Groups nested deeper than kMaxMenuGroupDepth are listed down to that depth and no further
+static void TestDepthLimit()
+{
+    MemoryRegistryBackend backend;
+    std::wstring shellPath = kShell;
+    for (unsigned level = 0; level < kMaxMenuGroupDepth + 4; level++)
+    {
+        MakeTestGroup(backend, shellPath, L"Level", L"Level " + std::to_wstring(level));
+        shellPath += L"\\Level\\shell";
+    }
+
+    ShellKeyEnumerator enumerator(backend);
+    std::vector<ShellEntry> entries = EnumerateAll(enumerator, kShell);
+    CHECK(entries.size() == kMaxMenuGroupDepth + 1);
+    std::wstring keyName = L"Level";
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+        CHECK(entries[i].depth == i && entries[i].keyName == keyName);
+        keyName += L"\\shell\\Level";
+    }
+}
+
+int main()
+{
+    TestLongNames();
+    TestMissingAndWrongTypeValues();
+    TestNestedGroups();
+    TestDepthLimit();
+    return TestResult("shell_enumerator_test");
+}
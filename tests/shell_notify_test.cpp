@@ -0,0 +1,138 @@
+// Coalesced shell notifications: one broadcast per burst after the quiet period, at least
+// one per maxDelay while a burst lasts, Flush and Stop send what is pending, and Stats()
+// counts the broadcasts saved. Timings are loose enough for a loaded test machine.
+
+#include "shell_notify.h"
+#include "test_util.h"
+
+using std::chrono::milliseconds;
+
+// Stand-in notifier that only counts broadcasts
+class CountingShellNotifier : public ShellNotifier
+{
+private:
+    std::mutex lock;
+    std::uint64_t count;
+
+public:
+    CountingShellNotifier() : count(0) {}
+
+    void Notify()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        count++;
+    }
+
+    std::uint64_t Count()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return count;
+    }
+};
+
+// Wait up to timeout for at least count broadcasts
+static bool WaitForCount(CountingShellNotifier &notifier, std::uint64_t count, milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (notifier.Count() < count)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(milliseconds(2));
+    }
+    return true;
+}
+
+// A burst shorter than the quiet period is announced once, after it has gone quiet
+static void TestQuietPeriod()
+{
+    CountingShellNotifier notifier;
+    ShellNotifyScheduler scheduler(notifier, milliseconds(200), milliseconds(10000));
+    scheduler.Start();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; i++)
+        scheduler.Request();
+    CHECK(notifier.Count() == 0);
+    CHECK(WaitForCount(notifier, 1, milliseconds(5000)));
+    CHECK(std::chrono::steady_clock::now() - start >= milliseconds(200));
+
+    // Nothing more once quiet
+    std::this_thread::sleep_for(milliseconds(300));
+    CHECK(notifier.Count() == 1);
+
+    // The next burst gets its own broadcast
+    scheduler.Request();
+    CHECK(WaitForCount(notifier, 2, milliseconds(5000)));
+
+    ShellNotifyStats stats = scheduler.Stats();
+    CHECK(stats.requests == 11 && stats.broadcasts == 2 && stats.Saved() == 9);
+    scheduler.Stop();
+    CHECK(notifier.Count() == 2);
+}
+
+// A burst that never goes quiet is still announced every maxDelay
+static void TestMaxDelay()
+{
+    CountingShellNotifier notifier;
+    ShellNotifyScheduler scheduler(notifier, milliseconds(100), milliseconds(250));
+    scheduler.Start();
+
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < milliseconds(1000))
+    {
+        scheduler.Request();
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    std::uint64_t during = notifier.Count();
+    CHECK(during >= 2 && during <= 5);
+
+    // The tail of the burst goes out after the quiet period
+    CHECK(WaitForCount(notifier, during + 1, milliseconds(5000)));
+    ShellNotifyStats stats = scheduler.Stats();
+    CHECK(stats.broadcasts == notifier.Count());
+    CHECK(stats.Saved() == stats.requests - stats.broadcasts && stats.Saved() > 0);
+    scheduler.Stop();
+}
+
+// Without Start nothing goes out until Flush; Stop sends what is pending
+static void TestFlush()
+{
+    CountingShellNotifier notifier;
+    {
+        ShellNotifyScheduler scheduler(notifier);
+        CHECK(!scheduler.Flush());
+        scheduler.Request();
+        scheduler.Request();
+        scheduler.Request();
+        std::this_thread::sleep_for(milliseconds(300));
+        CHECK(notifier.Count() == 0);
+        CHECK(scheduler.Flush());
+        CHECK(notifier.Count() == 1);
+        CHECK(!scheduler.Flush());
+
+        ShellNotifyStats stats = scheduler.Stats();
+        CHECK(stats.requests == 3 && stats.broadcasts == 1 && stats.Saved() == 2);
+    }
+
+    // Started with a long quiet period: Stop still announces the pending change
+    ShellNotifyScheduler scheduler(notifier, milliseconds(60000), milliseconds(60000));
+    scheduler.Start();
+    scheduler.Request();
+    scheduler.Stop();
+    CHECK(notifier.Count() == 2);
+    CHECK(!scheduler.Flush());
+
+    // And with nothing pending it sends nothing
+    scheduler.Stop();
+    CHECK(notifier.Count() == 2);
+    CHECK(scheduler.Stats().Saved() == 0);
+}
+
+int main()
+{
+    TestQuietPeriod();
+    TestMaxDelay();
+    TestFlush();
+    return TestResult("shell_notify_test");
+}
@@ -0,0 +1,224 @@
+// Built-in verb set and key index: every built-in verb is found and nothing else is, matching
+// exactly as documented; AppIndex stays equal to a rebuilt index through inserts, erases and
+// renames. Argument: random operations on the index.
+
+#include "context_menu_model.h"
+#include "test_util.h"
+
+#include <cstdlib>
+#include <random>
+
+static const std::size_t kVerbCount = sizeof(kSystemVerbs) / sizeof(kSystemVerbs[0]);
+
+static bool LinearContains(const wchar_t *name)
+{
+    for (const wchar_t *verb : kSystemVerbs)
+    {
+        if (wcscmp(verb, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void TestSystemVerbs()
+{
+    for (const wchar_t *verb : kSystemVerbs)
+        CHECK(IsSystemVerb(verb));
+    CHECK(IsSystemVerb(std::wstring(L"Open").c_str())); // By content, not by pointer
+
+    // Near misses: prefixes, extensions, key paths, custom names
+    const wchar_t *others[] = {L"", L"O", L"Ope", L"Opens", L"Open ", L" Open", L"OpenInNewWindow2",
+                               L"Open\\command", L"0064_CustomApp_Open", L"CustomApp_Print_3", L"Edit",
+                               L"runas", L"cmd", L"Powershell", L"Shar", L"Properties\\shell"};
+    for (const wchar_t *name : others)
+        CHECK(!IsSystemVerb(name));
+
+    // Matching is exact: the registry would treat these as the built-in verbs, the set does not
+    CHECK(!IsSystemVerb(L"open"));
+    CHECK(!IsSystemVerb(L"print"));
+    CHECK(!IsSystemVerb(L"OPEN"));
+    CHECK(!IsSystemVerb(L"properties"));
+
+    // Every one-character edit of every member agrees with a linear search
+    std::size_t disagreements = 0;
+    for (const wchar_t *verb : kSystemVerbs)
+    {
+        std::wstring name = verb;
+        for (std::size_t i = 0; i <= name.length(); i++)
+        {
+            for (wchar_t c : std::wstring(L"aZ_0\\ ."))
+            {
+                std::wstring inserted = name;
+                inserted.insert(inserted.begin() + i, c);
+                disagreements += IsSystemVerb(inserted.c_str()) != LinearContains(inserted.c_str());
+                if (i < name.length())
+                {
+                    std::wstring replaced = name;
+                    replaced[i] = c;
+                    disagreements += IsSystemVerb(replaced.c_str()) != LinearContains(replaced.c_str());
+                }
+            }
+            if (i < name.length())
+            {
+                std::wstring erased = name;
+                erased.erase(i, 1);
+                disagreements += IsSystemVerb(erased.c_str()) != LinearContains(erased.c_str());
+            }
+        }
+    }
+    CHECK(disagreements == 0);
+}
+
+// Sets built at compile time, down to one name and up to a nearly full table
+constexpr const wchar_t *kOne[] = {L"Only"};
+constexpr const wchar_t *kCrowded[] = {L"a", L"b", L"c", L"d", L"e", L"f", L"g"};
+constexpr auto kOneSet = MakeStaticNameSet<2>(kOne);
+constexpr auto kCrowdedSet = MakeStaticNameSet<8>(kCrowded);
+static_assert(kOneSet.Valid(), "one name always fits");
+static_assert(kCrowdedSet.Valid(), "seven names in eight slots");
+static_assert(kSystemVerbSet.Valid(), "checked where it is declared too");
+
+static void TestOtherSets()
+{
+    CHECK(kOneSet.Contains(L"Only") && !kOneSet.Contains(L"only") && !kOneSet.Contains(L""));
+    for (const wchar_t *name : kCrowded)
+        CHECK(kCrowdedSet.Contains(name));
+    CHECK(!kCrowdedSet.Contains(L"h") && !kCrowdedSet.Contains(L"A") && !kCrowdedSet.Contains(L"ab"));
+    CHECK(kSystemVerbSet.Contains(L"ScanWithMicrosoftDefender") && kVerbCount == 19);
+}
+
+static AppEntry Entry(StringPool &strings, const std::wstring &name)
+{
+    AppEntry app = {};
+    app.name = strings.Intern(name);
+    std::size_t leaf = name.find_last_of(L'\\');
+    app.depth = leaf == std::wstring::npos ? 0 : 1;
+    app.isCustom = name.find(L"CustomApp_", leaf == std::wstring::npos ? 0 : leaf + 1) != std::wstring::npos;
+    return app;
+}
+
+// The index after a series of reported changes must equal one built from scratch
+static bool SameAsRebuilt(const std::vector<AppEntry> &entries, const AppIndex &index)
+{
+    AppIndex rebuilt;
+    rebuilt.Rebuild(entries);
+    if (index.Size() != entries.size() || index.LastSortKey() != rebuilt.LastSortKey())
+        return false;
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+        if (index.Find(entries[i].name) != (int)i)
+            return false;
+    }
+    return true;
+}
+
+static void Insert(std::vector<AppEntry> &entries, AppIndex &index, const AppEntry &app)
+{
+    auto at = std::upper_bound(entries.begin(), entries.end(), app, AppKeyNameLess);
+    std::size_t position = at - entries.begin();
+    entries.insert(at, app);
+    index.Inserted(entries, position);
+}
+
+static void Erase(std::vector<AppEntry> &entries, AppIndex &index, std::size_t position)
+{
+    PooledString keyName = entries[position].name;
+    entries.erase(entries.begin() + position);
+    index.Erased(entries, position, keyName);
+}
+
+static void TestAppIndex()
+{
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    AppIndex index;
+    CHECK(index.Find(L"Anything") == -1 && index.LastSortKey() == -1 && index.Size() == 0);
+
+    const wchar_t *names[] = {L"0064_CustomApp_A", L"0128_CustomApp_B", L"0192_CustomApp_Tools",
+                              L"0192_CustomApp_Tools\\shell\\0640_CustomApp_Member", L"ThirdParty"};
+    for (const wchar_t *name : names)
+        entries.push_back(Entry(strings, name));
+    std::sort(entries.begin(), entries.end(), AppKeyNameLess);
+    index.Rebuild(entries);
+    CHECK(SameAsRebuilt(entries, index));
+    CHECK(index.LastSortKey() == 192); // Members' sort keys don't count
+    CHECK(index.Find(L"thirdparty") == index.Find(L"ThirdParty") && index.Find(L"ThirdParty") >= 0);
+    CHECK(index.Find(L"0192_CustomApp_Tools\\shell\\0640_customapp_member") >= 0);
+    CHECK(index.Find(L"0064_CustomApp") == -1);
+
+    // Insert in front: every position shifts
+    Insert(entries, index, Entry(strings, L"0032_CustomApp_First"));
+    CHECK(SameAsRebuilt(entries, index) && index.Find(L"0032_CustomApp_First") == 0);
+    CHECK(index.Find(L"ThirdParty") == (int)entries.size() - 1);
+
+    // A new last sort key; erasing it falls back to the next highest
+    Insert(entries, index, Entry(strings, L"0900_CustomApp_Late"));
+    CHECK(index.LastSortKey() == 900);
+    Erase(entries, index, index.Find(L"0900_CustomApp_Late"));
+    CHECK(SameAsRebuilt(entries, index) && index.LastSortKey() == 192 && index.Find(L"0900_CustomApp_Late") == -1);
+
+    // Rename: erase the old key, insert the new one
+    Erase(entries, index, index.Find(L"0064_CustomApp_A"));
+    Insert(entries, index, Entry(strings, L"0300_CustomApp_A"));
+    CHECK(SameAsRebuilt(entries, index));
+    CHECK(index.Find(L"0064_CustomApp_A") == -1 && index.Find(L"0300_CustomApp_A") >= 0 && index.LastSortKey() == 300);
+
+    index.Clear();
+    CHECK(index.Size() == 0 && index.Find(L"ThirdParty") == -1 && index.LastSortKey() == -1);
+}
+
+// Random inserts, erases and renames against a rebuilt index
+static void FuzzAppIndex(unsigned operations)
+{
+    std::mt19937 random(20240601);
+    StringPool strings;
+    std::vector<AppEntry> entries;
+    AppIndex index;
+    unsigned mismatches = 0;
+    auto randomName = [&]()
+    {
+        unsigned kind = random() % 4;
+        std::wstring suffix = std::to_wstring(random() % 500);
+        if (kind == 0)
+            return L"Vendor" + suffix;
+        if (kind == 1)
+            return L"CustomApp_Legacy_" + suffix;
+        return FormatCustomKeyName((int)(random() % kSortKeyLimit), L"App" + suffix);
+    };
+
+    for (unsigned n = 0; n < operations; n++)
+    {
+        unsigned op = random() % 3;
+        if (op == 0 || entries.empty())
+        {
+            AppEntry app = Entry(strings, randomName());
+            if (index.Find(app.name) < 0)
+                Insert(entries, index, app);
+        }
+        else if (op == 1)
+        {
+            Erase(entries, index, random() % entries.size());
+        }
+        else
+        {
+            std::size_t position = random() % entries.size();
+            AppEntry renamed = Entry(strings, randomName());
+            if (index.Find(renamed.name) >= 0)
+                continue;
+            Erase(entries, index, position);
+            Insert(entries, index, renamed);
+        }
+        if (!SameAsRebuilt(entries, index))
+            mismatches++;
+    }
+    CHECK(mismatches == 0);
+}
+
+int main(int argc, char **argv)
+{
+    TestSystemVerbs();
+    TestOtherSets();
+    TestAppIndex();
+    FuzzAppIndex(argc > 1 ? (unsigned)std::atoi(argv[1]) : 5000);
+    return TestResult("static_name_set_test");
+}
@@ -0,0 +1,164 @@
+// String pool: interning and handles, and a benchmark of a full menu reload on the
+// in-memory registry - allocations per entry and bytes held per entry, pooled against
+// what one std::wstring per field would hold. Arguments: verb count and program count
+// (20000 verbs over 2000 programs is the size the pool was measured at).
+
+#include "context_menu_model.h"
+#include "registry_memory.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+// Every allocation in the program is counted, so a reload's allocations can be reported
+static std::size_t allocations = 0;
+
+void *operator new(std::size_t size)
+{
+    allocations++;
+    void *block = std::malloc(size ? size : 1);
+    if (!block)
+        throw std::bad_alloc();
+    return block;
+}
+
+void operator delete(void *block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void *block, std::size_t) noexcept
+{
+    std::free(block);
+}
+
+static void TestIntern()
+{
+    StringPool strings;
+    PooledString a = strings.Intern(L"C:\\Apps\\app.exe");
+    PooledString b = strings.Intern(std::wstring(L"C:\\Apps\\app.exe"));
+    PooledString c = strings.Intern(L"C:\\APPS\\app.exe");
+    CHECK(a.c_str() == b.c_str());
+    CHECK(a.c_str() != c.c_str()); // Compared exactly, not as registry names
+    CHECK(a == L"C:\\Apps\\app.exe" && a.length() == 15 && a.c_str()[15] == 0);
+    CHECK(strings.Intern(L"").empty() && PooledString().empty());
+
+    // Enough strings to fill several chunks and grow the table; every handle stays valid
+    std::vector<PooledString> handles;
+    for (int i = 0; i < 20000; i++)
+        handles.push_back(strings.Intern(L"string number " + std::to_wstring(i)));
+    bool same = true;
+    for (int i = 0; i < 20000; i++)
+        same = same && handles[i] == L"string number " + std::to_wstring(i) &&
+               strings.Intern(L"string number " + std::to_wstring(i)).c_str() == handles[i].c_str();
+    CHECK(same);
+
+    StringPoolStats stats = strings.Stats();
+    CHECK(stats.strings == 20002 && stats.interned == 40004);
+    CHECK(stats.chunks > 1 && stats.bytes <= stats.reserved);
+    CHECK(strings.MemoryUsage() > stats.reserved);
+
+    // A move takes the chunks along; the handles follow them
+    StringPool moved(std::move(strings));
+    CHECK(handles[19999] == L"string number 19999" && moved.Stats().strings == 20002);
+    CHECK(strings.Stats().strings == 0 && strings.MemoryUsage() == 0);
+    moved.Clear();
+    CHECK(moved.MemoryUsage() == 0 && moved.Stats().chunks == 0);
+}
+
+// What AppEntry held before the pool: one std::wstring per field
+struct UnpooledAppEntry
+{
+    std::wstring name, path, arguments, displayName, icon;
+    bool isCustom, isGroup;
+    unsigned depth, health;
+};
+
+// Heap bytes and allocations of the strings of one unpooled entry
+static void CountUnpooled(const AppEntry &app, std::size_t &bytes, std::size_t &blocks)
+{
+    const std::size_t inPlace = std::wstring().capacity();
+    const PooledString *fields[] = {&app.name, &app.path, &app.arguments, &app.displayName, &app.icon};
+    for (const PooledString *field : fields)
+    {
+        if (field->length() > inPlace)
+        {
+            bytes += (field->length() + 1) * sizeof(wchar_t);
+            blocks++;
+        }
+    }
+}
+
+// Read the desktop menu the way the window reloads it: into a fresh list and pool, then sort and index
+static void Reload(ShellKeyEnumerator &enumerator, std::vector<AppEntry> &entries, StringPool &strings, AppIndex &index)
+{
+    enumerator.EnumerateTree(
+        kRegClassesRoot, kDesktopShellPath,
+        [](const wchar_t *keyName)
+        { return IsSystemVerb(keyName); },
+        [&entries, &strings](const ShellEntry &entry)
+        { entries.push_back(MakeAppEntry(entry, strings)); });
+    std::sort(entries.begin(), entries.end(), AppKeyNameLess);
+    index.Rebuild(entries);
+}
+
+static void Benchmark(std::size_t verbs, std::size_t programs)
+{
+    MemoryRegistryBackend backend;
+    for (std::size_t i = 0; i < verbs; i++)
+    {
+        std::wstring program = L"C:\\Program Files\\Vendor " + std::to_wstring(i % programs) + L"\\app.exe";
+        MakeTestVerb(backend, kDesktopShellPath, FormatCustomKeyName((int)(i + 1) * kSortKeyGap, L"App" + std::to_wstring(i)),
+                     L"App " + std::to_wstring(i % programs), L"\"" + program + L"\" \"%1\"");
+    }
+
+    ShellKeyEnumerator enumerator(backend);
+    AppIndex index;
+    {
+        // Warm the enumerator's buffers, as every reload after the first finds them
+        std::vector<AppEntry> entries;
+        StringPool strings;
+        Reload(enumerator, entries, strings, index);
+    }
+
+    std::vector<AppEntry> entries;
+    StringPool strings;
+    std::size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    Reload(enumerator, entries, strings, index);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::size_t reloadAllocations = allocations - before;
+    CHECK(entries.size() == verbs && index.Size() == verbs);
+
+    std::size_t unpooledBytes = 0, unpooledBlocks = 0;
+    for (const AppEntry &app : entries)
+        CountUnpooled(app, unpooledBytes, unpooledBlocks);
+    unpooledBytes += verbs * sizeof(UnpooledAppEntry);
+    std::size_t pooledBytes = entries.size() * sizeof(AppEntry) + strings.MemoryUsage();
+
+    StringPoolStats stats = strings.Stats();
+    CHECK(stats.interned == verbs * 5);
+    CHECK(stats.strings < stats.interned);
+    CHECK(pooledBytes < unpooledBytes);
+    // The index node per entry, plus the list's and the table's growth - the strings allocate nothing per entry
+    CHECK(reloadAllocations < verbs * 3 / 2 + 64);
+
+    double perEntry = verbs ? 1.0 / verbs : 0.0;
+    std::printf("string pool: %zu verbs over %zu programs, reload %.1f ms\n", verbs, programs, seconds * 1e3);
+    std::printf("  allocations per reload %zu (%.1f/entry), one string per field would add %zu (%.1f/entry)\n",
+                reloadAllocations, reloadAllocations * perEntry, unpooledBlocks, unpooledBlocks * perEntry);
+    std::printf("  entries held %.0f B/entry pooled (sizeof(AppEntry) %zu), %.0f B/entry as strings (%zu)\n",
+                pooledBytes * perEntry, sizeof(AppEntry), unpooledBytes * perEntry, sizeof(UnpooledAppEntry));
+    std::printf("  %zu distinct strings stored for %zu interned, %zu chunks\n", stats.strings, stats.interned,
+                stats.chunks);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t verbs = argc > 1 ? (std::size_t)std::atol(argv[1]) : 2000;
+    std::size_t programs = argc > 2 ? (std::size_t)std::atol(argv[2]) : verbs / 10;
+    TestIntern();
+    Benchmark(verbs, programs > 0 ? programs : 1);
+    return TestResult("string_pool_test");
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// Synthetic HKEY_CLASSES_ROOT for the audit benchmark and the command-line fuzzer
+
+#include "registry_memory.h"
+
+// Command lines in the shapes found in real HKEY_CLASSES_ROOT hives: quoted and unquoted
+// programs, paths with spaces and dots, scripts, environment variables and placeholders.
+constexpr const wchar_t *kSampleShellCommands[] = {
+    L"\"C:\\Program Files\\Synthetic\\app.exe\" \"%1\"",
+    L"%SystemRoot%\\system32\\NOTEPAD.EXE %1",
+    L"C:\\Program Files\\Synthetic Tools\\tool.exe -open \"%1\"",
+    L"\"C:\\tools.exe.d\\run.exe\" --file=\"%1\"",
+    L"C:\\tools.exe.d\\run.exe %1",
+    L"%SystemRoot%\\System32\\rundll32.exe \"%ProgramFiles%\\Windows Photo Viewer\\PhotoViewer.dll\", ImageView_Fullscreen %1",
+    L"cmd.exe /s /k pushd \"%V\"",
+    L"\"C:\\Scripts\\build.cmd\" \"%1\" %*",
+    L"C:\\Scripts\\deploy.bat %1",
+    L"powershell.exe -NoExit -Command \"Set-Location -LiteralPath '%V'\"",
+    L"\"C:\\Program Files\\Git\\git-bash.exe\" \"--cd=%v.\"",
+    L"wscript.exe \"C:\\Scripts\\run me.vbs\" \"%1\"",
+    L"\"C:\\Program Files\\Synthetic\\app.exe\" /arg \"a \\\"quoted\\\" word\" C:\\dir\\ \"C:\\dir\\\\\"",
+    L"notepad %1",
+    L"\"C:\\Unterminated\\app.exe %1"};
+
+// Fill backend with a synthetic HKCR for benchmarking the audit: classCount classes, every
+// third one without a shell key, the others with 1 to verbsPerClass verbs (common names
+// first, "Open" and "Properties" among them), each with a display name, an icon and a
+// command taken in turn from kSampleShellCommands.
+inline void BuildSyntheticShellHive(MemoryRegistryBackend &backend, std::size_t classCount, std::size_t verbsPerClass)
+{
+    static const wchar_t *const kVerbNames[] = {L"Open", L"edit", L"print", L"runas", L"Properties", L"Share"};
+    static const std::size_t kVerbNameCount = sizeof(kVerbNames) / sizeof(kVerbNames[0]);
+    static const std::size_t kCommandCount = sizeof(kSampleShellCommands) / sizeof(kSampleShellCommands[0]);
+
+    wchar_t path[128];
+    for (std::size_t i = 0; i < classCount; i++)
+    {
+        if (i % 3 == 2)
+        {
+            ScopedRegKey classKey(backend);
+            swprintf(path, 128, L"Synthetic.Class%zu", i);
+            backend.CreateKey(kRegClassesRoot, path, classKey.Receive());
+            continue;
+        }
+
+        std::size_t verbs = 1 + i % (verbsPerClass > 0 ? verbsPerClass : 1);
+        for (std::size_t v = 0; v < verbs; v++)
+        {
+            ScopedRegKey verbKey(backend);
+            ScopedRegKey commandKey(backend);
+            if (v < kVerbNameCount)
+                swprintf(path, 128, L"Synthetic.Class%zu\\shell\\%ls", i, kVerbNames[v]);
+            else
+                swprintf(path, 128, L"Synthetic.Class%zu\\shell\\verb%zu", i, v);
+            backend.CreateKey(kRegClassesRoot, path, verbKey.Receive());
+            SetStringValue(backend, verbKey.Get(), NULL, L"Synthetic verb");
+            SetStringValue(backend, verbKey.Get(), L"Icon", L"C:\\Program Files\\Synthetic\\app.exe,0");
+            backend.CreateKey(verbKey.Get(), L"command", commandKey.Receive());
+            SetStringValue(backend, commandKey.Get(), NULL, kSampleShellCommands[(i + v) % kCommandCount]);
+        }
+    }
+}
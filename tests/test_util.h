@@ -0,0 +1,120 @@
+#pragma once
+
+// Helpers shared by the tests
+//
+// No framework: every test is a plain program that checks with CHECK, keeps
+// going after a failure and returns TestResult() from main, which ctest reads
+// as pass or fail. The registry helpers build and compare trees in any
+// RegistryBackend, usually a MemoryRegistryBackend.
+
+#include "registry_tree.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+inline int &TestFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition)                                                       \
+    do                                                                         \
+    {                                                                          \
+        if (!(condition))                                                      \
+        {                                                                      \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            TestFailures()++;                                                  \
+        }                                                                      \
+    } while (0)
+
+inline int TestResult(const char *name)
+{
+    if (TestFailures() == 0)
+        std::printf("%s: ok\n", name);
+    else
+        std::printf("%s: %d check(s) failed\n", name, TestFailures());
+    return TestFailures() == 0 ? 0 : 1;
+}
+
+inline std::string Narrow(std::wstring_view text)
+{
+    std::string result;
+    for (wchar_t c : text)
+        result += c < 0x80 ? (char)c : '?';
+    return result;
+}
+
+inline void SetTestString(RegistryBackend &backend, RegKey key, const wchar_t *valueName, const std::wstring &value)
+{
+    backend.SetValue(key, valueName, RegTypeSz, value.c_str(), (std::uint32_t)((value.length() + 1) * sizeof(wchar_t)));
+}
+
+// A verb as this program writes it: display name and icon on the key, the command below it
+inline void MakeTestVerb(RegistryBackend &backend, const std::wstring &shellPath, const std::wstring &keyName,
+                         const std::wstring &displayName, const std::wstring &command)
+{
+    RegKey verb, commandKey;
+    backend.CreateKey(kRegClassesRoot, (shellPath + L"\\" + keyName).c_str(), &verb);
+    SetTestString(backend, verb, NULL, displayName);
+    SetTestString(backend, verb, L"Icon", command);
+    backend.CreateKey(verb, L"command", &commandKey);
+    SetTestString(backend, commandKey, NULL, command);
+    backend.CloseKey(commandKey);
+    backend.CloseKey(verb);
+}
+
+// An empty cascading group
+inline void MakeTestGroup(RegistryBackend &backend, const std::wstring &shellPath, const std::wstring &keyName,
+                          const std::wstring &displayName)
+{
+    RegKey group, members;
+    backend.CreateKey(kRegClassesRoot, (shellPath + L"\\" + keyName).c_str(), &group);
+    SetTestString(backend, group, L"MUIVerb", displayName);
+    SetTestString(backend, group, L"SubCommands", L"");
+    backend.CreateKey(group, L"shell", &members);
+    backend.CloseKey(members);
+    backend.CloseKey(group);
+}
+
+inline void DumpTestTree(const KeySnapshot &key, const std::wstring &path, std::wstring &out)
+{
+    std::vector<const ValueSnapshot *> values;
+    for (const ValueSnapshot &value : key.values)
+        values.push_back(&value);
+    std::sort(values.begin(), values.end(), [](const ValueSnapshot *a, const ValueSnapshot *b)
+              { return CompareRegistryNames(a->name, b->name) < 0; });
+    for (const ValueSnapshot *value : values)
+    {
+        out += path + L"|" + value->name + L"=" + std::to_wstring(value->type) + L":";
+        for (unsigned char byte : value->data)
+            out += L"0123456789abcdef"[byte >> 4], out += L"0123456789abcdef"[byte & 15];
+        out += L"\n";
+    }
+
+    std::vector<const KeySnapshot *> children;
+    for (const KeySnapshot &child : key.children)
+        children.push_back(&child);
+    std::sort(children.begin(), children.end(), [](const KeySnapshot *a, const KeySnapshot *b)
+              { return CompareRegistryNames(a->name, b->name) < 0; });
+    for (const KeySnapshot *child : children)
+    {
+        out += path + L"\\" + child->name + L"\n";
+        DumpTestTree(*child, path + L"\\" + child->name, out);
+    }
+}
+
+// Canonical text of everything below root\path (key and value names sorted), "" if it is missing
+inline std::wstring DumpTestKey(RegistryBackend &backend, const std::wstring &path, RegKey root = kRegClassesRoot)
+{
+    ScopedRegKey key(backend);
+    if (backend.OpenKey(root, path.c_str(), false, key.Receive()) != RegOk)
+        return std::wstring();
+    KeySnapshot snapshot;
+    CaptureKeyTree(backend, key.Get(), snapshot);
+    std::wstring out = L"@\n";
+    DumpTestTree(snapshot, L"", out);
+    return out;
+}
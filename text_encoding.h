@@ -0,0 +1,132 @@
+#pragma once
+
+// UTF-8 <-> wide string conversion without the Win32 API
+//
+// wchar_t is UTF-16 on Windows and UTF-32 elsewhere; both are handled, so the
+// portable headers can read and write UTF-8 text on any platform.
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Append the UTF-8 encoding of text[0, length) to out; unpaired surrogates become U+FFFD
+inline void AppendUtf8(std::string &out, const wchar_t *text, std::size_t length)
+{
+    for (std::size_t i = 0; i < length; i++)
+    {
+        std::uint32_t c = (std::uint32_t)text[i];
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < length &&
+            (std::uint32_t)text[i + 1] >= 0xDC00 && (std::uint32_t)text[i + 1] <= 0xDFFF)
+        {
+            c = 0x10000 + ((c - 0xD800) << 10) + ((std::uint32_t)text[i + 1] - 0xDC00);
+            i++;
+        }
+        else if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+        {
+            c = 0xFFFD;
+        }
+
+        if (c < 0x80)
+        {
+            out += (char)c;
+        }
+        else if (c < 0x800)
+        {
+            out += (char)(0xC0 | (c >> 6));
+            out += (char)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            out += (char)(0xE0 | (c >> 12));
+            out += (char)(0x80 | ((c >> 6) & 0x3F));
+            out += (char)(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            out += (char)(0xF0 | (c >> 18));
+            out += (char)(0x80 | ((c >> 12) & 0x3F));
+            out += (char)(0x80 | ((c >> 6) & 0x3F));
+            out += (char)(0x80 | (c & 0x3F));
+        }
+    }
+}
+
+inline std::string Utf8FromWide(std::wstring_view text)
+{
+    std::string out;
+    out.reserve(text.length());
+    AppendUtf8(out, text.data(), text.length());
+    return out;
+}
+
+// Decode UTF-8 (a leading BOM is skipped); malformed sequences become U+FFFD
+inline std::wstring WideFromUtf8(const char *text, std::size_t length)
+{
+    std::wstring out;
+    out.reserve(length);
+
+    std::size_t i = 0;
+    if (length >= 3 && (unsigned char)text[0] == 0xEF && (unsigned char)text[1] == 0xBB && (unsigned char)text[2] == 0xBF)
+        i = 3;
+
+    while (i < length)
+    {
+        unsigned char lead = (unsigned char)text[i];
+        std::uint32_t c;
+        std::size_t extra;
+        if (lead < 0x80)
+        {
+            c = lead;
+            extra = 0;
+        }
+        else if ((lead & 0xE0) == 0xC0)
+        {
+            c = lead & 0x1F;
+            extra = 1;
+        }
+        else if ((lead & 0xF0) == 0xE0)
+        {
+            c = lead & 0x0F;
+            extra = 2;
+        }
+        else if ((lead & 0xF8) == 0xF0)
+        {
+            c = lead & 0x07;
+            extra = 3;
+        }
+        else
+        {
+            out += (wchar_t)0xFFFD;
+            i++;
+            continue;
+        }
+
+        std::size_t j = 1;
+        for (; j <= extra && i + j < length && ((unsigned char)text[i + j] & 0xC0) == 0x80; j++)
+            c = (c << 6) | ((unsigned char)text[i + j] & 0x3F);
+        if (j <= extra || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+        {
+            out += (wchar_t)0xFFFD;
+            i += j;
+            continue;
+        }
+        i += j;
+
+        if (c >= 0x10000 && sizeof(wchar_t) == 2)
+        {
+            c -= 0x10000;
+            out += (wchar_t)(0xD800 + (c >> 10));
+            out += (wchar_t)(0xDC00 + (c & 0x3FF));
+        }
+        else
+        {
+            out += (wchar_t)c;
+        }
+    }
+    return out;
+}
+
+inline std::wstring WideFromUtf8(const std::string &text)
+{
+    return WideFromUtf8(text.data(), text.length());
+}